@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "autograd.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+
+/* Checks the tape gradients of the two layer model against the hand derived
+ * ones of mlp_forward_backward, then times a training step of both and of a
+ * deeper MLP on the tape, counting the heap bytes each step leaves behind.
+ *
+ * Usage: bench_autograd [--batch N] [--steps N]
+ */
+
+static ag_var_t* build_mlp(ag_tape_t* tape, ag_var_t* x, ag_var_t* y,
+        tensor_t** params, ag_var_t** vars, int n_layers);
+static tensor_t* layer_param(uint32_t n_in, uint32_t n_out);
+static float max_abs_diff(const tensor_t* t1, const tensor_t* t2);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int batch_size = 256, steps = 20;
+    unsigned int seed = 42;
+    uint32_t x_shape[2], y_shape[1];
+    uint32_t sizes[] = {28 * 28, 128, 10}, deep_sizes[] = {28 * 28, 256, 128, 64, 10};
+    tensor_t* params[8], *deep_params[8];
+    mnist_example_t* batch;
+    ag_var_t* x, *y, *loss, *vars[8];
+    ag_tape_t* tape;
+    train_res_t res;
+    mnist_t* ds;
+    mlp_t* mlp;
+    size_t heap;
+    double start, mlp_ms, tape_ms;
+    float diff;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (ds == NULL)
+        return 1;
+
+    srand(seed);
+    batch = mnist_batch_r(ds, batch_size, 1, &seed);
+    x_shape[0] = y_shape[0] = batch_size;
+    x_shape[1] = 28 * 28;
+
+    /* Same parameters on both sides */
+    mlp = mlp_init(sizes[0], sizes[1], sizes[2]);
+    params[0] = mlp->W1;
+    params[1] = mlp->b1;
+    params[2] = mlp->W2;
+    params[3] = mlp->b2;
+
+    tape = ag_tape_new();
+    x = ag_input(tape, x_shape, 2);
+    y = ag_input(tape, y_shape, 1);
+    loss = build_mlp(tape, x, y, params, vars, 2);
+
+    ag_feed(x, batch->image);
+    ag_feed(y, batch->label);
+    ag_forward(tape);
+    ag_backward(tape, loss);
+    res = mlp_forward_backward(mlp, batch->image, batch->label);
+
+    diff = fabsf(res.loss - loss->value->values[0]);
+    diff = fmaxf(diff, max_abs_diff(res.dW1, vars[0]->grad));
+    diff = fmaxf(diff, max_abs_diff(res.db1, vars[1]->grad));
+    diff = fmaxf(diff, max_abs_diff(res.dW2, vars[2]->grad));
+    diff = fmaxf(diff, max_abs_diff(res.db2, vars[3]->grad));
+    printf("Largest difference with mlp_forward_backward: %g\n\n", diff);
+    train_res_clean(&res);
+
+    start = now_seconds();
+    for (int s = 0; s < steps; s++)
+    {
+        res = mlp_forward_backward(mlp, batch->image, batch->label);
+        mlp_update(mlp, &res, 0.001);
+        train_res_clean(&res);
+    }
+    mlp_ms = (now_seconds() - start) * 1000 / steps;
+
+    start = now_seconds();
+    heap = mallinfo2().uordblks;
+    for (int s = 0; s < steps; s++)
+    {
+        ag_forward(tape);
+        ag_backward(tape, loss);
+        ag_sgd(tape, 0.001);
+    }
+    tape_ms = (now_seconds() - start) * 1000 / steps;
+
+    printf("%-26s %12s %16s\n", "model", "step (ms)", "heap bytes/step");
+    printf("%-26s %12.3f %16s\n", "784-128-10 hand written", mlp_ms, "-");
+    printf("%-26s %12.3f %16.0f\n", "784-128-10 tape", tape_ms,
+            (double)(mallinfo2().uordblks - heap) / steps);
+    ag_tape_clean(tape);
+
+    tape = ag_tape_new();
+    x = ag_input(tape, x_shape, 2);
+    y = ag_input(tape, y_shape, 1);
+    for (int l = 0; l < 4; l++)
+    {
+        deep_params[2 * l] = layer_param(deep_sizes[l], deep_sizes[l + 1]);
+        deep_params[2 * l + 1] = layer_param(0, deep_sizes[l + 1]);
+    }
+    loss = build_mlp(tape, x, y, deep_params, vars, 4);
+    ag_feed(x, batch->image);
+    ag_feed(y, batch->label);
+
+    /* The first step is the one allowed to allocate */
+    ag_forward(tape);
+    ag_backward(tape, loss);
+    ag_sgd(tape, 0.001);
+
+    start = now_seconds();
+    heap = mallinfo2().uordblks;
+    for (int s = 0; s < steps; s++)
+    {
+        ag_forward(tape);
+        ag_backward(tape, loss);
+        ag_sgd(tape, 0.001);
+    }
+    tape_ms = (now_seconds() - start) * 1000 / steps;
+    printf("%-26s %12.3f %16.0f\n", "784-256-128-64-10 tape", tape_ms,
+            (double)(mallinfo2().uordblks - heap) / steps);
+
+    ag_tape_clean(tape);
+    for (int p = 0; p < 8; p++)
+        tensor_clean(deep_params[p]);
+    mlp_clean(mlp);
+    mnist_example_clean(batch);
+    mnist_clean(ds);
+    return 0;
+}
+
+/* Records relu(x @ W + b) for every layer but the last one, which feeds
+ * the loss. params holds W and b of every layer in order, vars gets their
+ * nodes. */
+ag_var_t* build_mlp(ag_tape_t* tape, ag_var_t* x, ag_var_t* y,
+        tensor_t** params, ag_var_t** vars, int n_layers)
+{
+    ag_var_t* h = x;
+
+    for (int l = 0; l < n_layers; l++)
+    {
+        vars[2 * l] = ag_param(tape, params[2 * l]);
+        vars[2 * l + 1] = ag_param(tape, params[2 * l + 1]);
+        h = ag_add(tape, ag_mm(tape, h, vars[2 * l]), vars[2 * l + 1]);
+        if (l < n_layers - 1)
+            h = ag_relu(tape, h);
+    }
+    return ag_softmax_ce(tape, h, y);
+}
+
+/* [n_in, n_out] weights, or a [n_out] bias when n_in is 0 */
+tensor_t* layer_param(uint32_t n_in, uint32_t n_out)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+
+    if (n_in == 0)
+    {
+        shape[0] = n_out;
+        return tensor_zeros(shape, 1);
+    }
+
+    shape[0] = n_in;
+    shape[1] = n_out;
+    return tensor_uniform(-1 / sqrtf(n_in), 1 / sqrtf(n_in), shape, 2);
+}
+
+float max_abs_diff(const tensor_t* t1, const tensor_t* t2)
+{
+    float diff = 0;
+
+    for (uint32_t i = 0; i < tensor_numel(t1); i++)
+        diff = fmaxf(diff, fabsf(t1->values[i] - t2->values[i]));
+    return diff;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
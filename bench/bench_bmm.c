@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "bmm.h"
+
+/* Compares tensor_bmm with a loop of tensor_mm calls over slices of the
+ * batch, for a stack of independent products (multi-head) and for products
+ * sharing one operand (same weights over many inputs, one input through an
+ * ensemble of weights).
+ *
+ * Usage: bench_bmm [--threads N] [--reps N]
+ */
+
+typedef struct
+{
+    const char* name;
+    uint32_t b1;    /* 0 for a shared [M, K] left operand */
+    uint32_t b2;    /* 0 for a shared [K, N] right operand */
+    uint32_t M;
+    uint32_t K;
+    uint32_t N;
+} bmm_case_t;
+
+static const bmm_case_t CASES[] = {
+    {"multi-head [64,128,64]x[64,64,128]", 64, 64, 128, 64, 128},
+    {"shared W [64,32,256]x[256,256]", 64, 0, 32, 256, 256},
+    {"ensemble [256,784]x[8,784,10]", 0, 8, 256, 784, 10}
+};
+
+static tensor_t* loop_mm(const tensor_t* t1, const tensor_t* t2, uint32_t batch);
+static tensor_t* operand(uint32_t batch, uint32_t rows, uint32_t cols);
+static float max_abs_diff(const tensor_t* t1, const tensor_t* t2);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int threads = 4, reps = 5;
+    double start, loop_ms, bmm_ms, threads_ms;
+    tensor_t* t1, *t2, *ref, *out;
+    const bmm_case_t* c;
+    uint32_t batch;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    srand(42);
+    printf("%-38s %12s %12s %16s %10s\n", "case", "loop (ms)", "bmm (ms)", "bmm x threads", "max diff");
+    for (int i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+    {
+        c = &CASES[i];
+        t1 = operand(c->b1, c->M, c->K);
+        t2 = operand(c->b2, c->K, c->N);
+        batch = c->b1 > c->b2 ? c->b1 : c->b2;
+
+        ref = loop_mm(t1, t2, batch);
+        start = now_seconds();
+        for (int r = 0; r < reps; r++)
+            tensor_clean(loop_mm(t1, t2, batch));
+        loop_ms = (now_seconds() - start) * 1000 / reps;
+
+        bmm_set_threads(1);
+        out = tensor_bmm(t1, t2);
+        start = now_seconds();
+        for (int r = 0; r < reps; r++)
+            tensor_bmm_into(t1, t2, out);
+        bmm_ms = (now_seconds() - start) * 1000 / reps;
+
+        bmm_set_threads(threads);
+        start = now_seconds();
+        for (int r = 0; r < reps; r++)
+            tensor_bmm_into(t1, t2, out);
+        threads_ms = (now_seconds() - start) * 1000 / reps;
+
+        printf("%-38s %12.3f %12.3f %13.3f x%d %10g\n", c->name, loop_ms, bmm_ms, threads_ms, threads,
+                max_abs_diff(ref, out));
+
+        tensor_clean(t1);
+        tensor_clean(t2);
+        tensor_clean(ref);
+        tensor_clean(out);
+    }
+    return 0;
+}
+
+/* What callers had to do before: slice, multiply and copy back one product
+ * at a time */
+tensor_t* loop_mm(const tensor_t* t1, const tensor_t* t2, uint32_t batch)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 3);
+    uint32_t M = t1->shape[t1->n_dims - 2], N = t2->shape[t2->n_dims - 1];
+    tensor_t* a, *b, *c, *res;
+    uint32_t idx;
+
+    shape[0] = batch;
+    shape[1] = M;
+    shape[2] = N;
+    res = tensor_zeros(shape, 3);
+
+    for (idx = 0; idx < batch; idx++)
+    {
+        a = t1->n_dims == 3 ? tensor_index(t1, &idx, 1) : NULL;
+        b = t2->n_dims == 3 ? tensor_index(t2, &idx, 1) : NULL;
+        c = tensor_mm(a ? a : t1, b ? b : t2);
+        memcpy(&res->values[idx * M * N], c->values, sizeof(float) * M * N);
+        if (a)
+            tensor_clean(a);
+        if (b)
+            tensor_clean(b);
+        tensor_clean(c);
+    }
+    return res;
+}
+
+/* [batch, rows, cols], or [rows, cols] when batch is 0 */
+tensor_t* operand(uint32_t batch, uint32_t rows, uint32_t cols)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 3);
+    uint32_t n_dims = 0;
+
+    if (batch > 0)
+        shape[n_dims++] = batch;
+    shape[n_dims++] = rows;
+    shape[n_dims++] = cols;
+    return tensor_uniform(-1, 1, shape, n_dims);
+}
+
+float max_abs_diff(const tensor_t* t1, const tensor_t* t2)
+{
+    float diff = 0;
+
+    for (uint32_t i = 0; i < tensor_numel(t1); i++)
+        diff = fmaxf(diff, fabsf(t1->values[i] - t2->values[i]));
+    return diff;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
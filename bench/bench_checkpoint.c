@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "model.h"
+#include "checkpoint.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+
+/* Times training steps without checkpoints, with a background checkpoint
+ * every few steps and with the same checkpoints written in the loop, then
+ * resumes the last checkpoint and checks it matches the model and loop
+ * state it was taken from, continuing both for a few steps.
+ *
+ * Usage: bench_checkpoint [--model CONFIG] [--steps N] [--every N] [--path FILE]
+ */
+
+#define DEFAULT_MODEL "input:784 dense:256 relu dense:10 softmax_ce"
+#define BATCH 256
+#define LR 0.001
+
+typedef enum {
+    MODE_NONE = 0,
+    MODE_ASYNC,
+    MODE_SYNC
+} ckpt_mode_t;
+
+static const char* MODE_NAMES[] = {"no checkpoint", "background", "in the loop"};
+
+static model_t* train(const char* config, mnist_t* ds, ckpt_mode_t mode, const char* path, int steps,
+        int every, train_state_t* state, double* step_ms, double* ckpt_ms, double* max_ms);
+static void step(model_t* model, mnist_t* ds, train_state_t* state);
+static int same_params(const model_t* m1, const model_t* m2);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    const char* config = DEFAULT_MODEL, *path = "bench_checkpoint.ckpt";
+    int steps = 200, every = 10, same;
+    double step_ms, ckpt_ms, max_ms, base_ms = 0;
+    train_state_t state, resumed_state;
+    model_t* model, *trained = NULL, *resumed;
+    mnist_t* ds;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--model") && i + 1 < argc)
+            config = argv[++i];
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--every") && i + 1 < argc)
+            every = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--path") && i + 1 < argc)
+            path = argv[++i];
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+
+    printf("%d steps of %d images, checkpoint every %d steps, ms per step\n", steps, BATCH, every);
+    printf("%-16s %10s %16s %10s %10s\n", "checkpoints", "mean", "checkpoint step", "max",
+            "overhead");
+    for (int m = MODE_NONE; m <= MODE_SYNC; m++)
+    {
+        model = train(config, ds, m, path, steps, every, &state, &step_ms, &ckpt_ms, &max_ms);
+        if (m == MODE_NONE)
+            base_ms = step_ms;
+        printf("%-16s %10.3f %16.3f %10.3f %9.1f%%\n", MODE_NAMES[m], step_ms, ckpt_ms, max_ms,
+                (step_ms / base_ms - 1) * 100);
+        if (m == MODE_ASYNC)
+        {
+            trained = model;
+            resumed_state = state;
+        }
+        else
+            model_clean(model);
+    }
+    model = trained;
+    state = resumed_state;
+
+    /* Every run leaves the checkpoint of its last step behind, resuming it
+     * must give the same run as going on with the model of the async one */
+    resumed = checkpoint_resume(path, BATCH, &resumed_state);
+    same = same_params(model, resumed) && !memcmp(&state, &resumed_state, sizeof(state));
+    for (int i = 0; i < 10; i++)
+    {
+        step(model, ds, &state);
+        step(resumed, ds, &resumed_state);
+    }
+    same = same && same_params(model, resumed) && !memcmp(&state, &resumed_state, sizeof(state));
+    printf("\nResumed from %s at step %lu: %s\n", path, (unsigned long)state.step - 10,
+            same ? "identical parameters and state after 10 more steps" : "MISMATCH");
+
+    model_clean(model);
+    model_clean(resumed);
+    mnist_clean(ds);
+    return !same;
+}
+
+model_t* train(const char* config, mnist_t* ds, ckpt_mode_t mode, const char* path, int steps,
+        int every, train_state_t* state, double* step_ms, double* ckpt_ms, double* max_ms)
+{
+    checkpoint_t* ckpt;
+    model_t* model;
+    double start, ms, total = 0, total_ckpt = 0;
+    int n_ckpt = 0;
+
+    srand(42);
+    model = model_parse(config, BATCH);
+    ckpt = mode != MODE_NONE ? checkpoint_init(path, model) : NULL;
+    memset(state, 0, sizeof(train_state_t));
+    state->seed = 42;
+    *max_ms = 0;
+
+    for (int s = 0; s < steps; s++)
+    {
+        start = now_seconds();
+        step(model, ds, state);
+        if (ckpt != NULL && state->step % every == 0)
+        {
+            checkpoint_snapshot(ckpt, model, state);
+            if (mode == MODE_SYNC)
+                checkpoint_wait(ckpt);
+        }
+        ms = (now_seconds() - start) * 1000;
+
+        total += ms;
+        if (state->step % every == 0)
+        {
+            total_ckpt += ms;
+            n_ckpt++;
+        }
+        if (ms > *max_ms)
+            *max_ms = ms;
+    }
+
+    if (ckpt != NULL)
+        checkpoint_clean(ckpt);
+    *step_ms = total / steps;
+    *ckpt_ms = n_ckpt > 0 ? total_ckpt / n_ckpt : 0;
+    return model;
+}
+
+void step(model_t* model, mnist_t* ds, train_state_t* state)
+{
+    mnist_example_t* batch = mnist_batch_r(ds, BATCH, 1, &state->seed);
+
+    state->loss_sum += model_forward_backward(model, batch->image, batch->label);
+    model_update(model, LR);
+    state->step++;
+
+    tensor_clean(batch->image);
+    tensor_clean(batch->label);
+    free(batch);
+}
+
+int same_params(const model_t* m1, const model_t* m2)
+{
+    for (uint32_t i = 0; i < m1->n_layers; i++)
+        if (m1->layers[i].W != NULL && (
+                memcmp(m1->layers[i].W->values, m2->layers[i].W->values,
+                    sizeof(float) * tensor_numel(m1->layers[i].W)) ||
+                memcmp(m1->layers[i].b->values, m2->layers[i].b->values,
+                    sizeof(float) * tensor_numel(m1->layers[i].b))))
+            return 0;
+    return 1;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
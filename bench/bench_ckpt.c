@@ -0,0 +1,119 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "model.h"
+#include "ckpt.h"
+
+/* Saves a model, loads it back with model_load and checks that the loaded
+ * model predicts the same thing with its weights read in place from the
+ * mapping. Times the save, the load, the first inference (which faults the
+ * weight pages in) against one on the saved model and, for reference,
+ * building the same model from its config.
+ *
+ * Usage: bench_ckpt [--model CONFIG] [--path FILE] [--reps N]
+ */
+
+#define DEFAULT_MODEL "input:784 dense:1024 relu dense:1024 relu dense:10 softmax_ce"
+#define BATCH 16
+
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    const char* config = DEFAULT_MODEL, *path = "bench.ckpt";
+    int reps = 20, mismatches = 0, in_place = 1;
+    double start, save_ms, load_ms, first_ms, forward_ms, parse_ms;
+    model_t* model, *loaded;
+    const layer_t* l;
+    tensor_t* x;
+    uint32_t* shape;
+    float* preds;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--model") && i + 1 < argc)
+            config = argv[++i];
+        else if (!strcmp(argv[i], "--path") && i + 1 < argc)
+            path = argv[++i];
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    srand(42);
+    model = model_parse(config, BATCH);
+    model_summary(model);
+
+    shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+    shape[0] = BATCH;
+    shape[1] = model->n_inputs;
+    x = tensor_uniform(0, 1, shape, 2);
+    preds = (float*)malloc(sizeof(float) * BATCH);
+    memcpy(preds, model_forward(model, x)->values, sizeof(float) * BATCH);
+    start = now_seconds();
+    model_forward(model, x);
+    forward_ms = (now_seconds() - start) * 1000;
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        model_save(model, path);
+    save_ms = (now_seconds() - start) * 1000 / reps;
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        model_clean(model_parse(config, BATCH));
+    parse_ms = (now_seconds() - start) * 1000 / reps;
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        model_clean(model_load(path, BATCH));
+    load_ms = (now_seconds() - start) * 1000 / reps;
+
+    /* The file is in the page cache by now, the first inference still maps
+     * its pages into this process */
+    start = now_seconds();
+    loaded = model_load(path, BATCH);
+    model_forward(loaded, x);
+    first_ms = (now_seconds() - start) * 1000;
+
+    for (uint32_t i = 0; i < BATCH; i++)
+        mismatches += loaded->preds->values[i] != preds[i];
+    for (uint32_t i = 0; i < loaded->n_layers; i++)
+    {
+        l = &loaded->layers[i];
+        if (l->W != NULL && ((uint8_t*)l->W->values < loaded->ckpt->base ||
+                (uint8_t*)l->W->values >= loaded->ckpt->base + loaded->ckpt->size))
+            in_place = 0;
+    }
+
+    printf("\nCheckpoint %s: %.1f KB\n", path, loaded->ckpt->size / 1024.0);
+    printf("%-36s %10.3f ms\n", "model_save", save_ms);
+    printf("%-36s %10.3f ms\n", "model_parse (random init)", parse_ms);
+    printf("%-36s %10.3f ms\n", "model_load", load_ms);
+    printf("%-36s %10.3f ms\n", "model_load + first forward", first_ms);
+    printf("%-36s %10.3f ms\n", "forward of the saved model", forward_ms);
+    printf("Weights read in place: %s, prediction mismatches: %d / %d\n",
+            in_place ? "yes" : "no", mismatches, BATCH);
+
+    tensor_clean(x);
+    free(preds);
+    model_clean(loaded);
+    model_clean(model);
+    return mismatches > 0 || !in_place;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "conv.h"
+#include "model.h"
+
+/* Times both convolution paths on LeNet style layers, with the one
+ * conv_select picks marked, checks they agree, then times training and
+ * inference steps of a LeNet-5 model_t in images per second.
+ *
+ * Usage: bench_conv [--batch N] [--reps N]
+ */
+
+#define LENET "input:1x28x28 conv:6x5/2 relu pool:2 conv:16x5 relu pool:2 " \
+    "dense:120 relu dense:84 relu dense:10 softmax_ce"
+
+typedef struct
+{
+    const char* name;
+    uint32_t C;
+    uint32_t H;
+    uint32_t K;
+    uint32_t R;
+    uint32_t pad;
+    int plain;
+} conv_case_t;
+
+static const conv_case_t CASES[] = {
+    {"LeNet conv1 1x28x28 -> 6", 1, 28, 6, 5, 2, 1},
+    {"LeNet conv2 6x14x14 -> 16", 6, 14, 16, 5, 0, 0},
+    {"16x14x14 -> 8, 3x3", 16, 14, 8, 3, 1, 0},
+    {"32x7x7 -> 32, 3x3", 32, 7, 32, 3, 1, 0},
+    {"64x4x4 -> 64, 3x3", 64, 4, 64, 3, 1, 0},
+    {"64x7x7 -> 64, 1x1", 64, 7, 64, 1, 0, 0},
+    {"3x32x32 -> 16, 3x3", 3, 32, 16, 3, 1, 0},
+    {"128x2x2 -> 128, 3x3", 128, 2, 128, 3, 1, 0}
+};
+
+static void time_conv(const conv_shape_t* s, conv_algo_t algo, const float* x, const float* W,
+        const float* b, const float* dy, float* y, float* dx, float* dW, float* db,
+        uint32_t batch, int reps, float* work, double* fwd_ms, double* bwd_ms);
+static float* uniform(size_t n);
+static float max_abs_diff(const float* v1, const float* v2, size_t n);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int batch = 256, reps = 5;
+    double fwd_ms[2], bwd_ms[2], start, train_s, infer_s;
+    float* x, *W, *b, *dy, *y[2], *dx[2], *dW[2], *db[2], *work;
+    uint32_t in_size, out_size, CRR, Kp;
+    const conv_case_t* c;
+    conv_shape_t s;
+    model_t* model;
+    tensor_t* images, *labels;
+    uint32_t* shape;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    srand(42);
+    printf("Batch of %d, forward / backward ms, * marks the conv_select choice\n", batch);
+    printf("%-28s %20s %20s %10s\n", "layer", "im2col", "direct", "max diff");
+    for (int i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+    {
+        c = &CASES[i];
+        s = conv_make_shape(c->C, c->H, c->H, c->K, c->R, 1, c->pad, c->plain);
+        in_size = conv_in_size(&s);
+        out_size = conv_out_size(&s);
+        CRR = s.C * s.R * s.R;
+        Kp = conv_blocks(s.K) * CONV_CB;
+
+        /* Padding lanes and columns are zero like in a model */
+        x = uniform((size_t)batch * in_size);
+        if (!s.plain)
+            for (size_t j = 0; j < (size_t)batch * in_size; j++)
+                if (j % CONV_CB >= s.C - (j / (s.H * s.W * CONV_CB) % conv_blocks(s.C)) * CONV_CB)
+                    x[j] = 0;
+        W = uniform(CRR * Kp);
+        b = uniform(Kp);
+        for (uint32_t j = 0; j < CRR * Kp; j++)
+            if (j % Kp >= s.K)
+                W[j] = 0;
+        for (uint32_t k = s.K; k < Kp; k++)
+            b[k] = 0;
+        dy = uniform((size_t)batch * out_size);
+        work = (float*)malloc(sizeof(float) * conv_work_size(&s));
+
+        for (int a = 0; a < 2; a++)
+        {
+            y[a] = (float*)malloc(sizeof(float) * batch * out_size);
+            dx[a] = (float*)malloc(sizeof(float) * batch * in_size);
+            dW[a] = (float*)malloc(sizeof(float) * CRR * Kp);
+            db[a] = (float*)malloc(sizeof(float) * Kp);
+            fwd_ms[a] = bwd_ms[a] = NAN;
+        }
+
+        time_conv(&s, CONV_IM2COL, x, W, b, dy, y[0], dx[0], dW[0], db[0], batch, reps, work,
+                &fwd_ms[0], &bwd_ms[0]);
+        if (!s.plain)
+            time_conv(&s, CONV_DIRECT, x, W, b, dy, y[1], dx[1], dW[1], db[1], batch, reps, work,
+                    &fwd_ms[1], &bwd_ms[1]);
+
+        printf("%-28s %8.2f / %-8.2f%c %8.2f / %-8.2f%c", c->name, fwd_ms[0], bwd_ms[0],
+                conv_select(&s) == CONV_IM2COL ? '*' : ' ', fwd_ms[1], bwd_ms[1],
+                conv_select(&s) == CONV_DIRECT ? '*' : ' ');
+        if (s.plain)
+            printf(" %10s\n", "-");
+        else
+            printf(" %10g\n", fmaxf(max_abs_diff(y[0], y[1], (size_t)batch * out_size),
+                    fmaxf(max_abs_diff(dx[0], dx[1], (size_t)batch * in_size),
+                    max_abs_diff(dW[0], dW[1], CRR * Kp) / batch)));
+
+        for (int a = 0; a < 2; a++)
+        {
+            free(y[a]);
+            free(dx[a]);
+            free(dW[a]);
+            free(db[a]);
+        }
+        free(x);
+        free(W);
+        free(b);
+        free(dy);
+        free(work);
+    }
+
+    /* Whole model on random images */
+    model = model_parse(LENET, batch);
+    shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+    shape[0] = batch;
+    shape[1] = 28 * 28;
+    images = tensor_uniform(0, 1, shape, 2);
+    shape = (uint32_t*)malloc(sizeof(uint32_t));
+    shape[0] = batch;
+    labels = tensor_zeros(shape, 1);
+    for (int i = 0; i < batch; i++)
+        labels->values[i] = rand() % 10;
+
+    model_forward_backward(model, images, labels);
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+    {
+        model_forward_backward(model, images, labels);
+        model_update(model, 0.01);
+    }
+    train_s = (now_seconds() - start) / reps;
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        model_forward(model, images);
+    infer_s = (now_seconds() - start) / reps;
+
+    printf("\nLeNet-5: training %.0f images/s (%.2f ms per step), inference %.0f images/s\n",
+            batch / train_s, train_s * 1000, batch / infer_s);
+
+    tensor_clean(images);
+    tensor_clean(labels);
+    model_clean(model);
+    return 0;
+}
+
+void time_conv(const conv_shape_t* s, conv_algo_t algo, const float* x, const float* W,
+        const float* b, const float* dy, float* y, float* dx, float* dW, float* db,
+        uint32_t batch, int reps, float* work, double* fwd_ms, double* bwd_ms)
+{
+    double start;
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        conv2d_forward(s, algo, x, W, b, y, batch, work);
+    *fwd_ms = (now_seconds() - start) * 1000 / reps;
+
+    /* The first layer of a model has no input gradient */
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        conv2d_backward(s, algo, x, W, dy, s->plain ? NULL : dx, dW, db, batch, work);
+    *bwd_ms = (now_seconds() - start) * 1000 / reps;
+}
+
+float* uniform(size_t n)
+{
+    float* v = (float*)malloc(sizeof(float) * n);
+
+    for (size_t i = 0; i < n; i++)
+        v[i] = (float)rand() / RAND_MAX * 2 - 1;
+    return v;
+}
+
+float max_abs_diff(const float* v1, const float* v2, size_t n)
+{
+    float diff = 0;
+
+    for (size_t i = 0; i < n; i++)
+        diff = fmaxf(diff, fabsf(v1[i] - v2[i]));
+    return diff;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "half.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+
+/* Times tensor_mm and a full training step for every dtype, and reports the
+ * largest error of the 16 bit GEMMs against the fp32 one.
+ *
+ * Usage: bench_half [--batch N] [--reps N]
+ */
+
+static const tensor_dtype_t DTYPES[] = {TENSOR_F32, TENSOR_BF16, TENSOR_F16};
+static const char* DTYPE_NAMES[] = {"f32", "bf16", "f16"};
+
+static double now_seconds();
+static float max_rel_error(const tensor_t* ref, const tensor_t* t);
+
+int main(int argc, char** argv)
+{
+    int batch_size = 256, reps = 20;
+    unsigned int seed = 42;
+    uint32_t x_shape[2], w_shape[] = {28 * 28, 128};
+    tensor_t* x, *w, *xh, *wh, *ref, *out;
+    mnist_example_t* batch;
+    train_res_t res;
+    mnist_t* ds;
+    mlp_t* mlp;
+    double start, gemm_ms, step_ms;
+    float err;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (ds == NULL)
+        return 1;
+
+    srand(seed);
+    x_shape[0] = batch_size;
+    x_shape[1] = 28 * 28;
+    x = tensor_uniform(0, 255, x_shape, 2);
+    w = tensor_uniform(-0.05, 0.05, w_shape, 2);
+    ref = tensor_mm(x, w);
+    mlp = mlp_init(28 * 28, 128, 10);
+    batch = mnist_batch_r(ds, batch_size, 1, &seed);
+
+    printf("%-6s %14s %14s %14s\n", "dtype", "mm (ms)", "max rel err", "step (ms)");
+    for (int d = 0; d < 3; d++)
+    {
+        xh = tensor_to_dtype(x, DTYPES[d]);
+        wh = tensor_to_dtype(w, DTYPES[d]);
+
+        out = tensor_mm(xh, wh);
+        err = max_rel_error(ref, out);
+        tensor_clean(out);
+
+        start = now_seconds();
+        for (int r = 0; r < reps; r++)
+            tensor_clean(tensor_mm(xh, wh));
+        gemm_ms = (now_seconds() - start) * 1000 / reps;
+
+        mlp_set_dtype(mlp, DTYPES[d]);
+        start = now_seconds();
+        for (int r = 0; r < reps; r++)
+        {
+            res = mlp_forward_backward(mlp, batch->image, batch->label);
+            train_res_clean(&res);
+        }
+        step_ms = (now_seconds() - start) * 1000 / reps;
+
+        printf("%-6s %14.3f %14.5f %14.3f\n", DTYPE_NAMES[d], gemm_ms, err, step_ms);
+        tensor_clean(xh);
+        tensor_clean(wh);
+    }
+
+    mnist_example_clean(batch);
+    mnist_clean(ds);
+    mlp_clean(mlp);
+    tensor_clean(x);
+    tensor_clean(w);
+    tensor_clean(ref);
+    return 0;
+}
+
+float max_rel_error(const tensor_t* ref, const tensor_t* t)
+{
+    float err = 0, scale = 0;
+
+    for (int i = 0; i < tensor_numel(ref); i++)
+        scale = fmaxf(scale, fabsf(ref->values[i]));
+
+    for (int i = 0; i < tensor_numel(ref); i++)
+        err = fmaxf(err, fabsf(ref->values[i] - t->values[i]) / scale);
+
+    return err;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
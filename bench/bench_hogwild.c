@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "parallel.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+#define TEST_IMAGES "data/t10k-images-idx3-ubyte"
+#define TEST_LABELS "data/t10k-labels-idx1-ubyte"
+
+/* Compares Hogwild against synchronous data parallelism on the same number
+ * of threads. Both runs start from the same initial weights.
+ *
+ * Usage: bench_hogwild [--threads N] [--steps N] [--batch N] [--lr F]
+ *                      [--target F] [--eval-size N] [--eval-ms N] [--stop]
+ */
+
+static void print_stats(const char* name, const parallel_stats_t* s);
+static mlp_t* fresh_mlp(unsigned int seed);
+
+int main(int argc, char** argv)
+{
+    parallel_config_t cfg = {4, 64, 0.001, 500, 0.97, 0, 250, 42, 1};
+    int eval_size = 2000;
+    unsigned int eval_seed = 1234;
+
+    mnist_t* ds, *test_ds;
+    mnist_example_t* eval;
+    parallel_stats_t sync_stats, hogwild_stats;
+    mlp_t* mlp;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            cfg.n_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            cfg.max_steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            cfg.batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--lr") && i + 1 < argc)
+            cfg.lr = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--target") && i + 1 < argc)
+            cfg.target_acc = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--eval-size") && i + 1 < argc)
+            eval_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--eval-ms") && i + 1 < argc)
+            cfg.eval_interval_ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--stop"))
+            cfg.stop_at_target = 1;
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    test_ds = mnist_read(TEST_IMAGES, TEST_LABELS);
+    if (ds == NULL || test_ds == NULL)
+        return 1;
+
+    eval = mnist_batch_r(test_ds, eval_size, 1, &eval_seed);
+
+    printf("threads: %d  batch: %d  steps/thread: %d  lr: %g  target: %.3f\n",
+            cfg.n_threads, cfg.batch_size, cfg.max_steps, cfg.lr, cfg.target_acc);
+
+    mlp = fresh_mlp(cfg.seed);
+    sync_stats = parallel_sync(mlp, ds, eval, &cfg);
+    mlp_clean(mlp);
+
+    mlp = fresh_mlp(cfg.seed);
+    hogwild_stats = parallel_hogwild(mlp, ds, eval, &cfg);
+    mlp_clean(mlp);
+
+    printf("\n%-8s %12s %10s %12s %16s %10s\n",
+            "mode", "examples", "seconds", "examples/s", "time-to-target", "accuracy");
+    print_stats("sync", &sync_stats);
+    print_stats("hogwild", &hogwild_stats);
+    printf("hogwild speedup: %.2fx examples/s\n",
+            hogwild_stats.examples_per_sec / sync_stats.examples_per_sec);
+
+    mnist_example_clean(eval);
+    mnist_clean(ds);
+    mnist_clean(test_ds);
+    return 0;
+}
+
+void print_stats(const char* name, const parallel_stats_t* s)
+{
+    char ttt[32];
+
+    if (s->time_to_target < 0)
+        sprintf(ttt, "not reached");
+    else
+        sprintf(ttt, "%.2fs", s->time_to_target);
+
+    printf("%-8s %12ld %10.2f %12.1f %16s %10.4f\n",
+            name, s->examples, s->seconds, s->examples_per_sec, ttt, s->final_acc);
+}
+
+mlp_t* fresh_mlp(unsigned int seed)
+{
+    srand(seed);
+    return mlp_init(28 * 28, 128, 10);
+}
@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "kernels.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+
+/* Inference latency of the two layer model, relu(x @ W1 + b1) @ W2 + b2,
+ * through the generic tensor_mm path and through the kernels generated for
+ * KERNEL_MODEL, for single images and small batches.
+ *
+ * Usage: bench_kernels [--images N]
+ */
+
+static const uint32_t BATCH_SIZES[] = {1, 4, 16, 64, 256};
+
+typedef void (*dense_t)(const tensor_t* x, const tensor_t* W, const tensor_t* b, int relu,
+        tensor_t* out);
+
+static double infer_us(dense_t dense, const mlp_t* mlp, mnist_example_t* batch, tensor_t* h,
+        tensor_t* logits, int reps);
+static tensor_t* buffer(uint32_t rows, uint32_t cols);
+static float max_abs_diff(const tensor_t* t1, const tensor_t* t2);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int n_images = 20000, reps;
+    unsigned int seed = 42;
+    double generic_us, specialized_us;
+    mnist_example_t* batch;
+    tensor_t* h, *logits, *ref;
+    mnist_t* ds;
+    mlp_t* mlp;
+    float diff;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--images") && i + 1 < argc)
+            n_images = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (ds == NULL)
+        return 1;
+
+    srand(seed);
+    mlp = mlp_init(28 * 28, 128, 10);
+    printf("Specialized kernels: 784x128 %s, 128x10 %s\n\n",
+            kernels_find(28 * 28, 128) ? "yes" : "no", kernels_find(128, 10) ? "yes" : "no");
+
+    printf("%8s %14s %14s %14s %10s %10s\n", "batch", "generic (us)", "special (us)", "us / image",
+            "speedup", "max diff");
+    for (int b = 0; b < sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]); b++)
+    {
+        batch = mnist_batch_r(ds, BATCH_SIZES[b], 1, &seed);
+        h = buffer(BATCH_SIZES[b], 128);
+        logits = buffer(BATCH_SIZES[b], 10);
+        ref = buffer(BATCH_SIZES[b], 10);
+        reps = n_images / BATCH_SIZES[b] > 0 ? n_images / BATCH_SIZES[b] : 1;
+
+        generic_us = infer_us(kernels_dense_generic, mlp, batch, h, ref, reps);
+        specialized_us = infer_us(kernels_dense, mlp, batch, h, logits, reps);
+        diff = max_abs_diff(ref, logits);
+
+        printf("%8u %14.2f %14.2f %14.3f %9.2fx %10g\n", BATCH_SIZES[b], generic_us, specialized_us,
+                specialized_us / BATCH_SIZES[b], generic_us / specialized_us, diff);
+
+        tensor_clean(h);
+        tensor_clean(logits);
+        tensor_clean(ref);
+        mnist_example_clean(batch);
+    }
+
+    mlp_clean(mlp);
+    mnist_clean(ds);
+    return 0;
+}
+
+/* Mean time of one forward pass over the batch */
+double infer_us(dense_t dense, const mlp_t* mlp, mnist_example_t* batch, tensor_t* h,
+        tensor_t* logits, int reps)
+{
+    double start = now_seconds();
+
+    for (int r = 0; r < reps; r++)
+    {
+        dense(batch->image, mlp->W1, mlp->b1, 1, h);
+        dense(h, mlp->W2, mlp->b2, 0, logits);
+    }
+    return (now_seconds() - start) * 1e6 / reps;
+}
+
+tensor_t* buffer(uint32_t rows, uint32_t cols)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+
+    shape[0] = rows;
+    shape[1] = cols;
+    return tensor_zeros(shape, 2);
+}
+
+float max_abs_diff(const tensor_t* t1, const tensor_t* t2)
+{
+    float diff = 0;
+
+    for (uint32_t i = 0; i < tensor_numel(t1); i++)
+        diff = fmaxf(diff, fabsf(t1->values[i] - t2->values[i]));
+    return diff;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
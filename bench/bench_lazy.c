@@ -0,0 +1,179 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "nn.h"
+#include "lazy.h"
+
+/* Compares eager tensor.h chains with their fused lazy versions: time per
+ * evaluation and largest difference of the results.
+ *
+ * Usage: bench_lazy [--rows N] [--reps N]
+ */
+
+typedef enum { CHAIN_SOFTMAX = 0, CHAIN_SGD, CHAIN_BIAS_RELU, CHAIN_LONG, N_CHAINS } chain_t;
+
+static const char* CHAIN_NAMES[] = {
+    "softmax", "param - lr * grad", "relu(x + b) * s", "relu((a - b) * c / d + 1)"
+};
+
+static tensor_t* eager(chain_t chain, tensor_t** in);
+static tensor_t* lazy(chain_t chain, tensor_t** in);
+static tensor_t* matrix(uint32_t rows, uint32_t cols, float min, float max);
+static float max_abs_diff(const tensor_t* t1, const tensor_t* t2);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int rows = 1024, reps = 10;
+    tensor_t* in[5], *ref, *out;
+    double start, eager_ms, lazy_ms;
+    uint32_t* bias_shape;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--rows") && i + 1 < argc)
+            rows = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    srand(42);
+    in[0] = matrix(rows, 128, -2, 2);
+    in[1] = matrix(rows, 128, -2, 2);
+    in[2] = matrix(rows, 128, -2, 2);
+    in[3] = matrix(rows, 128, 1, 2);
+    bias_shape = (uint32_t*)malloc(sizeof(uint32_t));
+    bias_shape[0] = 128;
+    in[4] = tensor_uniform(-1, 1, bias_shape, 1);
+
+    printf("%-28s %12s %12s %12s\n", "chain", "eager (ms)", "lazy (ms)", "max diff");
+    for (int c = 0; c < N_CHAINS; c++)
+    {
+        ref = eager(c, in);
+        out = lazy(c, in);
+
+        start = now_seconds();
+        for (int r = 0; r < reps; r++)
+            tensor_clean(eager(c, in));
+        eager_ms = (now_seconds() - start) * 1000 / reps;
+
+        start = now_seconds();
+        for (int r = 0; r < reps; r++)
+            tensor_clean(lazy(c, in));
+        lazy_ms = (now_seconds() - start) * 1000 / reps;
+
+        printf("%-28s %12.3f %12.3f %12g\n", CHAIN_NAMES[c], eager_ms, lazy_ms, max_abs_diff(ref, out));
+        tensor_clean(ref);
+        tensor_clean(out);
+    }
+
+    for (int i = 0; i < 5; i++)
+        tensor_clean(in[i]);
+    return 0;
+}
+
+tensor_t* eager(chain_t chain, tensor_t** in)
+{
+    tensor_t* t[4], *res;
+
+    switch (chain)
+    {
+        case CHAIN_SOFTMAX:
+            return nn_softmax(in[0], 1);
+
+        case CHAIN_SGD:
+            t[0] = tensor_mul_scalar(in[1], 0.01);
+            res = tensor_sub(in[0], t[0]);
+            tensor_clean(t[0]);
+            return res;
+
+        case CHAIN_BIAS_RELU:
+            t[0] = tensor_add(in[0], in[4]);
+            t[1] = nn_relu(t[0]);
+            res = tensor_mul_scalar(t[1], 0.5);
+            tensor_clean(t[0]);
+            tensor_clean(t[1]);
+            return res;
+
+        default:
+            t[0] = tensor_sub(in[0], in[1]);
+            t[1] = tensor_mul(t[0], in[2]);
+            t[2] = tensor_div(t[1], in[3]);
+            t[3] = tensor_add_scalar(t[2], 1);
+            res = nn_relu(t[3]);
+            for (int i = 0; i < 4; i++)
+                tensor_clean(t[i]);
+            return res;
+    }
+}
+
+tensor_t* lazy(chain_t chain, tensor_t** in)
+{
+    lazy_graph_t* g = lazy_graph_new();
+    lazy_t* x = lazy_leaf(g, in[0]), *e, *root;
+    tensor_t* res;
+
+    switch (chain)
+    {
+        case CHAIN_SOFTMAX:
+            /* As in nn_softmax_lazy */
+            e = lazy_exp(g, x);
+            root = lazy_div(g, e, lazy_unsqueeze(g, lazy_reduce_sum(g, e, 1), 1));
+            break;
+
+        case CHAIN_SGD:
+            root = lazy_sub(g, x, lazy_mul_scalar(g, lazy_leaf(g, in[1]), 0.01));
+            break;
+
+        case CHAIN_BIAS_RELU:
+            root = lazy_mul_scalar(g, lazy_relu(g, lazy_add(g, x, lazy_leaf(g, in[4]))), 0.5);
+            break;
+
+        default:
+            root = lazy_sub(g, x, lazy_leaf(g, in[1]));
+            root = lazy_mul(g, root, lazy_leaf(g, in[2]));
+            root = lazy_div(g, root, lazy_leaf(g, in[3]));
+            root = lazy_relu(g, lazy_add_scalar(g, root, 1));
+            break;
+    }
+
+    res = lazy_eval(g, root);
+    lazy_graph_clean(g);
+    return res;
+}
+
+tensor_t* matrix(uint32_t rows, uint32_t cols, float min, float max)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+
+    shape[0] = rows;
+    shape[1] = cols;
+    return tensor_uniform(min, max, shape, 2);
+}
+
+float max_abs_diff(const tensor_t* t1, const tensor_t* t2)
+{
+    float diff = 0;
+
+    for (uint32_t i = 0; i < tensor_numel(t1); i++)
+        diff = fmaxf(diff, fabsf(t1->values[i] - t2->values[i]));
+    return diff;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "model.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+
+/* Checks the gradients of a model built from a config against those of
+ * mlp_forward_backward for the same parameters, then times a training step
+ * of a few model configs, counting the heap bytes each step leaves behind.
+ *
+ * Usage: bench_model [--batch N] [--steps N] [--model CONFIG]
+ */
+
+static const char* CONFIGS[] = {
+    "input:784 dense:128 relu dense:10 softmax_ce",
+    "input:784 dense:256 relu dense:128 relu dense:64 relu dense:10 softmax_ce",
+    "input:784 dense:512 relu dense:512 relu dense:10 softmax_ce"
+};
+
+static void time_config(const char* config, mnist_example_t* batch, int steps);
+static float max_abs_diff(const tensor_t* t1, const tensor_t* t2);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int batch_size = 256, steps = 20;
+    const char* config = NULL;
+    unsigned int seed = 42;
+    mnist_example_t* batch;
+    train_res_t res;
+    mnist_t* ds;
+    model_t* model;
+    mlp_t* mlp;
+    float loss, diff;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--model") && i + 1 < argc)
+            config = argv[++i];
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (ds == NULL)
+        return 1;
+    batch = mnist_batch_r(ds, batch_size, 1, &seed);
+
+    /* Both draw W1, b1, W2, b2 in the same order */
+    srand(seed);
+    mlp = mlp_init(28 * 28, 128, 10);
+    srand(seed);
+    model = model_parse(CONFIGS[0], batch_size);
+
+    loss = model_forward_backward(model, batch->image, batch->label);
+    res = mlp_forward_backward(mlp, batch->image, batch->label);
+    diff = fabsf(res.loss - loss);
+    diff = fmaxf(diff, max_abs_diff(res.dW1, model->layers[0].dW));
+    diff = fmaxf(diff, max_abs_diff(res.db1, model->layers[0].db));
+    diff = fmaxf(diff, max_abs_diff(res.dW2, model->layers[2].dW));
+    diff = fmaxf(diff, max_abs_diff(res.db2, model->layers[2].db));
+    printf("Largest difference with mlp_forward_backward: %g\n\n", diff);
+    train_res_clean(&res);
+    mlp_clean(mlp);
+    model_clean(model);
+
+    printf("%-72s %10s %16s\n", "model", "step (ms)", "heap bytes/step");
+    if (config != NULL)
+        time_config(config, batch, steps);
+    else
+        for (int c = 0; c < sizeof(CONFIGS) / sizeof(CONFIGS[0]); c++)
+            time_config(CONFIGS[c], batch, steps);
+
+    mnist_example_clean(batch);
+    mnist_clean(ds);
+    return 0;
+}
+
+void time_config(const char* config, mnist_example_t* batch, int steps)
+{
+    model_t* model = model_parse(config, batch->image->shape[0]);
+    double start, step_ms;
+    size_t heap;
+
+    start = now_seconds();
+    heap = mallinfo2().uordblks;
+    for (int s = 0; s < steps; s++)
+    {
+        model_forward_backward(model, batch->image, batch->label);
+        model_update(model, 0.001);
+    }
+    step_ms = (now_seconds() - start) * 1000 / steps;
+
+    printf("%-72s %10.3f %16.0f\n", config, step_ms, (double)(mallinfo2().uordblks - heap) / steps);
+    model_clean(model);
+}
+
+float max_abs_diff(const tensor_t* t1, const tensor_t* t2)
+{
+    float diff = 0;
+
+    for (uint32_t i = 0; i < tensor_numel(t1); i++)
+        diff = fmaxf(diff, fabsf(t1->values[i] - t2->values[i]));
+    return diff;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "parallel.h"
+#include "topology.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+#define TEST_IMAGES "data/t10k-images-idx3-ubyte"
+#define TEST_LABELS "data/t10k-labels-idx1-ubyte"
+
+/* Trains the same model twice, first with free floating threads and a single
+ * dataset copy, then with NUMA pinned workers and one dataset copy per node,
+ * and reports the share of remote pages every worker touched.
+ *
+ * Usage: bench_numa [--threads N] [--steps N] [--batch N] [--hogwild]
+ *                   [--sample-every N]
+ */
+
+static const char* KIND_NAMES[TOPO_N_KINDS] = {"dataset", "batch", "grads", "weights"};
+
+static parallel_stats_t run(mnist_t* ds, const mnist_example_t* eval,
+        const parallel_config_t* cfg, uint8_t hogwild);
+static void print_stats(const char* name, const parallel_stats_t* s);
+
+int main(int argc, char** argv)
+{
+    parallel_config_t cfg = {4, 64, 0.001, 200, 0, 0, 500, 42, 0};
+    unsigned int eval_seed = 1234;
+    uint8_t hogwild = 0;
+    parallel_stats_t before, after;
+    mnist_t* ds, *test_ds;
+    mnist_example_t* eval;
+    topo_t* topo;
+
+    cfg.numa_sample_every = 25;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            cfg.n_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            cfg.max_steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            cfg.batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--sample-every") && i + 1 < argc)
+            cfg.numa_sample_every = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--hogwild"))
+            hogwild = 1;
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    topo = topo_read();
+    printf("%d NUMA node(s), %d CPU(s)\n", topo->n_nodes, topo->n_cpus);
+    for (int i = 0; i < topo->n_nodes; i++)
+        printf("  node %d: %d CPU(s)\n", topo->node_ids[i], topo->n_node_cpus[i]);
+    topo_clean(topo);
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    test_ds = mnist_read(TEST_IMAGES, TEST_LABELS);
+    if (ds == NULL || test_ds == NULL)
+        return 1;
+    eval = mnist_batch_r(test_ds, 1000, 1, &eval_seed);
+
+    before = run(ds, eval, &cfg, hogwild);
+
+    cfg.pin_threads = 1;
+    cfg.replicate_dataset = 1;
+    after = run(ds, eval, &cfg, hogwild);
+
+    printf("\n%-8s %12s", "run", "examples/s");
+    for (int i = 0; i < TOPO_N_KINDS; i++)
+        printf(" %10s", KIND_NAMES[i]);
+    printf("   (remote pages %%)\n");
+    print_stats("before", &before);
+    print_stats("after", &after);
+
+    mnist_example_clean(eval);
+    mnist_clean(ds);
+    mnist_clean(test_ds);
+    return 0;
+}
+
+parallel_stats_t run(mnist_t* ds, const mnist_example_t* eval,
+        const parallel_config_t* cfg, uint8_t hogwild)
+{
+    parallel_stats_t stats;
+    mlp_t* mlp;
+
+    srand(cfg->seed);
+    mlp = mlp_init(28 * 28, 128, 10);
+    if (hogwild)
+        stats = parallel_hogwild(mlp, ds, eval, cfg);
+    else
+        stats = parallel_sync(mlp, ds, eval, cfg);
+    mlp_clean(mlp);
+    return stats;
+}
+
+void print_stats(const char* name, const parallel_stats_t* s)
+{
+    printf("%-8s %12.1f", name, s->examples_per_sec);
+    for (int i = 0; i < TOPO_N_KINDS; i++)
+    {
+        if (s->access.pages[i] == 0)
+            printf(" %10s", "-");
+        else
+            printf(" %9.1f%%", 100.0 * s->access.remote[i] / s->access.pages[i]);
+    }
+    printf("\n");
+}
@@ -0,0 +1,729 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "tensor.h"
+#include "nn.h"
+#include "bmm.h"
+#include "train_bench.h"
+
+/* Microbenchmarks of the public ops of tensor.h and nn.h, written as JSON
+ * so runs can be diffed across commits and hosts.
+ *
+ * Every case runs for each thread count: the ops are single threaded, so N
+ * threads run N replicas of the op on their own operands at the same time
+ * (tensor_bmm and tensor_bmm_into run once over bmm_set_threads(N)
+ * instead). A trial starts
+ * every replica together and lasts until the slowest is done, and repeats
+ * the op enough times to take about TRIAL_SECONDS. After the warm-up
+ * trials the median and p90 time per call are reported with GFLOP/s and
+ * effective GB/s, the bytes being the least an op has to read and write.
+ * Ops that return a new tensor are timed with its allocation and free,
+ * which callers pay too.
+ *
+ * The roofline is a triad (a = b + s * c) over arrays larger than the
+ * caches, measured the same way for each thread count and taking the best
+ * trial. Every result gives the fraction of it the op reaches.
+ *
+ * Left out: the factories (tensor_new, tensor_zeros, ...), tensor_clean,
+ * tensor_numel and the print functions.
+ *
+ * Usage: bench_ops [--threads N,N,..] [--trials N] [--warmup N] [--filter OP]
+ *                  [--label S] [--out PATH]
+ */
+
+#define MAX_THREAD_COUNTS 8
+#define TRIAL_SECONDS 0.002
+#define MAX_INNER 1000
+
+/* Ops that share one call between the threads */
+#define BMM_THREADS(kind) ((kind) == OP_BMM || (kind) == OP_BMM_INTO)
+
+typedef enum {
+    OP_MM = 0,
+    OP_MM_T,
+    OP_MM_INTO,
+    OP_MM_T_INTO,
+    OP_MM_NT_INTO,
+    OP_BMM,
+    OP_BMM_INTO,
+    OP_ADD,
+    OP_ADD_BIAS,
+    OP_ADD_SCALAR,
+    OP_SUB,
+    OP_SUB_SCALAR,
+    OP_MUL,
+    OP_MUL_SCALAR,
+    OP_DIV,
+    OP_DIV_SCALAR,
+    OP_NEG,
+    OP_GTE,
+    OP_EQ,
+    OP_REDUCE_SUM,
+    OP_ARGMAX,
+    OP_T,
+    OP_COPY,
+    OP_INDEX,
+    OP_RESHAPE,
+    OP_UNSQUEEZE,
+    OP_REPEAT,
+    OP_BROADCAST,
+    OP_TO_BF16,
+    OP_RELU,
+    OP_SOFTMAX,
+    OP_SOFTMAX_LAZY,
+    OP_CE_LOSS,
+    OP_ACCURACY,
+    OP_TRIAD
+} op_kind_t;
+
+/* Matmuls are [b,] m x k @ k x n, tensor_repeat repeats m x n k times
+ * along axis, every other op works on m x n */
+typedef struct
+{
+    op_kind_t kind;
+    const char* name;
+    uint32_t b, m, k, n;
+    int axis;       /* -1 when the op has none */
+} op_case_t;
+
+static const op_case_t CASES[] = {
+    {OP_MM, "tensor_mm", 0, 1, 784, 128, -1},
+    {OP_MM, "tensor_mm", 0, 64, 784, 128, -1},
+    {OP_MM, "tensor_mm", 0, 64, 128, 10, -1},
+    {OP_MM, "tensor_mm", 0, 128, 128, 128, -1},
+    {OP_MM, "tensor_mm", 0, 256, 256, 256, -1},
+    {OP_MM_T, "tensor_mm_T", 0, 784, 64, 128, -1},
+    {OP_MM_INTO, "tensor_mm_into", 0, 64, 784, 128, -1},
+    {OP_MM_T_INTO, "tensor_mm_T_into", 0, 784, 64, 128, -1},
+    {OP_MM_NT_INTO, "tensor_mm_NT_into", 0, 64, 128, 784, -1},
+    {OP_BMM, "tensor_bmm", 64, 128, 64, 128, -1},
+    {OP_BMM_INTO, "tensor_bmm_into", 64, 128, 64, 128, -1},
+    {OP_ADD, "tensor_add", 0, 64, 0, 128, -1},
+    {OP_ADD, "tensor_add", 0, 1024, 0, 1024, -1},
+    {OP_ADD_BIAS, "tensor_add", 0, 64, 0, 128, -1},
+    {OP_ADD_BIAS, "tensor_add", 0, 1024, 0, 1024, -1},
+    {OP_ADD_SCALAR, "tensor_add_scalar", 0, 1024, 0, 1024, -1},
+    {OP_SUB, "tensor_sub", 0, 1024, 0, 1024, -1},
+    {OP_SUB_SCALAR, "tensor_sub_scalar", 0, 1024, 0, 1024, -1},
+    {OP_MUL, "tensor_mul", 0, 1024, 0, 1024, -1},
+    {OP_MUL_SCALAR, "tensor_mul_scalar", 0, 1024, 0, 1024, -1},
+    {OP_DIV, "tensor_div", 0, 1024, 0, 1024, -1},
+    {OP_DIV_SCALAR, "tensor_div_scalar", 0, 1024, 0, 1024, -1},
+    {OP_NEG, "tensor_neg", 0, 1024, 0, 1024, -1},
+    {OP_GTE, "tensor_gte", 0, 1024, 0, 1024, -1},
+    {OP_EQ, "tensor_eq", 0, 1024, 0, 1024, -1},
+    {OP_REDUCE_SUM, "tensor_reduce_sum", 0, 1024, 0, 1024, 0},
+    {OP_REDUCE_SUM, "tensor_reduce_sum", 0, 1024, 0, 1024, 1},
+    {OP_ARGMAX, "tensor_argmax", 0, 64, 0, 10, 1},
+    {OP_ARGMAX, "tensor_argmax", 0, 1024, 0, 1024, 0},
+    {OP_ARGMAX, "tensor_argmax", 0, 1024, 0, 1024, 1},
+    {OP_T, "tensor_T", 0, 1024, 0, 1024, -1},
+    {OP_COPY, "tensor_copy", 0, 1024, 0, 1024, -1},
+    {OP_INDEX, "tensor_index", 0, 60000, 0, 784, 0},
+    {OP_RESHAPE, "tensor_reshape", 0, 1024, 0, 1024, -1},
+    {OP_UNSQUEEZE, "tensor_unsqueeze", 0, 1024, 0, 1024, 0},
+    {OP_REPEAT, "tensor_repeat", 0, 1, 64, 128, 0},
+    {OP_REPEAT, "tensor_repeat", 0, 64, 4, 128, 1},
+    {OP_BROADCAST, "tensor_broadcast", 0, 64, 0, 128, -1},
+    {OP_BROADCAST, "tensor_broadcast", 0, 1024, 0, 1024, -1},
+    {OP_TO_BF16, "tensor_to_dtype", 0, 1024, 0, 1024, -1},
+    {OP_RELU, "nn_relu", 0, 64, 0, 128, -1},
+    {OP_RELU, "nn_relu", 0, 1024, 0, 1024, -1},
+    {OP_SOFTMAX, "nn_softmax", 0, 64, 0, 10, 1},
+    {OP_SOFTMAX, "nn_softmax", 0, 1024, 0, 1024, 1},
+    {OP_SOFTMAX_LAZY, "nn_softmax_lazy", 0, 64, 0, 10, 1},
+    {OP_SOFTMAX_LAZY, "nn_softmax_lazy", 0, 1024, 0, 1024, 1},
+    {OP_CE_LOSS, "nn_sparse_ce_loss", 0, 1024, 0, 10, -1},
+    {OP_ACCURACY, "nn_accuracy_score", 0, 1024, 0, 1, -1}
+};
+
+/* 48 MB per thread */
+static const op_case_t TRIAD = {OP_TRIAD, "triad", 0, 4096, 0, 1024, -1};
+
+typedef struct
+{
+    tensor_t* a;
+    tensor_t* b;
+    tensor_t* c;    /* result of the _into ops */
+} operands_t;
+
+typedef struct
+{
+    const op_case_t* c;
+    operands_t ops;
+    pthread_barrier_t* barrier;
+    int n_trials;
+    int n_inner;
+    double* seconds;    /* per trial */
+} replica_t;
+
+static double* measure(const op_case_t* c, int n_threads, int n_trials, int n_inner);
+static int calibrate(const op_case_t* c);
+static void* replica_loop(void* arg);
+static void setup(const op_case_t* c, operands_t* ops);
+static void teardown(operands_t* ops);
+static void run_op(const op_case_t* c, operands_t* ops);
+static void op_cost(const op_case_t* c, double* flops, double* bytes);
+static void shape_str(const op_case_t* c, char* buf, size_t len);
+static tensor_t* matrix(uint32_t b, uint32_t rows, uint32_t cols);
+static tensor_t* labels(uint32_t n, uint32_t n_classes);
+static int cmp_double(const void* a, const void* b);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int threads[MAX_THREAD_COUNTS] = {1, 2, 4}, n_counts = 3, n_trials = 11, n_warmup = 2;
+    const char* filter = NULL, *label = "", *out_path = NULL;
+    double roofline[MAX_THREAD_COUNTS], flops, bytes, median, p90, *times;
+    char host[256], shape[64], *tok;
+    const op_case_t* c;
+    int n_inner, first = 1;
+    FILE* out = stdout;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            n_counts = 0;
+            for (tok = strtok(argv[++i], ","); tok != NULL && n_counts < MAX_THREAD_COUNTS; tok = strtok(NULL, ","))
+                threads[n_counts++] = atoi(tok);
+        }
+        else if (!strcmp(argv[i], "--trials") && i + 1 < argc)
+            n_trials = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--warmup") && i + 1 < argc)
+            n_warmup = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "--label") && i + 1 < argc)
+            label = argv[++i];
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            out_path = argv[++i];
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (n_trials <= 0 || n_warmup < 0)
+    {
+        printf("[ERROR] --trials must be positive and --warmup not negative\n");
+        return 1;
+    }
+    for (int t = 0; t < n_counts; t++)
+        if (threads[t] <= 0)
+        {
+            printf("[ERROR] --threads takes positive thread counts\n");
+            return 1;
+        }
+    if (n_counts == 0)
+    {
+        printf("[ERROR] --threads needs at least one thread count\n");
+        return 1;
+    }
+
+    if (out_path != NULL && (out = fopen(out_path, "w")) == NULL)
+    {
+        printf("[ERROR] Cannot write %s\n", out_path);
+        return 1;
+    }
+    if (gethostname(host, sizeof(host)) != 0)
+        strcpy(host, "unknown");
+    host[sizeof(host) - 1] = '\0';
+    srand(42);
+
+    fprintf(out, "{\n  \"label\": ");
+    train_bench_json_string(label, out);
+    fprintf(out, ",\n  \"host\": ");
+    train_bench_json_string(host, out);
+    fprintf(out, ",\n  \"cpus\": %ld,\n  \"time\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN),
+            (long)time(NULL));
+    fprintf(out, "  \"trials\": %d,\n  \"warmup\": %d,\n  \"roofline\": [", n_trials, n_warmup);
+    op_cost(&TRIAD, &flops, &bytes);
+    for (int t = 0; t < n_counts; t++)
+    {
+        times = measure(&TRIAD, threads[t], n_warmup + n_trials, 1);
+        qsort(times + n_warmup, n_trials, sizeof(double), cmp_double);
+        roofline[t] = threads[t] * bytes / times[n_warmup] * 1e-9;
+        fprintf(out, "%s\n    {\"threads\": %d, \"gbs\": %.2f}", t > 0 ? "," : "", threads[t], roofline[t]);
+        fprintf(stderr, "roofline x%d: %.2f GB/s\n", threads[t], roofline[t]);
+        free(times);
+    }
+    fprintf(out, "\n  ],\n  \"results\": [");
+
+    for (int i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+    {
+        c = &CASES[i];
+        if (filter != NULL && strstr(c->name, filter) == NULL)
+            continue;
+        shape_str(c, shape, sizeof(shape));
+        op_cost(c, &flops, &bytes);
+        n_inner = calibrate(c);
+
+        for (int t = 0; t < n_counts; t++)
+        {
+            times = measure(c, threads[t], n_warmup + n_trials, n_inner);
+            qsort(times + n_warmup, n_trials, sizeof(double), cmp_double);
+            median = times[n_warmup + n_trials / 2] / n_inner;
+            p90 = times[n_warmup + (int)(n_trials * 0.9)] / n_inner;
+
+            /* bmm shares one call between the threads */
+            if (!BMM_THREADS(c->kind))
+            {
+                flops *= threads[t];
+                bytes *= threads[t];
+            }
+            fprintf(out, "%s\n    {\"op\": \"%s\", \"shape\": \"%s\", \"axis\": %d, \"threads\": %d, "
+                    "\"parallel\": \"%s\", \"inner\": %d, \"median_us\": %.3f, \"p90_us\": %.3f, "
+                    "\"gflops\": %.3f, \"gbs\": %.3f, \"roofline_fraction\": %.3f}",
+                    first ? "" : ",", c->name, shape, c->axis, threads[t],
+                    BMM_THREADS(c->kind) ? "bmm_threads" : "replicas", n_inner, median * 1e6, p90 * 1e6,
+                    flops / median * 1e-9, bytes / median * 1e-9, bytes / median * 1e-9 / roofline[t]);
+            fprintf(stderr, "%-20s %-16s axis %2d x%d %12.3f us %10.3f GFLOP/s %8.2f GB/s\n", c->name,
+                    shape, c->axis, threads[t], median * 1e6, flops / median * 1e-9, bytes / median * 1e-9);
+            if (!BMM_THREADS(c->kind))
+            {
+                flops /= threads[t];
+                bytes /= threads[t];
+            }
+            first = 0;
+            free(times);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
+
+/* Seconds of every trial, the slowest replica of each */
+double* measure(const op_case_t* c, int n_threads, int n_trials, int n_inner)
+{
+    int n_replicas = BMM_THREADS(c->kind) ? 1 : n_threads;
+    replica_t* replicas = (replica_t*)malloc(sizeof(replica_t) * n_replicas);
+    pthread_t* tids = (pthread_t*)malloc(sizeof(pthread_t) * n_replicas);
+    double* seconds = (double*)calloc(n_trials, sizeof(double));
+    pthread_barrier_t barrier;
+
+    bmm_set_threads(BMM_THREADS(c->kind) ? n_threads : 1);
+    pthread_barrier_init(&barrier, NULL, n_replicas);
+    for (int r = 0; r < n_replicas; r++)
+    {
+        replicas[r].c = c;
+        replicas[r].barrier = &barrier;
+        replicas[r].n_trials = n_trials;
+        replicas[r].n_inner = n_inner;
+        replicas[r].seconds = (double*)malloc(sizeof(double) * n_trials);
+        setup(c, &replicas[r].ops);
+    }
+
+    /* The calling thread is replica 0 */
+    for (int r = 1; r < n_replicas; r++)
+        pthread_create(&tids[r], NULL, replica_loop, &replicas[r]);
+    replica_loop(&replicas[0]);
+    for (int r = 1; r < n_replicas; r++)
+        pthread_join(tids[r], NULL);
+
+    for (int r = 0; r < n_replicas; r++)
+    {
+        for (int t = 0; t < n_trials; t++)
+            if (replicas[r].seconds[t] > seconds[t])
+                seconds[t] = replicas[r].seconds[t];
+        free(replicas[r].seconds);
+        teardown(&replicas[r].ops);
+    }
+
+    bmm_set_threads(1);
+    pthread_barrier_destroy(&barrier);
+    free(replicas);
+    free(tids);
+    return seconds;
+}
+
+/* Calls per trial so a trial takes about TRIAL_SECONDS on one thread */
+int calibrate(const op_case_t* c)
+{
+    operands_t ops;
+    double start, once;
+
+    setup(c, &ops);
+    run_op(c, &ops);
+    start = now_seconds();
+    run_op(c, &ops);
+    once = now_seconds() - start;
+    teardown(&ops);
+
+    if (once * MAX_INNER < TRIAL_SECONDS)
+        return MAX_INNER;
+    return once >= TRIAL_SECONDS ? 1 : (int)(TRIAL_SECONDS / once);
+}
+
+void* replica_loop(void* arg)
+{
+    replica_t* r = (replica_t*)arg;
+    double start;
+
+    for (int t = 0; t < r->n_trials; t++)
+    {
+        pthread_barrier_wait(r->barrier);
+        start = now_seconds();
+        for (int i = 0; i < r->n_inner; i++)
+            run_op(r->c, &r->ops);
+        r->seconds[t] = now_seconds() - start;
+        pthread_barrier_wait(r->barrier);
+    }
+    return NULL;
+}
+
+void setup(const op_case_t* c, operands_t* ops)
+{
+    uint32_t* shape;
+
+    ops->a = ops->b = ops->c = NULL;
+    switch (c->kind)
+    {
+    case OP_MM:
+    case OP_MM_INTO:
+        ops->a = matrix(0, c->m, c->k);
+        ops->b = matrix(0, c->k, c->n);
+        if (c->kind == OP_MM_INTO)
+            ops->c = matrix(0, c->m, c->n);
+        break;
+    case OP_MM_T:
+    case OP_MM_T_INTO:
+        ops->a = matrix(0, c->k, c->m);
+        ops->b = matrix(0, c->k, c->n);
+        if (c->kind == OP_MM_T_INTO)
+            ops->c = matrix(0, c->m, c->n);
+        break;
+    case OP_MM_NT_INTO:
+        ops->a = matrix(0, c->m, c->k);
+        ops->b = matrix(0, c->n, c->k);
+        ops->c = matrix(0, c->m, c->n);
+        break;
+    case OP_BMM:
+    case OP_BMM_INTO:
+        ops->a = matrix(c->b, c->m, c->k);
+        ops->b = matrix(c->b, c->k, c->n);
+        if (c->kind == OP_BMM_INTO)
+            ops->c = matrix(c->b, c->m, c->n);
+        break;
+    case OP_ADD_BIAS:
+    case OP_BROADCAST:
+        ops->a = matrix(0, c->m, c->n);
+        shape = (uint32_t*)malloc(sizeof(uint32_t));
+        shape[0] = c->n;
+        ops->b = tensor_uniform(-1, 1, shape, 1);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_GTE:
+    case OP_TRIAD:
+        ops->a = matrix(0, c->m, c->n);
+        ops->b = matrix(0, c->m, c->n);
+        if (c->kind == OP_TRIAD)
+            ops->c = matrix(0, c->m, c->n);
+        break;
+    case OP_EQ:
+    case OP_ACCURACY:
+        ops->a = labels(c->m * c->n, 10);
+        ops->b = labels(c->m * c->n, 10);
+        break;
+    case OP_CE_LOSS:
+        ops->a = labels(c->m, c->n);
+        ops->c = matrix(0, c->m, c->n);
+        ops->b = nn_softmax(ops->c, 1);
+        break;
+    default:
+        ops->a = matrix(0, c->m, c->n);
+        break;
+    }
+}
+
+void teardown(operands_t* ops)
+{
+    if (ops->a)
+        tensor_clean(ops->a);
+    if (ops->b)
+        tensor_clean(ops->b);
+    if (ops->c)
+        tensor_clean(ops->c);
+}
+
+void run_op(const op_case_t* c, operands_t* ops)
+{
+    tensor_t* res = NULL, *res2;
+    volatile float sink = 0;
+    uint32_t index, shape[2];
+    float* a, *b, *d;
+
+    switch (c->kind)
+    {
+    case OP_MM:
+        res = tensor_mm(ops->a, ops->b);
+        break;
+    case OP_MM_T:
+        res = tensor_mm_T(ops->a, ops->b);
+        break;
+    case OP_MM_INTO:
+        tensor_mm_into(ops->a, ops->b, ops->c);
+        break;
+    case OP_MM_T_INTO:
+        tensor_mm_T_into(ops->a, ops->b, ops->c);
+        break;
+    case OP_MM_NT_INTO:
+        tensor_mm_NT_into(ops->a, ops->b, ops->c);
+        break;
+    case OP_BMM:
+        res = tensor_bmm(ops->a, ops->b);
+        break;
+    case OP_BMM_INTO:
+        tensor_bmm_into(ops->a, ops->b, ops->c);
+        break;
+    case OP_ADD:
+    case OP_ADD_BIAS:
+        res = tensor_add(ops->a, ops->b);
+        break;
+    case OP_ADD_SCALAR:
+        res = tensor_add_scalar(ops->a, 1);
+        break;
+    case OP_SUB:
+        res = tensor_sub(ops->a, ops->b);
+        break;
+    case OP_SUB_SCALAR:
+        res = tensor_sub_scalar(ops->a, 1);
+        break;
+    case OP_MUL:
+        res = tensor_mul(ops->a, ops->b);
+        break;
+    case OP_MUL_SCALAR:
+        res = tensor_mul_scalar(ops->a, 2);
+        break;
+    case OP_DIV:
+        res = tensor_div(ops->a, ops->b);
+        break;
+    case OP_DIV_SCALAR:
+        res = tensor_div_scalar(ops->a, 2);
+        break;
+    case OP_NEG:
+        res = tensor_neg(ops->a);
+        break;
+    case OP_GTE:
+        res = tensor_gte(ops->a, ops->b);
+        break;
+    case OP_EQ:
+        res = tensor_eq(ops->a, ops->b);
+        break;
+    case OP_REDUCE_SUM:
+        res = tensor_reduce_sum(ops->a, c->axis);
+        break;
+    case OP_ARGMAX:
+        res = tensor_argmax(ops->a, c->axis);
+        break;
+    case OP_T:
+        res = tensor_T(ops->a);
+        break;
+    case OP_COPY:
+        res = tensor_copy(ops->a);
+        break;
+    case OP_INDEX:
+        /* One image of a dataset sized tensor */
+        index = c->m / 2;
+        res = tensor_index(ops->a, &index, 1);
+        break;
+    case OP_RESHAPE:
+        /* The shape is not owned by the result */
+        shape[0] = c->n;
+        shape[1] = c->m;
+        res = tensor_reshape(ops->a, shape, 2);
+        break;
+    case OP_UNSQUEEZE:
+        res = tensor_unsqueeze(ops->a, c->axis);
+        break;
+    case OP_REPEAT:
+        res = tensor_repeat(ops->a, c->k, c->axis);
+        break;
+    case OP_BROADCAST:
+        /* Takes ownership of its operands, so it runs on copies (timed too)
+         * and the bias ends up as large as the matrix */
+        res = tensor_copy(ops->a);
+        res2 = tensor_copy(ops->b);
+        tensor_broadcast(&res, &res2);
+        tensor_clean(res2);
+        break;
+    case OP_TO_BF16:
+        res = tensor_to_dtype(ops->a, TENSOR_BF16);
+        break;
+    case OP_RELU:
+        res = nn_relu(ops->a);
+        break;
+    case OP_SOFTMAX:
+        res = nn_softmax(ops->a, c->axis);
+        break;
+    case OP_SOFTMAX_LAZY:
+        res = nn_softmax_lazy(ops->a, c->axis);
+        break;
+    case OP_CE_LOSS:
+        sink = nn_sparse_ce_loss(ops->a, ops->b);
+        break;
+    case OP_ACCURACY:
+        sink = nn_accuracy_score(ops->a, ops->b);
+        break;
+    case OP_TRIAD:
+        a = ops->a->values;
+        b = ops->b->values;
+        d = ops->c->values;
+        for (uint32_t i = 0; i < c->m * c->n; i++)
+            a[i] = b[i] + 3 * d[i];
+        break;
+    }
+    (void)sink;
+
+    if (res != NULL)
+        tensor_clean(res);
+}
+
+/* Flops and the bytes an op cannot avoid moving: every input read once and
+ * the result written once */
+void op_cost(const op_case_t* c, double* flops, double* bytes)
+{
+    double mn = (double)c->m * c->n, out;
+
+    switch (c->kind)
+    {
+    case OP_MM:
+    case OP_MM_T:
+    case OP_MM_INTO:
+    case OP_MM_T_INTO:
+    case OP_MM_NT_INTO:
+    case OP_BMM:
+    case OP_BMM_INTO:
+        *flops = 2.0 * (c->b > 0 ? c->b : 1) * c->m * c->k * c->n;
+        *bytes = 4.0 * (c->b > 0 ? c->b : 1) * ((double)c->m * c->k + (double)c->k * c->n + mn);
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_GTE:
+    case OP_EQ:
+        *flops = mn;
+        *bytes = 12 * mn;
+        break;
+    case OP_ADD_BIAS:
+        *flops = mn;
+        *bytes = 8 * mn + 4.0 * c->n;
+        break;
+    case OP_REDUCE_SUM:
+    case OP_ARGMAX:
+        out = c->axis == 0 ? c->n : c->m;
+        *flops = mn;
+        *bytes = 4 * (mn + out);
+        break;
+    case OP_T:
+    case OP_COPY:
+    case OP_RESHAPE:
+    case OP_UNSQUEEZE:
+        *flops = 0;
+        *bytes = 8 * mn;
+        break;
+    case OP_INDEX:
+        /* The row picked, read and written */
+        *flops = 0;
+        *bytes = 8.0 * c->n;
+        break;
+    case OP_REPEAT:
+        *flops = 0;
+        *bytes = 4 * mn * (1 + c->k);
+        break;
+    case OP_BROADCAST:
+        /* The matrix kept and the bias read and written m times */
+        *flops = 0;
+        *bytes = 8 * mn + 4.0 * c->n + 4 * mn;
+        break;
+    case OP_TO_BF16:
+        *flops = 0;
+        *bytes = 6 * mn;
+        break;
+    case OP_SOFTMAX:
+    case OP_SOFTMAX_LAZY:
+        /* exp, sum and division */
+        *flops = 3 * mn;
+        *bytes = 8 * mn;
+        break;
+    case OP_CE_LOSS:
+        /* One probability and one label per row */
+        *flops = 2.0 * c->m;
+        *bytes = 8.0 * c->m;
+        break;
+    case OP_ACCURACY:
+        *flops = mn;
+        *bytes = 8 * mn;
+        break;
+    case OP_TRIAD:
+        *flops = 2 * mn;
+        *bytes = 12 * mn;
+        break;
+    default:
+        *flops = mn;
+        *bytes = 8 * mn;
+        break;
+    }
+}
+
+void shape_str(const op_case_t* c, char* buf, size_t len)
+{
+    if (c->b > 0)
+        snprintf(buf, len, "%ux%ux%ux%u", c->b, c->m, c->k, c->n);
+    else if (c->k > 0)
+        snprintf(buf, len, "%ux%ux%u", c->m, c->k, c->n);
+    else
+        snprintf(buf, len, "%ux%u", c->m, c->n);
+}
+
+/* [b, rows, cols], or [rows, cols] when b is 0 */
+tensor_t* matrix(uint32_t b, uint32_t rows, uint32_t cols)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 3);
+    uint32_t n_dims = 0;
+
+    if (b > 0)
+        shape[n_dims++] = b;
+    shape[n_dims++] = rows;
+    shape[n_dims++] = cols;
+    return tensor_uniform(-1, 1, shape, n_dims);
+}
+
+tensor_t* labels(uint32_t n, uint32_t n_classes)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t));
+    tensor_t* t;
+
+    shape[0] = n;
+    t = tensor_zeros(shape, 1);
+    for (uint32_t i = 0; i < n; i++)
+        t->values[i] = rand() % n_classes;
+    return t;
+}
+
+int cmp_double(const void* a, const void* b)
+{
+    double d1 = *(const double*)a, d2 = *(const double*)b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,143 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "autograd.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+
+/* Plans the training step of the two layer model for growing batch sizes and
+ * reports the workspace needed with and without planning, and the largest
+ * batch fitting under a memory cap. Also checks that a planned tape trains
+ * exactly like an unplanned one.
+ *
+ * Usage: bench_planner [--cap MB] [--steps N]
+ */
+
+static const uint32_t BATCH_SIZES[] = {32, 64, 128, 256, 512, 1024, 2048, 4096, 8192};
+
+static ag_tape_t* record(const mlp_t* mlp, uint32_t batch_size, ag_var_t** x, ag_var_t** y,
+        ag_var_t** loss);
+static float max_param_diff(const mlp_t* m1, const mlp_t* m2);
+
+int main(int argc, char** argv)
+{
+    int steps = 20;
+    float cap_mb = 16;
+    unsigned int seed = 42;
+    uint32_t fit_naive = 0, fit_planned = 0;
+    mnist_example_t* batch;
+    ag_var_t* x1, *y1, *loss1, *x2, *y2, *loss2;
+    ag_tape_t* t1, *t2;
+    ag_plan_stats_t stats;
+    mnist_t* ds;
+    mlp_t* m1, *m2;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--cap") && i + 1 < argc)
+            cap_mb = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (ds == NULL)
+        return 1;
+
+    /* Two identical models, one trained on a planned tape */
+    srand(seed);
+    m1 = mlp_init(28 * 28, 128, 10);
+    srand(seed);
+    m2 = mlp_init(28 * 28, 128, 10);
+    t1 = record(m1, 256, &x1, &y1, &loss1);
+    t2 = record(m2, 256, &x2, &y2, &loss2);
+    ag_plan(t2, loss2);
+
+    for (int s = 0; s < steps; s++)
+    {
+        batch = mnist_batch_r(ds, 256, 1, &seed);
+        ag_feed(x1, batch->image);
+        ag_feed(y1, batch->label);
+        ag_feed(x2, batch->image);
+        ag_feed(y2, batch->label);
+
+        ag_forward(t1);
+        ag_backward(t1, loss1);
+        ag_sgd(t1, 0.001);
+        ag_forward(t2);
+        ag_backward(t2, loss2);
+        ag_sgd(t2, 0.001);
+        mnist_example_clean(batch);
+    }
+    printf("After %d steps: loss %.6f vs %.6f planned, largest parameter difference %g\n\n",
+            steps, loss1->value->values[0], loss2->value->values[0], max_param_diff(m1, m2));
+    ag_tape_clean(t1);
+    ag_tape_clean(t2);
+
+    printf("%8s %10s %14s %14s %8s\n", "batch", "buffers", "naive (KB)", "planned (KB)", "ratio");
+    for (int b = 0; b < sizeof(BATCH_SIZES) / sizeof(BATCH_SIZES[0]); b++)
+    {
+        t1 = record(m1, BATCH_SIZES[b], &x1, &y1, &loss1);
+        stats = ag_plan(t1, loss1);
+        printf("%8u %10u %14.1f %14.1f %7.2fx\n", BATCH_SIZES[b], stats.n_buffers,
+                stats.naive_bytes / 1024.0, stats.slab_bytes / 1024.0,
+                (float)stats.naive_bytes / stats.slab_bytes);
+
+        if (stats.naive_bytes <= cap_mb * 1024 * 1024)
+            fit_naive = BATCH_SIZES[b];
+        if (stats.slab_bytes <= cap_mb * 1024 * 1024)
+            fit_planned = BATCH_SIZES[b];
+        ag_tape_clean(t1);
+    }
+    printf("\nLargest batch under %.1f MB: %u naive, %u planned\n", cap_mb, fit_naive, fit_planned);
+
+    mlp_clean(m1);
+    mlp_clean(m2);
+    mnist_clean(ds);
+    return 0;
+}
+
+/* softmax_ce(relu(x @ W1 + b1) @ W2 + b2, y) over the parameters of `mlp` */
+ag_tape_t* record(const mlp_t* mlp, uint32_t batch_size, ag_var_t** x, ag_var_t** y,
+        ag_var_t** loss)
+{
+    ag_tape_t* tape = ag_tape_new();
+    uint32_t x_shape[] = {batch_size, mlp->W1->shape[0]}, y_shape[] = {batch_size};
+    ag_var_t* W1, *b1, *W2, *b2, *h;
+
+    *x = ag_input(tape, x_shape, 2);
+    *y = ag_input(tape, y_shape, 1);
+    W1 = ag_param(tape, mlp->W1);
+    b1 = ag_param(tape, mlp->b1);
+    W2 = ag_param(tape, mlp->W2);
+    b2 = ag_param(tape, mlp->b2);
+
+    h = ag_relu(tape, ag_add(tape, ag_mm(tape, *x, W1), b1));
+    *loss = ag_softmax_ce(tape, ag_add(tape, ag_mm(tape, h, W2), b2), *y);
+    return tape;
+}
+
+float max_param_diff(const mlp_t* m1, const mlp_t* m2)
+{
+    const tensor_t* p1[] = {m1->W1, m1->b1, m1->W2, m1->b2};
+    const tensor_t* p2[] = {m2->W1, m2->b1, m2->W2, m2->b2};
+    float diff = 0;
+
+    for (int p = 0; p < 4; p++)
+        for (uint32_t i = 0; i < tensor_numel(p1[p]); i++)
+            diff = fmaxf(diff, fabsf(p1[p]->values[i] - p2[p]->values[i]));
+    return diff;
+}
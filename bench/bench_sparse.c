@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "sparse.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+
+/* Times the first layer GEMMs (x @ W1 and x^T @ dz1) with the dense and the
+ * CSR kernels, on a real MNIST batch and on random inputs of growing density,
+ * to place SPARSE_MAX_DENSITY.
+ *
+ * Usage: bench_sparse [--batch N] [--reps N]
+ */
+
+static const float DENSITIES[] = {0.05, 0.1, 0.2, 0.4, 0.6, 0.8, 1.0};
+
+static void bench_input(const char* name, tensor_t* x, const tensor_t* w, const tensor_t* dz, int reps);
+static tensor_t* random_input(int batch_size, float density);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int batch_size = 256, reps = 10;
+    unsigned int seed = 42;
+    uint32_t w_shape[] = {28 * 28, 128}, dz_shape[2];
+    mnist_example_t* batch;
+    tensor_t* w, *dz, *x;
+    mnist_t* ds;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (ds == NULL)
+        return 1;
+
+    srand(seed);
+    dz_shape[0] = batch_size;
+    dz_shape[1] = 128;
+    w = tensor_uniform(-0.05, 0.05, w_shape, 2);
+    dz = tensor_uniform(-0.01, 0.01, dz_shape, 2);
+
+    printf("%-8s %8s %12s %12s %12s %12s %8s\n", "input", "density",
+            "mm dense", "mm sparse", "mm_T dense", "mm_T sparse", "picks");
+
+    batch = mnist_batch_r(ds, batch_size, 1, &seed);
+    bench_input("mnist", batch->image, w, dz, reps);
+    mnist_example_clean(batch);
+
+    for (int d = 0; d < sizeof(DENSITIES) / sizeof(DENSITIES[0]); d++)
+    {
+        x = random_input(batch_size, DENSITIES[d]);
+        bench_input("random", x, w, dz, reps);
+        tensor_clean(x);
+    }
+
+    tensor_clean(w);
+    tensor_clean(dz);
+    mnist_clean(ds);
+    return 0;
+}
+
+void bench_input(const char* name, tensor_t* x, const tensor_t* w, const tensor_t* dz, int reps)
+{
+    tensor_t* dense = tensor_copy(x), *out;
+    uint32_t mm_shape[] = {x->shape[0], w->shape[1]}, mm_T_shape[] = {x->shape[1], dz->shape[1]};
+    double start, mm_dense, mm_sparse, mm_T_dense, mm_T_sparse;
+
+    /* The copy has no CSR, so tensor_mm / tensor_mm_T stay dense on it */
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        tensor_clean(tensor_mm(dense, w));
+    mm_dense = (now_seconds() - start) * 1000 / reps;
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        tensor_clean(tensor_mm_T(dense, dz));
+    mm_T_dense = (now_seconds() - start) * 1000 / reps;
+
+    out = tensor_zeros(mm_shape, 2);
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+    {
+        memset(out->values, 0, sizeof(float) * tensor_numel(out));
+        sparse_mm(x, w, out->values);
+    }
+    mm_sparse = (now_seconds() - start) * 1000 / reps;
+    tensor_clean(out);
+
+    out = tensor_zeros(mm_T_shape, 2);
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+    {
+        memset(out->values, 0, sizeof(float) * tensor_numel(out));
+        sparse_mm_T(x, dz, out->values);
+    }
+    mm_T_sparse = (now_seconds() - start) * 1000 / reps;
+    tensor_clean(out);
+
+    printf("%-8s %8.3f %12.3f %12.3f %12.3f %12.3f %8s\n", name, sparse_density(x),
+            mm_dense, mm_sparse, mm_T_dense, mm_T_sparse,
+            sparse_density(x) < SPARSE_MAX_DENSITY ? "sparse" : "dense");
+    tensor_clean(dense);
+}
+
+tensor_t* random_input(int batch_size, float density)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+    tensor_t* x;
+
+    shape[0] = batch_size;
+    shape[1] = 28 * 28;
+    x = tensor_zeros(shape, 2);
+    for (int i = 0; i < tensor_numel(x); i++)
+        if ((float)rand() / RAND_MAX < density)
+            x->values[i] = 1 + rand() % 255;
+
+    x->csr = sparse_from_tensor(x);
+    return x;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
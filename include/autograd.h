@@ -0,0 +1,108 @@
+#ifndef _AUTOGRAD_H_
+#define _AUTOGRAD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tensor.h"
+
+/* Tape based reverse mode autograd.
+ *
+ * The graph is recorded once: every ag_* op appends a node to the tape and
+ * allocates its output, gradient and scratch buffers right away. A training
+ * step then only feeds new inputs and replays the tape with ag_forward and
+ * ag_backward, which write into those same buffers, so steps after the
+ * first one allocate nothing and rebuild nothing.
+ *
+ *     ag_tape_t* tape = ag_tape_new();
+ *     ag_var_t* x = ag_input(tape, x_shape, 2);
+ *     ag_var_t* y = ag_input(tape, y_shape, 1);
+ *     ag_var_t* h = ag_relu(tape, ag_add(tape, ag_mm(tape, x, ag_param(tape, W1)), ag_param(tape, b1)));
+ *     ag_var_t* loss = ag_softmax_ce(tape, ag_add(tape, ag_mm(tape, h, ag_param(tape, W2)), ag_param(tape, b2)), y);
+ *
+ *     ag_feed(x, batch->image);
+ *     ag_feed(y, batch->label);
+ *     ag_forward(tape);
+ *     ag_backward(tape, loss);
+ *     ag_sgd(tape, lr);
+ */
+
+typedef enum {
+    AG_INPUT = 0,
+    AG_PARAM,
+    AG_MM,
+    AG_ADD,
+    AG_RELU,
+    AG_SOFTMAX_CE
+} ag_op_t;
+
+typedef struct ag_var
+{
+    ag_op_t op;
+    struct ag_var* a;
+    struct ag_var* b;
+
+    /* Borrowed for inputs and parameters, owned by the tape otherwise */
+    tensor_t* value;
+
+    /* Only allocated when a parameter depends on this node */
+    tensor_t* grad;
+    uint8_t requires_grad;
+    uint8_t grad_written;
+    uint32_t n_uses;
+
+    /* Buffer for a second gradient contribution before it is added, the
+     * softmax probabilities for AG_SOFTMAX_CE or the shape of an input */
+    tensor_t* scratch;
+} ag_var_t;
+
+typedef struct
+{
+    ag_var_t** vars;
+    uint32_t len;
+    uint32_t capacity;
+
+    /* Set by ag_plan, every buffer owned by the tape then lives in it */
+    float* slab;
+} ag_tape_t;
+
+typedef struct
+{
+    uint32_t n_buffers;
+    size_t naive_bytes;     /* Every buffer allocated on its own */
+    size_t slab_bytes;      /* Peak workspace after planning */
+} ag_plan_stats_t;
+
+ag_tape_t* ag_tape_new();
+void ag_tape_clean(ag_tape_t* tape);
+
+/* Leaves. Inputs get their value with ag_feed before every ag_forward, the
+ * fed tensor must keep the shape given here. Parameters are updated in
+ * place by ag_sgd. */
+ag_var_t* ag_input(ag_tape_t* tape, const uint32_t* shape, uint32_t n_dims);
+ag_var_t* ag_param(ag_tape_t* tape, tensor_t* t);
+void ag_feed(ag_var_t* input, tensor_t* t);
+
+/* a [M, K] @ b [K, N] */
+ag_var_t* ag_mm(ag_tape_t* tape, ag_var_t* a, ag_var_t* b);
+/* a + b, b is either the shape of a or a row broadcast over a [M, N] */
+ag_var_t* ag_add(ag_tape_t* tape, ag_var_t* a, ag_var_t* b);
+ag_var_t* ag_relu(ag_tape_t* tape, ag_var_t* a);
+/* Mean cross entropy of softmax(logits [M, C]) against the class ids in
+ * labels [M], as a single value */
+ag_var_t* ag_softmax_ce(ag_tape_t* tape, ag_var_t* logits, ag_var_t* labels);
+
+void ag_forward(ag_tape_t* tape);
+/* Gradients of `loss` w.r.t. every node that requires them */
+void ag_backward(ag_tape_t* tape, ag_var_t* loss);
+/* param -= lr * grad for every parameter of the tape */
+void ag_sgd(ag_tape_t* tape, float lr);
+
+/* Static memory planning of a recorded tape, whose step is always
+ * ag_forward, ag_backward(loss) and reads of the parameter gradients.
+ * Liveness of every value, gradient and scratch buffer is taken from the
+ * op sequence and buffers whose lifetimes do not overlap share memory in a
+ * single slab. Afterwards only the loss value and the parameter gradients
+ * are valid once a step is done. */
+ag_plan_stats_t ag_plan(ag_tape_t* tape, ag_var_t* loss);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _BMM_H_
+#define _BMM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Columns of a packed panel of the right operand */
+#define BMM_NR 16
+
+/* Rows of the result per work item */
+#define BMM_ROWS 32
+
+/* Threads tensor_bmm may use, 1 by default. A job only gets as many as it
+ * has work for. */
+void bmm_set_threads(uint32_t n_threads);
+
+/* c[i] = a[i] [M, K] @ b[i] [K, N] for i < batch, c being contiguous.
+ * a[i] starts at a + i * stride_a and b[i] at b + i * stride_b, a stride of
+ * 0 shares one matrix between every product. A shared b is packed once
+ * into BMM_NR wide panels read by every product. */
+void bmm(const float* a, size_t stride_a, const float* b, size_t stride_b, float* c,
+        uint32_t batch, uint32_t M, uint32_t K, uint32_t N);
+
+#endif
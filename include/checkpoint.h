@@ -0,0 +1,73 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "tensor.h"
+#include "model.h"
+
+/* Periodic training checkpoints written without stalling the training loop.
+ *
+ * checkpoint_snapshot copies the parameters and the loop state into one of
+ * two staging buffers and returns, a background thread then writes that
+ * buffer with ckpt_save (fsync and atomic rename, see ckpt.h). The loop
+ * fills the buffer the writer is not reading, so it never waits for the
+ * disk: when it snapshots faster than the writer keeps up, the snapshot
+ * still queued is replaced by the newer one.
+ *
+ * Checkpoints are regular model checkpoints (model_load reads them) with
+ * one more tensor, train.state, holding the raw bytes of train_state_t.
+ * Plain SGD has no optimizer state, so weights, step, sampler seed and the
+ * running metrics are all a run needs to resume exactly.
+ */
+
+typedef struct
+{
+    uint64_t step;          /* steps done */
+    unsigned int seed;      /* rand_r state of the batch sampler (mnist_batch_r) */
+    float loss_sum;         /* running sums of the loss and accuracy */
+    float acc_sum;
+} train_state_t;
+
+typedef struct
+{
+    char* path;
+    char* config;
+    uint32_t n_tensors;
+    char (*names)[MODEL_PARAM_NAME_LEN];
+
+    /* Two staging copies of the parameters then the state */
+    tensor_t** slots[2];
+
+    /* Slot being written and slot waiting for the writer, -1 for none */
+    int writing;
+    int pending;
+    uint32_t n_written;
+    uint32_t n_replaced;
+    uint32_t n_failed;      /* Not written, training went on */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t running;
+} checkpoint_t;
+
+/* Checkpointer writing the parameters of model to path */
+checkpoint_t* checkpoint_init(const char* path, const model_t* model);
+
+/* Waits for the last snapshot to be on disk, then stops the writer. Warns
+ * when some checkpoints could not be written. */
+void checkpoint_clean(checkpoint_t* ckpt);
+
+/* Stages the parameters of model and the state, the write happens in the
+ * background */
+void checkpoint_snapshot(checkpoint_t* ckpt, const model_t* model, const train_state_t* state);
+
+/* Blocks until every staged snapshot is written */
+void checkpoint_wait(checkpoint_t* ckpt);
+
+/* Trainable model (parameters copied out of the file) and loop state of a
+ * checkpoint */
+model_t* checkpoint_resume(const char* path, uint32_t max_batch, train_state_t* state);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _CKPT_H_
+#define _CKPT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tensor.h"
+
+/* Binary checkpoint of named tensors, laid out to be mapped and used in
+ * place:
+ *
+ *     header      64 bytes: magic, version, counts, offsets, checksum
+ *     entries     n_tensors x ckpt_entry_t (name, dtype, shape, offset)
+ *     meta        free form string (the model config for model_save)
+ *     padding     up to the next CKPT_ALIGN bytes
+ *     data        raw F32 / half values of every tensor, each one starting
+ *                 on CKPT_ALIGN bytes, in the byte order of the host
+ *
+ * Opening only reads the header and the entries, so a truncated file or
+ * one with invalid entries is refused without touching the data. The
+ * checksum (64-bit FNV-1a over 8 byte words) covers everything after the
+ * header and is checked by ckpt_verify, which reads every page.
+ */
+
+#define CKPT_VERSION 1
+#define CKPT_ALIGN 64
+#define CKPT_NAME_LEN 32
+#define CKPT_MAX_DIMS 4
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_tensors;
+    uint64_t meta_len;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t checksum;
+    uint8_t reserved[16];
+} ckpt_header_t;
+
+typedef struct
+{
+    char name[CKPT_NAME_LEN];
+    uint32_t dtype;
+    uint32_t n_dims;
+    uint32_t shape[CKPT_MAX_DIMS];
+    uint64_t offset;    /* from the start of the file */
+    uint64_t nbytes;
+} ckpt_entry_t;
+
+/* Read-only mapping of a checkpoint file */
+typedef struct
+{
+    uint8_t* base;
+    size_t size;
+    const ckpt_header_t* header;
+    const ckpt_entry_t* entries;
+    const char* meta;
+    uint32_t refs;      /* Holders of the mapping, see ckpt_retain */
+} ckpt_t;
+
+/* Writes n tensors under the given names, plus meta (may be NULL). The file
+ * is replaced atomically: written to <path>.tmp, fsynced, then renamed.
+ * Returns -1 when the file could not be written, the previous one is then
+ * left as it was and the tmp file removed. */
+int ckpt_save(const char* path, const char* meta, const char** names,
+        const tensor_t** tensors, uint32_t n);
+
+/* Maps the file and checks its header, sizes and entries. ckpt_try_open
+ * returns NULL on an invalid file instead of exiting, for processes that
+ * must keep running. */
+ckpt_t* ckpt_open(const char* path);
+ckpt_t* ckpt_try_open(const char* path);
+void ckpt_close(ckpt_t* ckpt);
+
+/* 1 when the data matches the checksum of the header, 0 when the file is
+ * corrupted. Faults in every page of the mapping. */
+int ckpt_verify(const ckpt_t* ckpt);
+
+/* Another holder of the same mapping, ckpt_close unmaps it once every
+ * holder has closed it */
+ckpt_t* ckpt_retain(ckpt_t* ckpt);
+
+/* Tensor whose values (or halfs) point into the mapping, NULL when there is
+ * no such name. Writing to it faults: the pages are mapped read-only and
+ * shared with every process that maps the same file. Free it with
+ * ckpt_view_clean, never tensor_clean, and before ckpt_close. */
+tensor_t* ckpt_tensor(const ckpt_t* ckpt, const char* name);
+void ckpt_view_clean(tensor_t* t);
+
+#endif
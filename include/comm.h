@@ -0,0 +1,68 @@
+#ifndef _COMM_H_
+#define _COMM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define COMM_MAX_BUCKETS 16
+
+/* Shared memory communicator for processes on the same host.
+ *
+ * The segment holds one contiguous buffer per (bucket, rank). A bucket is
+ * all-reduced with a ring: every rank reads the chunks of its left neighbour
+ * straight from shared memory, so there are no copies besides the reduction
+ * itself. Ranks synchronize through a futex word per buffer that counts the
+ * ring steps the rank has completed.
+ */
+typedef struct
+{
+    char name[64];
+    int rank;
+    int world;
+    int n_buckets;
+    uint32_t sizes[COMM_MAX_BUCKETS];
+
+    uint8_t* base;
+    size_t size;
+    uint32_t rounds[COMM_MAX_BUCKETS];
+    uint32_t barriers;
+
+    /* Progress thread that runs the queued all-reduces in order */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int queue[COMM_MAX_BUCKETS];
+    int q_len;
+    uint32_t started[COMM_MAX_BUCKETS];
+    uint32_t done[COMM_MAX_BUCKETS];
+    uint8_t running;
+} comm_t;
+
+/* Creates and initializes the segment. Every rank must open it afterwards.
+ * Both print the error and return -1 / NULL when the segment cannot be
+ * created or mapped, or does not hold the rank. */
+int comm_create(const char* name, int world, const uint32_t* bucket_sizes, int n_buckets);
+comm_t* comm_open(const char* name, int rank);
+void comm_close(comm_t* comm);
+void comm_unlink(const char* name);
+
+/* Returns the buffer of this rank for the given bucket, for reading */
+float* comm_bucket(comm_t* comm, int bucket);
+
+/* Returns the buffer of this rank for the given bucket, once the neighbours
+ * are done reading the previous round out of it */
+float* comm_bucket_acquire(comm_t* comm, int bucket);
+
+/* Sums the bucket over every rank, the result ends up in every buffer */
+void comm_allreduce(comm_t* comm, int bucket);
+
+/* Same as comm_allreduce but queued on the progress thread, so it overlaps
+ * with the computation of the caller. Buckets are reduced in the same order
+ * they are started, which must match on every rank. */
+void comm_allreduce_start(comm_t* comm, int bucket);
+void comm_allreduce_wait(comm_t* comm, int bucket);
+
+void comm_barrier(comm_t* comm);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _CONV_H_
+#define _CONV_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 2D convolution and max pooling over batches of images.
+ *
+ * Activations use a blocked NCHWc layout: each image is [C / CONV_CB, H, W,
+ * CONV_CB] floats, so the CONV_CB channels of a pixel are contiguous and the
+ * inner loops run over them as one vector. Channels past C in the last block
+ * are padding and stay zero. A layer reading the raw input may take it in
+ * plain NCHW instead (`plain`, only the im2col path reads it).
+ *
+ * Weights are [C * R * R, CONV_CB * blocks of K], row (c * R + r) * R + s,
+ * padding columns zero, the right operand of the im2col GEMM as is. Both
+ * paths share them.
+ */
+
+/* Channels per block, one AVX2 vector */
+#define CONV_CB 8
+
+typedef enum {
+    CONV_AUTO = 0,
+    CONV_IM2COL,    /* patch matrix then one GEMM (bmm.h) per chunk of images */
+    CONV_DIRECT     /* loops over the blocked layout, no copy */
+} conv_algo_t;
+
+typedef struct
+{
+    uint32_t C;         /* input channels, height and width */
+    uint32_t H;
+    uint32_t W;
+    uint32_t K;         /* output channels and square kernel size */
+    uint32_t R;
+    uint32_t stride;
+    uint32_t pad;
+    uint32_t P;         /* output height and width */
+    uint32_t Q;
+    int plain;
+} conv_shape_t;
+
+/* Checks the sizes and computes P and Q */
+conv_shape_t conv_make_shape(uint32_t C, uint32_t H, uint32_t W, uint32_t K, uint32_t R,
+        uint32_t stride, uint32_t pad, int plain);
+
+/* CONV_CB blocks needed for n channels */
+uint32_t conv_blocks(uint32_t n);
+
+/* Floats of one input / output image */
+uint32_t conv_in_size(const conv_shape_t* s);
+uint32_t conv_out_size(const conv_shape_t* s);
+
+/* Scratch floats conv2d_forward and conv2d_backward need, whatever the
+ * batch size */
+size_t conv_work_size(const conv_shape_t* s);
+
+/* Path for a shape: im2col for plain inputs and outputs narrower than the
+ * pixel blocks of the direct path, direct otherwise */
+conv_algo_t conv_select(const conv_shape_t* s);
+
+/* y [N, out size] = conv(x [N, in size], W) + b */
+void conv2d_forward(const conv_shape_t* s, conv_algo_t algo, const float* x, const float* W,
+        const float* b, float* y, uint32_t N, float* work);
+
+/* Gradients of W and b (overwritten) and of x when dx is not NULL */
+void conv2d_backward(const conv_shape_t* s, conv_algo_t algo, const float* x, const float* W,
+        const float* dy, float* dx, float* dW, float* db, uint32_t N, float* work);
+
+/* size x size max pooling with stride size over blocked [C, H, W] images.
+ * argmax keeps, for every output, the offset of its input in the image. */
+void maxpool_forward(uint32_t C, uint32_t H, uint32_t W, uint32_t size, const float* x,
+        float* y, uint32_t* argmax, uint32_t N);
+void maxpool_backward(uint32_t C, uint32_t H, uint32_t W, uint32_t size, const float* dy,
+        const uint32_t* argmax, float* dx, uint32_t N);
+
+#endif
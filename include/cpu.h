@@ -0,0 +1,15 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+/* Instruction sets of the host, detected once and cached. The kernels
+ * compiled for them are picked at run time, so the binaries still run on
+ * CPUs without them. */
+
+/* AVX2 alone, for integer kernels */
+int cpu_has_avx2();
+
+/* AVX2 and FMA, for float kernels (FMA came with AVX2 on every x86 CPU but
+ * the kernels rely on both) */
+int cpu_has_avx2_fma();
+
+#endif
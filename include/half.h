@@ -0,0 +1,22 @@
+#ifndef _HALF_H_
+#define _HALF_H_
+
+#include <stdint.h>
+#include "tensor.h"
+
+/* Conversion kernels between float and the 16 bit storage formats. They use
+ * F16C / AVX-512 BF16 when the CPU has them and scalar emulation otherwise.
+ * Conversions to 16 bits round to nearest even. */
+void half_from_f32(uint16_t* dst, const float* src, uint32_t n, tensor_dtype_t dtype);
+void half_to_f32(float* dst, const uint16_t* src, uint32_t n, tensor_dtype_t dtype);
+
+uint16_t half_bf16_from_f32(float v);
+float half_bf16_to_f32(uint16_t v);
+uint16_t half_f16_from_f32(float v);
+float half_f16_to_f32(uint16_t v);
+
+/* result[M, N] = t1[M, K] @ t2[K, N] for any mix of dtypes, accumulating in
+ * fp32. `result` must hold M * N floats. */
+void half_mm(const tensor_t* t1, const tensor_t* t2, float* result);
+
+#endif
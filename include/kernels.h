@@ -0,0 +1,40 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include <stdint.h>
+#include "tensor.h"
+
+/* Dense layer kernels specialized for the layer shapes of the model config
+ * the tree is built for (KERNEL_MODEL in the Makefile). gen_kernels writes
+ * them with constant loop bounds into out/kernels_gen.c, and kernels_dense
+ * picks one when the shapes match, falling back to tensor_mm otherwise. */
+
+/* out[M, N] = x[M, K] @ W[K, N] + b, then relu when `relu` is set */
+typedef void (*kernel_dense_fn_t)(const float* x, const float* W, const float* b,
+        float* out, uint32_t M, int relu);
+
+typedef struct
+{
+    uint32_t K;
+    uint32_t N;
+    kernel_dense_fn_t fn;
+    kernel_dense_fn_t fn_avx2;
+} kernel_entry_t;
+
+/* Defined by the generated file */
+extern const kernel_entry_t KERNELS_GEN[];
+extern const uint32_t KERNELS_GEN_LEN;
+
+/* Specialized kernel for [K, N] weights (its AVX2 build when the CPU has
+ * it), or NULL */
+kernel_dense_fn_t kernels_find(uint32_t K, uint32_t N);
+
+/* out = x @ W + b (relu'd when asked) for F32 tensors, b is [N] and out an
+ * existing [M, N] tensor */
+void kernels_dense(const tensor_t* x, const tensor_t* W, const tensor_t* b, int relu, tensor_t* out);
+
+/* Same always going through tensor_mm_into */
+void kernels_dense_generic(const tensor_t* x, const tensor_t* W, const tensor_t* b, int relu,
+        tensor_t* out);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef _LAZY_H_
+#define _LAZY_H_
+
+#include <stdint.h>
+#include "tensor.h"
+
+/* Lazy version of the elementwise part of tensor.h.
+ *
+ * lazy_* calls only record nodes of a small expression DAG. lazy_eval then
+ * runs every chain of elementwise and broadcast ops as one loop over tiles
+ * of LAZY_TILE elements: intermediates only live in tile sized buffers, so
+ * memory is touched once per input and once for the output whatever the
+ * number of ops. A reduction is computed in the same loop as the expression
+ * it reduces, and its (small) result is then read like any other input.
+ *
+ *     lazy_graph_t* g = lazy_graph_new();
+ *     lazy_t* e = lazy_exp(g, lazy_leaf(g, logits));
+ *     lazy_t* d = lazy_unsqueeze(g, lazy_reduce_sum(g, e, 1), 1);
+ *     tensor_t* softmax = lazy_eval(g, lazy_div(g, e, d));
+ *     lazy_graph_clean(g);
+ *
+ * Binary ops broadcast like tensor_broadcast: shapes are aligned on their
+ * last dim and dims of size 1 are repeated.
+ */
+
+#define LAZY_TILE 256
+#define LAZY_MAX_DIMS 8
+
+typedef enum {
+    LAZY_LEAF = 0,
+    LAZY_VIEW,
+    LAZY_REDUCE_SUM,
+
+    /* Elementwise */
+    LAZY_ADD,
+    LAZY_SUB,
+    LAZY_MUL,
+    LAZY_DIV,
+    LAZY_GTE,
+    LAZY_EQ,
+    LAZY_ADD_SCALAR,
+    LAZY_SUB_SCALAR,
+    LAZY_MUL_SCALAR,
+    LAZY_DIV_SCALAR,
+    LAZY_NEG,
+    LAZY_EXP,
+    LAZY_RELU
+} lazy_op_t;
+
+typedef struct lazy
+{
+    lazy_op_t op;
+    struct lazy* a;
+    struct lazy* b;
+    float scalar;
+    uint32_t axis;
+
+    uint32_t n_dims;
+    uint32_t shape[LAZY_MAX_DIMS];
+
+    /* Input tensor of a leaf, or the materialized result of a reduction or
+     * view during lazy_eval */
+    const tensor_t* value;
+    tensor_t* owned;
+
+    /* Tile buffer of elementwise nodes, and start of the tile it holds */
+    float* tile;
+    uint32_t tile_start;
+
+    /* Tile of a materialized node read with broadcasting */
+    float* bcast;
+} lazy_t;
+
+typedef struct
+{
+    lazy_t** nodes;
+    uint32_t len;
+    uint32_t capacity;
+} lazy_graph_t;
+
+lazy_graph_t* lazy_graph_new();
+void lazy_graph_clean(lazy_graph_t* g);
+
+/* `t` must stay alive and unchanged until the graph is evaluated */
+lazy_t* lazy_leaf(lazy_graph_t* g, const tensor_t* t);
+
+lazy_t* lazy_unsqueeze(lazy_graph_t* g, lazy_t* a, uint32_t axis);
+lazy_t* lazy_reduce_sum(lazy_graph_t* g, lazy_t* a, uint32_t axis);
+
+lazy_t* lazy_add(lazy_graph_t* g, lazy_t* a, lazy_t* b);
+lazy_t* lazy_sub(lazy_graph_t* g, lazy_t* a, lazy_t* b);
+lazy_t* lazy_mul(lazy_graph_t* g, lazy_t* a, lazy_t* b);
+lazy_t* lazy_div(lazy_graph_t* g, lazy_t* a, lazy_t* b);
+lazy_t* lazy_gte(lazy_graph_t* g, lazy_t* a, lazy_t* b);
+lazy_t* lazy_eq(lazy_graph_t* g, lazy_t* a, lazy_t* b);
+
+lazy_t* lazy_add_scalar(lazy_graph_t* g, lazy_t* a, float scalar);
+lazy_t* lazy_sub_scalar(lazy_graph_t* g, lazy_t* a, float scalar);
+lazy_t* lazy_mul_scalar(lazy_graph_t* g, lazy_t* a, float scalar);
+lazy_t* lazy_div_scalar(lazy_graph_t* g, lazy_t* a, float scalar);
+
+lazy_t* lazy_neg(lazy_graph_t* g, lazy_t* a);
+lazy_t* lazy_exp(lazy_graph_t* g, lazy_t* a);
+lazy_t* lazy_relu(lazy_graph_t* g, lazy_t* a);
+
+/* Returns a new F32 tensor with the value of `node` */
+tensor_t* lazy_eval(lazy_graph_t* g, lazy_t* node);
+
+/* Same writing into `out`, which must have the shape of `node`. `out` may
+ * be one of the leaves, e.g. for param = param - lr * grad. */
+void lazy_eval_into(lazy_graph_t* g, lazy_t* node, tensor_t* out);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef _MEMTRACK_H_
+#define _MEMTRACK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tensor.h"
+
+/* Accounting of the memory owned by tensors: live and peak bytes, per call
+ * site of tensor_new, per training step and held by tensor pools.
+ *
+ * A tensor owns its struct, values, halfs and csr, measured when it is
+ * created and again by memtrack_resize when one of them is attached or
+ * replaced afterwards. Tensors made while accounting is off, or built on
+ * the stack or over a checkpoint mapping, are left out. Shape arrays are
+ * not owned (tensor_clean leaves them to the caller, they are often shared
+ * or on the stack), the ones allocated by the tensor.h ops are only
+ * counted, as they are never freed.
+ *
+ * When accounting is off tensor_new and tensor_clean pay one branch.
+ */
+
+#define MEMTRACK_MAX_SITES 1024
+
+typedef struct
+{
+    const char* file;
+    int line;
+    const char* func;
+    uint64_t allocs;
+    uint64_t frees;
+    int64_t live_bytes;
+    uint64_t total_bytes;
+} memtrack_site_t;
+
+typedef struct
+{
+    int64_t live_bytes;
+    int64_t peak_bytes;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t total_bytes;
+    int64_t pooled_tensors;     /* Added to a tensor_pool and not emptied yet */
+    int64_t pooled_bytes;
+    int64_t peak_pooled_bytes;
+    uint64_t shape_allocs;
+    uint64_t shape_bytes;
+} memtrack_stats_t;
+
+typedef struct
+{
+    uint64_t allocs;
+    uint64_t bytes;             /* Allocated during the step */
+    int64_t peak_bytes;         /* Live at the peak of the step */
+    int64_t live_delta;         /* Left live by the step */
+} memtrack_step_t;
+
+extern uint8_t memtrack_enabled;
+
+/* Accounts every tensor made from now on, the summary and the tensors
+ * still live are printed at exit */
+void memtrack_enable();
+
+void memtrack_stats(memtrack_stats_t* stats);
+
+/* The first max_sites call sites by live bytes (live_only) or by bytes
+ * allocated */
+void memtrack_print_sites(FILE* f, int max_sites, int live_only);
+
+/* Summary and leaks, what is printed at exit */
+void memtrack_report(FILE* f);
+
+/* Steps of a training loop on one thread, allocations of other threads in
+ * between count too. Past a budget (0 for none) memtrack_step_end prints
+ * the step and the sites and exits. */
+void memtrack_budget(uint64_t max_allocs, uint64_t max_bytes);
+void memtrack_step_begin();
+memtrack_step_t memtrack_step_end();
+
+/* Hooks of tensor.c and tensor_pool.c */
+void memtrack_alloc(tensor_t* t, const char* file, int line, const char* func);
+void memtrack_resize(tensor_t* t);
+void memtrack_free(tensor_t* t);
+void memtrack_pool(int64_t tensors, int64_t bytes);
+void memtrack_shape(uint32_t n_dims);
+
+#endif
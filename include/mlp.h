@@ -0,0 +1,64 @@
+#ifndef _MLP_H_
+#define _MLP_H_
+
+#include <stdint.h>
+#include "tensor.h"
+
+/* Two layer perceptron: softmax(relu(x @ W1 + b1) @ W2 + b2) */
+typedef struct
+{
+    tensor_t* W1;
+    tensor_t* b1;
+
+    tensor_t* W2;
+    tensor_t* b2;
+
+    /* Storage of the GEMM inputs (weights and activations). The parameters
+     * above are always the F32 master copy the updates are applied to. */
+    tensor_dtype_t dtype;
+
+    /* W1 / W2 in dtype, read by the GEMMs and refreshed by mlp_update, NULL
+     * in fp32 */
+    tensor_t* W1h;
+    tensor_t* W2h;
+} mlp_t;
+
+typedef struct
+{
+    tensor_t* dW1;
+    tensor_t* db1;
+
+    tensor_t* dW2;
+    tensor_t* db2;
+
+    float loss;
+    tensor_t* predictions;
+} train_res_t;
+
+/* Called as soon as the gradients of a layer are ready, from the last layer
+ * (1) down to the first one (0), so they can be consumed while backward
+ * keeps running */
+typedef void (*mlp_grad_hook_t)(int layer, const train_res_t* res, void* ctx);
+
+mlp_t* mlp_init(uint32_t n_inputs, uint32_t n_hidden, uint32_t n_outputs);
+void mlp_clean(mlp_t* mlp);
+
+/* Switches the GEMMs to dtype and converts the weights for them. Code that
+ * writes W1 / W2 other than through mlp_update calls it again. */
+void mlp_set_dtype(mlp_t* mlp, tensor_dtype_t dtype);
+
+tensor_t* mlp_forward(const mlp_t* mlp, const tensor_t* x);
+train_res_t mlp_forward_backward(const mlp_t* mlp, const tensor_t* x, const tensor_t* y);
+train_res_t mlp_forward_backward_hook(const mlp_t* mlp, const tensor_t* x, const tensor_t* y,
+        mlp_grad_hook_t hook, void* ctx);
+
+/* Applies `param -= lr * grad` in place for every parameter, then refreshes
+ * the half weights. The update is done with plain (racy) writes, so several
+ * threads may call it over the same model at once (Hogwild). */
+void mlp_update(mlp_t* mlp, const train_res_t* res, float lr);
+
+float mlp_accuracy(const mlp_t* mlp, const tensor_t* x, const tensor_t* y);
+
+void train_res_clean(train_res_t* res);
+
+#endif
@@ -33,9 +33,17 @@ typedef struct
 } mnist_example_t;
 
 mnist_t* mnist_read(const char* images_fname, const char* labels_fname);
+
+/* Images of an IDX file alone, for inputs without labels */
+mnist_images_t* mnist_read_images(const char* fname);
+void mnist_images_clean(mnist_images_t* images);
+
+mnist_t* mnist_copy(const mnist_t* ds);
 mnist_example_t* mnist_sample(mnist_t* ds, uint8_t flat);
 mnist_example_t* mnist_batch(mnist_t* ds, int n_samples, uint8_t flat);
+mnist_example_t* mnist_batch_r(mnist_t* ds, int n_samples, uint8_t flat, unsigned int* seed);
 mnist_example_t* mnist_as_tensor(mnist_t* ds, uint8_t flat);
+void mnist_example_clean(mnist_example_t* ex);
 void mnist_clean(mnist_t* ds);
 
 #endif
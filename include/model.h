@@ -0,0 +1,133 @@
+#ifndef _MODEL_H_
+#define _MODEL_H_
+
+#include <stdint.h>
+#include "tensor.h"
+#include "conv.h"
+#include "ckpt.h"
+
+#define MODEL_PARAM_NAME_LEN CKPT_NAME_LEN
+
+/* Feed forward model made of a stack of layers, described by a config such
+ * as
+ *
+ *     input:784 dense:128 relu dense:64 relu dense:10 softmax_ce
+ *
+ * Tokens are separated by spaces, commas or new lines, and config files may
+ * hold '#' comments. Small CNNs take their input as CxHxW and add
+ * convolutions (conv:KxR for K filters of RxR, conv:KxR/pad with zero
+ * padding) and max pooling over SxS windows (pool:S):
+ *
+ *     input:1x28x28 conv:6x5/2 relu pool:2 conv:16x5 relu pool:2 dense:120
+ *     relu dense:84 relu dense:10 softmax_ce
+ *
+ * Their activations use the blocked layout of conv.h, which a dense layer
+ * after them reads flattened. The model is built once for a maximum batch
+ * size: every activation and gradient buffer is allocated then, and forward,
+ * backward and update only write into them. Any batch up to max_batch rows goes
+ * through the same layers, training and inference alike.
+ */
+
+typedef enum {
+    LAYER_DENSE = 0,
+    LAYER_RELU,
+    LAYER_SOFTMAX_CE,
+    LAYER_CONV,
+    LAYER_MAXPOOL
+} layer_type_t;
+
+typedef struct
+{
+    layer_type_t type;
+    uint32_t n_in;
+    uint32_t n_out;
+
+    /* Dense and conv: x @ W + b (conv.h for the conv weights) and the
+     * gradients of W and b */
+    tensor_t* W;
+    tensor_t* b;
+    tensor_t* dW;
+    tensor_t* db;
+
+    /* Conv and pool: input and output sizes (R being the pooling size for
+     * pool) and, for pool, the input offset of every output */
+    conv_shape_t shape;
+    conv_algo_t algo;
+    uint32_t* argmax;
+
+    /* [max_batch, n_out] output, and gradient of the loss w.r.t. the input
+     * [max_batch, n_in] (not needed, so NULL, for the first layer). Their
+     * first dim is set to the rows of the current batch. */
+    tensor_t* out;
+    tensor_t* d_in;
+} layer_t;
+
+typedef struct
+{
+    layer_t* layers;
+    uint32_t n_layers;
+    uint32_t n_inputs;
+    uint32_t max_batch;
+
+    /* Scratch shared by the conv layers */
+    float* work;
+
+    /* Argmax of the last layer and mean loss of the last batch */
+    tensor_t* preds;
+    float loss;
+
+    /* Config the model was parsed from, and the checkpoint its parameters
+     * are mapped from for models from model_load (NULL otherwise) */
+    char* config;
+    ckpt_t* ckpt;
+} model_t;
+
+model_t* model_parse(const char* config, uint32_t max_batch);
+model_t* model_from_file(const char* path, uint32_t max_batch);
+void model_clean(model_t* model);
+
+/* Writes the config and the parameters of every layer to a checkpoint
+ * (ckpt.h), as layers.<i>.W and layers.<i>.b */
+void model_save(const model_t* model, const char* path);
+
+/* W and b of every dense and conv layer in checkpoint order, with their
+ * names. Returns how many, at most 2 * n_layers. */
+uint32_t model_params(const model_t* model, tensor_t** params, char (*names)[MODEL_PARAM_NAME_LEN]);
+
+/* Rebuilds a saved model for inference. The parameters are not copied: W
+ * and b of every layer point into the read-only mapping of the file, so
+ * loading costs a page fault per page touched and processes loading the
+ * same file share its pages. The checksum is not checked, see ckpt_verify.
+ * Such a model cannot be trained (no dW / db). */
+model_t* model_load(const char* path, uint32_t max_batch);
+
+/* Same over a checkpoint already open, which the model then owns.
+ * model_try_from_ckpt returns NULL instead of exiting when the checkpoint
+ * has no config, a bad one or parameters of other shapes, for processes
+ * that must keep running; the checkpoint is then still the caller's. */
+model_t* model_from_ckpt(ckpt_t* ckpt, uint32_t max_batch);
+model_t* model_try_from_ckpt(ckpt_t* ckpt, uint32_t max_batch);
+
+/* Prints the layers and their number of parameters */
+void model_summary(const model_t* model);
+
+/* Returns the predictions for x [rows, n_inputs], owned by the model. The
+ * softmax is skipped, predictions being the argmax of the logits. */
+const tensor_t* model_forward(model_t* model, const tensor_t* x);
+
+/* Forward and backward pass over a batch whose last layer is softmax_ce,
+ * leaves the gradients in the layers and returns the loss */
+float model_forward_backward(model_t* model, const tensor_t* x, const tensor_t* y);
+
+/* The two halves of it, for callers timing them apart: model_backward
+ * must follow model_forward_loss on the same batch */
+float model_forward_loss(model_t* model, const tensor_t* x, const tensor_t* y);
+void model_backward(model_t* model, const tensor_t* x, const tensor_t* y);
+
+/* param -= lr * grad for every dense and conv layer */
+void model_update(model_t* model, float lr);
+
+/* Accuracy over any number of rows, run max_batch rows at a time */
+float model_accuracy(model_t* model, const tensor_t* x, const tensor_t* y);
+
+#endif
@@ -5,6 +5,8 @@
 
 tensor_t* nn_relu(tensor_t* t);
 tensor_t* nn_softmax(tensor_t* t, uint32_t axis);
+/* nn_softmax fused through lazy.h, without storing exp(t) */
+tensor_t* nn_softmax_lazy(tensor_t* t, uint32_t axis);
 
 float nn_sparse_ce_loss(const tensor_t* y_true, const tensor_t* y_pred);
 
@@ -0,0 +1,46 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include "mlp.h"
+#include "mnist.h"
+#include "topology.h"
+
+typedef struct
+{
+    int n_threads;
+    int batch_size;         /* Examples per worker step */
+    float lr;
+    int max_steps;          /* Steps per worker */
+    float target_acc;       /* Accuracy used for time-to-target, 0 disables it */
+    uint8_t stop_at_target; /* Stop every worker once target_acc is reached */
+    int eval_interval_ms;
+    unsigned int seed;
+    uint8_t verbose;
+
+    uint8_t pin_threads;        /* Pin workers to CPUs following the NUMA layout */
+    uint8_t replicate_dataset;  /* Give every NUMA node its own dataset copy */
+    int numa_sample_every;      /* Sample page placement every N steps, 0 disables it */
+} parallel_config_t;
+
+typedef struct
+{
+    double seconds;
+    long examples;
+    double examples_per_sec;
+    double time_to_target;  /* Seconds, -1 if target_acc was never reached */
+    float final_acc;
+    topo_access_t access;   /* Remote / resident pages seen by the workers */
+} parallel_stats_t;
+
+/* Hogwild: every worker samples its own batches and applies its gradients
+ * straight to the shared model with racy writes. No barrier between steps,
+ * so results are not reproducible. */
+parallel_stats_t parallel_hogwild(mlp_t* mlp, mnist_t* ds,
+        const mnist_example_t* eval, const parallel_config_t* cfg);
+
+/* Synchronous data parallelism: every worker computes the gradients of its
+ * own batch, the gradients are averaged and applied once per step. */
+parallel_stats_t parallel_sync(mlp_t* mlp, mnist_t* ds,
+        const mnist_example_t* eval, const parallel_config_t* cfg);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _PERFCTR_H_
+#define _PERFCTR_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Hardware performance counters read with perf_event_open, counting the
+ * user space of the calling thread only.
+ *
+ * Once enabled, every op traced by trace.h (TRACE_BEGIN / TRACE_OP) reads
+ * the counters of its thread on entry and exit, and adds the difference to
+ * the totals of its name, with the elements of its result (or input, or
+ * bytes / 4). Calls made inside an op are counted in it as well, work handed
+ * to other threads is not. Phases, like those of train_bench.h, read them
+ * with perfctr_read.
+ *
+ * Each thread opens its counters on its first read, one fd per counter
+ * rather than one group, and closes them when it exits. With more counters
+ * than the PMU has, the kernel multiplexes each fd on its own and the reads
+ * are scaled by its share of the time, so counters of one op are estimates
+ * taken over different slices of it and ratios such as IPC are approximate.
+ * Counters the kernel or the container does not provide are left out and
+ * reported as n/a. When none can be opened perfctr_enable prints a warning
+ * and the ops are not instrumented.
+ */
+
+typedef enum {
+    PERFCTR_TASK_CLOCK = 0,     /* ns on the CPU, a software counter */
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_DTLB_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_COUNT
+} perfctr_kind_t;
+
+#define PERFCTR_MAX_OPS 256
+
+/* Bit i set when counter i could be opened */
+extern uint32_t perfctr_available;
+
+/* Returns perfctr_available, the report is printed at exit */
+uint32_t perfctr_enable();
+
+/* Counters of the calling thread since it opened them, scaled when the
+ * kernel had to multiplex them. Returns 0 when they are not available. */
+int perfctr_read(uint64_t counts[PERFCTR_COUNT]);
+
+/* Per op: calls, elements, IPC and counts per element */
+void perfctr_report(FILE* f);
+
+const char* perfctr_name(perfctr_kind_t kind);
+
+/* Hooks of trace.c, the counters on entry are kept on a per thread stack
+ * of start times */
+void perfctr_push(uint64_t start);
+void perfctr_pop(const char* name, uint64_t start, uint64_t elements);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _PRUNE_H_
+#define _PRUNE_H_
+
+#include <stdint.h>
+#include "tensor.h"
+#include "mlp.h"
+
+/* Weights are pruned and stored in blocks of 1 x PRUNE_BLOCK consecutive
+ * outputs, so every kept block is one 8-wide multiply-add */
+#define PRUNE_BLOCK 8
+
+/* Block sparse rows of a [n_rows, n_cols] weight matrix: the kept blocks of
+ * row k are block_cols / blocks[row_ptr[k] .. row_ptr[k + 1]) */
+typedef struct
+{
+    uint32_t n_rows;
+    uint32_t n_cols;
+    uint32_t n_blocks;
+    uint32_t* row_ptr;
+    uint32_t* block_cols;   /* First column of each block */
+    float* blocks;          /* [n_blocks][PRUNE_BLOCK] */
+} prune_bsr_t;
+
+/* Pruned mlp_t for inference, the first layer is block sparse */
+typedef struct
+{
+    prune_bsr_t* W1;
+    tensor_t* b1;
+    tensor_t* W2;
+    tensor_t* b2;
+} prune_mlp_t;
+
+/* Zeroes the blocks of W with the smallest L2 norm until `sparsity` of them
+ * are gone. Returns the 0 / 1 mask of the kept weights. */
+tensor_t* prune_magnitude(tensor_t* W, float sparsity);
+
+/* Zeroes again the pruned weights after an update, for fine-tuning */
+void prune_apply(tensor_t* W, const tensor_t* mask);
+
+prune_bsr_t* prune_bsr_from_tensor(const tensor_t* W);
+void prune_bsr_clean(prune_bsr_t* bsr);
+
+/* Copies the biases and W2, W1 is stored block sparse */
+prune_mlp_t* prune_mlp_new(const mlp_t* mlp);
+void prune_mlp_clean(prune_mlp_t* p);
+/* Bytes taken by the parameters */
+uint32_t prune_mlp_bytes(const prune_mlp_t* p);
+
+/* Same result as mlp_forward (argmax predictions). Reads x through its CSR
+ * when it has one. */
+tensor_t* prune_forward(const prune_mlp_t* p, const tensor_t* x);
+
+#endif
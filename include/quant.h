@@ -0,0 +1,44 @@
+#ifndef _QUANT_H_
+#define _QUANT_H_
+
+#include <stdint.h>
+#include "tensor.h"
+#include "mlp.h"
+
+/* INT8 version of a trained mlp_t for inference.
+ *
+ * Weights are int8 with one scale per output channel and are stored
+ * transposed ([out][in], rows padded to QUANT_ALIGN) so every dot product
+ * reads contiguous memory. Inputs are the raw uint8 pixels, which is exactly
+ * what the fp32 model was trained on, so they need no conversion. Hidden
+ * activations are requantized to uint8 in the same pass that adds the bias
+ * and applies the ReLU.
+ */
+#define QUANT_ALIGN 64
+
+typedef struct
+{
+    uint32_t n_inputs;
+    uint32_t n_hidden;
+    uint32_t n_outputs;
+    uint32_t k1;            /* n_inputs padded to QUANT_ALIGN */
+    uint32_t k2;            /* n_hidden padded to QUANT_ALIGN */
+
+    int8_t* w1;             /* [n_hidden][k1] */
+    int32_t* b1;            /* Bias in accumulator units */
+    float* requant;         /* Accumulator to uint8 activation, per channel */
+    float act_scale;        /* Real value of one hidden activation step */
+
+    int8_t* w2;             /* [n_outputs][k2] */
+    float* dequant;         /* Accumulator to logits, per channel */
+    float* b2;
+} qmlp_t;
+
+/* Calibrates the hidden activation range on `calib` (F32 rows of pixels) */
+qmlp_t* qmlp_quantize(const mlp_t* mlp, const tensor_t* calib);
+void qmlp_clean(qmlp_t* q);
+
+/* Writes the predicted class of each of the `n` images in `pixels` */
+void qmlp_predict(const qmlp_t* q, const uint8_t* pixels, uint32_t n, uint8_t* labels);
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "model.h"
+
+/* Inference server for processes on the same host, over a Unix domain
+ * socket.
+ *
+ * A client sends server_request_t records and gets one server_response_t
+ * back per request, carrying the same id. Requests may be pipelined on a
+ * connection; responses of a connection can come back out of order when
+ * several workers serve it.
+ *
+ * One I/O thread reads the requests of every connection into a shared
+ * queue. Workers take them in batches: a worker waits until max_batch
+ * requests are queued or the oldest one has waited max_wait_us, then runs
+ * whatever is queued (up to max_batch) as one batch through its own
+ * model_t. The workers' models are built over one mapping of the
+ * checkpoint, so they share the pages of the weights.
+ *
+ * With server_watch the server follows the checkpoint file: when it is
+ * replaced, a watcher thread maps the new weights, warms the new models up
+ * and swaps the pointer to the current version. Workers pick the version
+ * up at the start of a batch, so a batch runs on one version from start to
+ * end and requests are never dropped. The old version is freed once every
+ * worker has left it (epoch based reclamation: each worker publishes the
+ * epoch of the version it runs on, or 0 between batches).
+ */
+
+#define SERVER_IMAGE_BYTES (28 * 28)
+
+/* Requests queued before the I/O thread stops reading */
+#define SERVER_QUEUE_LEN 4096
+
+typedef struct
+{
+    uint32_t id;
+    uint8_t pixels[SERVER_IMAGE_BYTES];
+} server_request_t;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t digit;
+} server_response_t;
+
+typedef struct server_conn server_conn_t;
+
+typedef struct
+{
+    server_conn_t* conn;
+    uint32_t id;
+    double arrival;
+    uint8_t pixels[SERVER_IMAGE_BYTES];
+} server_item_t;
+
+typedef struct server server_t;
+
+/* Weights being served, one model per worker over the same file */
+typedef struct
+{
+    uint64_t epoch;
+    model_t** models;
+} server_version_t;
+
+typedef struct
+{
+    server_t* server;
+    pthread_t thread;
+    int index;
+    uint64_t epoch;     /* of the version the current batch runs on, 0 between batches */
+    tensor_t* x;
+    server_conn_t** conns;
+    uint32_t* ids;
+} server_worker_t;
+
+struct server
+{
+    char* socket_path;
+    char* model_path;
+    uint32_t max_batch;
+    uint32_t max_wait_us;
+    int n_workers;
+
+    int listen_fd;
+    int wake_fd[2];
+    pthread_t io_thread;
+    server_worker_t* workers;
+
+    /* Ring of queued requests */
+    server_item_t* queue;
+    uint32_t head;
+    uint32_t count;
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    pthread_cond_t space;
+    uint8_t running;
+
+    /* Served requests and batches they were run in */
+    uint64_t n_requests;
+    uint64_t n_batches;
+
+    /* Current version, swapped atomically, and the thread that watches
+     * model_path for new ones */
+    server_version_t* current;
+    pthread_t watcher;
+    uint32_t watch_ms;
+    uint8_t watching;
+    uint64_t n_reloads;
+};
+
+/* Listens on socket_path (replacing any stale socket) and starts serving
+ * the checkpoint at model_path */
+server_t* server_start(const char* socket_path, const char* model_path, uint32_t max_batch,
+        uint32_t max_wait_us, int n_workers);
+
+/* Stops reading, serves what is queued, then closes every connection */
+void server_stop(server_t* server);
+
+/* Checks every interval_ms whether the checkpoint file was replaced (as
+ * ckpt_save does, by rename) and switches to it between batches. Invalid
+ * files are reported and skipped, the server keeps its weights. */
+void server_watch(server_t* server, uint32_t interval_ms);
+
+#endif
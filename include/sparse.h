@@ -0,0 +1,32 @@
+#ifndef _SPARSE_H_
+#define _SPARSE_H_
+
+#include <stdint.h>
+#include "tensor.h"
+
+/* Share of nonzeros below which inputs go through the CSR kernels. The
+ * crossover measured with bench_sparse is near 0.9 for sparse_mm (sparse_mm_T
+ * stays ahead up to 1.0). The limit is kept below it, as bench_sparse does
+ * not time building the CSR of each batch and the crossover moves with the
+ * host. MNIST batches are around 0.2. */
+#define SPARSE_MAX_DENSITY 0.75f
+
+/* CSR of the `n_rows` uint8 rows of `n_cols` values pointed by `rows`,
+ * e.g. images picked from a dataset */
+tensor_csr_t* sparse_from_u8(const uint8_t* const* rows, uint32_t n_rows, uint32_t n_cols);
+
+/* CSR of a dense 2D F32 tensor */
+tensor_csr_t* sparse_from_tensor(const tensor_t* t);
+void sparse_csr_clean(tensor_csr_t* csr);
+
+/* Share of nonzeros of a tensor with a CSR */
+float sparse_density(const tensor_t* t);
+
+/* Both kernels read t1 through its CSR and only touch the rows of t2 /
+ * result matching its nonzero columns. `result` must be zeroed.
+ *   sparse_mm:   result[M, N] = t1[M, K] @ t2[K, N]
+ *   sparse_mm_T: result[K, N] = t1[M, K]^T @ t2[M, N] */
+void sparse_mm(const tensor_t* t1, const tensor_t* t2, float* result);
+void sparse_mm_T(const tensor_t* t1, const tensor_t* t2, float* result);
+
+#endif
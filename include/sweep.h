@@ -0,0 +1,62 @@
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <stdint.h>
+#include "tensor.h"
+#include "mlp.h"
+
+/* K independent two layer perceptrons (see mlp.h) trained in lockstep on
+ * the same batches, e.g. for a learning rate or seed sweep.
+ *
+ * Their first layers sit side by side in one [n_inputs, K * n_hidden]
+ * matrix, so the shared input goes through a single wide GEMM (and is
+ * sampled, converted and read once). The second layers are stacked as
+ * [K, n_hidden, n_outputs] and run as one tensor_bmm. Every buffer is
+ * allocated for max_batch rows when the sweep is created.
+ */
+typedef struct
+{
+    uint32_t n_models;
+    uint32_t n_inputs;
+    uint32_t n_hidden;
+    uint32_t n_outputs;
+    uint32_t max_batch;
+
+    /* Model k owns columns [k * n_hidden, (k + 1) * n_hidden) of W1 / b1 */
+    tensor_t* W1;   /* [n_inputs, K * n_hidden] */
+    tensor_t* b1;   /* [K * n_hidden] */
+    tensor_t* W2;   /* [K, n_hidden, n_outputs] */
+    tensor_t* b2;   /* [K, n_outputs] */
+    float* lrs;
+
+    /* Workspace */
+    tensor_t* z1;   /* [B, K * n_hidden], then its gradient */
+    tensor_t* a1;   /* [K, B, n_hidden] */
+    tensor_t* da1;  /* [K, B, n_hidden] */
+    tensor_t* z2;   /* [K, B, n_outputs], then its gradient */
+    tensor_t* dW1;
+    tensor_t* db1;
+    tensor_t* dW2;
+    tensor_t* db2;
+
+    /* Of the last batch, per model */
+    float* losses;
+    tensor_t* preds;    /* [K, B] */
+} sweep_t;
+
+/* Model k is initialized like mlp_init after srand(seeds[k]) and trained
+ * with learning rate lrs[k] */
+sweep_t* sweep_init(uint32_t n_models, const float* lrs, const unsigned int* seeds,
+        uint32_t n_inputs, uint32_t n_hidden, uint32_t n_outputs, uint32_t max_batch);
+void sweep_clean(sweep_t* sweep);
+
+/* Forward, backward and SGD update of every model over the same batch */
+void sweep_step(sweep_t* sweep, const tensor_t* x, const tensor_t* y);
+
+/* Accuracy of every model over any number of rows */
+void sweep_accuracy(sweep_t* sweep, const tensor_t* x, const tensor_t* y, float* accs);
+
+/* Copy of model k as a standalone mlp_t */
+mlp_t* sweep_extract(const sweep_t* sweep, uint32_t k);
+
+#endif
@@ -3,20 +3,55 @@
 
 #include <stdint.h>
 
+typedef enum {
+    TENSOR_F32 = 0,
+    TENSOR_BF16,
+    TENSOR_F16
+} tensor_dtype_t;
+
+/* Compressed sparse rows of a 2D F32 tensor: the nonzeros of row i are
+ * cols / values[row_ptr[i] .. row_ptr[i + 1]) */
+typedef struct {
+    uint32_t nnz;
+    uint32_t* row_ptr;
+    uint32_t* cols;
+    float* values;
+} tensor_csr_t;
+
 typedef struct {
     uint32_t n_dims;
     uint32_t* shape;
     float* values;
+
+    /* BF16 / F16 tensors keep their data in `halfs` and have no `values`.
+     * Besides copies, transposes, conversions and tensor_mm every op expects
+     * F32 tensors. */
+    tensor_dtype_t dtype;
+    uint16_t* halfs;
+
+    /* Optional CSR copy of `values` for inputs with many zeros (mnist_batch
+     * builds it for the pixels). tensor_mm and tensor_mm_T switch to sparse
+     * kernels when its density is low enough. Copies do not keep it. */
+    tensor_csr_t* csr;
+
+    /* Bytes owned and call site of tensor_new + 1 for memtrack.h, a site of
+     * 0 when it is not accounted */
+    uint64_t mem_bytes;
+    uint32_t mem_site;
 } tensor_t;
 
-/* Factory methods */
-tensor_t* tensor_new(float* values, uint32_t* shape, uint32_t n_dims);
+/* Factory methods, tensor_new records its call site for memtrack.h */
+tensor_t* tensor_new_at(float* values, uint32_t* shape, uint32_t n_dims,
+        const char* file, int line, const char* func);
+#define tensor_new(values, shape, n_dims) \
+    tensor_new_at(values, shape, n_dims, __FILE__, __LINE__, __func__)
 tensor_t* tensor_arange(float start, float end, float step, uint32_t* shape, uint32_t n_dims);
 tensor_t* tensor_zeros(uint32_t* shape, uint32_t n_dims);
 tensor_t* tensor_ones(uint32_t* shape, uint32_t n_dims);
 tensor_t* tensor_uniform(float min, float max, uint32_t* shape, uint32_t n_dims);
 tensor_t* tensor_copy(const tensor_t* t);
 tensor_t* tensor_index(const tensor_t* t, uint32_t* index, uint32_t n_indices);
+tensor_t* tensor_to_dtype(const tensor_t* t, tensor_dtype_t dtype);
 
 /* Destructor */
 void tensor_clean(tensor_t* t);
@@ -51,8 +86,27 @@ tensor_t* tensor_mul_scalar(const tensor_t* ti, float scalar);
 tensor_t* tensor_div(const tensor_t* t1, const tensor_t* t2);
 tensor_t* tensor_div_scalar(const tensor_t* t, float scalar);
 
+/* Accepts any mix of dtypes, accumulates in fp32 and returns an F32 tensor */
 tensor_t* tensor_mm(const tensor_t* t1, const tensor_t* t2);
 
+/* t1^T @ t2 without materializing the transpose of t1 */
+tensor_t* tensor_mm_T(const tensor_t* t1, const tensor_t* t2);
+
+/* Same as above writing into an existing F32 `result` of the right shape */
+void tensor_mm_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result);
+void tensor_mm_T_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result);
+
+/* result = t1 [M, N] @ t2 [K, N]^T, every output is a dot product of two
+ * contiguous rows */
+void tensor_mm_NT_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result);
+
+/* Batched F32 matmul: t1 [B, M, K] @ t2 [B, K, N] -> [B, M, N]. Either side
+ * may be a single [M, K] / [K, N] matrix (or have a batch of 1) shared by
+ * every product. The whole batch runs as one job over bmm_set_threads
+ * threads (bmm.h). */
+tensor_t* tensor_bmm(const tensor_t* t1, const tensor_t* t2);
+void tensor_bmm_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result);
+
 /* Standard output information */
 void tensor_print(const tensor_t* t);
 void tensor_specs(const tensor_t* t);
@@ -0,0 +1,51 @@
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+#include <stddef.h>
+
+/* CPU / NUMA node layout of the host, read from /sys/devices/system/node.
+ * Nodes are indexed 0 .. n_nodes - 1 in the order of the online list, their
+ * kernel ids may have gaps. Hosts without NUMA information are described as
+ * a single node holding every online CPU. */
+typedef struct
+{
+    int n_nodes;
+    int n_cpus;
+    int* node_ids;
+    int* node_of_cpu;
+    int* n_node_cpus;
+    int** node_cpus;
+} topo_t;
+
+/* Buffers whose page placement is sampled by the parallel trainer */
+enum
+{
+    TOPO_DATASET,
+    TOPO_BATCH,
+    TOPO_GRADS,
+    TOPO_WEIGHTS,
+    TOPO_N_KINDS
+};
+
+typedef struct
+{
+    long remote[TOPO_N_KINDS];
+    long pages[TOPO_N_KINDS];
+} topo_access_t;
+
+topo_t* topo_read();
+void topo_clean(topo_t* topo);
+
+/* Pins the calling thread. Workers are spread round robin over the nodes
+ * and over the CPUs of each node. Both return the node, or -1 on failure */
+int topo_pin_worker(const topo_t* topo, int worker);
+int topo_pin_node(const topo_t* topo, int node);
+
+int topo_current_node(const topo_t* topo);
+
+/* Counts the resident pages of [addr, addr + bytes) and how many of them
+ * live on a node other than the node of index `node` */
+void topo_sample(const topo_t* topo, const void* addr, size_t bytes, int node, long* remote,
+        long* pages);
+
+#endif
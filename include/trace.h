@@ -0,0 +1,68 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include "tensor.h"
+
+/* Per-op tracing, exported as Chrome Trace Event JSON (chrome://tracing,
+ * ui.perfetto.dev).
+ *
+ * Traced functions take a timestamp on entry with TRACE_BEGIN and record an
+ * event on exit with TRACE_OP (up to two input shapes, the result shape and
+ * the bytes of all three), TRACE_OUT (a result and the bytes read for it)
+ * or TRACE_BYTES. Calls made inside a traced op show up nested under it.
+ * When tracing is off TRACE_BEGIN is a load and a branch, and the other
+ * macros compute nothing.
+ *
+ * Every thread writes its events into its own ring of TRACE_RING_LEN
+ * events, allocated on its first event, with no lock or atomic read-modify-
+ * write. Once a ring is full its oldest events are overwritten.
+ *
+ * The same hooks read the hardware counters of perfctr.h when it is
+ * enabled, with or without events being recorded.
+ *
+ * Traced: the ops of tensor.h (not the accessors tensor_new, tensor_numel,
+ * tensor_clean, tensor_print and tensor_specs, which other ops call in
+ * their loops), nn.h, the mnist loaders and the optimizer steps
+ * model_update and mlp_update.
+ */
+
+#define TRACE_RING_LEN (1 << 16)
+
+/* Bits of trace_enabled */
+#define TRACE_EVENTS 1
+#define TRACE_COUNTERS 2
+
+extern uint8_t trace_enabled;
+
+#define TRACE_BEGIN() (trace_enabled ? trace_begin() : 0)
+
+#define TRACE_OP(start, name, in1, in2, out) \
+    do { if (start) trace_record(name, start, in1, in2, out, 0); } while (0)
+
+#define TRACE_OUT(start, name, out, bytes) \
+    do { if (start) trace_record(name, start, NULL, NULL, out, bytes); } while (0)
+
+#define TRACE_BYTES(start, name, bytes) \
+    do { if (start) trace_record(name, start, NULL, NULL, NULL, bytes); } while (0)
+
+/* Starts recording, timestamps count from the first trace_enable */
+void trace_enable();
+void trace_disable();
+
+/* Writes every event still in the rings as JSON, returns how many. Meant
+ * for when the traced threads are done or idle. */
+uint64_t trace_export(const char* path);
+
+/* Monotonic ns */
+uint64_t trace_now();
+
+/* Start of an op, trace_now and the counters on entry */
+uint64_t trace_begin();
+
+/* Event from start to now on the calling thread, bytes being added to the
+ * size of the tensors given */
+void trace_record(const char* name, uint64_t start, const tensor_t* in1, const tensor_t* in2,
+        const tensor_t* out, uint64_t bytes);
+
+#endif
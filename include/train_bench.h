@@ -0,0 +1,88 @@
+#ifndef _TRAIN_BENCH_H_
+#define _TRAIN_BENCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mnist.h"
+#include "perfctr.h"
+
+/* Headless training benchmark over model_t (model.h): a fixed number of
+ * steps from a fixed seed, every step timed in four phases. The model is
+ * trained single threaded, so n_threads runs that many replicas at once,
+ * each with its own model and sampler seed, to measure how throughput
+ * scales on the host. Replica 0 evaluates on the first TRAIN_BENCH_EVAL
+ * test images every eval_every steps, off the clock, for the time to the
+ * target accuracy. With perfctr.h enabled the counters of every phase are
+ * read as well, those reads are then part of the timed steps.
+ */
+
+#define TRAIN_BENCH_EVAL 1000
+
+typedef enum {
+    PHASE_DATA = 0,     /* Sampling and converting the batch */
+    PHASE_FORWARD,
+    PHASE_BACKWARD,
+    PHASE_UPDATE,
+    PHASE_COUNT
+} train_phase_t;
+
+/* Log2 buckets of microseconds: bucket i counts the steps in
+ * [2^(i-1), 2^i) us, the last one every longer step too */
+#define TRAIN_BENCH_BUCKETS 24
+
+typedef struct
+{
+    const char* model_config;
+    int batch_size;
+    int steps;              /* Per replica */
+    int n_threads;
+    unsigned int seed;
+    float lr;
+    float target_acc;       /* 0 disables it */
+    int eval_every;
+} train_bench_config_t;
+
+typedef struct
+{
+    double mean_us;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+    uint64_t buckets[TRAIN_BENCH_BUCKETS];
+} train_bench_phase_t;
+
+typedef struct
+{
+    train_bench_config_t cfg;
+    double seconds;             /* Wall time of the training, evaluations excluded */
+    double images_per_sec;      /* Of every replica together */
+    train_bench_phase_t phases[PHASE_COUNT];
+    train_bench_phase_t step;   /* All four phases */
+    double time_to_target;      /* Seconds, -1 if the target was never reached */
+    float final_loss;           /* Mean of the last eval_every steps of replica 0 */
+    float final_acc;            /* Of replica 0 on the eval images */
+    long peak_rss_kb;
+
+    /* Tensor memory when memtrack.h is enabled, 0 otherwise. With one
+     * replica every step is a memtrack step, its budget applies. */
+    double allocs_per_step;
+    double alloc_bytes_per_step;
+    int64_t peak_tensor_bytes;
+
+    /* Counters of every replica together, 0 unless in perfctr_available */
+    uint64_t counters[PHASE_COUNT][PERFCTR_COUNT];
+} train_bench_result_t;
+
+train_bench_result_t train_bench_run(const train_bench_config_t* cfg, mnist_t* ds, mnist_t* test_ds);
+
+/* Human readable summary */
+void train_bench_print(const train_bench_result_t* res);
+
+/* Machine readable result, one JSON object */
+void train_bench_json(const train_bench_result_t* res, FILE* f);
+
+/* str as a quoted JSON string, escaped */
+void train_bench_json_string(const char* str, FILE* f);
+
+#endif
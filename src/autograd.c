@@ -0,0 +1,666 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "autograd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Workspace buffers are placed on this boundary inside the slab */
+#define PLAN_ALIGN 64
+
+typedef struct
+{
+    tensor_t* t;
+    uint32_t first;     /* Lifetime in step time, see ag_plan */
+    uint32_t last;
+    size_t bytes;
+    size_t offset;
+
+    /* Slot of this buffer, and of the input it may overwrite in place when
+     * the input dies at the step that produces it (or UINT32_MAX) */
+    uint32_t slot;
+    uint32_t in_place;
+} plan_buffer_t;
+
+/* Utility functions */
+static ag_var_t* push(ag_tape_t* tape, ag_op_t op, ag_var_t* a, ag_var_t* b,
+        const uint32_t* shape, uint32_t n_dims);
+static void use(ag_var_t* v);
+static tensor_t* zeros_like(const uint32_t* shape, uint32_t n_dims);
+static void check_shape(const tensor_t* t1, const tensor_t* t2);
+
+static tensor_t* grad_begin(ag_var_t* v);
+static void grad_end(ag_var_t* v, tensor_t* out);
+
+static void forward_add(ag_var_t* v);
+static void forward_softmax_ce(ag_var_t* v);
+static void backward(ag_var_t* v);
+
+static uint32_t index_of(const ag_tape_t* tape, const ag_var_t* v);
+static void live(uint32_t* first, uint32_t* last, uint32_t t);
+static int compare_sizes(const void* a, const void* b);
+static void place(plan_buffer_t* buffers, uint32_t k);
+static int collide(const plan_buffer_t* b, const plan_buffer_t* p);
+
+ag_tape_t* ag_tape_new()
+{
+    ag_tape_t* tape = (ag_tape_t*)malloc(sizeof(ag_tape_t));
+
+    tape->capacity = 16;
+    tape->len = 0;
+    tape->vars = (ag_var_t**)malloc(sizeof(ag_var_t*) * tape->capacity);
+    tape->slab = NULL;
+    return tape;
+}
+
+void ag_tape_clean(ag_tape_t* tape)
+{
+    ag_var_t* v;
+
+    for (uint32_t i = 0; i < tape->len; i++)
+    {
+        v = tape->vars[i];
+
+        /* Planned buffers point inside the slab */
+        if (tape->slab)
+        {
+            if (v->op != AG_INPUT && v->op != AG_PARAM)
+                v->value->values = NULL;
+            if (v->grad)
+                v->grad->values = NULL;
+            if (v->scratch && v->op != AG_INPUT)
+                v->scratch->values = NULL;
+        }
+
+        if (v->op != AG_INPUT && v->op != AG_PARAM)
+            tensor_clean(v->value);
+        if (v->grad)
+            tensor_clean(v->grad);
+        if (v->scratch)
+            tensor_clean(v->scratch);
+        free(v);
+    }
+    free(tape->slab);
+    free(tape->vars);
+    free(tape);
+}
+
+ag_var_t* ag_input(ag_tape_t* tape, const uint32_t* shape, uint32_t n_dims)
+{
+    ag_var_t* v = push(tape, AG_INPUT, NULL, NULL, NULL, 0);
+
+    /* Until something is fed the value is a placeholder holding the shape */
+    v->scratch = tensor_new(NULL, (uint32_t*)malloc(sizeof(uint32_t) * n_dims), n_dims);
+    memcpy(v->scratch->shape, shape, sizeof(uint32_t) * n_dims);
+    v->value = v->scratch;
+    return v;
+}
+
+ag_var_t* ag_param(ag_tape_t* tape, tensor_t* t)
+{
+    ag_var_t* v = push(tape, AG_PARAM, NULL, NULL, NULL, 0);
+
+    v->value = t;
+    v->requires_grad = 1;
+    v->grad = zeros_like(t->shape, t->n_dims);
+    return v;
+}
+
+void ag_feed(ag_var_t* input, tensor_t* t)
+{
+    if (input->op != AG_INPUT)
+    {
+        printf("[ERROR] Only inputs can be fed\n");
+        exit(1);
+    }
+
+    check_shape(input->scratch, t);
+    input->value = t;
+}
+
+ag_var_t* ag_mm(ag_tape_t* tape, ag_var_t* a, ag_var_t* b)
+{
+    uint32_t shape[2];
+
+    if (a->value->n_dims != 2 || b->value->n_dims != 2 ||
+            a->value->shape[1] != b->value->shape[0])
+    {
+        printf("[ERROR] No compatible shapes for ag_mm\n");
+        exit(1);
+    }
+
+    shape[0] = a->value->shape[0];
+    shape[1] = b->value->shape[1];
+    return push(tape, AG_MM, a, b, shape, 2);
+}
+
+ag_var_t* ag_add(ag_tape_t* tape, ag_var_t* a, ag_var_t* b)
+{
+    uint32_t n = tensor_numel(b->value);
+
+    if (tensor_numel(a->value) != n && (b->value->n_dims != 1 ||
+            a->value->n_dims != 2 || a->value->shape[1] != n))
+    {
+        printf("[ERROR] ag_add needs equal shapes or a row to broadcast\n");
+        exit(1);
+    }
+
+    return push(tape, AG_ADD, a, b, a->value->shape, a->value->n_dims);
+}
+
+ag_var_t* ag_relu(ag_tape_t* tape, ag_var_t* a)
+{
+    return push(tape, AG_RELU, a, NULL, a->value->shape, a->value->n_dims);
+}
+
+ag_var_t* ag_softmax_ce(ag_tape_t* tape, ag_var_t* logits, ag_var_t* labels)
+{
+    uint32_t shape[] = {1};
+    ag_var_t* v;
+
+    if (logits->value->n_dims != 2 || labels->value->n_dims != 1 ||
+            labels->value->shape[0] != logits->value->shape[0])
+    {
+        printf("[ERROR] ag_softmax_ce needs logits [M, C] and labels [M]\n");
+        exit(1);
+    }
+
+    v = push(tape, AG_SOFTMAX_CE, logits, labels, shape, 1);
+    v->scratch = zeros_like(logits->value->shape, 2);
+    return v;
+}
+
+void ag_forward(ag_tape_t* tape)
+{
+    ag_var_t* v;
+
+    for (uint32_t i = 0; i < tape->len; i++)
+    {
+        v = tape->vars[i];
+        switch (v->op)
+        {
+            case AG_MM:
+                tensor_mm_into(v->a->value, v->b->value, v->value);
+                break;
+            case AG_ADD:
+                forward_add(v);
+                break;
+            case AG_RELU:
+                for (uint32_t j = 0; j < tensor_numel(v->value); j++)
+                    v->value->values[j] = v->a->value->values[j] > 0 ? v->a->value->values[j] : 0;
+                break;
+            case AG_SOFTMAX_CE:
+                forward_softmax_ce(v);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void ag_backward(ag_tape_t* tape, ag_var_t* loss)
+{
+    ag_var_t* v;
+
+    for (uint32_t i = 0; i < tape->len; i++)
+        tape->vars[i]->grad_written = 0;
+
+    if (!loss->requires_grad)
+        return;
+
+    for (uint32_t j = 0; j < tensor_numel(loss->grad); j++)
+        loss->grad->values[j] = 1;
+    loss->grad_written = 1;
+
+    /* Nodes are recorded after their inputs, so going backwards every node
+     * has all of its gradient before passing it on */
+    for (uint32_t i = tape->len; i > 0; i--)
+    {
+        v = tape->vars[i - 1];
+        if (v->grad_written)
+            backward(v);
+    }
+
+    /* Parameters the loss does not depend on get a 0 gradient */
+    for (uint32_t i = 0; i < tape->len; i++)
+    {
+        v = tape->vars[i];
+        if (v->op == AG_PARAM && !v->grad_written)
+            memset(v->grad->values, 0, sizeof(float) * tensor_numel(v->grad));
+    }
+}
+
+void ag_sgd(ag_tape_t* tape, float lr)
+{
+    ag_var_t* v;
+
+    for (uint32_t i = 0; i < tape->len; i++)
+    {
+        v = tape->vars[i];
+        if (v->op == AG_PARAM)
+            for (uint32_t j = 0; j < tensor_numel(v->value); j++)
+                v->value->values[j] -= lr * v->grad->values[j];
+    }
+}
+
+ag_plan_stats_t ag_plan(ag_tape_t* tape, ag_var_t* loss)
+{
+    uint32_t n = tape->len, end = 2 * tape->len, n_buffers = 0, bwd, j;
+    uint32_t* first = (uint32_t*)malloc(sizeof(uint32_t) * 3 * n);
+    uint32_t* last = (uint32_t*)malloc(sizeof(uint32_t) * 3 * n);
+    uint32_t* in_place = (uint32_t*)malloc(sizeof(uint32_t) * 3 * n);
+    plan_buffer_t* buffers = (plan_buffer_t*)malloc(sizeof(plan_buffer_t) * 3 * n);
+    ag_plan_stats_t stats = {0, 0, 0};
+    tensor_t* slots[3];
+    ag_var_t* v, *x;
+    void* slab;
+
+    if (tape->slab)
+    {
+        printf("[ERROR] The tape is already planned\n");
+        exit(1);
+    }
+
+    /* A step runs the forward of node i at time i and its backward at time
+     * 2n - 1 - i. Slots 3i, 3i + 1 and 3i + 2 are the value, gradient and
+     * scratch of node i. */
+    for (uint32_t i = 0; i < 3 * n; i++)
+    {
+        first[i] = UINT32_MAX;
+        last[i] = 0;
+        in_place[i] = UINT32_MAX;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        v = tape->vars[i];
+        bwd = end - 1 - i;
+
+        if (v->op != AG_INPUT && v->op != AG_PARAM)
+            live(&first[3 * i], &last[3 * i], i);
+        if (v->requires_grad)
+            live(&first[3 * i + 1], &last[3 * i + 1], bwd);
+        if (v->op == AG_SOFTMAX_CE)
+        {
+            live(&first[3 * i + 2], &last[3 * i + 2], i);
+            live(&first[3 * i + 2], &last[3 * i + 2], bwd);
+        }
+
+        for (int side = 0; side < 2; side++)
+        {
+            x = side ? v->b : v->a;
+            if (x == NULL)
+                continue;
+
+            /* Read by this forward, and by this backward for the ops that
+             * need their inputs to get the gradients */
+            j = index_of(tape, x);
+            live(&first[3 * j], &last[3 * j], i);
+            if (v->op == AG_MM || (v->op == AG_RELU && !side) || (v->op == AG_SOFTMAX_CE && side))
+                live(&first[3 * j], &last[3 * j], bwd);
+
+            /* Gradient contributions land in the gradient or the scratch */
+            if (x->requires_grad && v->requires_grad)
+            {
+                live(&first[3 * j + 1], &last[3 * j + 1], bwd);
+                if (x->n_uses > 1)
+                    live(&first[3 * j + 2], &last[3 * j + 2], bwd);
+            }
+        }
+
+        /* Parameter gradients are read by the update after the step */
+        if (v->op == AG_PARAM)
+            live(&first[3 * i + 1], &last[3 * i + 1], end);
+
+        /* Elementwise ops may write over the input they read last, both in
+         * forward (value) and backward (gradient of the single consumer) */
+        if (v->op == AG_RELU || (v->op == AG_ADD &&
+                    tensor_numel(v->a->value) == tensor_numel(v->value)))
+        {
+            j = index_of(tape, v->a);
+            if (v->a->op != AG_INPUT && v->a->op != AG_PARAM)
+                in_place[3 * i] = 3 * j;
+            if (v->a->requires_grad && v->a->n_uses == 1)
+                in_place[3 * j + 1] = 3 * i + 1;
+        }
+        if (v->op == AG_SOFTMAX_CE && v->a->requires_grad && v->a->n_uses == 1)
+            in_place[3 * index_of(tape, v->a) + 1] = 3 * i + 2;
+    }
+
+    /* The loss gradient is seeded before any backward and its value is
+     * read once the step is done */
+    j = index_of(tape, loss);
+    live(&first[3 * j], &last[3 * j], end);
+    if (loss->requires_grad)
+        live(&first[3 * j + 1], &last[3 * j + 1], n);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        v = tape->vars[i];
+        slots[0] = v->op != AG_INPUT && v->op != AG_PARAM ? v->value : NULL;
+        slots[1] = v->grad;
+        slots[2] = v->op != AG_INPUT ? v->scratch : NULL;
+
+        for (int k = 0; k < 3; k++)
+        {
+            if (slots[k] == NULL)
+                continue;
+
+            buffers[n_buffers].t = slots[k];
+            buffers[n_buffers].slot = 3 * i + k;
+            buffers[n_buffers].in_place = in_place[3 * i + k];
+            buffers[n_buffers].first = first[3 * i + k] == UINT32_MAX ? end : first[3 * i + k];
+            buffers[n_buffers].last = first[3 * i + k] == UINT32_MAX ? end : last[3 * i + k];
+            buffers[n_buffers].bytes = (sizeof(float) * tensor_numel(slots[k]) + PLAN_ALIGN - 1)
+                / PLAN_ALIGN * PLAN_ALIGN;
+            stats.naive_bytes += buffers[n_buffers].bytes;
+            n_buffers++;
+        }
+    }
+
+    /* Largest buffers first, each one at the lowest offset free during its
+     * whole lifetime */
+    qsort(buffers, n_buffers, sizeof(plan_buffer_t), compare_sizes);
+    for (uint32_t k = 0; k < n_buffers; k++)
+    {
+        place(buffers, k);
+        if (buffers[k].offset + buffers[k].bytes > stats.slab_bytes)
+            stats.slab_bytes = buffers[k].offset + buffers[k].bytes;
+    }
+
+    if (posix_memalign(&slab, PLAN_ALIGN, stats.slab_bytes ? stats.slab_bytes : PLAN_ALIGN) != 0)
+    {
+        printf("[ERROR] Allocating a workspace of %zu bytes\n", stats.slab_bytes);
+        exit(1);
+    }
+
+    tape->slab = (float*)slab;
+    for (uint32_t k = 0; k < n_buffers; k++)
+    {
+        free(buffers[k].t->values);
+        buffers[k].t->values = (float*)((char*)slab + buffers[k].offset);
+    }
+
+    stats.n_buffers = n_buffers;
+    free(first);
+    free(last);
+    free(in_place);
+    free(buffers);
+    return stats;
+}
+
+ag_var_t* push(ag_tape_t* tape, ag_op_t op, ag_var_t* a, ag_var_t* b,
+        const uint32_t* shape, uint32_t n_dims)
+{
+    ag_var_t* v;
+
+    if (tape->slab)
+    {
+        printf("[ERROR] Cannot record on a planned tape\n");
+        exit(1);
+    }
+
+    v = (ag_var_t*)malloc(sizeof(ag_var_t));
+    v->op = op;
+    v->a = a;
+    v->b = b;
+    v->value = NULL;
+    v->grad = NULL;
+    v->scratch = NULL;
+    v->grad_written = 0;
+    v->n_uses = 0;
+    v->requires_grad = (a && a->requires_grad) || (b && b->requires_grad);
+
+    if (shape)
+        v->value = zeros_like(shape, n_dims);
+    if (v->requires_grad)
+        v->grad = zeros_like(shape, n_dims);
+
+    if (a)
+        use(a);
+    if (b && b != a)
+        use(b);
+
+    if (tape->len == tape->capacity)
+    {
+        tape->capacity *= 2;
+        tape->vars = (ag_var_t**)realloc(tape->vars, sizeof(ag_var_t*) * tape->capacity);
+    }
+    tape->vars[tape->len++] = v;
+    return v;
+}
+
+/* A node feeding several others receives several gradient contributions,
+ * it gets the scratch buffer to sum them while recording */
+void use(ag_var_t* v)
+{
+    if (++v->n_uses == 2 && v->requires_grad)
+        v->scratch = zeros_like(v->grad->shape, v->grad->n_dims);
+}
+
+tensor_t* zeros_like(const uint32_t* shape, uint32_t n_dims)
+{
+    uint32_t* copy = (uint32_t*)malloc(sizeof(uint32_t) * n_dims);
+
+    memcpy(copy, shape, sizeof(uint32_t) * n_dims);
+    return tensor_zeros(copy, n_dims);
+}
+
+void check_shape(const tensor_t* t1, const tensor_t* t2)
+{
+    int same = t1->n_dims == t2->n_dims;
+
+    for (uint32_t i = 0; same && i < t1->n_dims; i++)
+        same = t1->shape[i] == t2->shape[i];
+
+    if (!same)
+    {
+        printf("[ERROR] Fed tensor does not have the shape of the input\n");
+        exit(1);
+    }
+}
+
+/* The first contribution goes straight into grad, later ones into scratch */
+tensor_t* grad_begin(ag_var_t* v)
+{
+    return v->grad_written ? v->scratch : v->grad;
+}
+
+void grad_end(ag_var_t* v, tensor_t* out)
+{
+    if (out == v->scratch)
+        for (uint32_t i = 0; i < tensor_numel(v->grad); i++)
+            v->grad->values[i] += out->values[i];
+    v->grad_written = 1;
+}
+
+void forward_add(ag_var_t* v)
+{
+    const float* a = v->a->value->values, *b = v->b->value->values;
+    uint32_t nels = tensor_numel(v->value), n = tensor_numel(v->b->value);
+
+    for (uint32_t i = 0; i < nels; i++)
+        v->value->values[i] = a[i] + b[i % n];
+}
+
+/* Log-softmax is taken as z - max - log(sum(exp(z - max))), so no
+ * probability is ever passed to log */
+void forward_softmax_ce(ag_var_t* v)
+{
+    const tensor_t* z = v->a->value, *y = v->b->value;
+    uint32_t M = z->shape[0], C = z->shape[1];
+    float* p = v->scratch->values;
+    float max, sum, loss = 0;
+    const float* row;
+
+    for (uint32_t i = 0; i < M; i++)
+    {
+        row = &z->values[i * C];
+        max = row[0];
+        for (uint32_t c = 1; c < C; c++)
+            max = fmaxf(max, row[c]);
+
+        sum = 0;
+        for (uint32_t c = 0; c < C; c++)
+        {
+            p[i * C + c] = expf(row[c] - max);
+            sum += p[i * C + c];
+        }
+
+        for (uint32_t c = 0; c < C; c++)
+            p[i * C + c] /= sum;
+        loss -= row[(int)y->values[i]] - max - logf(sum);
+    }
+    v->value->values[0] = loss / M;
+}
+
+void backward(ag_var_t* v)
+{
+    const float* g = v->grad->values;
+    ag_var_t* a = v->a, *b = v->b;
+    uint32_t nels, n, M, C;
+    tensor_t* out;
+    float scale;
+
+    switch (v->op)
+    {
+        case AG_MM:
+            if (a->requires_grad)
+            {
+                out = grad_begin(a);
+                tensor_mm_NT_into(v->grad, b->value, out);
+                grad_end(a, out);
+            }
+            if (b->requires_grad)
+            {
+                out = grad_begin(b);
+                tensor_mm_T_into(a->value, v->grad, out);
+                grad_end(b, out);
+            }
+            break;
+
+        case AG_ADD:
+            nels = tensor_numel(v->value);
+            if (a->requires_grad)
+            {
+                out = grad_begin(a);
+                /* Planned tapes may share both buffers */
+                if (out->values != g)
+                    memcpy(out->values, g, sizeof(float) * nels);
+                grad_end(a, out);
+            }
+            if (b->requires_grad)
+            {
+                /* A broadcast row collects the sum over all rows */
+                n = tensor_numel(b->value);
+                out = grad_begin(b);
+                memset(out->values, 0, sizeof(float) * n);
+                for (uint32_t i = 0; i < nels; i++)
+                    out->values[i % n] += g[i];
+                grad_end(b, out);
+            }
+            break;
+
+        case AG_RELU:
+            if (a->requires_grad)
+            {
+                out = grad_begin(a);
+                for (uint32_t i = 0; i < tensor_numel(v->value); i++)
+                    out->values[i] = a->value->values[i] > 0 ? g[i] : 0;
+                grad_end(a, out);
+            }
+            break;
+
+        case AG_SOFTMAX_CE:
+            if (a->requires_grad)
+            {
+                /* d(mean CE)/dz = (softmax(z) - onehot(y)) / M */
+                M = a->value->shape[0];
+                C = a->value->shape[1];
+                scale = g[0] / M;
+                out = grad_begin(a);
+                for (uint32_t i = 0; i < M * C; i++)
+                    out->values[i] = v->scratch->values[i] * scale;
+                for (uint32_t i = 0; i < M; i++)
+                    out->values[i * C + (int)b->value->values[i]] -= scale;
+                grad_end(a, out);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+uint32_t index_of(const ag_tape_t* tape, const ag_var_t* v)
+{
+    for (uint32_t i = 0; i < tape->len; i++)
+        if (tape->vars[i] == v)
+            return i;
+
+    printf("[ERROR] Variable not recorded on this tape\n");
+    exit(1);
+}
+
+void live(uint32_t* first, uint32_t* last, uint32_t t)
+{
+    if (t < *first)
+        *first = t;
+    if (t > *last)
+        *last = t;
+}
+
+int compare_sizes(const void* a, const void* b)
+{
+    size_t sa = ((const plan_buffer_t*)a)->bytes, sb = ((const plan_buffer_t*)b)->bytes;
+    return (sa < sb) - (sa > sb);
+}
+
+/* Puts buffer k over the input it overwrites in place when that fits,
+ * otherwise moves it up past every placed buffer it collides with until it
+ * does */
+void place(plan_buffer_t* buffers, uint32_t k)
+{
+    plan_buffer_t* b = &buffers[k], *p;
+    int moved = 1;
+
+    for (uint32_t i = 0; i < k; i++)
+    {
+        p = &buffers[i];
+        if ((b->in_place == p->slot && p->last == b->first) ||
+                (p->in_place == b->slot && b->last == p->first))
+        {
+            b->offset = p->offset;
+            for (uint32_t j = 0; j < k && b->offset == p->offset; j++)
+                if (j != i && collide(b, &buffers[j]))
+                    b->offset = SIZE_MAX;
+            if (b->offset == p->offset)
+                return;
+        }
+    }
+
+    b->offset = 0;
+    while (moved)
+    {
+        moved = 0;
+        for (uint32_t i = 0; i < k; i++)
+        {
+            p = &buffers[i];
+            if (collide(b, p))
+            {
+                b->offset = p->offset + p->bytes;
+                moved = 1;
+            }
+        }
+    }
+}
+
+/* Both alive at some step and overlapping in the slab */
+int collide(const plan_buffer_t* b, const plan_buffer_t* p)
+{
+    return p->first <= b->last && b->first <= p->last &&
+        p->offset < b->offset + b->bytes && b->offset < p->offset + p->bytes;
+}
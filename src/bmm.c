@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bmm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Multiply-adds a thread must get before another one is started */
+#define BMM_MIN_WORK (1 << 20)
+
+#define MAX_THREADS 64
+
+typedef struct
+{
+    const float* a;
+    const float* b;
+    float* c;
+    size_t stride_a;
+    size_t stride_b;
+    uint32_t M;
+    uint32_t K;
+    uint32_t N;
+
+    /* Packed shared b, or NULL */
+    const float* panels;
+
+    /* Work items are (product, block of BMM_ROWS rows), taken in order */
+    uint32_t n_row_blocks;
+    uint32_t n_items;
+    uint32_t next;
+} bmm_job_t;
+
+static uint32_t n_threads = 1;
+
+/* Utility functions */
+static void* worker(void* arg);
+static float* alloc_panels(uint32_t K, uint32_t N);
+static void pack_panels(const float* b, uint32_t K, uint32_t N, uint32_t n0, float* panels);
+static void rows_kernel(const float* a, uint32_t rows, uint32_t K, const float* b, uint32_t ldb,
+        float* c, uint32_t ldc, uint32_t width);
+
+void bmm_set_threads(uint32_t n)
+{
+    n_threads = n == 0 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+void bmm(const float* a, size_t stride_a, const float* b, size_t stride_b, float* c,
+        uint32_t batch, uint32_t M, uint32_t K, uint32_t N)
+{
+    pthread_t threads[MAX_THREADS];
+    uint32_t n;
+    double work = (double)batch * M * K * N;
+    float* panels = NULL;
+    bmm_job_t job;
+
+    if (batch == 0 || M == 0 || N == 0)
+        return;
+
+    job.a = a;
+    job.b = b;
+    job.c = c;
+    job.stride_a = stride_a;
+    job.stride_b = stride_b;
+    job.M = M;
+    job.K = K;
+    job.N = N;
+    job.n_row_blocks = (M + BMM_ROWS - 1) / BMM_ROWS;
+    job.n_items = batch * job.n_row_blocks;
+    job.next = 0;
+
+    if (stride_b == 0 && batch > 1)
+    {
+        panels = alloc_panels(K, N);
+        pack_panels(b, K, N, 0, panels);
+    }
+    job.panels = panels;
+
+    /* The calling thread takes part, so n - 1 are started */
+    n = n_threads;
+    if (n > job.n_items)
+        n = job.n_items;
+    if (n > work / BMM_MIN_WORK)
+        n = work < 2.0 * BMM_MIN_WORK ? 1 : (uint32_t)(work / BMM_MIN_WORK);
+
+    for (uint32_t i = 1; i < n; i++)
+        pthread_create(&threads[i], NULL, worker, &job);
+    worker(&job);
+    for (uint32_t i = 1; i < n; i++)
+        pthread_join(threads[i], NULL);
+
+    free(panels);
+}
+
+void* worker(void* arg)
+{
+    bmm_job_t* job = (bmm_job_t*)arg;
+    uint32_t item, i, r0, rows, n0, width, K = job->K, N = job->N, tail_of = UINT32_MAX;
+    float* tail = NULL, *c;
+    const float* a, *b;
+
+    while ((item = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n_items)
+    {
+        i = item / job->n_row_blocks;
+        r0 = (item % job->n_row_blocks) * BMM_ROWS;
+        rows = job->M - r0 < BMM_ROWS ? job->M - r0 : BMM_ROWS;
+        a = job->a + i * job->stride_a + (size_t)r0 * K;
+        c = job->c + (size_t)i * job->M * N + (size_t)r0 * N;
+
+        /* Panel by panel, so one panel of b stays in cache for all the rows */
+        for (n0 = 0; n0 < N; n0 += BMM_NR)
+        {
+            width = N - n0 < BMM_NR ? N - n0 : BMM_NR;
+            if (job->panels)
+                rows_kernel(a, rows, K, job->panels + (size_t)(n0 / BMM_NR) * K * BMM_NR, BMM_NR,
+                        c + n0, N, width);
+            else if (width == BMM_NR)
+                rows_kernel(a, rows, K, job->b + i * job->stride_b + n0, N, c + n0, N, width);
+            else
+            {
+                /* A narrow last panel is padded to full width, once per
+                 * product */
+                b = job->b + i * job->stride_b;
+                if (tail == NULL)
+                    tail = alloc_panels(K, BMM_NR);
+                if (tail_of != i)
+                    pack_panels(b, K, N, n0, tail);
+                tail_of = i;
+                rows_kernel(a, rows, K, tail, BMM_NR, c + n0, N, width);
+            }
+        }
+    }
+
+    free(tail);
+    return NULL;
+}
+
+float* alloc_panels(uint32_t K, uint32_t N)
+{
+    uint32_t n_panels = (N + BMM_NR - 1) / BMM_NR;
+    float* panels;
+
+    if (posix_memalign((void**)&panels, 64, sizeof(float) * n_panels * K * BMM_NR) != 0)
+    {
+        printf("[ERROR] Could not allocate the packed panels of tensor_bmm\n");
+        exit(1);
+    }
+    return panels;
+}
+
+/* Panels of the columns of b from `first` on: panel p holds columns
+ * [first + p * BMM_NR, first + (p + 1) * BMM_NR) row after row, the last one
+ * padded with zeros */
+void pack_panels(const float* b, uint32_t K, uint32_t N, uint32_t first, float* panels)
+{
+    uint32_t width;
+    float* dst;
+
+    for (uint32_t n0 = first; n0 < N; n0 += BMM_NR)
+    {
+        width = N - n0 < BMM_NR ? N - n0 : BMM_NR;
+        dst = panels + (size_t)((n0 - first) / BMM_NR) * K * BMM_NR;
+        for (uint32_t k = 0; k < K; k++)
+        {
+            memcpy(&dst[k * BMM_NR], &b[(size_t)k * N + n0], sizeof(float) * width);
+            memset(&dst[k * BMM_NR + width], 0, sizeof(float) * (BMM_NR - width));
+        }
+    }
+}
+
+/* c[rows, width] = a[rows, K] @ b[K, width], rows of b being ldb apart.
+ * BMM_NR columns of b are always read, so narrower panels must be padded. */
+void rows_kernel(const float* a, uint32_t rows, uint32_t K, const float* b, uint32_t ldb,
+        float* c, uint32_t ldc, uint32_t width)
+{
+    float acc[BMM_NR];
+    const float* bk;
+    float av;
+
+    for (uint32_t r = 0; r < rows; r++)
+    {
+        for (uint32_t j = 0; j < BMM_NR; j++)
+            acc[j] = 0;
+
+        for (uint32_t k = 0; k < K; k++)
+        {
+            av = a[(size_t)r * K + k];
+            bk = &b[(size_t)k * ldb];
+            for (uint32_t j = 0; j < BMM_NR; j++)
+                acc[j] += av * bk[j];
+        }
+
+        memcpy(&c[(size_t)r * ldc], acc, sizeof(float) * width);
+    }
+}
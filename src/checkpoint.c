@@ -0,0 +1,217 @@
+#include "checkpoint.h"
+#include "ckpt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATE_NAME "train.state"
+
+/* Utility functions */
+static void* writer_loop(void* arg);
+static tensor_t* state_tensor();
+
+checkpoint_t* checkpoint_init(const char* path, const model_t* model)
+{
+    checkpoint_t* ckpt = (checkpoint_t*)calloc(1, sizeof(checkpoint_t));
+    tensor_t** params = (tensor_t**)malloc(sizeof(tensor_t*) * 2 * model->n_layers);
+    uint32_t n_params;
+
+    ckpt->path = (char*)malloc(strlen(path) + 1);
+    strcpy(ckpt->path, path);
+    ckpt->config = (char*)malloc(strlen(model->config) + 1);
+    strcpy(ckpt->config, model->config);
+
+    /* The state goes last, under its own name */
+    ckpt->names = (char (*)[MODEL_PARAM_NAME_LEN])malloc(
+            MODEL_PARAM_NAME_LEN * (2 * model->n_layers + 1));
+    n_params = model_params(model, params, ckpt->names);
+    strcpy(ckpt->names[n_params], STATE_NAME);
+    ckpt->n_tensors = n_params + 1;
+
+    for (int s = 0; s < 2; s++)
+    {
+        ckpt->slots[s] = (tensor_t**)malloc(sizeof(tensor_t*) * ckpt->n_tensors);
+        for (uint32_t i = 0; i < n_params; i++)
+            ckpt->slots[s][i] = tensor_copy(params[i]);
+        ckpt->slots[s][n_params] = state_tensor();
+    }
+    free(params);
+
+    ckpt->writing = ckpt->pending = -1;
+    pthread_mutex_init(&ckpt->lock, NULL);
+    pthread_cond_init(&ckpt->cond, NULL);
+    ckpt->running = 1;
+    pthread_create(&ckpt->thread, NULL, writer_loop, ckpt);
+    return ckpt;
+}
+
+void checkpoint_clean(checkpoint_t* ckpt)
+{
+    checkpoint_wait(ckpt);
+
+    pthread_mutex_lock(&ckpt->lock);
+    ckpt->running = 0;
+    pthread_cond_broadcast(&ckpt->cond);
+    pthread_mutex_unlock(&ckpt->lock);
+    pthread_join(ckpt->thread, NULL);
+    if (ckpt->n_failed > 0)
+        printf("[WARNING] %u of %u checkpoints of %s could not be written\n", ckpt->n_failed,
+                ckpt->n_failed + ckpt->n_written, ckpt->path);
+
+    for (int s = 0; s < 2; s++)
+    {
+        for (uint32_t i = 0; i < ckpt->n_tensors; i++)
+            tensor_clean(ckpt->slots[s][i]);
+        free(ckpt->slots[s]);
+    }
+    pthread_mutex_destroy(&ckpt->lock);
+    pthread_cond_destroy(&ckpt->cond);
+    free(ckpt->names);
+    free(ckpt->config);
+    free(ckpt->path);
+    free(ckpt);
+}
+
+void checkpoint_snapshot(checkpoint_t* ckpt, const model_t* model, const train_state_t* state)
+{
+    tensor_t** params = (tensor_t**)malloc(sizeof(tensor_t*) * 2 * model->n_layers);
+    char (*names)[MODEL_PARAM_NAME_LEN] = (char (*)[MODEL_PARAM_NAME_LEN])malloc(
+            MODEL_PARAM_NAME_LEN * 2 * model->n_layers);
+    uint32_t n_params = model_params(model, params, names);
+    tensor_t** slot;
+    int s;
+
+    if (n_params + 1 != ckpt->n_tensors)
+    {
+        printf("[ERROR] Checkpoint snapshot of a model with other layers\n");
+        exit(1);
+    }
+
+    /* The writer only reads the slot it took, so the other one is free even
+     * when it still holds a snapshot it did not get to */
+    pthread_mutex_lock(&ckpt->lock);
+    s = ckpt->writing == 0 ? 1 : 0;
+    if (ckpt->pending == s)
+        ckpt->n_replaced++;
+
+    slot = ckpt->slots[s];
+    for (uint32_t i = 0; i < n_params; i++)
+        memcpy(slot[i]->values, params[i]->values, sizeof(float) * tensor_numel(params[i]));
+    memcpy(slot[n_params]->values, state, sizeof(train_state_t));
+
+    ckpt->pending = s;
+    pthread_cond_broadcast(&ckpt->cond);
+    pthread_mutex_unlock(&ckpt->lock);
+
+    free(names);
+    free(params);
+}
+
+void checkpoint_wait(checkpoint_t* ckpt)
+{
+    pthread_mutex_lock(&ckpt->lock);
+    while (ckpt->pending >= 0 || ckpt->writing >= 0)
+        pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+    pthread_mutex_unlock(&ckpt->lock);
+}
+
+model_t* checkpoint_resume(const char* path, uint32_t max_batch, train_state_t* state)
+{
+    ckpt_t* file = ckpt_open(path);
+    model_t* model;
+    tensor_t** params, *view;
+    char (*names)[MODEL_PARAM_NAME_LEN];
+    uint32_t n_params;
+
+    /* Every parameter is copied out, so the checksum costs no extra faults */
+    if (!ckpt_verify(file))
+    {
+        printf("[ERROR] Checkpoint %s is corrupted\n", path);
+        exit(1);
+    }
+    if (file->meta == NULL)
+    {
+        printf("[ERROR] Checkpoint %s holds no model config\n", path);
+        exit(1);
+    }
+
+    model = model_parse(file->meta, max_batch);
+    params = (tensor_t**)malloc(sizeof(tensor_t*) * 2 * model->n_layers);
+    names = (char (*)[MODEL_PARAM_NAME_LEN])malloc(MODEL_PARAM_NAME_LEN * 2 * model->n_layers);
+    n_params = model_params(model, params, names);
+
+    for (uint32_t i = 0; i <= n_params; i++)
+    {
+        view = ckpt_tensor(file, i < n_params ? names[i] : STATE_NAME);
+        if (view == NULL || view->dtype != TENSOR_F32 ||
+                tensor_numel(view) != (i < n_params ? tensor_numel(params[i]) :
+                sizeof(train_state_t) / sizeof(float)))
+        {
+            printf("[ERROR] Checkpoint %s has no %s to resume from\n", path,
+                    i < n_params ? names[i] : STATE_NAME);
+            exit(1);
+        }
+
+        if (i < n_params)
+            memcpy(params[i]->values, view->values, sizeof(float) * tensor_numel(view));
+        else
+            memcpy(state, view->values, sizeof(train_state_t));
+        ckpt_view_clean(view);
+    }
+
+    ckpt_close(file);
+    free(names);
+    free(params);
+    return model;
+}
+
+void* writer_loop(void* arg)
+{
+    checkpoint_t* ckpt = (checkpoint_t*)arg;
+    const char** names = (const char**)malloc(sizeof(char*) * ckpt->n_tensors);
+    int s, failed;
+
+    for (uint32_t i = 0; i < ckpt->n_tensors; i++)
+        names[i] = ckpt->names[i];
+
+    pthread_mutex_lock(&ckpt->lock);
+    while (1)
+    {
+        while (ckpt->running && ckpt->pending < 0)
+            pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+        if (ckpt->pending < 0)
+            break;
+
+        s = ckpt->writing = ckpt->pending;
+        ckpt->pending = -1;
+        pthread_mutex_unlock(&ckpt->lock);
+
+        /* A full disk or an I/O error loses this checkpoint, not the run */
+        failed = ckpt_save(ckpt->path, ckpt->config, names, (const tensor_t**)ckpt->slots[s],
+                ckpt->n_tensors) != 0;
+        if (failed)
+            printf("[WARNING] Training goes on, the last checkpoint on disk is an older one\n");
+
+        pthread_mutex_lock(&ckpt->lock);
+        ckpt->writing = -1;
+        if (failed)
+            ckpt->n_failed++;
+        else
+            ckpt->n_written++;
+        pthread_cond_broadcast(&ckpt->cond);
+    }
+    pthread_mutex_unlock(&ckpt->lock);
+
+    free(names);
+    return NULL;
+}
+
+/* F32 tensor just large enough for the raw bytes of a train_state_t */
+tensor_t* state_tensor()
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t));
+
+    shape[0] = (sizeof(train_state_t) + sizeof(float) - 1) / sizeof(float);
+    return tensor_zeros(shape, 1);
+}
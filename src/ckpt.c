@@ -0,0 +1,284 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ckpt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CKPT_MAGIC "MNISTCKP"
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* Utility functions */
+static uint64_t align_up(uint64_t n);
+static uint64_t checksum(const uint8_t* data, size_t size);
+static const void* tensor_data(const tensor_t* t, uint64_t* nbytes);
+static uint64_t entry_bytes(const ckpt_entry_t* e);
+static void sync_dir(const char* path);
+
+int ckpt_save(const char* path, const char* meta, const char** names,
+        const tensor_t** tensors, uint32_t n)
+{
+    ckpt_header_t header;
+    ckpt_entry_t* entries = (ckpt_entry_t*)calloc(n, sizeof(ckpt_entry_t));
+    uint64_t meta_len = meta != NULL ? strlen(meta) + 1 : 0, offset, nbytes;
+    size_t size;
+    uint8_t* file;
+    const void* data;
+    char tmp_path[4096];
+    FILE* f;
+    int failed;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CKPT_MAGIC, sizeof(header.magic));
+    header.version = CKPT_VERSION;
+    header.n_tensors = n;
+    header.meta_len = meta_len;
+    header.data_offset = align_up(sizeof(header) + n * sizeof(ckpt_entry_t) + meta_len);
+
+    offset = header.data_offset;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (strlen(names[i]) >= CKPT_NAME_LEN || tensors[i]->n_dims > CKPT_MAX_DIMS)
+        {
+            printf("[ERROR] Tensor %s has a name over %d chars or over %d dims\n", names[i],
+                    CKPT_NAME_LEN - 1, CKPT_MAX_DIMS);
+            exit(1);
+        }
+        strcpy(entries[i].name, names[i]);
+        entries[i].dtype = tensors[i]->dtype;
+        entries[i].n_dims = tensors[i]->n_dims;
+        memcpy(entries[i].shape, tensors[i]->shape, sizeof(uint32_t) * tensors[i]->n_dims);
+        tensor_data(tensors[i], &entries[i].nbytes);
+        entries[i].offset = offset;
+        offset = align_up(offset + entries[i].nbytes);
+    }
+    header.data_size = offset - header.data_offset;
+
+    /* The whole file is built in memory first so the checksum can go in
+     * the header */
+    size = offset;
+    file = (uint8_t*)calloc(size, 1);
+    memcpy(file + sizeof(header), entries, n * sizeof(ckpt_entry_t));
+    if (meta_len > 0)
+        memcpy(file + sizeof(header) + n * sizeof(ckpt_entry_t), meta, meta_len);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        data = tensor_data(tensors[i], &nbytes);
+        memcpy(file + entries[i].offset, data, nbytes);
+    }
+    header.checksum = checksum(file + sizeof(header), size - sizeof(header));
+    memcpy(file, &header, sizeof(header));
+
+    /* Written next to the target, flushed to disk and renamed over it, so
+     * readers and crashes only ever see a complete checkpoint */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    f = fopen(tmp_path, "wb");
+    failed = f == NULL || fwrite(file, 1, size, f) != size || fflush(f) != 0 ||
+            fsync(fileno(f)) != 0;
+    if (f != NULL)
+        failed |= fclose(f) != 0;
+    failed = failed || rename(tmp_path, path) != 0;
+
+    free(file);
+    free(entries);
+    if (failed)
+    {
+        printf("[ERROR] Could not write checkpoint %s\n", path);
+        unlink(tmp_path);
+        return -1;
+    }
+    sync_dir(path);
+    return 0;
+}
+
+ckpt_t* ckpt_open(const char* path)
+{
+    ckpt_t* ckpt = ckpt_try_open(path);
+
+    if (ckpt == NULL)
+        exit(1);
+    return ckpt;
+}
+
+ckpt_t* ckpt_try_open(const char* path)
+{
+    ckpt_t* ckpt = (ckpt_t*)calloc(1, sizeof(ckpt_t));
+    const ckpt_header_t* h;
+    const ckpt_entry_t* e;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        printf("[ERROR] Could not open checkpoint %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        free(ckpt);
+        return NULL;
+    }
+
+    ckpt->size = st.st_size;
+    ckpt->refs = 1;
+    ckpt->base = ckpt->size >= sizeof(ckpt_header_t) ?
+            (uint8_t*)mmap(NULL, ckpt->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (ckpt->base == MAP_FAILED)
+    {
+        printf("[ERROR] Could not map checkpoint %s\n", path);
+        free(ckpt);
+        return NULL;
+    }
+
+    h = ckpt->header = (const ckpt_header_t*)ckpt->base;
+    if (memcmp(h->magic, CKPT_MAGIC, sizeof(h->magic)) || h->version != CKPT_VERSION)
+    {
+        printf("[ERROR] %s is not a version %d checkpoint\n", path, CKPT_VERSION);
+        ckpt_close(ckpt);
+        return NULL;
+    }
+
+    if (h->data_offset + h->data_size != ckpt->size ||
+            sizeof(ckpt_header_t) + h->n_tensors * sizeof(ckpt_entry_t) + h->meta_len > h->data_offset)
+    {
+        printf("[ERROR] Checkpoint %s is truncated\n", path);
+        ckpt_close(ckpt);
+        return NULL;
+    }
+
+    ckpt->entries = (const ckpt_entry_t*)(ckpt->base + sizeof(ckpt_header_t));
+    ckpt->meta = h->meta_len > 0 ? (const char*)&ckpt->entries[h->n_tensors] : NULL;
+    if (ckpt->meta != NULL && ckpt->meta[h->meta_len - 1] != '\0')
+    {
+        printf("[ERROR] Checkpoint %s has an unterminated meta string\n", path);
+        ckpt_close(ckpt);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < h->n_tensors; i++)
+    {
+        e = &ckpt->entries[i];
+        if (e->offset % CKPT_ALIGN || e->offset + e->nbytes > ckpt->size ||
+                e->n_dims > CKPT_MAX_DIMS || e->dtype > TENSOR_F16 || e->nbytes != entry_bytes(e))
+        {
+            printf("[ERROR] Checkpoint %s has an invalid entry %u\n", path, i);
+            ckpt_close(ckpt);
+            return NULL;
+        }
+    }
+    return ckpt;
+}
+
+void ckpt_close(ckpt_t* ckpt)
+{
+    if (__atomic_sub_fetch(&ckpt->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    munmap(ckpt->base, ckpt->size);
+    free(ckpt);
+}
+
+int ckpt_verify(const ckpt_t* ckpt)
+{
+    return checksum(ckpt->base + sizeof(ckpt_header_t), ckpt->size - sizeof(ckpt_header_t)) ==
+            ckpt->header->checksum;
+}
+
+ckpt_t* ckpt_retain(ckpt_t* ckpt)
+{
+    __atomic_add_fetch(&ckpt->refs, 1, __ATOMIC_RELAXED);
+    return ckpt;
+}
+
+tensor_t* ckpt_tensor(const ckpt_t* ckpt, const char* name)
+{
+    const ckpt_entry_t* e = NULL;
+    tensor_t* t;
+
+    for (uint32_t i = 0; i < ckpt->header->n_tensors && e == NULL; i++)
+        if (!strncmp(ckpt->entries[i].name, name, CKPT_NAME_LEN))
+            e = &ckpt->entries[i];
+    if (e == NULL)
+        return NULL;
+
+    t = (tensor_t*)calloc(1, sizeof(tensor_t));
+    t->n_dims = e->n_dims;
+    t->shape = (uint32_t*)malloc(sizeof(uint32_t) * CKPT_MAX_DIMS);
+    memcpy(t->shape, e->shape, sizeof(uint32_t) * e->n_dims);
+    t->dtype = e->dtype;
+    if (t->dtype == TENSOR_F32)
+        t->values = (float*)(ckpt->base + e->offset);
+    else
+        t->halfs = (uint16_t*)(ckpt->base + e->offset);
+    return t;
+}
+
+void ckpt_view_clean(tensor_t* t)
+{
+    free(t->shape);
+    free(t);
+}
+
+uint64_t align_up(uint64_t n)
+{
+    return (n + CKPT_ALIGN - 1) / CKPT_ALIGN * CKPT_ALIGN;
+}
+
+/* FNV-1a over 8 byte words, size is a multiple of 8 as every section ends
+ * on CKPT_ALIGN bytes */
+uint64_t checksum(const uint8_t* data, size_t size)
+{
+    uint64_t hash = FNV_OFFSET, word;
+
+    for (size_t i = 0; i + 8 <= size; i += 8)
+    {
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    return hash;
+}
+
+const void* tensor_data(const tensor_t* t, uint64_t* nbytes)
+{
+    if (t->dtype == TENSOR_F32)
+    {
+        *nbytes = sizeof(float) * (uint64_t)tensor_numel(t);
+        return t->values;
+    }
+    *nbytes = sizeof(uint16_t) * (uint64_t)tensor_numel(t);
+    return t->halfs;
+}
+
+uint64_t entry_bytes(const ckpt_entry_t* e)
+{
+    uint64_t n = e->dtype == TENSOR_F32 ? sizeof(float) : sizeof(uint16_t);
+
+    for (uint32_t d = 0; d < e->n_dims && d < CKPT_MAX_DIMS; d++)
+        n *= e->shape[d];
+    return n;
+}
+
+/* Makes the rename of path durable */
+void sync_dir(const char* path)
+{
+    char dir[4096];
+    const char* slash = strrchr(path, '/');
+    int fd;
+
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+
+    fd = open(dir, O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+
+#include "comm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define COMM_MAGIC 0x4d4e4953
+#define LINE 64
+#define SPIN 2000
+#define OPEN_RETRIES 10000
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t ready;
+    uint32_t world;
+    uint32_t n_buckets;
+    uint32_t sizes[COMM_MAX_BUCKETS];
+    uint32_t barrier;
+} comm_header_t;
+
+/* Utility functions */
+static size_t align_up(size_t n);
+static size_t header_size();
+static size_t region_size(uint32_t n_floats);
+static size_t segment_size(int world, const uint32_t* sizes, int n_buckets);
+static uint32_t* region(comm_t* comm, int bucket, int rank);
+static float* region_data(comm_t* comm, int bucket, int rank);
+
+static void wait_counter(uint32_t* addr, uint32_t target);
+static void publish(uint32_t* addr, uint32_t value);
+static void ring_allreduce(comm_t* comm, int bucket);
+static void* progress_loop(void* arg);
+
+int comm_create(const char* name, int world, const uint32_t* bucket_sizes, int n_buckets)
+{
+    size_t size = segment_size(world, bucket_sizes, n_buckets);
+    comm_header_t* header;
+    int fd;
+
+    if (n_buckets > COMM_MAX_BUCKETS)
+    {
+        printf("[ERROR] At most %d buckets are supported\n", COMM_MAX_BUCKETS);
+        return -1;
+    }
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, size) != 0)
+    {
+        printf("[ERROR] Creating shared memory segment %s\n", name);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    header = (comm_header_t*)mmap(NULL, header_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        printf("[ERROR] Mapping shared memory segment %s\n", name);
+        return -1;
+    }
+
+    header->magic = COMM_MAGIC;
+    header->world = world;
+    header->n_buckets = n_buckets;
+    for (int i = 0; i < n_buckets; i++)
+        header->sizes[i] = bucket_sizes[i];
+    publish(&header->ready, 1);
+
+    munmap(header, header_size());
+    return 0;
+}
+
+comm_t* comm_open(const char* name, int rank)
+{
+    comm_t* comm;
+    comm_header_t* header;
+    struct stat st;
+    struct timespec pause = {0, 1000000};
+    int fd = -1;
+
+    /* Ranks started by hand may come up before the segment exists */
+    for (int i = 0; i < OPEN_RETRIES && fd < 0; i++)
+    {
+        fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0)
+            nanosleep(&pause, NULL);
+    }
+
+    if (fd < 0)
+    {
+        printf("[ERROR] Opening shared memory segment %s\n", name);
+        return NULL;
+    }
+
+    while (fstat(fd, &st) == 0 && st.st_size < header_size())
+        nanosleep(&pause, NULL);
+
+    header = (comm_header_t*)mmap(NULL, header_size(), PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+    {
+        printf("[ERROR] Mapping shared memory segment %s\n", name);
+        close(fd);
+        return NULL;
+    }
+    wait_counter(&header->ready, 1);
+
+    if (header->magic != COMM_MAGIC || rank < 0 || rank >= header->world)
+    {
+        printf("[ERROR] Invalid segment %s or rank %d\n", name, rank);
+        munmap(header, header_size());
+        close(fd);
+        return NULL;
+    }
+
+    comm = (comm_t*)calloc(1, sizeof(comm_t));
+    strncpy(comm->name, name, sizeof(comm->name) - 1);
+    comm->rank = rank;
+    comm->world = header->world;
+    comm->n_buckets = header->n_buckets;
+    memcpy(comm->sizes, header->sizes, sizeof(comm->sizes));
+    munmap(header, header_size());
+
+    comm->size = segment_size(comm->world, comm->sizes, comm->n_buckets);
+    comm->base = (uint8_t*)mmap(NULL, comm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (comm->base == MAP_FAILED)
+    {
+        printf("[ERROR] Mapping shared memory segment %s\n", name);
+        free(comm);
+        return NULL;
+    }
+
+    pthread_mutex_init(&comm->lock, NULL);
+    pthread_cond_init(&comm->cond, NULL);
+    comm->running = 1;
+    pthread_create(&comm->thread, NULL, progress_loop, comm);
+
+    return comm;
+}
+
+void comm_close(comm_t* comm)
+{
+    pthread_mutex_lock(&comm->lock);
+    comm->running = 0;
+    pthread_cond_broadcast(&comm->cond);
+    pthread_mutex_unlock(&comm->lock);
+    pthread_join(comm->thread, NULL);
+
+    pthread_mutex_destroy(&comm->lock);
+    pthread_cond_destroy(&comm->cond);
+    munmap(comm->base, comm->size);
+    free(comm);
+}
+
+void comm_unlink(const char* name)
+{
+    shm_unlink(name);
+}
+
+float* comm_bucket(comm_t* comm, int bucket)
+{
+    return region_data(comm, bucket, comm->rank);
+}
+
+float* comm_bucket_acquire(comm_t* comm, int bucket)
+{
+    int right = (comm->rank + 1) % comm->world;
+    uint32_t base = comm->rounds[bucket] * (2 * comm->world - 1);
+
+    /* The right neighbour reads our chunks until its last ring step */
+    wait_counter(region(comm, bucket, right), base);
+    return region_data(comm, bucket, comm->rank);
+}
+
+void comm_allreduce(comm_t* comm, int bucket)
+{
+    ring_allreduce(comm, bucket);
+}
+
+void comm_allreduce_start(comm_t* comm, int bucket)
+{
+    pthread_mutex_lock(&comm->lock);
+    comm->queue[comm->q_len++] = bucket;
+    comm->started[bucket]++;
+    pthread_cond_broadcast(&comm->cond);
+    pthread_mutex_unlock(&comm->lock);
+}
+
+void comm_allreduce_wait(comm_t* comm, int bucket)
+{
+    pthread_mutex_lock(&comm->lock);
+    while (comm->done[bucket] != comm->started[bucket])
+        pthread_cond_wait(&comm->cond, &comm->lock);
+    pthread_mutex_unlock(&comm->lock);
+}
+
+void comm_barrier(comm_t* comm)
+{
+    comm_header_t* header = (comm_header_t*)comm->base;
+
+    comm->barriers++;
+    __atomic_fetch_add(&header->barrier, 1, __ATOMIC_ACQ_REL);
+    syscall(SYS_futex, &header->barrier, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    wait_counter(&header->barrier, comm->barriers * comm->world);
+}
+
+/* Ring all-reduce over `world` chunks. Counters count completed steps: one
+ * for depositing the local buffer, then world - 1 reduce-scatter steps and
+ * world - 1 all-gather steps. At ring step s every rank touches chunk
+ * (rank - 1 - s) mod world, reading it from its left neighbour. Waiting for
+ * both neighbours to finish step s - 1 keeps a rank from overwriting a chunk
+ * its right neighbour is still reading. */
+void ring_allreduce(comm_t* comm, int bucket)
+{
+    int world = comm->world;
+    int rank = comm->rank;
+    int left = (rank + world - 1) % world;
+    int right = (rank + 1) % world;
+    uint32_t n = comm->sizes[bucket];
+    uint32_t base = comm->rounds[bucket] * (2 * world - 1);
+
+    uint32_t* me = region(comm, bucket, rank);
+    float* own = region_data(comm, bucket, rank);
+    float* src = region_data(comm, bucket, left);
+    int chunk;
+    uint32_t start, end;
+
+    publish(me, base + 1);
+
+    for (int s = 0; s < 2 * (world - 1); s++)
+    {
+        wait_counter(region(comm, bucket, left), base + 1 + s);
+        wait_counter(region(comm, bucket, right), base + 1 + s);
+
+        chunk = ((rank - 1 - s) % world + world) % world;
+        start = (uint64_t)n * chunk / world;
+        end = (uint64_t)n * (chunk + 1) / world;
+
+        if (s < world - 1)
+            for (uint32_t i = start; i < end; i++)
+                own[i] += src[i];
+        else
+            memcpy(&own[start], &src[start], sizeof(float) * (end - start));
+
+        publish(me, base + 2 + s);
+    }
+
+    comm->rounds[bucket]++;
+}
+
+void* progress_loop(void* arg)
+{
+    comm_t* comm = (comm_t*)arg;
+    int bucket;
+
+    pthread_mutex_lock(&comm->lock);
+    while (1)
+    {
+        while (comm->running && comm->q_len == 0)
+            pthread_cond_wait(&comm->cond, &comm->lock);
+
+        if (comm->q_len == 0)
+            break;
+
+        bucket = comm->queue[0];
+        pthread_mutex_unlock(&comm->lock);
+
+        ring_allreduce(comm, bucket);
+
+        pthread_mutex_lock(&comm->lock);
+        comm->q_len--;
+        memmove(comm->queue, &comm->queue[1], sizeof(int) * comm->q_len);
+        comm->done[bucket]++;
+        pthread_cond_broadcast(&comm->cond);
+    }
+    pthread_mutex_unlock(&comm->lock);
+    return NULL;
+}
+
+void wait_counter(uint32_t* addr, uint32_t target)
+{
+    uint32_t v;
+
+    for (int i = 0; i < SPIN; i++)
+        if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) >= target)
+            return;
+
+    while ((v = __atomic_load_n(addr, __ATOMIC_ACQUIRE)) < target)
+        syscall(SYS_futex, addr, FUTEX_WAIT, v, NULL, NULL, 0);
+}
+
+void publish(uint32_t* addr, uint32_t value)
+{
+    __atomic_store_n(addr, value, __ATOMIC_RELEASE);
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+size_t align_up(size_t n)
+{
+    return (n + LINE - 1) / LINE * LINE;
+}
+
+size_t header_size()
+{
+    return align_up(sizeof(comm_header_t));
+}
+
+/* Counter on its own cache line followed by the data */
+size_t region_size(uint32_t n_floats)
+{
+    return LINE + align_up(sizeof(float) * n_floats);
+}
+
+size_t segment_size(int world, const uint32_t* sizes, int n_buckets)
+{
+    size_t size = header_size();
+    for (int i = 0; i < n_buckets; i++)
+        size += world * region_size(sizes[i]);
+    return size;
+}
+
+uint32_t* region(comm_t* comm, int bucket, int rank)
+{
+    size_t offset = header_size();
+    for (int i = 0; i < bucket; i++)
+        offset += comm->world * region_size(comm->sizes[i]);
+    offset += rank * region_size(comm->sizes[bucket]);
+    return (uint32_t*)(comm->base + offset);
+}
+
+float* region_data(comm_t* comm, int bucket, int rank)
+{
+    return (float*)((uint8_t*)region(comm, bucket, rank) + LINE);
+}
@@ -0,0 +1,652 @@
+#include "conv.h"
+#include "cpu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Patch matrix floats per im2col chunk, whole images at a time */
+#define CONV_CHUNK_FLOATS (1 << 17)
+
+/* Output pixels computed together, each weight vector loaded once for all
+ * of them */
+#define CONV_QB 4
+
+/* The CONV_CB lanes of a channel block */
+typedef float vf_t __attribute__((vector_size(CONV_CB * sizeof(float))));
+
+static const float ZEROS[CONV_CB];
+
+/* Utility functions */
+static uint32_t chunk_images(const conv_shape_t* s);
+static const float* plane(const conv_shape_t* s, const float* x, uint32_t c, uint32_t* step);
+static void valid_cols(const conv_shape_t* s, uint32_t q, uint32_t* k0, uint32_t* k1);
+static void im2col(const conv_shape_t* s, const float* x, uint32_t n_images, float* col);
+static void col2im(const conv_shape_t* s, const float* col, uint32_t n_images, float* dx);
+static void im2col_forward(const conv_shape_t* s, const float* x, const float* W,
+        const float* b, float* y, uint32_t N, float* work);
+static void im2col_backward(const conv_shape_t* s, const float* x, const float* W,
+        const float* dy, float* dx, float* dW, float* db, uint32_t N, float* work);
+static void patch_gemm(const float* col, const float* W, const float* b, float* y,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ);
+static void patch_gemm_avx2(const float* col, const float* W, const float* b, float* y,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ);
+static void patch_gemm_tn(const float* col, const float* dy, float* dW, float* db,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ);
+static void patch_gemm_tn_avx2(const float* col, const float* dy, float* dW, float* db,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ);
+static void patch_gemm_nt(const float* dy, const float* WT, float* dcol,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ);
+static void patch_gemm_nt_avx2(const float* dy, const float* WT, float* dcol,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ);
+static void direct_forward(const conv_shape_t* s, const float* x, const float* W,
+        const float* b, float* y, uint32_t N);
+static void direct_forward_avx2(const conv_shape_t* s, const float* x, const float* W,
+        const float* b, float* y, uint32_t N);
+static void direct_backward(const conv_shape_t* s, const float* x, const float* dy,
+        float* dx, float* dW, uint32_t N, const float* WT);
+static void direct_backward_avx2(const conv_shape_t* s, const float* x, const float* dy,
+        float* dx, float* dW, uint32_t N, const float* WT);
+
+conv_shape_t conv_make_shape(uint32_t C, uint32_t H, uint32_t W, uint32_t K, uint32_t R,
+        uint32_t stride, uint32_t pad, int plain)
+{
+    conv_shape_t s;
+
+    if (C == 0 || K == 0 || R == 0 || stride == 0 || H + 2 * pad < R || W + 2 * pad < R)
+    {
+        printf("[ERROR] Invalid convolution of %ux%u kernels over %ux%ux%u (pad %u)\n",
+                R, R, C, H, W, pad);
+        exit(1);
+    }
+
+    s.C = C;
+    s.H = H;
+    s.W = W;
+    s.K = K;
+    s.R = R;
+    s.stride = stride;
+    s.pad = pad;
+    s.P = (H + 2 * pad - R) / stride + 1;
+    s.Q = (W + 2 * pad - R) / stride + 1;
+    s.plain = plain;
+    return s;
+}
+
+uint32_t conv_blocks(uint32_t n)
+{
+    return (n + CONV_CB - 1) / CONV_CB;
+}
+
+uint32_t conv_in_size(const conv_shape_t* s)
+{
+    return (s->plain ? s->C : conv_blocks(s->C) * CONV_CB) * s->H * s->W;
+}
+
+uint32_t conv_out_size(const conv_shape_t* s)
+{
+    return conv_blocks(s->K) * CONV_CB * s->P * s->Q;
+}
+
+size_t conv_work_size(const conv_shape_t* s)
+{
+    size_t rows = (size_t)chunk_images(s) * s->P * s->Q, CRR = s->C * s->R * s->R;
+    size_t Kp = conv_blocks(s->K) * CONV_CB, Cp = conv_blocks(s->C) * CONV_CB;
+    size_t im2col = rows * CRR + Kp * conv_blocks(CRR) * CONV_CB, direct = Kp * s->R * s->R * Cp;
+
+    return im2col > direct ? im2col : direct;
+}
+
+conv_algo_t conv_select(const conv_shape_t* s)
+{
+    /* The direct path computes CONV_QB pixels of an output row at once, so
+     * narrower outputs waste most of its accumulators. The im2col GEMM
+     * blocks rows across pixels and images instead, at the cost of the patch
+     * copy (bench_conv has the measurements). */
+    if (s->plain || s->Q < CONV_QB)
+        return CONV_IM2COL;
+    return CONV_DIRECT;
+}
+
+void conv2d_forward(const conv_shape_t* s, conv_algo_t algo, const float* x, const float* W,
+        const float* b, float* y, uint32_t N, float* work)
+{
+    if (algo == CONV_AUTO)
+        algo = conv_select(s);
+
+    if (algo == CONV_IM2COL)
+        im2col_forward(s, x, W, b, y, N, work);
+    else if (s->plain)
+    {
+        printf("[ERROR] Direct convolution needs a blocked input\n");
+        exit(1);
+    }
+    else if (cpu_has_avx2_fma())
+        direct_forward_avx2(s, x, W, b, y, N);
+    else
+        direct_forward(s, x, W, b, y, N);
+}
+
+void conv2d_backward(const conv_shape_t* s, conv_algo_t algo, const float* x, const float* W,
+        const float* dy, float* dx, float* dW, float* db, uint32_t N, float* work)
+{
+    uint32_t Kp = conv_blocks(s->K) * CONV_CB, Cp = conv_blocks(s->C) * CONV_CB;
+    uint32_t CRR = s->C * s->R * s->R, PQ = s->P * s->Q, RR = s->R * s->R;
+
+    if (algo == CONV_AUTO)
+        algo = conv_select(s);
+
+    if (algo == CONV_IM2COL)
+        im2col_backward(s, x, W, dy, dx, dW, db, N, work);
+    else if (s->plain)
+    {
+        printf("[ERROR] Direct convolution needs a blocked input\n");
+        exit(1);
+    }
+    else
+    {
+        /* Weights as [Kp, R, R, Cp] so dx accumulates whole channel blocks */
+        memset(work, 0, sizeof(float) * Kp * RR * Cp);
+        for (uint32_t c = 0; c < s->C; c++)
+            for (uint32_t rs = 0; rs < RR; rs++)
+                for (uint32_t k = 0; k < s->K; k++)
+                    work[(k * RR + rs) * Cp + c] = W[(c * RR + rs) * Kp + k];
+
+        if (cpu_has_avx2_fma())
+            direct_backward_avx2(s, x, dy, dx, dW, N, work);
+        else
+            direct_backward(s, x, dy, dx, dW, N, work);
+
+        /* Every image is Kb runs of PQ pixels */
+        memset(db, 0, sizeof(float) * Kp);
+        for (size_t i = 0; i < (size_t)N * Kp * PQ / CONV_CB; i++)
+            for (uint32_t l = 0; l < CONV_CB; l++)
+                db[(i / PQ) % (Kp / CONV_CB) * CONV_CB + l] += dy[i * CONV_CB + l];
+    }
+
+    /* Padding channels get no gradient, so their weights stay zero */
+    for (uint32_t row = 0; row < CRR; row++)
+        for (uint32_t k = s->K; k < Kp; k++)
+            dW[row * Kp + k] = 0;
+    for (uint32_t k = s->K; k < Kp; k++)
+        db[k] = 0;
+}
+
+void maxpool_forward(uint32_t C, uint32_t H, uint32_t W, uint32_t size, const float* x,
+        float* y, uint32_t* argmax, uint32_t N)
+{
+    uint32_t P = H / size, Q = W / size, Cb = conv_blocks(C), in, out, at;
+    const float* img;
+
+    for (uint32_t n = 0; n < N; n++)
+    {
+        img = &x[(size_t)n * Cb * H * W * CONV_CB];
+        for (uint32_t cb = 0; cb < Cb; cb++)
+            for (uint32_t p = 0; p < P; p++)
+                for (uint32_t q = 0; q < Q; q++)
+                {
+                    out = (((n * Cb + cb) * P + p) * Q + q) * CONV_CB;
+                    for (uint32_t l = 0; l < CONV_CB; l++)
+                    {
+                        at = ((cb * H + p * size) * W + q * size) * CONV_CB + l;
+                        for (uint32_t r = 0; r < size; r++)
+                            for (uint32_t c = 0; c < size; c++)
+                            {
+                                in = ((cb * H + p * size + r) * W + q * size + c) * CONV_CB + l;
+                                if (img[in] > img[at])
+                                    at = in;
+                            }
+                        y[out + l] = img[at];
+                        argmax[out + l] = at;
+                    }
+                }
+    }
+}
+
+void maxpool_backward(uint32_t C, uint32_t H, uint32_t W, uint32_t size, const float* dy,
+        const uint32_t* argmax, float* dx, uint32_t N)
+{
+    uint32_t in_size = conv_blocks(C) * H * W * CONV_CB;
+    uint32_t out_size = conv_blocks(C) * (H / size) * (W / size) * CONV_CB;
+
+    memset(dx, 0, sizeof(float) * N * in_size);
+    for (uint32_t n = 0; n < N; n++)
+        for (uint32_t o = 0; o < out_size; o++)
+            dx[(size_t)n * in_size + argmax[n * out_size + o]] += dy[(size_t)n * out_size + o];
+}
+
+uint32_t chunk_images(const conv_shape_t* s)
+{
+    uint32_t per_image = s->P * s->Q * s->C * s->R * s->R;
+    return per_image < CONV_CHUNK_FLOATS ? CONV_CHUNK_FLOATS / per_image : 1;
+}
+
+/* Channel c of image x, its pixels being `step` floats apart */
+const float* plane(const conv_shape_t* s, const float* x, uint32_t c, uint32_t* step)
+{
+    *step = s->plain ? 1 : CONV_CB;
+    if (s->plain)
+        return &x[c * s->H * s->W];
+    return &x[(c / CONV_CB) * s->H * s->W * CONV_CB + c % CONV_CB];
+}
+
+/* Kernel columns [*k0, *k1) of output column q land inside the image */
+void valid_cols(const conv_shape_t* s, uint32_t q, uint32_t* k0, uint32_t* k1)
+{
+    int w0 = (int)(q * s->stride) - (int)s->pad;
+
+    *k0 = w0 < 0 ? -w0 : 0;
+    *k1 = w0 + (int)s->R > (int)s->W ? s->W - w0 : s->R;
+}
+
+/* One [C * R * R] row per output pixel of every image, 0 in the padding */
+void im2col(const conv_shape_t* s, const float* x, uint32_t n_images, float* col)
+{
+    uint32_t R = s->R, in_size = conv_in_size(s), step, k0, k1;
+    const float* in;
+    int h, w0;
+
+    for (uint32_t n = 0; n < n_images; n++)
+        for (uint32_t p = 0; p < s->P; p++)
+            for (uint32_t q = 0; q < s->Q; q++)
+            {
+                valid_cols(s, q, &k0, &k1);
+                w0 = (int)(q * s->stride) - (int)s->pad;
+                for (uint32_t c = 0; c < s->C; c++)
+                {
+                    in = plane(s, &x[(size_t)n * in_size], c, &step);
+                    for (uint32_t r = 0; r < R; r++, col += R)
+                    {
+                        h = (int)(p * s->stride + r) - (int)s->pad;
+                        if (h < 0 || h >= s->H)
+                        {
+                            memset(col, 0, sizeof(float) * R);
+                            continue;
+                        }
+                        for (uint32_t k = 0; k < k0; k++)
+                            col[k] = 0;
+                        for (uint32_t k = k0; k < k1; k++)
+                            col[k] = in[(h * s->W + w0 + k) * step];
+                        for (uint32_t k = k1; k < R; k++)
+                            col[k] = 0;
+                    }
+                }
+            }
+}
+
+/* Adds every patch row back onto the pixels it was read from */
+void col2im(const conv_shape_t* s, const float* col, uint32_t n_images, float* dx)
+{
+    uint32_t R = s->R, in_size = conv_in_size(s), step, k0, k1;
+    float* in;
+    int h, w0;
+
+    for (uint32_t n = 0; n < n_images; n++)
+        for (uint32_t p = 0; p < s->P; p++)
+            for (uint32_t q = 0; q < s->Q; q++)
+            {
+                valid_cols(s, q, &k0, &k1);
+                w0 = (int)(q * s->stride) - (int)s->pad;
+                for (uint32_t c = 0; c < s->C; c++)
+                {
+                    in = (float*)plane(s, &dx[(size_t)n * in_size], c, &step);
+                    for (uint32_t r = 0; r < R; r++, col += R)
+                    {
+                        h = (int)(p * s->stride + r) - (int)s->pad;
+                        if (h < 0 || h >= s->H)
+                            continue;
+                        for (uint32_t k = k0; k < k1; k++)
+                            in[(h * s->W + w0 + k) * step] += col[k];
+                    }
+                }
+            }
+}
+
+void im2col_forward(const conv_shape_t* s, const float* x, const float* W,
+        const float* b, float* y, uint32_t N, float* work)
+{
+    uint32_t CRR = s->C * s->R * s->R, PQ = s->P * s->Q, Kb = conv_blocks(s->K);
+    uint32_t nb = chunk_images(s), n_images, in_size = conv_in_size(s);
+
+    for (uint32_t n0 = 0; n0 < N; n0 += nb)
+    {
+        n_images = N - n0 < nb ? N - n0 : nb;
+        im2col(s, &x[(size_t)n0 * in_size], n_images, work);
+        if (cpu_has_avx2_fma())
+            patch_gemm_avx2(work, W, b, &y[(size_t)n0 * Kb * PQ * CONV_CB], n_images * PQ, CRR, Kb, PQ);
+        else
+            patch_gemm(work, W, b, &y[(size_t)n0 * Kb * PQ * CONV_CB], n_images * PQ, CRR, Kb, PQ);
+    }
+}
+
+void im2col_backward(const conv_shape_t* s, const float* x, const float* W,
+        const float* dy, float* dx, float* dW, float* db, uint32_t N, float* work)
+{
+    uint32_t CRR = s->C * s->R * s->R, PQ = s->P * s->Q, Kb = conv_blocks(s->K);
+    uint32_t nb = chunk_images(s), n_images, in_size = conv_in_size(s);
+    uint32_t Kp = Kb * CONV_CB, CRRp = conv_blocks(CRR) * CONV_CB;
+    float* WT = &work[(size_t)nb * PQ * CRR];
+    const float* g;
+
+    /* [Kp, CRRp] so a patch row gradient is a sum of WT rows */
+    memset(WT, 0, sizeof(float) * Kp * CRRp);
+    for (uint32_t j = 0; j < CRR; j++)
+        for (uint32_t k = 0; k < Kp; k++)
+            WT[k * CRRp + j] = W[j * Kp + k];
+
+    memset(dW, 0, sizeof(float) * CRR * Kp);
+    memset(db, 0, sizeof(float) * Kp);
+    if (dx != NULL)
+        memset(dx, 0, sizeof(float) * N * in_size);
+
+    for (uint32_t n0 = 0; n0 < N; n0 += nb)
+    {
+        n_images = N - n0 < nb ? N - n0 : nb;
+        g = &dy[(size_t)n0 * Kb * PQ * CONV_CB];
+        im2col(s, &x[(size_t)n0 * in_size], n_images, work);
+        if (cpu_has_avx2_fma())
+            patch_gemm_tn_avx2(work, g, dW, db, n_images * PQ, CRR, Kb, PQ);
+        else
+            patch_gemm_tn(work, g, dW, db, n_images * PQ, CRR, Kb, PQ);
+
+        /* The patch matrix is done with, its gradient takes its place */
+        if (dx == NULL)
+            continue;
+        if (cpu_has_avx2_fma())
+            patch_gemm_nt_avx2(g, WT, work, n_images * PQ, CRR, Kb, PQ);
+        else
+            patch_gemm_nt(g, WT, work, n_images * PQ, CRR, Kb, PQ);
+        col2im(s, work, n_images, &dx[(size_t)n0 * in_size]);
+    }
+}
+
+/* Every kernel below is compiled twice from an always inlined body, once for
+ * the baseline target and once for AVX2, on vectors of the CONV_CB lanes of a
+ * channel block. Blocks of CONV_QB output pixels share each weight load and
+ * keep their accumulators in registers. */
+#define KERNEL_VARIANTS(name, params, args) \
+    void name params { name##_body args; } \
+    __attribute__((target("avx2,fma"))) void name##_avx2 params { name##_body args; }
+
+/* Output pixel m of a patch GEMM is pixel m % PQ of image m / PQ, the lanes
+ * of block kb of which are at block_at(m, kb) in the blocked layout */
+#define block_at(m, kb) (((size_t)((m) / PQ) * Kb + (kb)) * PQ + (m) % PQ) * CONV_CB
+
+/* y = col [rows, CRR] @ W + b, straight into the blocked layout. The last
+ * block of rows repeats the last row rather than branching. */
+static inline __attribute__((always_inline))
+void patch_gemm_body(const float* col, const float* W, const float* b, float* y,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ)
+{
+    uint32_t Kp = Kb * CONV_CB;
+    const float* a0, *a1, *a2, *a3;
+    vf_t acc0, acc1, acc2, acc3, wv;
+
+    for (uint32_t kb = 0; kb < Kb; kb++)
+        for (uint32_t m = 0; m < rows; m += CONV_QB)
+        {
+            a0 = &col[(size_t)m * CRR];
+            a1 = &col[(size_t)(m + 1 < rows ? m + 1 : m) * CRR];
+            a2 = &col[(size_t)(m + 2 < rows ? m + 2 : m) * CRR];
+            a3 = &col[(size_t)(m + 3 < rows ? m + 3 : m) * CRR];
+            memcpy(&acc0, &b[kb * CONV_CB], sizeof(vf_t));
+            acc1 = acc2 = acc3 = acc0;
+
+            for (uint32_t j = 0; j < CRR; j++)
+            {
+                memcpy(&wv, &W[j * Kp + kb * CONV_CB], sizeof(vf_t));
+                acc0 += a0[j] * wv;
+                acc1 += a1[j] * wv;
+                acc2 += a2[j] * wv;
+                acc3 += a3[j] * wv;
+            }
+
+            memcpy(&y[block_at(m, kb)], &acc0, sizeof(vf_t));
+            if (m + 1 < rows)
+                memcpy(&y[block_at(m + 1, kb)], &acc1, sizeof(vf_t));
+            if (m + 2 < rows)
+                memcpy(&y[block_at(m + 2, kb)], &acc2, sizeof(vf_t));
+            if (m + 3 < rows)
+                memcpy(&y[block_at(m + 3, kb)], &acc3, sizeof(vf_t));
+        }
+}
+
+/* dW += col^T @ dy and db += the sum of dy over its rows, dy being read in
+ * the blocked layout. Rows past the end get a zero gradient. */
+static inline __attribute__((always_inline))
+void patch_gemm_tn_body(const float* col, const float* dy, float* dW, float* db,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ)
+{
+    uint32_t Kp = Kb * CONV_CB;
+    const float* a0, *a1, *a2, *a3;
+    vf_t g0, g1, g2, g3, dw, dbv;
+
+    for (uint32_t kb = 0; kb < Kb; kb++)
+    {
+        memcpy(&dbv, &db[kb * CONV_CB], sizeof(vf_t));
+        for (uint32_t m = 0; m < rows; m += CONV_QB)
+        {
+            a0 = &col[(size_t)m * CRR];
+            a1 = &col[(size_t)(m + 1 < rows ? m + 1 : m) * CRR];
+            a2 = &col[(size_t)(m + 2 < rows ? m + 2 : m) * CRR];
+            a3 = &col[(size_t)(m + 3 < rows ? m + 3 : m) * CRR];
+            memcpy(&g0, &dy[block_at(m, kb)], sizeof(vf_t));
+            g1 = g2 = g3 = (vf_t){0};
+            if (m + 1 < rows)
+                memcpy(&g1, &dy[block_at(m + 1, kb)], sizeof(vf_t));
+            if (m + 2 < rows)
+                memcpy(&g2, &dy[block_at(m + 2, kb)], sizeof(vf_t));
+            if (m + 3 < rows)
+                memcpy(&g3, &dy[block_at(m + 3, kb)], sizeof(vf_t));
+            dbv += g0 + g1 + g2 + g3;
+
+            for (uint32_t j = 0; j < CRR; j++)
+            {
+                memcpy(&dw, &dW[j * Kp + kb * CONV_CB], sizeof(vf_t));
+                dw += a0[j] * g0 + a1[j] * g1 + a2[j] * g2 + a3[j] * g3;
+                memcpy(&dW[j * Kp + kb * CONV_CB], &dw, sizeof(vf_t));
+            }
+        }
+        memcpy(&db[kb * CONV_CB], &dbv, sizeof(vf_t));
+    }
+}
+
+/* dcol [rows, CRR] = dy @ W^T, with W^T given as WT [Kp, CRR rounded up to
+ * CONV_CB] and dy read in the blocked layout */
+static inline __attribute__((always_inline))
+void patch_gemm_nt_body(const float* dy, const float* WT, float* dcol,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ)
+{
+    uint32_t CRRp = conv_blocks(CRR) * CONV_CB, n;
+    const float* g0, *g1, *g2, *g3;
+    vf_t acc0, acc1, acc2, acc3, wv;
+
+    for (uint32_t m = 0; m < rows; m += CONV_QB)
+        for (uint32_t j = 0; j < CRR; j += CONV_CB)
+        {
+            acc0 = acc1 = acc2 = acc3 = (vf_t){0};
+            for (uint32_t kb = 0; kb < Kb; kb++)
+            {
+                g0 = &dy[block_at(m, kb)];
+                g1 = &dy[block_at(m + 1 < rows ? m + 1 : m, kb)];
+                g2 = &dy[block_at(m + 2 < rows ? m + 2 : m, kb)];
+                g3 = &dy[block_at(m + 3 < rows ? m + 3 : m, kb)];
+                for (uint32_t l = 0; l < CONV_CB; l++)
+                {
+                    memcpy(&wv, &WT[(kb * CONV_CB + l) * CRRp + j], sizeof(vf_t));
+                    acc0 += g0[l] * wv;
+                    acc1 += g1[l] * wv;
+                    acc2 += g2[l] * wv;
+                    acc3 += g3[l] * wv;
+                }
+            }
+
+            n = CRR - j < CONV_CB ? CRR - j : CONV_CB;
+            memcpy(&dcol[(size_t)m * CRR + j], &acc0, sizeof(float) * n);
+            if (m + 1 < rows)
+                memcpy(&dcol[(size_t)(m + 1) * CRR + j], &acc1, sizeof(float) * n);
+            if (m + 2 < rows)
+                memcpy(&dcol[(size_t)(m + 2) * CRR + j], &acc2, sizeof(float) * n);
+            if (m + 3 < rows)
+                memcpy(&dcol[(size_t)(m + 3) * CRR + j], &acc3, sizeof(float) * n);
+        }
+}
+
+/* Pixels of a CONV_QB block outside the image (or past the end of the row)
+ * read ZEROS and write to a local sink instead of branching */
+static inline __attribute__((always_inline))
+void direct_forward_body(const conv_shape_t* s, const float* x, const float* W,
+        const float* b, float* y, uint32_t N)
+{
+    uint32_t Cb = conv_blocks(s->C), Kb = conv_blocks(s->K), Kp = Kb * CONV_CB;
+    uint32_t R = s->R, cw;
+    const float* img, *row, *px[CONV_QB], *wrow;
+    vf_t acc0, acc1, acc2, acc3, wv;
+    float* out;
+    int h, w;
+
+    for (uint32_t n = 0; n < N; n++)
+    {
+        img = &x[(size_t)n * Cb * s->H * s->W * CONV_CB];
+        for (uint32_t kb = 0; kb < Kb; kb++)
+            for (uint32_t p = 0; p < s->P; p++)
+                for (uint32_t q = 0; q < s->Q; q += CONV_QB)
+                {
+                    memcpy(&acc0, &b[kb * CONV_CB], sizeof(vf_t));
+                    acc1 = acc2 = acc3 = acc0;
+
+                    for (uint32_t cb = 0; cb < Cb; cb++)
+                    {
+                        cw = s->C - cb * CONV_CB < CONV_CB ? s->C - cb * CONV_CB : CONV_CB;
+                        for (uint32_t r = 0; r < R; r++)
+                        {
+                            h = (int)(p * s->stride + r) - (int)s->pad;
+                            if (h < 0 || h >= s->H)
+                                continue;
+                            row = &img[(cb * s->H + h) * s->W * CONV_CB];
+                            for (uint32_t k = 0; k < R; k++)
+                            {
+                                for (uint32_t t = 0; t < CONV_QB; t++)
+                                {
+                                    w = (int)((q + t) * s->stride + k) - (int)s->pad;
+                                    px[t] = w >= 0 && w < s->W && q + t < s->Q ? &row[w * CONV_CB] : ZEROS;
+                                }
+                                wrow = &W[((cb * CONV_CB * R + r) * R + k) * Kp + kb * CONV_CB];
+                                for (uint32_t c = 0; c < cw; c++)
+                                {
+                                    memcpy(&wv, &wrow[c * R * R * Kp], sizeof(vf_t));
+                                    acc0 += px[0][c] * wv;
+                                    acc1 += px[1][c] * wv;
+                                    acc2 += px[2][c] * wv;
+                                    acc3 += px[3][c] * wv;
+                                }
+                            }
+                        }
+                    }
+
+                    out = &y[((((size_t)n * Kb + kb) * s->P + p) * s->Q + q) * CONV_CB];
+                    memcpy(out, &acc0, sizeof(vf_t));
+                    if (q + 1 < s->Q)
+                        memcpy(&out[CONV_CB], &acc1, sizeof(vf_t));
+                    if (q + 2 < s->Q)
+                        memcpy(&out[2 * CONV_CB], &acc2, sizeof(vf_t));
+                    if (q + 3 < s->Q)
+                        memcpy(&out[3 * CONV_CB], &acc3, sizeof(vf_t));
+                }
+    }
+}
+
+/* dW from every (input pixel, output pixel) pair and dx through the
+ * [Kp, R, R, Cp] weights in WT, CONV_QB output pixels at a time */
+static inline __attribute__((always_inline))
+void direct_backward_body(const conv_shape_t* s, const float* x, const float* dy,
+        float* dx, float* dW, uint32_t N, const float* WT)
+{
+    uint32_t Cb = conv_blocks(s->C), Kb = conv_blocks(s->K), Kp = Kb * CONV_CB;
+    uint32_t Cp = Cb * CONV_CB, R = s->R, in_size = Cb * s->H * s->W * CONV_CB, cw;
+    const float* img, *g[CONV_QB], *px[CONV_QB], *wt;
+    float* dimg, *dpx[CONV_QB], *dw, sink[CONV_CB];
+    vf_t g0, g1, g2, g3, acc, d0, d1, d2, d3, wv;
+    int h, w, valid;
+
+    memset(dW, 0, sizeof(float) * s->C * R * R * Kp);
+    if (dx != NULL)
+        memset(dx, 0, sizeof(float) * N * in_size);
+
+    for (uint32_t n = 0; n < N; n++)
+    {
+        img = &x[(size_t)n * in_size];
+        dimg = dx != NULL ? &dx[(size_t)n * in_size] : NULL;
+        for (uint32_t kb = 0; kb < Kb; kb++)
+            for (uint32_t p = 0; p < s->P; p++)
+                for (uint32_t q = 0; q < s->Q; q += CONV_QB)
+                {
+                    for (uint32_t t = 0; t < CONV_QB; t++)
+                        g[t] = q + t < s->Q ?
+                            &dy[((((size_t)n * Kb + kb) * s->P + p) * s->Q + q + t) * CONV_CB] : ZEROS;
+                    memcpy(&g0, g[0], sizeof(vf_t));
+                    memcpy(&g1, g[1], sizeof(vf_t));
+                    memcpy(&g2, g[2], sizeof(vf_t));
+                    memcpy(&g3, g[3], sizeof(vf_t));
+
+                    for (uint32_t r = 0; r < R; r++)
+                    {
+                        h = (int)(p * s->stride + r) - (int)s->pad;
+                        if (h < 0 || h >= s->H)
+                            continue;
+                        for (uint32_t k = 0; k < R; k++)
+                            for (uint32_t cb = 0; cb < Cb; cb++)
+                            {
+                                for (uint32_t t = 0; t < CONV_QB; t++)
+                                {
+                                    w = (int)((q + t) * s->stride + k) - (int)s->pad;
+                                    valid = w >= 0 && w < s->W && q + t < s->Q;
+                                    px[t] = valid ? &img[((cb * s->H + h) * s->W + w) * CONV_CB] : ZEROS;
+                                    dpx[t] = valid && dimg != NULL ?
+                                        &dimg[((cb * s->H + h) * s->W + w) * CONV_CB] : sink;
+                                }
+
+                                cw = s->C - cb * CONV_CB < CONV_CB ? s->C - cb * CONV_CB : CONV_CB;
+                                dw = &dW[((cb * CONV_CB * R + r) * R + k) * Kp + kb * CONV_CB];
+                                for (uint32_t c = 0; c < cw; c++)
+                                {
+                                    memcpy(&acc, &dw[c * R * R * Kp], sizeof(vf_t));
+                                    acc += px[0][c] * g0 + px[1][c] * g1 + px[2][c] * g2 + px[3][c] * g3;
+                                    memcpy(&dw[c * R * R * Kp], &acc, sizeof(vf_t));
+                                }
+
+                                if (dimg == NULL)
+                                    continue;
+                                memcpy(&d0, dpx[0], sizeof(vf_t));
+                                memcpy(&d1, dpx[1], sizeof(vf_t));
+                                memcpy(&d2, dpx[2], sizeof(vf_t));
+                                memcpy(&d3, dpx[3], sizeof(vf_t));
+                                wt = &WT[((kb * CONV_CB * R + r) * R + k) * Cp + cb * CONV_CB];
+                                for (uint32_t l = 0; l < CONV_CB; l++)
+                                {
+                                    memcpy(&wv, &wt[l * R * R * Cp], sizeof(vf_t));
+                                    d0 += g[0][l] * wv;
+                                    d1 += g[1][l] * wv;
+                                    d2 += g[2][l] * wv;
+                                    d3 += g[3][l] * wv;
+                                }
+                                memcpy(dpx[0], &d0, sizeof(vf_t));
+                                memcpy(dpx[1], &d1, sizeof(vf_t));
+                                memcpy(dpx[2], &d2, sizeof(vf_t));
+                                memcpy(dpx[3], &d3, sizeof(vf_t));
+                            }
+                    }
+                }
+    }
+}
+
+KERNEL_VARIANTS(patch_gemm, (const float* col, const float* W, const float* b, float* y,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ), (col, W, b, y, rows, CRR, Kb, PQ))
+KERNEL_VARIANTS(patch_gemm_tn, (const float* col, const float* dy, float* dW, float* db,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ), (col, dy, dW, db, rows, CRR, Kb, PQ))
+KERNEL_VARIANTS(patch_gemm_nt, (const float* dy, const float* WT, float* dcol,
+        uint32_t rows, uint32_t CRR, uint32_t Kb, uint32_t PQ), (dy, WT, dcol, rows, CRR, Kb, PQ))
+KERNEL_VARIANTS(direct_forward, (const conv_shape_t* s, const float* x, const float* W,
+        const float* b, float* y, uint32_t N), (s, x, W, b, y, N))
+KERNEL_VARIANTS(direct_backward, (const conv_shape_t* s, const float* x, const float* dy,
+        float* dx, float* dW, uint32_t N, const float* WT), (s, x, dy, dx, dW, N, WT))
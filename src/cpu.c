@@ -0,0 +1,19 @@
+#include "cpu.h"
+
+int cpu_has_avx2()
+{
+    static int cached = -1;
+
+    if (cached < 0)
+        cached = __builtin_cpu_supports("avx2") != 0;
+    return cached;
+}
+
+int cpu_has_avx2_fma()
+{
+    static int cached = -1;
+
+    if (cached < 0)
+        cached = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return cached;
+}
@@ -0,0 +1,348 @@
+#include "half.h"
+#include "cpu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+/* Rows of the right operand converted to fp32 at once, the panel stays in
+ * cache while every row of the left operand goes over it */
+#define K_BLOCK 128
+
+/* Utility functions */
+static int has_f16c();
+static int has_bf16();
+
+static const float* as_f32(const tensor_t* t, uint32_t offset, uint32_t n, float* scratch);
+static void axpy(float* y, float a, const float* x, uint32_t n);
+static void axpy_avx2(float* y, float a, const float* x, uint32_t n);
+
+static void f16_from_f32_f16c(uint16_t* dst, const float* src, uint32_t n);
+static void f16_to_f32_f16c(float* dst, const uint16_t* src, uint32_t n);
+static void bf16_from_f32_avx512(uint16_t* dst, const float* src, uint32_t n);
+static void bf16_to_f32_avx2(float* dst, const uint16_t* src, uint32_t n);
+static void mm_bf16_dot(const uint16_t* A, const uint16_t* B, float* C,
+        uint32_t M, uint32_t K, uint32_t N);
+
+void half_from_f32(uint16_t* dst, const float* src, uint32_t n, tensor_dtype_t dtype)
+{
+    if (dtype == TENSOR_BF16 && has_bf16())
+        bf16_from_f32_avx512(dst, src, n);
+    else if (dtype == TENSOR_BF16)
+        for (int i = 0; i < n; i++)
+            dst[i] = half_bf16_from_f32(src[i]);
+    else if (has_f16c())
+        f16_from_f32_f16c(dst, src, n);
+    else
+        for (int i = 0; i < n; i++)
+            dst[i] = half_f16_from_f32(src[i]);
+}
+
+void half_to_f32(float* dst, const uint16_t* src, uint32_t n, tensor_dtype_t dtype)
+{
+    if (dtype == TENSOR_BF16 && cpu_has_avx2_fma())
+        bf16_to_f32_avx2(dst, src, n);
+    else if (dtype == TENSOR_BF16)
+        for (int i = 0; i < n; i++)
+            dst[i] = half_bf16_to_f32(src[i]);
+    else if (has_f16c())
+        f16_to_f32_f16c(dst, src, n);
+    else
+        for (int i = 0; i < n; i++)
+            dst[i] = half_f16_to_f32(src[i]);
+}
+
+uint16_t half_bf16_from_f32(float v)
+{
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+
+    /* Keep NaNs quiet instead of rounding them into infinities */
+    if ((u & 0x7fffffff) > 0x7f800000)
+        return (u >> 16) | 0x40;
+
+    u += 0x7fff + ((u >> 16) & 1);
+    return u >> 16;
+}
+
+float half_bf16_to_f32(uint16_t v)
+{
+    uint32_t u = (uint32_t)v << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+uint16_t half_f16_from_f32(float v)
+{
+    uint32_t u, sign, mant, h, rem, halfway;
+    int32_t exp;
+    int shift;
+
+    memcpy(&u, &v, sizeof(u));
+    sign = (u >> 16) & 0x8000;
+    exp = (int32_t)((u >> 23) & 0xff) - 127 + 15;
+    mant = u & 0x7fffff;
+
+    if (((u >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+    if (exp >= 31)
+        return sign | 0x7c00;
+
+    if (exp <= 0)
+    {
+        /* Subnormal half, or zero when even the rounding cannot reach it */
+        if (exp < -10)
+            return sign;
+
+        mant |= 0x800000;
+        shift = 14 - exp;
+        h = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1)))
+            h++;
+        return sign | h;
+    }
+
+    /* A carry out of the mantissa correctly bumps the exponent */
+    h = sign | (exp << 10) | (mant >> 13);
+    rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++;
+    return h;
+}
+
+float half_f16_to_f32(uint16_t v)
+{
+    uint32_t sign = (uint32_t)(v & 0x8000) << 16;
+    int32_t exp = (v >> 10) & 0x1f;
+    uint32_t mant = v & 0x3ff;
+    uint32_t u;
+    float f;
+
+    if (exp == 0 && mant == 0)
+        u = sign;
+    else if (exp == 0)
+    {
+        exp = 1;
+        while (!(mant & 0x400))
+        {
+            mant <<= 1;
+            exp--;
+        }
+        u = sign | ((exp + 127 - 15) << 23) | ((mant & 0x3ff) << 13);
+    }
+    else if (exp == 31)
+        u = sign | 0x7f800000 | (mant << 13);
+    else
+        u = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+void half_mm(const tensor_t* t1, const tensor_t* t2, float* result)
+{
+    uint32_t M = t1->shape[0], K = t1->shape[1], N = t2->shape[1];
+    uint32_t kb;
+    float* panel_scratch, *row_scratch;
+    const float* panel, *row;
+
+    if (t1->dtype == TENSOR_BF16 && t2->dtype == TENSOR_BF16 && has_bf16())
+    {
+        mm_bf16_dot(t1->halfs, t2->halfs, result, M, K, N);
+        return;
+    }
+
+    /* Emulation: widen a panel of t2 and a row of t1 at a time, so the
+     * 16 bit data is only read once from memory */
+    panel_scratch = (float*)malloc(sizeof(float) * K_BLOCK * N);
+    row_scratch = (float*)malloc(sizeof(float) * K_BLOCK);
+    memset(result, 0, sizeof(float) * M * N);
+
+    for (uint32_t k0 = 0; k0 < K; k0 += K_BLOCK)
+    {
+        kb = K - k0 < K_BLOCK ? K - k0 : K_BLOCK;
+        panel = as_f32(t2, k0 * N, kb * N, panel_scratch);
+
+        for (uint32_t m = 0; m < M; m++)
+        {
+            row = as_f32(t1, m * K + k0, kb, row_scratch);
+            for (uint32_t k = 0; k < kb; k++)
+                if (row[k] != 0)
+                    axpy(&result[m * N], row[k], &panel[k * N], N);
+        }
+    }
+
+    free(panel_scratch);
+    free(row_scratch);
+}
+
+const float* as_f32(const tensor_t* t, uint32_t offset, uint32_t n, float* scratch)
+{
+    if (t->dtype == TENSOR_F32)
+        return &t->values[offset];
+
+    half_to_f32(scratch, &t->halfs[offset], n, t->dtype);
+    return scratch;
+}
+
+void axpy(float* y, float a, const float* x, uint32_t n)
+{
+    if (cpu_has_avx2_fma())
+    {
+        axpy_avx2(y, a, x, n);
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+        y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,fma")))
+void axpy_avx2(float* y, float a, const float* x, uint32_t n)
+{
+    __m256 va = _mm256_set1_ps(a);
+    uint32_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(&y[i], _mm256_fmadd_ps(va, _mm256_loadu_ps(&x[i]), _mm256_loadu_ps(&y[i])));
+
+    for (; i < n; i++)
+        y[i] += a * x[i];
+}
+
+__attribute__((target("avx2,f16c")))
+void f16_from_f32_f16c(uint16_t* dst, const float* src, uint32_t n)
+{
+    uint32_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)&dst[i],
+                _mm256_cvtps_ph(_mm256_loadu_ps(&src[i]), _MM_FROUND_TO_NEAREST_INT));
+
+    for (; i < n; i++)
+        dst[i] = half_f16_from_f32(src[i]);
+}
+
+__attribute__((target("avx2,f16c")))
+void f16_to_f32_f16c(float* dst, const uint16_t* src, uint32_t n)
+{
+    uint32_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(&dst[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&src[i])));
+
+    for (; i < n; i++)
+        dst[i] = half_f16_to_f32(src[i]);
+}
+
+__attribute__((target("avx512f,avx512bf16")))
+void bf16_from_f32_avx512(uint16_t* dst, const float* src, uint32_t n)
+{
+    uint32_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i*)&dst[i],
+                (__m256i)_mm512_cvtneps_pbh(_mm512_loadu_ps(&src[i])));
+
+    for (; i < n; i++)
+        dst[i] = half_bf16_from_f32(src[i]);
+}
+
+/* bf16 is the top half of a float, widening is a shift */
+__attribute__((target("avx2")))
+void bf16_to_f32_avx2(float* dst, const uint16_t* src, uint32_t n)
+{
+    uint32_t i = 0;
+    __m256i v;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)&src[i]));
+        _mm256_storeu_ps(&dst[i], _mm256_castsi256_ps(_mm256_slli_epi32(v, 16)));
+    }
+
+    for (; i < n; i++)
+        dst[i] = half_bf16_to_f32(src[i]);
+}
+
+/* AVX-512 BF16 path. B is repacked so every 32 bit lane holds the pair
+ * (B[2p][n], B[2p + 1][n]) and vdpbf16ps multiplies it by the broadcast pair
+ * (A[m][2p], A[m][2p + 1]), accumulating both products in fp32. */
+__attribute__((target("avx512f,avx512bf16")))
+void mm_bf16_dot(const uint16_t* A, const uint16_t* B, float* C,
+        uint32_t M, uint32_t K, uint32_t N)
+{
+    uint32_t K2 = (K + 1) / 2;
+    uint32_t Np = (N + 15) / 16 * 16;
+    uint32_t* packed = (uint32_t*)calloc((size_t)K2 * Np, sizeof(uint32_t));
+    uint32_t* a_pairs = (uint32_t*)malloc(sizeof(uint32_t) * K2);
+    uint32_t lo, hi, n_left;
+    __m512 acc[4];
+    __m512i a;
+    __mmask16 mask;
+    int nb;
+
+    for (uint32_t p = 0; p < K2; p++)
+        for (uint32_t n = 0; n < N; n++)
+        {
+            lo = B[2 * p * N + n];
+            hi = 2 * p + 1 < K ? B[(2 * p + 1) * N + n] : 0;
+            packed[p * Np + n] = lo | (hi << 16);
+        }
+
+    for (uint32_t m = 0; m < M; m++)
+    {
+        for (uint32_t p = 0; p < K2; p++)
+        {
+            lo = A[m * K + 2 * p];
+            hi = 2 * p + 1 < K ? A[m * K + 2 * p + 1] : 0;
+            a_pairs[p] = lo | (hi << 16);
+        }
+
+        /* Four blocks of 16 columns share every broadcast of A */
+        for (uint32_t n0 = 0; n0 < Np; n0 += 64)
+        {
+            nb = (Np - n0) / 16 < 4 ? (Np - n0) / 16 : 4;
+            for (int j = 0; j < 4; j++)
+                acc[j] = _mm512_setzero_ps();
+
+            for (uint32_t p = 0; p < K2; p++)
+            {
+                a = _mm512_set1_epi32(a_pairs[p]);
+                for (int j = 0; j < nb; j++)
+                    acc[j] = _mm512_dpbf16_ps(acc[j], (__m512bh)a,
+                            (__m512bh)_mm512_loadu_si512(&packed[p * Np + n0 + 16 * j]));
+            }
+
+            for (int j = 0; j < nb; j++)
+            {
+                n_left = N - (n0 + 16 * j);
+                mask = n_left >= 16 ? 0xffff : (__mmask16)((1u << n_left) - 1);
+                _mm512_mask_storeu_ps(&C[m * N + n0 + 16 * j], mask, acc[j]);
+            }
+        }
+    }
+
+    free(packed);
+    free(a_pairs);
+}
+
+int has_f16c()
+{
+    static int cached = -1;
+    if (cached < 0)
+        cached = cpu_has_avx2_fma() && __builtin_cpu_supports("f16c");
+    return cached;
+}
+
+int has_bf16()
+{
+    static int cached = -1;
+    if (cached < 0)
+        cached = __builtin_cpu_supports("avx512bf16") != 0;
+    return cached;
+}
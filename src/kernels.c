@@ -0,0 +1,53 @@
+#include "kernels.h"
+#include "cpu.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+kernel_dense_fn_t kernels_find(uint32_t K, uint32_t N)
+{
+    for (uint32_t i = 0; i < KERNELS_GEN_LEN; i++)
+        if (KERNELS_GEN[i].K == K && KERNELS_GEN[i].N == N)
+            return cpu_has_avx2_fma() ? KERNELS_GEN[i].fn_avx2 : KERNELS_GEN[i].fn;
+    return NULL;
+}
+
+void kernels_dense(const tensor_t* x, const tensor_t* W, const tensor_t* b, int relu, tensor_t* out)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    kernel_dense_fn_t fn;
+
+    if (x->dtype != TENSOR_F32 || W->dtype != TENSOR_F32 || x->n_dims != 2 || W->n_dims != 2 ||
+            x->shape[1] != W->shape[0] || (fn = kernels_find(W->shape[0], W->shape[1])) == NULL)
+    {
+        kernels_dense_generic(x, W, b, relu, out);
+        TRACE_OP(trace_start, "kernels_dense", x, W, out);
+        return;
+    }
+
+    if (out->shape[0] != x->shape[0] || out->shape[1] != W->shape[1])
+    {
+        printf("[ERROR] Result of kernels_dense has the wrong shape\n");
+        exit(1);
+    }
+    fn(x->values, W->values, b->values, out->values, x->shape[0], relu);
+    TRACE_OP(trace_start, "kernels_dense", x, W, out);
+}
+
+void kernels_dense_generic(const tensor_t* x, const tensor_t* W, const tensor_t* b, int relu,
+        tensor_t* out)
+{
+    uint32_t M, N = W->shape[1];
+    float* o = out->values;
+
+    tensor_mm_into(x, W, out);
+    M = out->shape[0];
+    for (uint32_t r = 0; r < M; r++)
+        for (uint32_t c = 0; c < N; c++)
+        {
+            o[r * N + c] += b->values[c];
+            if (relu && o[r * N + c] < 0)
+                o[r * N + c] = 0;
+        }
+}
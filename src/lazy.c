@@ -0,0 +1,429 @@
+#include "lazy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Utility functions */
+static lazy_t* push(lazy_graph_t* g, lazy_op_t op, lazy_t* a, lazy_t* b,
+        const uint32_t* shape, uint32_t n_dims);
+static lazy_t* binary(lazy_graph_t* g, lazy_op_t op, lazy_t* a, lazy_t* b);
+static lazy_t* unary(lazy_graph_t* g, lazy_op_t op, lazy_t* a, float scalar);
+static int is_elementwise(const lazy_t* node);
+static int same_shape(const lazy_t* a, const lazy_t* b);
+static uint32_t numel(const lazy_t* node);
+
+static const tensor_t* materialize(lazy_t* node);
+static void prepare(lazy_t* node);
+static void reduce_sum(lazy_t* node);
+static void run_kernel(lazy_t* node, float* out);
+static const float* eval_tile(lazy_t* node, uint32_t start, uint32_t len);
+static const float* eval_input(lazy_t* input, const lazy_t* node, uint32_t start, uint32_t len);
+static void gather(const lazy_t* node, const lazy_t* like, uint32_t start, uint32_t len);
+static void reset(lazy_graph_t* g);
+
+lazy_graph_t* lazy_graph_new()
+{
+    lazy_graph_t* g = (lazy_graph_t*)malloc(sizeof(lazy_graph_t));
+
+    g->capacity = 16;
+    g->len = 0;
+    g->nodes = (lazy_t**)malloc(sizeof(lazy_t*) * g->capacity);
+    return g;
+}
+
+void lazy_graph_clean(lazy_graph_t* g)
+{
+    reset(g);
+    for (uint32_t i = 0; i < g->len; i++)
+    {
+        free(g->nodes[i]->tile);
+        free(g->nodes[i]->bcast);
+        free(g->nodes[i]);
+    }
+    free(g->nodes);
+    free(g);
+}
+
+lazy_t* lazy_leaf(lazy_graph_t* g, const tensor_t* t)
+{
+    lazy_t* node;
+
+    if (t->dtype != TENSOR_F32 || t->n_dims > LAZY_MAX_DIMS)
+    {
+        printf("[ERROR] Lazy leaves must be F32 tensors of at most %d dims\n", LAZY_MAX_DIMS);
+        exit(1);
+    }
+
+    node = push(g, LAZY_LEAF, NULL, NULL, t->shape, t->n_dims);
+    node->value = t;
+    return node;
+}
+
+lazy_t* lazy_unsqueeze(lazy_graph_t* g, lazy_t* a, uint32_t axis)
+{
+    uint32_t shape[LAZY_MAX_DIMS];
+
+    if (axis > a->n_dims || a->n_dims == LAZY_MAX_DIMS)
+    {
+        printf("[ERROR] Axis %d is larger than the available n_dims range [0, %d]\n", axis, a->n_dims);
+        exit(1);
+    }
+
+    for (uint32_t i = 0, j = 0; i < a->n_dims + 1; i++)
+        shape[i] = i == axis ? 1 : a->shape[j++];
+    return push(g, LAZY_VIEW, a, NULL, shape, a->n_dims + 1);
+}
+
+lazy_t* lazy_reduce_sum(lazy_graph_t* g, lazy_t* a, uint32_t axis)
+{
+    uint32_t shape[LAZY_MAX_DIMS];
+    lazy_t* node;
+
+    if (axis > a->n_dims - 1)
+    {
+        printf("[ERROR] Axis %d is larger than the available n_dims range [0, %d)\n", axis, a->n_dims);
+        exit(1);
+    }
+
+    for (uint32_t i = 0, j = 0; i < a->n_dims; i++)
+        if (i != axis)
+            shape[j++] = a->shape[i];
+
+    node = push(g, LAZY_REDUCE_SUM, a, NULL, shape, a->n_dims - 1);
+    node->axis = axis;
+    return node;
+}
+
+lazy_t* lazy_add(lazy_graph_t* g, lazy_t* a, lazy_t* b) { return binary(g, LAZY_ADD, a, b); }
+lazy_t* lazy_sub(lazy_graph_t* g, lazy_t* a, lazy_t* b) { return binary(g, LAZY_SUB, a, b); }
+lazy_t* lazy_mul(lazy_graph_t* g, lazy_t* a, lazy_t* b) { return binary(g, LAZY_MUL, a, b); }
+lazy_t* lazy_div(lazy_graph_t* g, lazy_t* a, lazy_t* b) { return binary(g, LAZY_DIV, a, b); }
+lazy_t* lazy_gte(lazy_graph_t* g, lazy_t* a, lazy_t* b) { return binary(g, LAZY_GTE, a, b); }
+lazy_t* lazy_eq(lazy_graph_t* g, lazy_t* a, lazy_t* b) { return binary(g, LAZY_EQ, a, b); }
+
+lazy_t* lazy_add_scalar(lazy_graph_t* g, lazy_t* a, float scalar) { return unary(g, LAZY_ADD_SCALAR, a, scalar); }
+lazy_t* lazy_sub_scalar(lazy_graph_t* g, lazy_t* a, float scalar) { return unary(g, LAZY_SUB_SCALAR, a, scalar); }
+lazy_t* lazy_mul_scalar(lazy_graph_t* g, lazy_t* a, float scalar) { return unary(g, LAZY_MUL_SCALAR, a, scalar); }
+lazy_t* lazy_div_scalar(lazy_graph_t* g, lazy_t* a, float scalar) { return unary(g, LAZY_DIV_SCALAR, a, scalar); }
+
+lazy_t* lazy_neg(lazy_graph_t* g, lazy_t* a) { return unary(g, LAZY_NEG, a, 0); }
+lazy_t* lazy_exp(lazy_graph_t* g, lazy_t* a) { return unary(g, LAZY_EXP, a, 0); }
+lazy_t* lazy_relu(lazy_graph_t* g, lazy_t* a) { return unary(g, LAZY_RELU, a, 0); }
+
+tensor_t* lazy_eval(lazy_graph_t* g, lazy_t* node)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * (node->n_dims ? node->n_dims : 1));
+    tensor_t* out;
+
+    memcpy(shape, node->shape, sizeof(uint32_t) * node->n_dims);
+    out = tensor_zeros(shape, node->n_dims);
+    lazy_eval_into(g, node, out);
+    return out;
+}
+
+void lazy_eval_into(lazy_graph_t* g, lazy_t* node, tensor_t* out)
+{
+    const tensor_t* value;
+
+    if (out->dtype != TENSOR_F32 || out->n_dims != node->n_dims ||
+            memcmp(out->shape, node->shape, sizeof(uint32_t) * node->n_dims))
+    {
+        printf("[ERROR] Output of lazy_eval_into does not have the shape of the node\n");
+        exit(1);
+    }
+
+    /* Leaves may have changed since the last evaluation */
+    reset(g);
+
+    if (is_elementwise(node))
+    {
+        prepare(node);
+        run_kernel(node, out->values);
+        return;
+    }
+
+    value = materialize(node);
+    if (value->values != out->values)
+        memcpy(out->values, value->values, sizeof(float) * numel(node));
+}
+
+lazy_t* push(lazy_graph_t* g, lazy_op_t op, lazy_t* a, lazy_t* b,
+        const uint32_t* shape, uint32_t n_dims)
+{
+    lazy_t* node = (lazy_t*)malloc(sizeof(lazy_t));
+
+    node->op = op;
+    node->a = a;
+    node->b = b;
+    node->scalar = 0;
+    node->axis = 0;
+    node->n_dims = n_dims;
+    memcpy(node->shape, shape, sizeof(uint32_t) * n_dims);
+    node->value = NULL;
+    node->owned = NULL;
+    node->tile = (float*)malloc(sizeof(float) * LAZY_TILE);
+    node->tile_start = UINT32_MAX;
+    node->bcast = (float*)malloc(sizeof(float) * LAZY_TILE);
+
+    if (g->len == g->capacity)
+    {
+        g->capacity *= 2;
+        g->nodes = (lazy_t**)realloc(g->nodes, sizeof(lazy_t*) * g->capacity);
+    }
+    g->nodes[g->len++] = node;
+    return node;
+}
+
+/* Output shape follows the broadcasting of tensor_broadcast */
+lazy_t* binary(lazy_graph_t* g, lazy_op_t op, lazy_t* a, lazy_t* b)
+{
+    uint32_t n_dims = a->n_dims > b->n_dims ? a->n_dims : b->n_dims;
+    uint32_t shape[LAZY_MAX_DIMS], da, db;
+
+    for (uint32_t i = 0; i < n_dims; i++)
+    {
+        da = i < a->n_dims ? a->shape[a->n_dims - 1 - i] : 1;
+        db = i < b->n_dims ? b->shape[b->n_dims - 1 - i] : 1;
+        if (da != db && da != 1 && db != 1)
+        {
+            printf("[ERROR] No compatible shapes for broadcasting\n");
+            exit(1);
+        }
+        shape[n_dims - 1 - i] = da > db ? da : db;
+    }
+
+    return push(g, op, a, b, shape, n_dims);
+}
+
+lazy_t* unary(lazy_graph_t* g, lazy_op_t op, lazy_t* a, float scalar)
+{
+    lazy_t* node = push(g, op, a, NULL, a->shape, a->n_dims);
+
+    node->scalar = scalar;
+    return node;
+}
+
+int is_elementwise(const lazy_t* node)
+{
+    return node->op >= LAZY_ADD;
+}
+
+int same_shape(const lazy_t* a, const lazy_t* b)
+{
+    return a->n_dims == b->n_dims && !memcmp(a->shape, b->shape, sizeof(uint32_t) * a->n_dims);
+}
+
+uint32_t numel(const lazy_t* node)
+{
+    uint32_t n = 1;
+
+    for (uint32_t i = 0; i < node->n_dims; i++)
+        n *= node->shape[i];
+    return n;
+}
+
+/* Computes the whole value of a node that cannot be evaluated tile by tile
+ * inside its consumer: reductions, views, and elementwise nodes read with
+ * broadcasting */
+const tensor_t* materialize(lazy_t* node)
+{
+    const tensor_t* child;
+    uint32_t* shape;
+
+    if (node->value)
+        return node->value;
+
+    shape = (uint32_t*)malloc(sizeof(uint32_t) * (node->n_dims ? node->n_dims : 1));
+    memcpy(shape, node->shape, sizeof(uint32_t) * node->n_dims);
+
+    if (node->op == LAZY_VIEW)
+    {
+        /* Same values under another shape, nothing is copied. They are set
+         * after tensor_new so memtrack.h does not count them twice. */
+        child = materialize(node->a);
+        node->owned = tensor_new(NULL, shape, node->n_dims);
+        node->owned->values = child->values;
+    }
+    else
+    {
+        node->owned = tensor_zeros(shape, node->n_dims);
+        node->value = node->owned;
+        if (node->op == LAZY_REDUCE_SUM)
+            reduce_sum(node);
+        else
+        {
+            prepare(node);
+            run_kernel(node, node->owned->values);
+        }
+    }
+
+    node->value = node->owned;
+    return node->value;
+}
+
+/* Elementwise children of the same shape join the kernel of `node`, every
+ * other input is materialized first */
+void prepare(lazy_t* node)
+{
+    lazy_t* children[] = {node->a, node->b};
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (children[i] == NULL)
+            continue;
+        if (is_elementwise(children[i]) && same_shape(children[i], node))
+            prepare(children[i]);
+        else
+            materialize(children[i]);
+    }
+}
+
+/* The reduced expression is evaluated tile by tile and summed straight into
+ * the result, it is never stored */
+void reduce_sum(lazy_t* node)
+{
+    lazy_t* child = node->a;
+    uint32_t pitch = 1, to_reduce = child->shape[node->axis], n = numel(child), len;
+    float* out = node->owned->values;
+    const float* tile;
+
+    for (uint32_t i = node->axis + 1; i < child->n_dims; i++)
+        pitch *= child->shape[i];
+
+    if (is_elementwise(child))
+        prepare(child);
+    else
+        materialize(child);
+
+    for (uint32_t start = 0; start < n; start += LAZY_TILE)
+    {
+        len = n - start < LAZY_TILE ? n - start : LAZY_TILE;
+        tile = eval_tile(child, start, len);
+        for (uint32_t i = 0; i < len; i++)
+            out[(start + i) / (to_reduce * pitch) * pitch + (start + i) % pitch] += tile[i];
+    }
+}
+
+void run_kernel(lazy_t* node, float* out)
+{
+    uint32_t n = numel(node), len;
+    const float* tile;
+
+    for (uint32_t start = 0; start < n; start += LAZY_TILE)
+    {
+        len = n - start < LAZY_TILE ? n - start : LAZY_TILE;
+        tile = eval_tile(node, start, len);
+        memcpy(&out[start], tile, sizeof(float) * len);
+    }
+}
+
+/* Values [start, start + len) of `node`, in the index space of its kernel.
+ * Each node is computed once per tile even if it is read several times. */
+const float* eval_tile(lazy_t* node, uint32_t start, uint32_t len)
+{
+    const float* x, *y = NULL;
+    float* t = node->tile, s = node->scalar;
+
+    if (!is_elementwise(node))
+        return node->value->values + start;
+
+    if (node->tile_start == start)
+        return t;
+
+    x = eval_input(node->a, node, start, len);
+    if (node->b)
+        y = eval_input(node->b, node, start, len);
+
+    switch (node->op)
+    {
+        case LAZY_ADD: for (uint32_t i = 0; i < len; i++) t[i] = x[i] + y[i]; break;
+        case LAZY_SUB: for (uint32_t i = 0; i < len; i++) t[i] = x[i] - y[i]; break;
+        case LAZY_MUL: for (uint32_t i = 0; i < len; i++) t[i] = x[i] * y[i]; break;
+        case LAZY_DIV: for (uint32_t i = 0; i < len; i++) t[i] = x[i] / y[i]; break;
+        case LAZY_GTE: for (uint32_t i = 0; i < len; i++) t[i] = x[i] >= y[i]; break;
+        case LAZY_EQ: for (uint32_t i = 0; i < len; i++) t[i] = x[i] == y[i]; break;
+        case LAZY_ADD_SCALAR: for (uint32_t i = 0; i < len; i++) t[i] = x[i] + s; break;
+        case LAZY_SUB_SCALAR: for (uint32_t i = 0; i < len; i++) t[i] = x[i] - s; break;
+        case LAZY_MUL_SCALAR: for (uint32_t i = 0; i < len; i++) t[i] = x[i] * s; break;
+        case LAZY_DIV_SCALAR: for (uint32_t i = 0; i < len; i++) t[i] = x[i] / s; break;
+        case LAZY_NEG: for (uint32_t i = 0; i < len; i++) t[i] = -x[i]; break;
+        case LAZY_EXP: for (uint32_t i = 0; i < len; i++) t[i] = expf(x[i]); break;
+        case LAZY_RELU: for (uint32_t i = 0; i < len; i++) t[i] = x[i] > 0 ? x[i] : 0; break;
+        default: break;
+    }
+
+    node->tile_start = start;
+    return t;
+}
+
+/* Inputs of another shape were materialized by prepare and are broadcast */
+const float* eval_input(lazy_t* input, const lazy_t* node, uint32_t start, uint32_t len)
+{
+    if (same_shape(input, node))
+        return eval_tile(input, start, len);
+
+    gather(input, node, start, len);
+    return input->bcast;
+}
+
+/* Reads the materialized `node` broadcast to the shape of `like` into the
+ * bcast tile of `node` */
+void gather(const lazy_t* node, const lazy_t* like, uint32_t start, uint32_t len)
+{
+    uint32_t coords[LAZY_MAX_DIMS], strides[LAZY_MAX_DIMS];
+    uint32_t n_dims = like->n_dims, offset = 0, stride = 1, rest = start, dim;
+    int d;
+
+    /* Dims missing from `node` or of size 1 get a 0 stride */
+    for (d = n_dims - 1; d >= 0; d--)
+    {
+        dim = (uint32_t)d + node->n_dims >= n_dims ? node->shape[d + node->n_dims - n_dims] : 1;
+        strides[d] = dim == 1 ? 0 : stride;
+        stride *= dim;
+
+        coords[d] = rest % like->shape[d];
+        rest /= like->shape[d];
+        offset += coords[d] * strides[d];
+    }
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        node->bcast[i] = node->value->values[offset];
+
+        /* Next index, carrying over the dims */
+        for (d = n_dims - 1; d >= 0; d--)
+        {
+            offset += strides[d];
+            if (++coords[d] < like->shape[d])
+                break;
+            offset -= coords[d] * strides[d];
+            coords[d] = 0;
+        }
+    }
+}
+
+/* Drops everything computed by a previous evaluation */
+void reset(lazy_graph_t* g)
+{
+    lazy_t* node;
+
+    for (uint32_t i = 0; i < g->len; i++)
+    {
+        node = g->nodes[i];
+        node->tile_start = UINT32_MAX;
+        if (node->op == LAZY_LEAF)
+            continue;
+
+        if (node->owned)
+        {
+            /* Views share the values of their child */
+            if (node->op == LAZY_VIEW)
+                node->owned->values = NULL;
+            tensor_clean(node->owned);
+        }
+        node->owned = NULL;
+        node->value = NULL;
+    }
+}
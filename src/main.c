@@ -9,42 +9,24 @@
 #include "mnist.h"
 #include "plot.h"
 #include "nn.h"
+#include "model.h"
+#include "checkpoint.h"
+#include "train_bench.h"
+#include "trace.h"
+#include "memtrack.h"
+#include "perfctr.h"
 
 #define TRAIN_IMAGES "data/train-images-idx3-ubyte"
 #define TRAIN_LABELS "data/train-labels-idx1-ubyte"
 #define TEST_IMAGES "data/t10k-images-idx3-ubyte"
 #define TEST_LABELS "data/t10k-labels-idx1-ubyte"
 
-
-typedef struct 
-{
-    tensor_t* dW1;
-    tensor_t* db1;
-
-    tensor_t* dW2;
-    tensor_t* db2;
-
-    float loss;
-    tensor_t* predictions;
-} train_res_t;
+#define DEFAULT_MODEL "input:784 dense:128 relu dense:10 softmax_ce"
 
 static void plot_grid(mnist_t* ds, int h, int w);
 
-static tensor_t* update_parameter(const tensor_t* param, const tensor_t* grad, float lr);
-
-static tensor_t* forward(const tensor_t* x,
-        const tensor_t* W1, const tensor_t* b1,
-        const tensor_t* W2, const tensor_t* b2);
-
-static train_res_t forward_backward(const tensor_t* x, const tensor_t* y,
-        const tensor_t* W1, const tensor_t* b1,
-        const tensor_t* W2, const tensor_t* b2);
-
-static tensor_t* layer_init(uint32_t* shape, uint32_t n_dims);
-
 int main(int argc, char** argv) 
 {
-    srand(time(NULL));
 
     mnist_t* ds, *test_ds;
     mnist_example_t* batch;
@@ -52,211 +34,221 @@ int main(int argc, char** argv)
 
     /* Training Hyperparams */
     int batch_size = 256;
+    int steps = 250;
     float lr = 0.001;
+    unsigned int seed = time(NULL);
+
+    /* Step, sampler seed and monitoring sums, all a checkpoint needs to
+     * resume the loop */
+    train_state_t state = {0, time(NULL), 0, 0};
+    float test_acc;
+    checkpoint_t* ckpt = NULL;
+    const char* ckpt_path = NULL;
+    int ckpt_every = 50;
+
+    /* Headless benchmark mode (train_bench.h) */
+    train_bench_config_t bench = {NULL, 0, 0, 1, 0, 0, 0, 50};
+    train_bench_result_t bench_res;
+    const char* json_path = NULL, *trace_path = NULL;
+    int bench_mode = 0;
+    FILE* json;
+
+    /* Tensor memory accounting (memtrack.h), a budget of tensor allocations
+     * per step turns it on */
+    int mem_report = 0, alloc_budget = 0;
+
+    /* Hardware counters per op and phase (perfctr.h) */
+    int perf = 0;
+
+    /* Create the Neural Network
+     * An NN is no more than a set of matrices, its layers come from a config
+     * (see model.h) and are allocated once for the batch size, so it is only
+     * built once every argument is known
+     */
+    model_t* model = NULL;
+    const char* save_path = NULL, *model_config = DEFAULT_MODEL, *model_file = NULL;
+    const char* load_path = NULL, *resume_path = NULL;
 
-    /* Monitoring variables */
-    train_res_t train_res;
-    float acc = 0, loss = 0, test_acc;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--model") && i + 1 < argc)
+            model_config = argv[++i];
+        else if (!strcmp(argv[i], "--model-file") && i + 1 < argc)
+            model_file = argv[++i];
+        else if (!strcmp(argv[i], "--load") && i + 1 < argc)
+            load_path = argv[++i];
+        else if (!strcmp(argv[i], "--save") && i + 1 < argc)
+            save_path = argv[++i];
+        else if (!strcmp(argv[i], "--resume") && i + 1 < argc)
+            resume_path = argv[++i];
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bench"))
+            bench_mode = 1;
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            bench.n_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--target") && i + 1 < argc)
+            bench.target_acc = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--eval-every") && i + 1 < argc)
+            bench.eval_every = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--json") && i + 1 < argc)
+            json_path = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (!strcmp(argv[i], "--perf"))
+            perf = 1;
+        else if (!strcmp(argv[i], "--mem-report"))
+            mem_report = 1;
+        else if (!strcmp(argv[i], "--alloc-budget") && i + 1 < argc)
+            alloc_budget = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc)
+            ckpt_path = argv[++i];
+        else if (!strcmp(argv[i], "--checkpoint-every") && i + 1 < argc)
+            ckpt_every = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--lr") && i + 1 < argc)
+            lr = atof(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (ckpt_every <= 0)
+    {
+        printf("[ERROR] --checkpoint-every must be a positive number of steps\n");
+        return 1;
+    }
 
-    /* NN architecture parameters */
-    uint32_t l1_shape[] = {28 * 28, 128};
-    uint32_t l2_shape[] = {128, 10};
+    /* Every op from here on, written at exit */
+    if (trace_path != NULL)
+        trace_enable();
+    if (perf)
+        perfctr_enable();
+    if (mem_report || alloc_budget > 0)
+    {
+        memtrack_enable();
+        memtrack_budget(alloc_budget, 0);
+    }
 
-    /* Create the Neural Network 
-     * An NN is no more than a set of matrices
-     */
-    tensor_t* W1 = layer_init(l1_shape, 2);
-    tensor_t* b1 = layer_init(&l1_shape[1], 1);
-    tensor_t* W2 = layer_init(l2_shape, 2);
-    tensor_t* b2 = layer_init(&l2_shape[1], 1);
-    tensor_t* test_preds;
+    srand(seed);
+    state.seed = seed;
+    if (resume_path != NULL)
+        model = checkpoint_resume(resume_path, batch_size, &state);
+    else if (load_path != NULL)
+        model = model_load(load_path, batch_size);
+    else if (model_file != NULL)
+        model = model_from_file(model_file, batch_size);
+    else
+        model = model_parse(model_config, batch_size);
+    model_summary(model);
 
     /* Load the train and test data */
     ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
     test_ds = mnist_read(TEST_IMAGES, TEST_LABELS);
 
+    /* No window and no checkpoints, a fresh model of the same config is
+     * trained from the seed */
+    if (bench_mode)
+    {
+        bench.model_config = model->config;
+        bench.batch_size = batch_size;
+        bench.steps = steps;
+        bench.seed = seed;
+        bench.lr = lr;
+        bench_res = train_bench_run(&bench, ds, test_ds);
+        train_bench_print(&bench_res);
+        if (json_path != NULL)
+        {
+            if ((json = fopen(json_path, "w")) == NULL)
+            {
+                printf("[ERROR] Cannot write %s\n", json_path);
+                return 1;
+            }
+            train_bench_json(&bench_res, json);
+            fclose(json);
+        }
+        if (trace_path != NULL)
+            printf("Wrote %lu trace events to %s\n", (unsigned long)trace_export(trace_path),
+                    trace_path);
+
+        mnist_clean(ds);
+        mnist_clean(test_ds);
+        model_clean(model);
+        return 0;
+    }
+
     printf("Press any key...\n");
     plot_grid(ds, 5, 5);
 
-    for (int step = 0; step < 250; step++)
+    if (ckpt_path != NULL && model->ckpt == NULL)
+        ckpt = checkpoint_init(ckpt_path, model);
+
+    /* A loaded checkpoint is read-only, it is only evaluated */
+    while (state.step < steps && model->ckpt == NULL)
     {
         /* Randomly sample a batch  
          * we set the last parameter to 1 indicating that we want the flattened
          * version of the batch (shape of [batch_size, 28 * 28]) 
          */
-        batch = mnist_batch(ds, batch_size, 1);
+        if (memtrack_enabled)
+            memtrack_step_begin();
+        batch = mnist_batch_r(ds, batch_size, 1, &state.seed);
         tensor_pool_add(train_pool, batch->image);
         tensor_pool_add(train_pool, batch->label);
 
         /* Run the forward pass and also compute the gradients */
-        train_res = forward_backward(batch->image, batch->label, W1, b1, W2, b2);
-        acc += nn_accuracy_score(batch->label, train_res.predictions);
-        loss += train_res.loss;
-
-        /* Update second layer parameters */
-        tensor_pool_add(train_pool, train_res.dW2);
-        tensor_pool_add(train_pool, W2);
-        W2 = update_parameter(W2, train_res.dW2, lr);
-
-        tensor_pool_add(train_pool, train_res.db2);
-        tensor_pool_add(train_pool, b2);
-        b2 = update_parameter(b2, train_res.db2, lr);
-
-        /* Update first layer parameters */
-        tensor_pool_add(train_pool, train_res.dW1);
-        tensor_pool_add(train_pool, W1);
-        W1 = update_parameter(W1, train_res.dW1, lr);
-
-        tensor_pool_add(train_pool, train_res.db1);
-        tensor_pool_add(train_pool, b1);
-        b1 = update_parameter(b1, train_res.db1, lr);
+        state.loss_sum += model_forward_backward(model, batch->image, batch->label);
+        state.acc_sum += nn_accuracy_score(batch->label, model->preds);
+
+        /* Update the parameters of every layer */
+        model_update(model, lr);
         tensor_pool_empty(train_pool);
+        if (memtrack_enabled)
+            memtrack_step_end();
+        state.step++;
 
-        if ((step + 1) % 20 == 0)
-            printf("[Step %d] loss: %.5f  accuracy: %.5f\n", step, train_res.loss / step, acc / step);
+        if (state.step % 20 == 0)
+            printf("[Step %d] loss: %.5f  accuracy: %.5f\n", (int)state.step - 1,
+                    state.loss_sum / state.step, state.acc_sum / state.step);
+
+        /* Only copied here, written to disk in the background */
+        if (ckpt != NULL && state.step % ckpt_every == 0)
+            checkpoint_snapshot(ckpt, model, &state);
     }
     tensor_pool_clean(train_pool);
+    if (ckpt != NULL)
+        checkpoint_clean(ckpt);
 
     printf("Running test evaluation... ");
     batch = mnist_as_tensor(test_ds, 1);
-    test_preds = forward(batch->image, W1, b1, W2, b2);
-    test_acc = nn_accuracy_score(batch->label, test_preds);
+    test_acc = model_accuracy(model, batch->image, batch->label);
     printf("Test accuracy: %.2f\n", test_acc * 100);
 
+    if (save_path != NULL)
+    {
+        model_save(model, save_path);
+        printf("Saved checkpoint to %s\n", save_path);
+    }
+
+    if (trace_path != NULL)
+        printf("Wrote %lu trace events to %s\n", (unsigned long)trace_export(trace_path),
+                trace_path);
+
     mnist_clean(ds);
     mnist_clean(test_ds);
 
     tensor_clean(batch->image);
     tensor_clean(batch->label);
-    tensor_clean(test_preds);
 
-    tensor_clean(W1);
-    tensor_clean(W2);
-    tensor_clean(b1);
-    tensor_clean(b2);
+    model_clean(model);
 
     return 0;
 }
 
-tensor_t* update_parameter(const tensor_t* param, const tensor_t* grad, float lr)
-{
-    tensor_pool_t* pool = tensor_pool_init();
-    tensor_t* res;
-
-    grad = tensor_mul_scalar(grad, lr);
-    tensor_pool_add(pool, grad);
-
-    res = tensor_sub(param, grad);
-
-    tensor_pool_clean(pool);
-
-    return res;
-}
-
-tensor_t* forward(const tensor_t* x,
-        const tensor_t* W1, const tensor_t* b1,
-        const tensor_t* W2, const tensor_t* b2)
-{
-    tensor_t* t1 = tensor_mm(x, W1);
-    tensor_t* z1 = tensor_add(t1, b1);
-    tensor_t* a1 = nn_relu(z1);
-
-    tensor_t* t2 = tensor_mm(a1, W2);
-    tensor_t* z2 = tensor_add(t2, b2);
-    tensor_t* a2 = nn_softmax(z2, 1);
-    tensor_t* preds = tensor_argmax(a2, 1);
-
-    tensor_clean(t1);
-    tensor_clean(z1);
-    tensor_clean(a1);
-    tensor_clean(t2);
-    tensor_clean(z2);
-    tensor_clean(a2);
-    return preds;
-}
-
-static train_res_t forward_backward(const tensor_t* x, const tensor_t* y,
-        const tensor_t* W1, const tensor_t* b1,
-        const tensor_t* W2, const tensor_t* b2)
-{
-    tensor_pool_t* pool = tensor_pool_init();
-
-    float piy;
-    train_res_t res;
-
-    tensor_t* dz2;
-    tensor_t* da1;
-    tensor_t* dz1;
-
-    tensor_t* t1 = tensor_mm(x, W1);
-    tensor_pool_add(pool, t1);
-
-    tensor_t* z1 = tensor_add(t1, b1);
-    tensor_pool_add(pool, z1);
-
-    tensor_t* a1 = nn_relu(z1);
-    tensor_pool_add(pool, a1);
-
-    tensor_t* t2 = tensor_mm(a1, W2);
-    tensor_pool_add(pool, t2);
-
-    tensor_t* z2 = tensor_add(t2, b2);
-    tensor_pool_add(pool, z2);
-
-    tensor_t* a2 = nn_softmax(z2, 1);
-    tensor_pool_add(pool, a2);
-
-    res.predictions = tensor_argmax(a2, 1);
-    res.loss = nn_sparse_ce_loss(y, a2);
-
-    dz2 = tensor_copy(a2);
-    for (int i = 0; i < tensor_numel(y); i++)
-    {
-        piy = a2->values[i * a2->shape[1] + (int)y->values[i]];
-        dz2->values[i * dz2->shape[1] + (int)y->values[i]] = piy - 1 ;
-    }
-    tensor_pool_add(pool, dz2);
-
-    dz2 = tensor_div_scalar(dz2, x->shape[0]);
-    tensor_pool_add(pool, dz2);
-
-    res.dW2 = tensor_mm(tensor_T(a1), dz2);
-    res.db2 = tensor_reduce_sum(dz2, 0);
-
-    da1 = tensor_mm(dz2, tensor_T(W2));
-    tensor_pool_add(pool, da1);
-
-    dz1 = tensor_zeros(z1->shape, 2);
-    tensor_pool_add(pool, dz1);
-
-    dz1 = tensor_gte(z1, dz1);
-    tensor_pool_add(pool, dz1);
-
-    dz1 = tensor_mul(dz1, da1);
-    tensor_pool_add(pool, dz1);
-
-    res.dW1 = tensor_mm(tensor_T(x), dz1);
-    res.db1 = tensor_reduce_sum(dz1, 0);
-
-    tensor_pool_clean(pool);
-
-    return res;
-}
-
-static tensor_t* layer_init(uint32_t* shape, uint32_t n_dims)
-{
-    float prod = 1;
-    tensor_t* gc, *res;
-
-    for (int i = 0; i < n_dims; i++)
-        prod *= shape[i];
-
-    gc = tensor_uniform(-1, 1, shape, n_dims);
-    res = tensor_div_scalar(gc, sqrt(prod));
-    tensor_clean(gc);
-    return res;
-}
-
 void plot_grid(mnist_t* ds, int h, int w)
 {
     char title[256];
@@ -0,0 +1,283 @@
+#include "memtrack.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Sites are found by open addressing on file and line, a slot is published
+ * by the release store of its line. The extra last site takes every call
+ * site past MEMTRACK_MAX_SITES. */
+static memtrack_site_t sites[MEMTRACK_MAX_SITES + 1];
+static pthread_mutex_t sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static memtrack_stats_t totals;
+static int sort_live = 0;
+
+/* Of the step in progress */
+static memtrack_stats_t step_start;
+static int64_t step_peak = 0;
+static uint64_t step_index = 0, step_allocs = 0;
+static uint64_t budget_allocs = 0, budget_bytes = 0;
+
+uint8_t memtrack_enabled = 0;
+
+/* Utility functions */
+static uint32_t site_find(const char* file, int line, const char* func);
+static int64_t owned_bytes(const tensor_t* t);
+static void account(uint32_t site, int64_t bytes, int alloc);
+static void peak_max(int64_t* peak, int64_t value);
+static int cmp_sites(const void* a, const void* b);
+static void report_at_exit();
+
+void memtrack_enable()
+{
+    if (!memtrack_enabled)
+        atexit(report_at_exit);
+    __atomic_store_n(&memtrack_enabled, 1, __ATOMIC_RELEASE);
+}
+
+void memtrack_stats(memtrack_stats_t* stats)
+{
+    stats->live_bytes = __atomic_load_n(&totals.live_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&totals.peak_bytes, __ATOMIC_RELAXED);
+    stats->allocs = __atomic_load_n(&totals.allocs, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&totals.frees, __ATOMIC_RELAXED);
+    stats->total_bytes = __atomic_load_n(&totals.total_bytes, __ATOMIC_RELAXED);
+    stats->pooled_tensors = __atomic_load_n(&totals.pooled_tensors, __ATOMIC_RELAXED);
+    stats->pooled_bytes = __atomic_load_n(&totals.pooled_bytes, __ATOMIC_RELAXED);
+    stats->peak_pooled_bytes = __atomic_load_n(&totals.peak_pooled_bytes, __ATOMIC_RELAXED);
+    stats->shape_allocs = __atomic_load_n(&totals.shape_allocs, __ATOMIC_RELAXED);
+    stats->shape_bytes = __atomic_load_n(&totals.shape_bytes, __ATOMIC_RELAXED);
+}
+
+void memtrack_print_sites(FILE* f, int max_sites, int live_only)
+{
+    memtrack_site_t* sorted = (memtrack_site_t*)malloc(sizeof(sites));
+    const memtrack_site_t* s;
+    int n = 0;
+
+    pthread_mutex_lock(&sites_lock);
+    for (int i = 0; i <= MEMTRACK_MAX_SITES; i++)
+        if (sites[i].line != 0 && (!live_only || sites[i].allocs > sites[i].frees))
+            sorted[n++] = sites[i];
+    pthread_mutex_unlock(&sites_lock);
+
+    sort_live = live_only;
+    qsort(sorted, n, sizeof(memtrack_site_t), cmp_sites);
+    fprintf(f, "%12s %10s %12s %14s  %s\n", "live tensors", "live KB", "allocations", "allocated KB",
+            "site");
+    for (int i = 0; i < n && i < max_sites; i++)
+    {
+        s = &sorted[i];
+        fprintf(f, "%12lu %10.1f %12lu %14.1f  %s:%d %s\n", (unsigned long)(s->allocs - s->frees),
+                s->live_bytes / 1024.0, (unsigned long)s->allocs, s->total_bytes / 1024.0, s->file,
+                s->line, s->func);
+    }
+    if (n > max_sites)
+        fprintf(f, "... %d more sites\n", n - max_sites);
+    free(sorted);
+}
+
+void memtrack_report(FILE* f)
+{
+    memtrack_stats_t s;
+
+    memtrack_stats(&s);
+    fprintf(f, "[MEM] %lu tensors allocated (%.1f MB), peak %.1f MB live, peak %.1f MB pooled\n",
+            (unsigned long)s.allocs, s.total_bytes / 1048576.0, s.peak_bytes / 1048576.0,
+            s.peak_pooled_bytes / 1048576.0);
+    if (step_index > 0)
+        fprintf(f, "[MEM] %lu steps, %.1f allocations per step\n", (unsigned long)step_index,
+                (double)step_allocs / step_index);
+    if (s.shape_allocs > 0)
+        fprintf(f, "[MEM] %lu shape arrays (%.1f KB) allocated by tensor ops, never freed by "
+                "tensor_clean\n", (unsigned long)s.shape_allocs, s.shape_bytes / 1024.0);
+
+    if (s.allocs == s.frees)
+    {
+        fprintf(f, "[MEM] No tensor left live\n");
+        return;
+    }
+    fprintf(f, "[MEM] %lu tensors (%.1f KB) left live:\n", (unsigned long)(s.allocs - s.frees),
+            s.live_bytes / 1024.0);
+    memtrack_print_sites(f, 20, 1);
+}
+
+void memtrack_budget(uint64_t max_allocs, uint64_t max_bytes)
+{
+    budget_allocs = max_allocs;
+    budget_bytes = max_bytes;
+}
+
+void memtrack_step_begin()
+{
+    memtrack_stats(&step_start);
+    __atomic_store_n(&step_peak, step_start.live_bytes, __ATOMIC_RELAXED);
+}
+
+memtrack_step_t memtrack_step_end()
+{
+    memtrack_stats_t now;
+    memtrack_step_t step;
+
+    memtrack_stats(&now);
+    step.allocs = now.allocs - step_start.allocs;
+    step.bytes = now.total_bytes - step_start.total_bytes;
+    step.peak_bytes = __atomic_load_n(&step_peak, __ATOMIC_RELAXED);
+    step.live_delta = now.live_bytes - step_start.live_bytes;
+
+    if ((budget_allocs > 0 && step.allocs > budget_allocs) ||
+            (budget_bytes > 0 && step.bytes > budget_bytes))
+    {
+        printf("[ERROR] Step %lu made %lu tensor allocations of %lu bytes, over the budget of %lu "
+                "allocations and %lu bytes\n", (unsigned long)step_index, (unsigned long)step.allocs,
+                (unsigned long)step.bytes, (unsigned long)budget_allocs,
+                (unsigned long)budget_bytes);
+        memtrack_print_sites(stdout, 20, 0);
+        exit(1);
+    }
+    step_index++;
+    step_allocs += step.allocs;
+    return step;
+}
+
+void memtrack_alloc(tensor_t* t, const char* file, int line, const char* func)
+{
+    t->mem_site = site_find(file, line, func) + 1;
+    t->mem_bytes = owned_bytes(t);
+    account(t->mem_site - 1, t->mem_bytes, 1);
+}
+
+void memtrack_resize(tensor_t* t)
+{
+    int64_t bytes;
+
+    if (t->mem_site == 0)
+        return;
+    bytes = owned_bytes(t);
+    account(t->mem_site - 1, bytes - (int64_t)t->mem_bytes, 0);
+    t->mem_bytes = bytes;
+}
+
+void memtrack_free(tensor_t* t)
+{
+    memtrack_site_t* s = &sites[t->mem_site - 1];
+
+    __atomic_fetch_add(&s->frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&s->live_bytes, t->mem_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&totals.frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&totals.live_bytes, t->mem_bytes, __ATOMIC_RELAXED);
+}
+
+void memtrack_pool(int64_t tensors, int64_t bytes)
+{
+    __atomic_fetch_add(&totals.pooled_tensors, tensors, __ATOMIC_RELAXED);
+    peak_max(&totals.peak_pooled_bytes,
+            __atomic_add_fetch(&totals.pooled_bytes, bytes, __ATOMIC_RELAXED));
+}
+
+void memtrack_shape(uint32_t n_dims)
+{
+    __atomic_fetch_add(&totals.shape_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&totals.shape_bytes, sizeof(uint32_t) * n_dims, __ATOMIC_RELAXED);
+}
+
+uint32_t site_find(const char* file, int line, const char* func)
+{
+    uint32_t hash = line * 2654435761u, i;
+
+    for (const char* c = file; *c; c++)
+        hash = hash * 31 + *c;
+
+    for (uint32_t probe = 0; probe < MEMTRACK_MAX_SITES; probe++)
+    {
+        i = (hash + probe) % MEMTRACK_MAX_SITES;
+        if (__atomic_load_n(&sites[i].line, __ATOMIC_ACQUIRE) == 0)
+        {
+            pthread_mutex_lock(&sites_lock);
+            if (sites[i].line == 0)
+            {
+                sites[i].file = file;
+                sites[i].func = func;
+                __atomic_store_n(&sites[i].line, line, __ATOMIC_RELEASE);
+            }
+            pthread_mutex_unlock(&sites_lock);
+        }
+        if (sites[i].line == line && !strcmp(sites[i].file, file))
+            return i;
+    }
+
+    pthread_mutex_lock(&sites_lock);
+    if (sites[MEMTRACK_MAX_SITES].line == 0)
+    {
+        sites[MEMTRACK_MAX_SITES].file = "(other sites)";
+        sites[MEMTRACK_MAX_SITES].func = "";
+        __atomic_store_n(&sites[MEMTRACK_MAX_SITES].line, -1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&sites_lock);
+    return MEMTRACK_MAX_SITES;
+}
+
+/* Struct and buffers, the shape aside */
+int64_t owned_bytes(const tensor_t* t)
+{
+    int64_t bytes = sizeof(tensor_t);
+    uint32_t rows;
+
+    if (t->values != NULL)
+        bytes += sizeof(float) * (int64_t)tensor_numel(t);
+    if (t->halfs != NULL)
+        bytes += sizeof(uint16_t) * (int64_t)tensor_numel(t);
+    if (t->csr != NULL)
+    {
+        rows = t->n_dims > 0 ? t->shape[0] : 1;
+        bytes += sizeof(tensor_csr_t) + sizeof(uint32_t) * (rows + 1) +
+            (sizeof(uint32_t) + sizeof(float)) * (int64_t)(t->csr->nnz ? t->csr->nnz : 1);
+    }
+    return bytes;
+}
+
+void account(uint32_t site, int64_t bytes, int alloc)
+{
+    memtrack_site_t* s = &sites[site];
+    int64_t live;
+
+    if (alloc)
+    {
+        __atomic_fetch_add(&s->allocs, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&totals.allocs, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&s->live_bytes, bytes, __ATOMIC_RELAXED);
+    if (bytes > 0)
+    {
+        __atomic_fetch_add(&s->total_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&totals.total_bytes, bytes, __ATOMIC_RELAXED);
+    }
+
+    live = __atomic_add_fetch(&totals.live_bytes, bytes, __ATOMIC_RELAXED);
+    peak_max(&totals.peak_bytes, live);
+    peak_max(&step_peak, live);
+}
+
+void peak_max(int64_t* peak, int64_t value)
+{
+    int64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (value > old &&
+            !__atomic_compare_exchange_n(peak, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* By live bytes or bytes allocated, largest first */
+int cmp_sites(const void* a, const void* b)
+{
+    const memtrack_site_t* s1 = (const memtrack_site_t*)a, *s2 = (const memtrack_site_t*)b;
+    int64_t k1 = sort_live ? s1->live_bytes : (int64_t)s1->total_bytes;
+    int64_t k2 = sort_live ? s2->live_bytes : (int64_t)s2->total_bytes;
+
+    return (k1 < k2) - (k1 > k2);
+}
+
+void report_at_exit()
+{
+    memtrack_report(stdout);
+}
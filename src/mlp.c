@@ -0,0 +1,255 @@
+#include "mlp.h"
+#include "tensor_pool.h"
+#include "nn.h"
+#include "trace.h"
+#include "half.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+static tensor_t* layer_init(uint32_t* shape, uint32_t n_dims);
+static void sgd_step(tensor_t* param, const tensor_t* grad, float lr);
+static const tensor_t* gemm_input(const mlp_t* mlp, const tensor_t* t, tensor_pool_t* pool);
+static void refresh_half(const tensor_t* W, tensor_t* Wh, tensor_dtype_t dtype);
+
+mlp_t* mlp_init(uint32_t n_inputs, uint32_t n_hidden, uint32_t n_outputs)
+{
+    mlp_t* mlp = (mlp_t*)malloc(sizeof(mlp_t));
+    uint32_t l1_shape[] = {n_inputs, n_hidden};
+    uint32_t l2_shape[] = {n_hidden, n_outputs};
+
+    mlp->W1 = layer_init(l1_shape, 2);
+    mlp->b1 = layer_init(&l1_shape[1], 1);
+    mlp->W2 = layer_init(l2_shape, 2);
+    mlp->b2 = layer_init(&l2_shape[1], 1);
+    mlp->dtype = TENSOR_F32;
+    mlp->W1h = NULL;
+    mlp->W2h = NULL;
+    return mlp;
+}
+
+void mlp_clean(mlp_t* mlp)
+{
+    tensor_clean(mlp->W1);
+    tensor_clean(mlp->b1);
+    tensor_clean(mlp->W2);
+    tensor_clean(mlp->b2);
+    if (mlp->W1h != NULL)
+    {
+        tensor_clean(mlp->W1h);
+        tensor_clean(mlp->W2h);
+    }
+    free(mlp);
+}
+
+void mlp_set_dtype(mlp_t* mlp, tensor_dtype_t dtype)
+{
+    if (mlp->W1h != NULL && mlp->dtype != dtype)
+    {
+        tensor_clean(mlp->W1h);
+        tensor_clean(mlp->W2h);
+        mlp->W1h = mlp->W2h = NULL;
+    }
+
+    mlp->dtype = dtype;
+    if (dtype == TENSOR_F32)
+        return;
+    if (mlp->W1h == NULL)
+    {
+        mlp->W1h = tensor_to_dtype(mlp->W1, dtype);
+        mlp->W2h = tensor_to_dtype(mlp->W2, dtype);
+    }
+    else
+    {
+        refresh_half(mlp->W1, mlp->W1h, dtype);
+        refresh_half(mlp->W2, mlp->W2h, dtype);
+    }
+}
+
+tensor_t* mlp_forward(const mlp_t* mlp, const tensor_t* x)
+{
+    tensor_pool_t* pool = tensor_pool_init();
+
+    tensor_t* t1 = tensor_mm(gemm_input(mlp, x, pool), mlp->W1h ? mlp->W1h : mlp->W1);
+    tensor_t* z1 = tensor_add(t1, mlp->b1);
+    tensor_t* a1 = nn_relu(z1);
+
+    tensor_t* t2 = tensor_mm(gemm_input(mlp, a1, pool), mlp->W2h ? mlp->W2h : mlp->W2);
+    tensor_t* z2 = tensor_add(t2, mlp->b2);
+    tensor_t* a2 = nn_softmax(z2, 1);
+    tensor_t* preds = tensor_argmax(a2, 1);
+
+    tensor_pool_clean(pool);
+    tensor_clean(t1);
+    tensor_clean(z1);
+    tensor_clean(a1);
+    tensor_clean(t2);
+    tensor_clean(z2);
+    tensor_clean(a2);
+    return preds;
+}
+
+train_res_t mlp_forward_backward(const mlp_t* mlp, const tensor_t* x, const tensor_t* y)
+{
+    return mlp_forward_backward_hook(mlp, x, y, NULL, NULL);
+}
+
+train_res_t mlp_forward_backward_hook(const mlp_t* mlp, const tensor_t* x, const tensor_t* y,
+        mlp_grad_hook_t hook, void* ctx)
+{
+    tensor_pool_t* pool = tensor_pool_init();
+
+    float piy;
+    train_res_t res;
+
+    tensor_t* dz2;
+    tensor_t* da1;
+    tensor_t* dz1;
+    tensor_t* T;
+
+    /* With a 16 bit dtype the GEMMs read half width copies of the weights
+     * and activations, everything else stays in fp32 */
+    const tensor_t* xh = gemm_input(mlp, x, pool);
+    const tensor_t* a1h;
+    const tensor_t* W2h = mlp->W2h ? mlp->W2h : mlp->W2;
+
+    tensor_t* t1 = tensor_mm(xh, mlp->W1h ? mlp->W1h : mlp->W1);
+    tensor_pool_add(pool, t1);
+
+    tensor_t* z1 = tensor_add(t1, mlp->b1);
+    tensor_pool_add(pool, z1);
+
+    tensor_t* a1 = nn_relu(z1);
+    tensor_pool_add(pool, a1);
+
+    a1h = gemm_input(mlp, a1, pool);
+    tensor_t* t2 = tensor_mm(a1h, W2h);
+    tensor_pool_add(pool, t2);
+
+    tensor_t* z2 = tensor_add(t2, mlp->b2);
+    tensor_pool_add(pool, z2);
+
+    tensor_t* a2 = nn_softmax(z2, 1);
+    tensor_pool_add(pool, a2);
+
+    res.predictions = tensor_argmax(a2, 1);
+    res.loss = nn_sparse_ce_loss(y, a2);
+
+    dz2 = tensor_copy(a2);
+    for (int i = 0; i < tensor_numel(y); i++)
+    {
+        piy = a2->values[i * a2->shape[1] + (int)y->values[i]];
+        dz2->values[i * dz2->shape[1] + (int)y->values[i]] = piy - 1 ;
+    }
+    tensor_pool_add(pool, dz2);
+
+    dz2 = tensor_div_scalar(dz2, x->shape[0]);
+    tensor_pool_add(pool, dz2);
+
+    T = tensor_T(a1h);
+    tensor_pool_add(pool, T);
+    res.dW2 = tensor_mm(T, dz2);
+    res.db2 = tensor_reduce_sum(dz2, 0);
+    if (hook)
+        hook(1, &res, ctx);
+
+    T = tensor_T(W2h);
+    tensor_pool_add(pool, T);
+    da1 = tensor_mm(dz2, T);
+    tensor_pool_add(pool, da1);
+
+    dz1 = tensor_zeros(z1->shape, 2);
+    tensor_pool_add(pool, dz1);
+
+    dz1 = tensor_gte(z1, dz1);
+    tensor_pool_add(pool, dz1);
+
+    dz1 = tensor_mul(dz1, da1);
+    tensor_pool_add(pool, dz1);
+
+    /* Takes the sparse path when x comes with a CSR */
+    res.dW1 = tensor_mm_T(xh, dz1);
+    res.db1 = tensor_reduce_sum(dz1, 0);
+    if (hook)
+        hook(0, &res, ctx);
+
+    tensor_pool_clean(pool);
+
+    return res;
+}
+
+void mlp_update(mlp_t* mlp, const train_res_t* res, float lr)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+
+    sgd_step(mlp->W2, res->dW2, lr);
+    sgd_step(mlp->b2, res->db2, lr);
+    sgd_step(mlp->W1, res->dW1, lr);
+    sgd_step(mlp->b1, res->db1, lr);
+    if (mlp->W1h != NULL)
+    {
+        refresh_half(mlp->W1, mlp->W1h, mlp->dtype);
+        refresh_half(mlp->W2, mlp->W2h, mlp->dtype);
+    }
+
+    /* Every parameter and gradient read, every parameter written */
+    TRACE_BYTES(trace_start, "mlp_update", 3 * sizeof(float) * (tensor_numel(mlp->W1) +
+            tensor_numel(mlp->b1) + tensor_numel(mlp->W2) + tensor_numel(mlp->b2)));
+}
+
+float mlp_accuracy(const mlp_t* mlp, const tensor_t* x, const tensor_t* y)
+{
+    tensor_t* preds = mlp_forward(mlp, x);
+    float acc = nn_accuracy_score(y, preds);
+    tensor_clean(preds);
+    return acc;
+}
+
+void train_res_clean(train_res_t* res)
+{
+    tensor_clean(res->dW1);
+    tensor_clean(res->db1);
+    tensor_clean(res->dW2);
+    tensor_clean(res->db2);
+    tensor_clean(res->predictions);
+}
+
+static void sgd_step(tensor_t* param, const tensor_t* grad, float lr)
+{
+    uint32_t nels = tensor_numel(param);
+    for (int i = 0; i < nels; i++)
+        param->values[i] -= lr * grad->values[i];
+}
+
+/* Returns the activations `t` themselves when the model computes in fp32,
+ * otherwise a copy in the model dtype owned by `pool` */
+static const tensor_t* gemm_input(const mlp_t* mlp, const tensor_t* t, tensor_pool_t* pool)
+{
+    tensor_t* res;
+
+    if (mlp->dtype == TENSOR_F32)
+        return t;
+
+    res = tensor_to_dtype(t, mlp->dtype);
+    tensor_pool_add(pool, res);
+    return res;
+}
+
+static void refresh_half(const tensor_t* W, tensor_t* Wh, tensor_dtype_t dtype)
+{
+    half_from_f32(Wh->halfs, W->values, tensor_numel(W), dtype);
+}
+
+static tensor_t* layer_init(uint32_t* shape, uint32_t n_dims)
+{
+    float prod = 1;
+    tensor_t* gc, *res;
+
+    for (int i = 0; i < n_dims; i++)
+        prod *= shape[i];
+
+    gc = tensor_uniform(-1, 1, shape, n_dims);
+    res = tensor_div_scalar(gc, sqrt(prod));
+    tensor_clean(gc);
+    return res;
+}
@@ -1,34 +1,72 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "mnist.h"
+#include "sparse.h"
+#include "trace.h"
+#include "memtrack.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 /* Utility functions  */
 static int reverse_int(int i);
 static void read_int(FILE* f, int* value);
+static mnist_example_t* batch_sample(mnist_t* ds, int n_samples, uint8_t flat, unsigned int* seed);
 
 mnist_t* mnist_read(const char* images_fname, const char* labels_fname)
 {
-    FILE* images_f;
+    uint64_t trace_start = TRACE_BEGIN();
     FILE* labels_f;
-    int kk, amount;
+    int kk;
 
-    mnist_images_t* mnist_images = (mnist_images_t*)malloc(sizeof(mnist_images_t));
+    mnist_images_t* mnist_images;
     mnist_labels_t* mnist_labels = (mnist_labels_t*)malloc(sizeof(mnist_labels_t));
     mnist_t* mnist = (mnist_t*)malloc(sizeof(mnist_t));
 
-    images_f = fopen(images_fname, "rb");
+    mnist_images = mnist_read_images(images_fname);
+    if (mnist_images == NULL)
+        return NULL;
+
     labels_f = fopen(labels_fname, "rb");
+    if (labels_f == NULL)
+    {
+        printf("[ERROR] Reading file %s\n", labels_fname);
+        return NULL;
+    }
 
-    if (images_f == NULL)
+    /* Filling labels struct  */
+    fread(&kk, 4, 1, labels_f);
+    read_int(labels_f, &(mnist_labels->n_items));
+    mnist_labels->labels = (unsigned char*)malloc(mnist_labels->n_items);
+
+    if (fread(mnist_labels->labels, 1, 
+                mnist_labels->n_items, labels_f) != mnist_labels->n_items)
     {
-        printf("[ERROR] Reading file %s\n", images_fname);
+        printf("[ERROR] Reading bytes from labels file\n");
         return NULL;
     }
 
-    if (labels_f == NULL)
+    mnist->images = mnist_images;
+    mnist->labels = mnist_labels;
+
+    fclose(labels_f);
+    TRACE_BYTES(trace_start, "mnist_read", (uint64_t)mnist_images->n_images * mnist_images->rows *
+            mnist_images->cols + mnist_labels->n_items);
+    return mnist;
+}
+
+mnist_images_t* mnist_read_images(const char* fname)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    FILE* images_f = fopen(fname, "rb");
+    int kk, amount;
+
+    mnist_images_t* mnist_images = (mnist_images_t*)malloc(sizeof(mnist_images_t));
+
+    if (images_f == NULL)
     {
-        printf("[ERROR] Reading file %s\n", labels_fname);
+        printf("[ERROR] Reading file %s\n", fname);
         return NULL;
     }
 
@@ -47,28 +85,36 @@ mnist_t* mnist_read(const char* images_fname, const char* labels_fname)
         return NULL;
     }
 
-    /* Filling labels struct  */
-    fread(&kk, 4, 1, labels_f);
-    read_int(labels_f, &(mnist_labels->n_items));
-    mnist_labels->labels = (unsigned char*)malloc(mnist_labels->n_items);
+    fclose(images_f);
+    TRACE_BYTES(trace_start, "mnist_read_images", amount);
+    return mnist_images;
+}
 
-    if (fread(mnist_labels->labels, 1, 
-                mnist_labels->n_items, labels_f) != mnist_labels->n_items)
-    {
-        printf("[ERROR] Reading bytes from labels file\n");
-        return NULL;
-    }
+mnist_t* mnist_copy(const mnist_t* ds)
+{
+    int amount = ds->images->n_images * ds->images->rows * ds->images->cols;
+    mnist_images_t* mnist_images = (mnist_images_t*)malloc(sizeof(mnist_images_t));
+    mnist_labels_t* mnist_labels = (mnist_labels_t*)malloc(sizeof(mnist_labels_t));
+    mnist_t* mnist = (mnist_t*)malloc(sizeof(mnist_t));
+
+    /* The copy is written by the calling thread, so its pages are placed on
+     * the NUMA node that thread runs on */
+    *mnist_images = *ds->images;
+    mnist_images->pixels = (unsigned char*)malloc(amount);
+    memcpy(mnist_images->pixels, ds->images->pixels, amount);
+
+    *mnist_labels = *ds->labels;
+    mnist_labels->labels = (unsigned char*)malloc(mnist_labels->n_items);
+    memcpy(mnist_labels->labels, ds->labels->labels, mnist_labels->n_items);
 
     mnist->images = mnist_images;
     mnist->labels = mnist_labels;
-
-    fclose(images_f);
-    fclose(labels_f);
     return mnist;
 }
 
 mnist_example_t* mnist_sample(mnist_t* ds, uint8_t flat)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     int rand_idx = rand() % ds->images->n_images;
 
     /* Sample image variables */
@@ -99,11 +145,23 @@ mnist_example_t* mnist_sample(mnist_t* ds, uint8_t flat)
 
     result->image = tensor_new(values, shape, n_dims);
     result->label = tensor_new(label_values, NULL, 0);
+    TRACE_OUT(trace_start, "mnist_sample", result->image, n_bytes + sizeof(float));
     return result;
 }
 
 mnist_example_t* mnist_batch(mnist_t* ds, int n_samples, uint8_t flat)
 {
+    return batch_sample(ds, n_samples, flat, NULL);
+}
+
+mnist_example_t* mnist_batch_r(mnist_t* ds, int n_samples, uint8_t flat, unsigned int* seed)
+{
+    return batch_sample(ds, n_samples, flat, seed);
+}
+
+mnist_example_t* batch_sample(mnist_t* ds, int n_samples, uint8_t flat, unsigned int* seed)
+{
+    uint64_t trace_start = TRACE_BEGIN();
     int rand_idx;
     
     /* Sample Image variables */
@@ -117,6 +175,7 @@ mnist_example_t* mnist_batch(mnist_t* ds, int n_samples, uint8_t flat)
     float* label_values = (float*)malloc(sizeof(float) * n_samples);
     uint32_t* label_shape = (uint32_t*)malloc(sizeof(uint32_t));
     mnist_example_t* result = (mnist_example_t*)malloc(sizeof(mnist_example_t));
+    const uint8_t** rows = (const uint8_t**)malloc(sizeof(uint8_t*) * n_samples);
     label_shape[0] = n_samples;
 
     if (flat) 
@@ -133,20 +192,32 @@ mnist_example_t* mnist_batch(mnist_t* ds, int n_samples, uint8_t flat)
 
     for (int i = 0; i < n_samples; i++)
     {
-        rand_idx = rand() % ds->images->n_images;
+        /* rand() shares a global state, so threads sample with their own seed */
+        rand_idx = (seed ? rand_r(seed) : rand()) % ds->images->n_images;
         base_idx = n_bytes * rand_idx;
         label_values[i] = (float)ds->labels->labels[rand_idx];
+        rows[i] = &ds->images->pixels[base_idx];
         for (int j = 0; j < n_bytes; j++)
             values[i * n_bytes + j] = (float)ds->images->pixels[base_idx + j];
     }
 
     result->image = tensor_new(values, shape, n_dims);
     result->label = tensor_new(label_values, label_shape, 1);
+
+    /* Most pixels are 0, flat batches also get a CSR for the first layer */
+    if (flat)
+    {
+        result->image->csr = sparse_from_u8(rows, n_samples, n_bytes);
+        memtrack_resize(result->image);
+    }
+    free(rows);
+    TRACE_OUT(trace_start, "mnist_batch", result->image, (uint64_t)n_samples * (n_bytes + sizeof(float)));
     return result;
 }
 
 mnist_example_t* mnist_as_tensor(mnist_t* ds, uint8_t flat)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     int n_samples = ds->images->n_images;
     int n_bytes = ds->images->rows * ds->images->cols;
     int n_dims = flat ? 2 : 3;
@@ -156,6 +227,7 @@ mnist_example_t* mnist_as_tensor(mnist_t* ds, uint8_t flat)
     float* label_values = (float*)malloc(sizeof(float) * n_samples);
     uint32_t* label_shape = (uint32_t*)malloc(sizeof(uint32_t));
     mnist_example_t* result = (mnist_example_t*)malloc(sizeof(mnist_example_t));
+    const uint8_t** rows;
     label_shape[0] = n_samples;
 
     if (flat)
@@ -178,13 +250,36 @@ mnist_example_t* mnist_as_tensor(mnist_t* ds, uint8_t flat)
 
     result->image = tensor_new(values, shape, n_dims);
     result->label = tensor_new(label_values, label_shape, 1);
+
+    if (flat)
+    {
+        rows = (const uint8_t**)malloc(sizeof(uint8_t*) * n_samples);
+        for (int i = 0; i < n_samples; i++)
+            rows[i] = &ds->images->pixels[i * n_bytes];
+        result->image->csr = sparse_from_u8(rows, n_samples, n_bytes);
+        memtrack_resize(result->image);
+        free(rows);
+    }
+    TRACE_OUT(trace_start, "mnist_as_tensor", result->image, (uint64_t)n_samples * (n_bytes + sizeof(float)));
     return result;
 }
 
+void mnist_example_clean(mnist_example_t* ex)
+{
+    tensor_clean(ex->image);
+    tensor_clean(ex->label);
+    free(ex);
+}
+
+void mnist_images_clean(mnist_images_t* images)
+{
+    free(images->pixels);
+    free(images);
+}
+
 void mnist_clean(mnist_t* ds)
 {
-   free(ds->images->pixels);
-   free(ds->images);
+   mnist_images_clean(ds->images);
    free(ds->labels->labels);
    free(ds->labels);
    free(ds);
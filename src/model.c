@@ -0,0 +1,722 @@
+#include "model.h"
+#include "kernels.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define CONFIG_DELIMITERS " ,\t\r\n"
+
+static const char* LAYER_NAMES[] = {"dense", "relu", "softmax_ce", "conv", "maxpool"};
+
+/* Utility functions */
+static model_t* parse(const char* config, uint32_t max_batch, ckpt_t* ckpt, int try_only);
+static model_t* parse_fail(model_t* model, char* copy, int try_only);
+static int params_match(const model_t* model);
+static layer_t* add_layer(model_t* model, uint32_t* capacity, layer_type_t type,
+        uint32_t n_in, uint32_t n_out);
+static void alloc_buffers(model_t* model);
+static tensor_t* buffer(uint32_t rows, uint32_t cols);
+static tensor_t* param_init(uint32_t rows, uint32_t cols);
+static tensor_t* param_load(const model_t* model, uint32_t layer, const char* name,
+        uint32_t rows, uint32_t cols);
+static void forward(model_t* model, const tensor_t* x, const tensor_t* y);
+static void backward(model_t* model, const tensor_t* x, const tensor_t* y);
+static float softmax_ce(const tensor_t* z, const tensor_t* y, tensor_t* p);
+
+model_t* model_parse(const char* config, uint32_t max_batch)
+{
+    return parse(config, max_batch, NULL, 0);
+}
+
+model_t* model_from_file(const char* path, uint32_t max_batch)
+{
+    FILE* f = fopen(path, "r");
+    size_t len = 0, capacity = 256;
+    char* config = (char*)malloc(capacity);
+    model_t* model;
+    int c;
+
+    if (f == NULL)
+    {
+        printf("[ERROR] Could not open model config %s\n", path);
+        exit(1);
+    }
+
+    while ((c = fgetc(f)) != EOF)
+    {
+        /* Comments run to the end of the line */
+        if (c == '#')
+            while ((c = fgetc(f)) != EOF && c != '\n');
+        if (c == EOF)
+            break;
+
+        if (len + 1 == capacity)
+            config = (char*)realloc(config, capacity *= 2);
+        config[len++] = c;
+    }
+    config[len] = '\0';
+    fclose(f);
+
+    model = model_parse(config, max_batch);
+    free(config);
+    return model;
+}
+
+void model_clean(model_t* model)
+{
+    layer_t* l;
+
+    for (uint32_t i = 0; i < model->n_layers; i++)
+    {
+        l = &model->layers[i];
+        if (l->W != NULL && model->ckpt != NULL)
+        {
+            ckpt_view_clean(l->W);
+            ckpt_view_clean(l->b);
+        }
+        else if (l->W != NULL)
+        {
+            tensor_clean(l->W);
+            tensor_clean(l->b);
+            tensor_clean(l->dW);
+            tensor_clean(l->db);
+        }
+        free(l->argmax);
+        tensor_clean(l->out);
+        if (l->d_in != NULL)
+            tensor_clean(l->d_in);
+    }
+    if (model->ckpt != NULL)
+        ckpt_close(model->ckpt);
+    tensor_clean(model->preds);
+    free(model->work);
+    free(model->config);
+    free(model->layers);
+    free(model);
+}
+
+uint32_t model_params(const model_t* model, tensor_t** params, char (*names)[MODEL_PARAM_NAME_LEN])
+{
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < model->n_layers; i++)
+        if (model->layers[i].W != NULL)
+        {
+            snprintf(names[n], MODEL_PARAM_NAME_LEN, "layers.%u.W", i);
+            params[n++] = model->layers[i].W;
+            snprintf(names[n], MODEL_PARAM_NAME_LEN, "layers.%u.b", i);
+            params[n++] = model->layers[i].b;
+        }
+    return n;
+}
+
+void model_save(const model_t* model, const char* path)
+{
+    tensor_t** tensors = (tensor_t**)malloc(sizeof(tensor_t*) * 2 * model->n_layers);
+    char (*names)[MODEL_PARAM_NAME_LEN] = (char (*)[MODEL_PARAM_NAME_LEN])malloc(
+            MODEL_PARAM_NAME_LEN * 2 * model->n_layers);
+    const char** name_ptrs = (const char**)malloc(sizeof(char*) * 2 * model->n_layers);
+    uint32_t n = model_params(model, tensors, names);
+
+    for (uint32_t i = 0; i < n; i++)
+        name_ptrs[i] = names[i];
+
+    if (ckpt_save(path, model->config, name_ptrs, (const tensor_t**)tensors, n) != 0)
+        exit(1);
+
+    free(name_ptrs);
+    free(names);
+    free(tensors);
+}
+
+model_t* model_load(const char* path, uint32_t max_batch)
+{
+    return model_from_ckpt(ckpt_open(path), max_batch);
+}
+
+model_t* model_from_ckpt(ckpt_t* ckpt, uint32_t max_batch)
+{
+    model_t* model = model_try_from_ckpt(ckpt, max_batch);
+
+    if (model == NULL)
+        exit(1);
+    return model;
+}
+
+model_t* model_try_from_ckpt(ckpt_t* ckpt, uint32_t max_batch)
+{
+    if (ckpt->meta == NULL)
+    {
+        printf("[ERROR] Checkpoint holds no model config\n");
+        return NULL;
+    }
+    return parse(ckpt->meta, max_batch, ckpt, 1);
+}
+
+void model_summary(const model_t* model)
+{
+    uint32_t params, total = 0;
+    const layer_t* l;
+
+    printf("%-12s %16s %10s\n", "layer", "shape", "params");
+    printf("%-12s %16u %10s\n", "input", model->n_inputs, "-");
+    for (uint32_t i = 0; i < model->n_layers; i++)
+    {
+        l = &model->layers[i];
+        params = l->type == LAYER_DENSE ? (l->n_in + 1) * l->n_out : 0;
+        if (l->type == LAYER_CONV)
+            params = (l->shape.C * l->shape.R * l->shape.R + 1) * l->shape.K;
+        total += params;
+        printf("%-12s %7u -> %-6u %10u\n", LAYER_NAMES[l->type], l->n_in, l->n_out, params);
+    }
+    printf("Total parameters: %u, max batch %u\n", total, model->max_batch);
+}
+
+const tensor_t* model_forward(model_t* model, const tensor_t* x)
+{
+    forward(model, x, NULL);
+    return model->preds;
+}
+
+float model_forward_backward(model_t* model, const tensor_t* x, const tensor_t* y)
+{
+    model_forward_loss(model, x, y);
+    model_backward(model, x, y);
+    return model->loss;
+}
+
+float model_forward_loss(model_t* model, const tensor_t* x, const tensor_t* y)
+{
+    if (model->ckpt != NULL)
+    {
+        printf("[ERROR] A model loaded from a checkpoint is read-only, it cannot be trained\n");
+        exit(1);
+    }
+
+    if (model->layers[model->n_layers - 1].type != LAYER_SOFTMAX_CE)
+    {
+        printf("[ERROR] Training needs a model ending with softmax_ce\n");
+        exit(1);
+    }
+
+    if (y->n_dims != 1 || y->shape[0] != x->shape[0])
+    {
+        printf("[ERROR] Labels must have shape [%u]\n", x->shape[0]);
+        exit(1);
+    }
+
+    forward(model, x, y);
+    return model->loss;
+}
+
+void model_backward(model_t* model, const tensor_t* x, const tensor_t* y)
+{
+    backward(model, x, y);
+}
+
+void model_update(model_t* model, float lr)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    uint64_t bytes = 0;
+    layer_t* l;
+
+    if (model->ckpt != NULL)
+    {
+        printf("[ERROR] A model loaded from a checkpoint is read-only, it cannot be trained\n");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < model->n_layers; i++)
+    {
+        l = &model->layers[i];
+        if (l->W == NULL)
+            continue;
+
+        for (uint32_t j = 0; j < tensor_numel(l->W); j++)
+            l->W->values[j] -= lr * l->dW->values[j];
+        for (uint32_t j = 0; j < tensor_numel(l->b); j++)
+            l->b->values[j] -= lr * l->db->values[j];
+
+        /* Parameters and gradients read, parameters written */
+        bytes += 3 * sizeof(float) * (tensor_numel(l->W) + tensor_numel(l->b));
+    }
+    TRACE_BYTES(trace_start, "model_update", bytes);
+}
+
+float model_accuracy(model_t* model, const tensor_t* x, const tensor_t* y)
+{
+    uint32_t rows = x->shape[0], cols = x->shape[1], correct = 0;
+    uint32_t shape[2];
+    tensor_t view;
+
+    /* Row slices of x share its values */
+    memset(&view, 0, sizeof(tensor_t));
+    view.n_dims = 2;
+    view.shape = shape;
+    view.dtype = TENSOR_F32;
+    shape[1] = cols;
+
+    for (uint32_t start = 0; start < rows; start += model->max_batch)
+    {
+        shape[0] = rows - start < model->max_batch ? rows - start : model->max_batch;
+        view.values = &x->values[start * cols];
+        forward(model, &view, NULL);
+
+        for (uint32_t i = 0; i < shape[0]; i++)
+            correct += model->preds->values[i] == y->values[start + i];
+    }
+    return (float)correct / rows;
+}
+
+/* Builds the layers of a config, with parameters mapped from ckpt when
+ * it is not NULL and drawn at random otherwise */
+model_t* parse(const char* config, uint32_t max_batch, ckpt_t* ckpt, int try_only)
+{
+    model_t* model = (model_t*)calloc(1, sizeof(model_t));
+    char* copy = (char*)malloc(strlen(config) + 1), *tok;
+    uint32_t capacity = 0, width = 0, C = 0, H = 0, W = 0;
+    unsigned int n, h, w, r, pad = 0;
+    int plain = 0, fields;
+    layer_t* l;
+
+    strcpy(copy, config);
+    for (tok = strtok(copy, CONFIG_DELIMITERS); tok != NULL; tok = strtok(NULL, CONFIG_DELIMITERS))
+    {
+        if (width == 0)
+        {
+            /* CxHxW inputs are images in plain NCHW */
+            if (sscanf(tok, "input:%ux%ux%u", &n, &h, &w) == 3 && n > 0 && h > 0 && w > 0)
+            {
+                C = n;
+                H = h;
+                W = w;
+                plain = 1;
+                n *= h * w;
+            }
+            else if (sscanf(tok, "input:%u", &n) != 1 || n == 0)
+            {
+                printf("[ERROR] Model config must start with input:N, got %s\n", tok);
+                return parse_fail(model, copy, try_only);
+            }
+            width = model->n_inputs = n;
+        }
+        else if (model->n_layers > 0 && model->layers[model->n_layers - 1].type == LAYER_SOFTMAX_CE)
+        {
+            printf("[ERROR] softmax_ce must be the last layer, got %s after it\n", tok);
+            return parse_fail(model, copy, try_only);
+        }
+        else if (sscanf(tok, "dense:%u", &n) == 1 && n > 0)
+        {
+            /* Flattens any image before it */
+            width = add_layer(model, &capacity, LAYER_DENSE, width, n)->n_out;
+            C = 0;
+        }
+        else if ((fields = sscanf(tok, "conv:%ux%u/%u", &n, &r, &pad)) >= 2 && n > 0 && r > 0)
+        {
+            if (C == 0)
+            {
+                printf("[ERROR] %s needs an image input (input:CxHxW), not a flat one\n", tok);
+                return parse_fail(model, copy, try_only);
+            }
+            if (H + 2 * (fields == 3 ? pad : 0) < r || W + 2 * (fields == 3 ? pad : 0) < r)
+            {
+                printf("[ERROR] %s needs an input of at least %ux%u, got %ux%u\n", tok, r, r, H, W);
+                return parse_fail(model, copy, try_only);
+            }
+            l = add_layer(model, &capacity, LAYER_CONV, width, 0);
+            l->shape = conv_make_shape(C, H, W, n, r, 1, fields == 3 ? pad : 0, plain);
+            l->algo = conv_select(&l->shape);
+            width = l->n_out = conv_out_size(&l->shape);
+            C = l->shape.K;
+            H = l->shape.P;
+            W = l->shape.Q;
+            plain = 0;
+        }
+        else if (sscanf(tok, "pool:%u", &n) == 1 && n > 0)
+        {
+            if (C == 0 || plain || H < n || W < n)
+            {
+                printf("[ERROR] %s needs a conv output of at least %ux%u before it\n", tok, n, n);
+                return parse_fail(model, copy, try_only);
+            }
+            l = add_layer(model, &capacity, LAYER_MAXPOOL, width, 0);
+            l->shape = conv_make_shape(C, H, W, C, n, n, 0, 0);
+            width = l->n_out = conv_in_size(&l->shape) / (H * W) * l->shape.P * l->shape.Q;
+            H = l->shape.P;
+            W = l->shape.Q;
+        }
+        else if (!strcmp(tok, "relu"))
+            add_layer(model, &capacity, LAYER_RELU, width, width);
+        else if (!strcmp(tok, "softmax_ce"))
+            add_layer(model, &capacity, LAYER_SOFTMAX_CE, width, width);
+        else
+        {
+            printf("[ERROR] Unknown layer %s\n", tok);
+            return parse_fail(model, copy, try_only);
+        }
+    }
+    free(copy);
+
+    if (model->n_layers == 0)
+    {
+        printf("[ERROR] Model config has no layer\n");
+        return parse_fail(model, NULL, try_only);
+    }
+
+    model->max_batch = max_batch;
+    model->ckpt = ckpt;
+    if (ckpt != NULL && !params_match(model))
+        return parse_fail(model, NULL, try_only);
+
+    model->config = (char*)malloc(strlen(config) + 1);
+    strcpy(model->config, config);
+    alloc_buffers(model);
+    return model;
+}
+
+layer_t* add_layer(model_t* model, uint32_t* capacity, layer_type_t type,
+        uint32_t n_in, uint32_t n_out)
+{
+    layer_t* l;
+
+    if (model->n_layers == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 8;
+        model->layers = (layer_t*)realloc(model->layers, sizeof(layer_t) * *capacity);
+    }
+
+    l = &model->layers[model->n_layers++];
+    memset(l, 0, sizeof(layer_t));
+    l->type = type;
+    l->n_in = n_in;
+    l->n_out = n_out;
+    return l;
+}
+
+/* A bad config or checkpoint, reported already: exits, or frees what was
+ * parsed when the caller must keep running */
+model_t* parse_fail(model_t* model, char* copy, int try_only)
+{
+    if (!try_only)
+        exit(1);
+    free(copy);
+    free(model->layers);
+    free(model);
+    return NULL;
+}
+
+/* Whether the checkpoint has every parameter of the config, checked before
+ * any buffer is allocated */
+int params_match(const model_t* model)
+{
+    char full[MODEL_PARAM_NAME_LEN];
+    uint32_t rows, cols;
+    const layer_t* l;
+    tensor_t* t;
+    int ok = 1;
+
+    for (uint32_t i = 0; i < model->n_layers && ok; i++)
+    {
+        l = &model->layers[i];
+        if (l->type != LAYER_DENSE && l->type != LAYER_CONV)
+            continue;
+        rows = l->type == LAYER_DENSE ? l->n_in : l->shape.C * l->shape.R * l->shape.R;
+        cols = l->type == LAYER_DENSE ? l->n_out : conv_blocks(l->shape.K) * CONV_CB;
+        for (int p = 0; p < 2 && ok; p++)
+        {
+            snprintf(full, sizeof(full), "layers.%u.%s", i, p == 0 ? "W" : "b");
+            t = ckpt_tensor(model->ckpt, full);
+            ok = t != NULL && t->dtype == TENSOR_F32 && t->n_dims == (p == 0 ? 2 : 1) &&
+                (p == 1 || t->shape[0] == rows) && t->shape[t->n_dims - 1] == cols;
+            if (!ok)
+                printf("[ERROR] Checkpoint has no F32 %s of shape [%u, %u] for its config\n", full,
+                        p == 0 ? rows : 0, cols);
+            if (t != NULL)
+                ckpt_view_clean(t);
+        }
+    }
+    return ok;
+}
+
+/* Parameters are drawn layer by layer, W then b, like mlp_init, or mapped
+ * from the checkpoint without gradients */
+void alloc_buffers(model_t* model)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t));
+    uint32_t rows, Kp;
+    size_t work = 0;
+    layer_t* l;
+
+    for (uint32_t i = 0; i < model->n_layers; i++)
+    {
+        l = &model->layers[i];
+        if (l->type == LAYER_DENSE && model->ckpt != NULL)
+        {
+            l->W = param_load(model, i, "W", l->n_in, l->n_out);
+            l->b = param_load(model, i, "b", 0, l->n_out);
+        }
+        else if (l->type == LAYER_DENSE)
+        {
+            l->W = param_init(l->n_in, l->n_out);
+            l->b = param_init(0, l->n_out);
+            l->dW = buffer(l->n_in, l->n_out);
+            l->db = buffer(0, l->n_out);
+        }
+        else if (l->type == LAYER_CONV)
+        {
+            /* [C * R * R, Kp] with zero padding columns (conv.h), uniform in
+             * +-1 / sqrt(fan in) as the numel scaling of dense layers would
+             * leave a deep CNN with no signal */
+            rows = l->shape.C * l->shape.R * l->shape.R;
+            Kp = conv_blocks(l->shape.K) * CONV_CB;
+            if (model->ckpt != NULL)
+            {
+                l->W = param_load(model, i, "W", rows, Kp);
+                l->b = param_load(model, i, "b", 0, Kp);
+            }
+            else
+            {
+                l->W = param_init(rows, Kp);
+                l->b = param_init(0, Kp);
+                for (uint32_t j = 0; j < rows * Kp; j++)
+                    l->W->values[j] = j % Kp < l->shape.K ? l->W->values[j] * sqrt(Kp) : 0;
+                for (uint32_t k = 0; k < Kp; k++)
+                    l->b->values[k] = k < l->shape.K ? l->b->values[k] * sqrt(Kp) / sqrt(rows) : 0;
+                l->dW = buffer(rows, Kp);
+                l->db = buffer(0, Kp);
+            }
+            if (conv_work_size(&l->shape) > work)
+                work = conv_work_size(&l->shape);
+        }
+        else if (l->type == LAYER_MAXPOOL)
+            l->argmax = (uint32_t*)malloc(sizeof(uint32_t) * model->max_batch * l->n_out);
+        l->out = buffer(model->max_batch, l->n_out);
+        if (i > 0)
+            l->d_in = buffer(model->max_batch, l->n_in);
+    }
+
+    shape[0] = model->max_batch;
+    model->preds = tensor_zeros(shape, 1);
+    model->work = work > 0 ? (float*)malloc(sizeof(float) * work) : NULL;
+}
+
+/* Zeroed [rows, cols], or [cols] when rows is 0 */
+tensor_t* buffer(uint32_t rows, uint32_t cols)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+    uint32_t n_dims = 0;
+
+    if (rows > 0)
+        shape[n_dims++] = rows;
+    shape[n_dims++] = cols;
+    return tensor_zeros(shape, n_dims);
+}
+
+/* [rows, cols] weights, or a [cols] bias when rows is 0, uniform in
+ * +-1 / sqrt(numel) */
+tensor_t* param_init(uint32_t rows, uint32_t cols)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+    uint32_t n_dims = 0;
+    float scale;
+    tensor_t* t;
+
+    if (rows > 0)
+        shape[n_dims++] = rows;
+    shape[n_dims++] = cols;
+
+    t = tensor_uniform(-1, 1, shape, n_dims);
+    scale = sqrt(tensor_numel(t));
+    for (uint32_t i = 0; i < tensor_numel(t); i++)
+        t->values[i] /= scale;
+    return t;
+}
+
+/* Mapped parameter layers.<layer>.<name>, which must be F32 of the shape
+ * the config gives (params_match checked it for model_try_from_ckpt) */
+tensor_t* param_load(const model_t* model, uint32_t layer, const char* name,
+        uint32_t rows, uint32_t cols)
+{
+    char full[MODEL_PARAM_NAME_LEN];
+    tensor_t* t;
+
+    snprintf(full, sizeof(full), "layers.%u.%s", layer, name);
+    t = ckpt_tensor(model->ckpt, full);
+    if (t == NULL || t->dtype != TENSOR_F32 || t->n_dims != (rows > 0 ? 2 : 1) ||
+            (rows > 0 && t->shape[0] != rows) || t->shape[t->n_dims - 1] != cols)
+    {
+        printf("[ERROR] Checkpoint has no F32 %s of shape [%u, %u] for its config\n", full,
+                rows, cols);
+        exit(1);
+    }
+    return t;
+}
+
+void forward(model_t* model, const tensor_t* x, const tensor_t* y)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    uint32_t rows = x->shape[0], C;
+    const tensor_t* in = x, *scores = x;
+    float* out, max;
+    layer_t* l;
+
+    if (x->n_dims != 2 || x->shape[1] != model->n_inputs || rows > model->max_batch)
+    {
+        printf("[ERROR] Model input must be [<= %u, %u]\n", model->max_batch, model->n_inputs);
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < model->n_layers; i++)
+    {
+        l = &model->layers[i];
+        l->out->shape[0] = rows;
+        if (l->d_in != NULL)
+            l->d_in->shape[0] = rows;
+        out = l->out->values;
+
+        switch (l->type)
+        {
+            case LAYER_DENSE:
+                /* Specialized kernel when the shape was generated for */
+                kernels_dense(in, l->W, l->b, 0, l->out);
+                break;
+
+            case LAYER_RELU:
+                for (uint32_t j = 0; j < rows * l->n_out; j++)
+                    out[j] = in->values[j] > 0 ? in->values[j] : 0;
+                break;
+
+            case LAYER_SOFTMAX_CE:
+                /* Without labels only the argmax of the logits is needed */
+                model->loss = y != NULL ? softmax_ce(in, y, l->out) : 0;
+                break;
+
+            case LAYER_CONV:
+                conv2d_forward(&l->shape, l->algo, in->values, l->W->values, l->b->values, out,
+                        rows, model->work);
+                break;
+
+            case LAYER_MAXPOOL:
+                maxpool_forward(l->shape.C, l->shape.H, l->shape.W, l->shape.R, in->values, out,
+                        l->argmax, rows);
+                break;
+        }
+        in = l->out;
+        if (l->type != LAYER_SOFTMAX_CE)
+            scores = l->out;
+    }
+
+    /* Argmax of every row of the logits */
+    C = scores->shape[1];
+    model->preds->shape[0] = rows;
+    for (uint32_t r = 0; r < rows; r++)
+    {
+        model->preds->values[r] = 0;
+        max = scores->values[r * C];
+        for (uint32_t c = 1; c < C; c++)
+            if (scores->values[r * C + c] > max)
+            {
+                max = scores->values[r * C + c];
+                model->preds->values[r] = c;
+            }
+    }
+    TRACE_OP(trace_start, "model_forward", x, NULL, scores);
+}
+
+/* Gradients of every layer from the last one down, each layer reads the
+ * gradient of its output from the d_in of the next one */
+void backward(model_t* model, const tensor_t* x, const tensor_t* y)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    const tensor_t* in, *d_out;
+    layer_t* l;
+    uint32_t rows = x->shape[0];
+    float* d_in;
+
+    for (int i = model->n_layers - 1; i >= 0; i--)
+    {
+        l = &model->layers[i];
+        in = i > 0 ? model->layers[i - 1].out : x;
+        d_out = i < model->n_layers - 1 ? model->layers[i + 1].d_in : NULL;
+        d_in = l->d_in != NULL ? l->d_in->values : NULL;
+
+        switch (l->type)
+        {
+            case LAYER_DENSE:
+                /* Takes the sparse path when x comes with a CSR */
+                tensor_mm_T_into(in, d_out, l->dW);
+                memset(l->db->values, 0, sizeof(float) * l->n_out);
+                for (uint32_t r = 0; r < rows; r++)
+                    for (uint32_t c = 0; c < l->n_out; c++)
+                        l->db->values[c] += d_out->values[r * l->n_out + c];
+                if (d_in != NULL)
+                    tensor_mm_NT_into(d_out, l->W, l->d_in);
+                break;
+
+            case LAYER_RELU:
+                if (d_in != NULL)
+                    for (uint32_t j = 0; j < rows * l->n_out; j++)
+                        d_in[j] = in->values[j] > 0 ? d_out->values[j] : 0;
+                break;
+
+            case LAYER_SOFTMAX_CE:
+                /* d(mean CE)/dz = (softmax(z) - onehot(y)) / M */
+                if (d_in != NULL)
+                {
+                    for (uint32_t j = 0; j < rows * l->n_out; j++)
+                        d_in[j] = l->out->values[j] / rows;
+                    for (uint32_t r = 0; r < rows; r++)
+                        d_in[r * l->n_out + (int)y->values[r]] -= 1.0f / rows;
+                }
+                break;
+
+            case LAYER_CONV:
+                conv2d_backward(&l->shape, l->algo, in->values, l->W->values, d_out->values, d_in,
+                        l->dW->values, l->db->values, rows, model->work);
+                break;
+
+            case LAYER_MAXPOOL:
+                if (d_in != NULL)
+                    maxpool_backward(l->shape.C, l->shape.H, l->shape.W, l->shape.R, d_out->values,
+                            l->argmax, d_in, rows);
+                break;
+        }
+    }
+    TRACE_OP(trace_start, "model_backward", x, NULL, NULL);
+}
+
+/* Writes softmax(z) into p and returns the mean cross entropy against y
+ * (0 without labels). Log-softmax is taken as z - max - log(sum(exp(z - max))),
+ * so no probability is passed to log. */
+float softmax_ce(const tensor_t* z, const tensor_t* y, tensor_t* p)
+{
+    uint32_t M = z->shape[0], C = z->shape[1];
+    float max, sum, loss = 0;
+    const float* row;
+    float* prow;
+
+    for (uint32_t i = 0; i < M; i++)
+    {
+        row = &z->values[i * C];
+        prow = &p->values[i * C];
+        max = row[0];
+        for (uint32_t c = 1; c < C; c++)
+            max = fmaxf(max, row[c]);
+
+        sum = 0;
+        for (uint32_t c = 0; c < C; c++)
+        {
+            prow[c] = expf(row[c] - max);
+            sum += prow[c];
+        }
+        for (uint32_t c = 0; c < C; c++)
+            prow[c] /= sum;
+
+        if (y != NULL)
+            loss -= row[(int)y->values[i]] - max - logf(sum);
+    }
+    return loss / M;
+}
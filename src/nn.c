@@ -1,4 +1,6 @@
 #include "nn.h"
+#include "lazy.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <math.h>
@@ -6,14 +8,17 @@
 
 tensor_t* nn_relu(tensor_t* t)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* result = tensor_copy(t);
     for (int i = 0; i < tensor_numel(t); i++)
         result->values[i] = t->values[i] > 0 ? t->values[i] : 0;
+    TRACE_OP(trace_start, "nn_relu", t, NULL, result);
     return result;
 }
 
 tensor_t* nn_softmax(tensor_t* t, uint32_t axis)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* exp_tensor = tensor_copy(t);
     tensor_t* activation;
     tensor_t* denominator;
@@ -32,11 +37,29 @@ tensor_t* nn_softmax(tensor_t* t, uint32_t axis)
     tensor_clean(gc);
     tensor_clean(exp_tensor);
 
+    TRACE_OP(trace_start, "nn_softmax", t, NULL, activation);
+    return activation;
+}
+
+tensor_t* nn_softmax_lazy(tensor_t* t, uint32_t axis)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    /* exp(t) / sum(exp(t)) as one pass for the sum and one for the division,
+     * exp(t) itself is never stored. The lazy exp is expf, so results may
+     * differ from nn_softmax in the last bits */
+    lazy_graph_t* g = lazy_graph_new();
+    lazy_t* exp_t = lazy_exp(g, lazy_leaf(g, t));
+    lazy_t* denominator = lazy_unsqueeze(g, lazy_reduce_sum(g, exp_t, axis), axis);
+    tensor_t* activation = lazy_eval(g, lazy_div(g, exp_t, denominator));
+
+    lazy_graph_clean(g);
+    TRACE_OP(trace_start, "nn_softmax_lazy", t, NULL, activation);
     return activation;
 }
 
 float nn_sparse_ce_loss(const tensor_t* y_true, const tensor_t* y_pred)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     float loss = 0;
 
     if (y_true->n_dims != 1)
@@ -62,14 +85,18 @@ float nn_sparse_ce_loss(const tensor_t* y_true, const tensor_t* y_pred)
         loss += -1 * log(y_pred->values[i * y_pred->shape[1] + (int)y_true->values[i]]);
     }
 
+    TRACE_OP(trace_start, "nn_sparse_ce_loss", y_true, y_pred, NULL);
     return loss / y_true->shape[0];
 }
 
 float nn_accuracy_score(const tensor_t* y_true, const tensor_t* y_pred)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     float correct = 0;
     tensor_t* gc = tensor_eq(y_true, y_pred);
    for (int i = 0; i < tensor_numel(y_true); i++)
         correct += gc->values[i];
+    tensor_clean(gc);
+    TRACE_OP(trace_start, "nn_accuracy_score", y_true, y_pred, NULL);
     return correct / y_true->shape[0];
 }
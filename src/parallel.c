@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct
+{
+    mlp_t* mlp;
+    mnist_t* ds;
+    const parallel_config_t* cfg;
+
+    int stop;
+    int halt;
+    int finished;
+    long examples;
+    double start;
+    double end;
+
+    pthread_barrier_t barrier;
+    train_res_t* grads;
+
+    topo_t* topo;
+    mnist_t** replicas;
+    topo_access_t access;
+} run_t;
+
+typedef struct
+{
+    run_t* run;
+    int id;
+    int node;
+} worker_t;
+
+/* Utility functions */
+static parallel_stats_t run_workers(run_t* run, const mnist_example_t* eval,
+        void* (*fn)(void*), const char* name);
+static void* hogwild_worker(void* arg);
+static void* sync_worker(void* arg);
+static void accumulate(tensor_t* dst, const tensor_t* src);
+static mnist_t* worker_setup(worker_t* w);
+static void sample_placement(worker_t* w, int step, const mnist_t* ds,
+        const mnist_example_t* batch, const train_res_t* res);
+static void replicate(run_t* run);
+static void* replicate_worker(void* arg);
+static void worker_done(run_t* run);
+static double now_seconds();
+
+parallel_stats_t parallel_hogwild(mlp_t* mlp, mnist_t* ds,
+        const mnist_example_t* eval, const parallel_config_t* cfg)
+{
+    run_t run = {mlp, ds, cfg, 0, 0, 0, 0};
+    return run_workers(&run, eval, hogwild_worker, "hogwild");
+}
+
+parallel_stats_t parallel_sync(mlp_t* mlp, mnist_t* ds,
+        const mnist_example_t* eval, const parallel_config_t* cfg)
+{
+    parallel_stats_t stats;
+    run_t run = {mlp, ds, cfg, 0, 0, 0, 0};
+
+    run.grads = (train_res_t*)malloc(sizeof(train_res_t) * cfg->n_threads);
+    pthread_barrier_init(&run.barrier, NULL, cfg->n_threads);
+
+    stats = run_workers(&run, eval, sync_worker, "sync");
+
+    pthread_barrier_destroy(&run.barrier);
+    free(run.grads);
+    return stats;
+}
+
+/* Starts the workers and monitors them from the calling thread. Evaluation
+ * runs concurrently with training, so it competes for cores in the same
+ * way for every mode. */
+parallel_stats_t run_workers(run_t* run, const mnist_example_t* eval,
+        void* (*fn)(void*), const char* name)
+{
+    const parallel_config_t* cfg = run->cfg;
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * cfg->n_threads);
+    worker_t* workers = (worker_t*)malloc(sizeof(worker_t) * cfg->n_threads);
+    struct timespec interval;
+    parallel_stats_t stats;
+    double start, elapsed;
+    float acc;
+
+    if (cfg->pin_threads || cfg->replicate_dataset || cfg->numa_sample_every > 0)
+        run->topo = topo_read();
+    if (cfg->replicate_dataset)
+        replicate(run);
+
+    interval.tv_sec = cfg->eval_interval_ms / 1000;
+    interval.tv_nsec = (cfg->eval_interval_ms % 1000) * 1000000L;
+    stats.time_to_target = -1;
+
+    start = now_seconds();
+    run->start = start;
+    for (int i = 0; i < cfg->n_threads; i++)
+    {
+        workers[i].run = run;
+        workers[i].id = i;
+        pthread_create(&threads[i], NULL, fn, &workers[i]);
+    }
+
+    while (__atomic_load_n(&run->finished, __ATOMIC_ACQUIRE) < cfg->n_threads)
+    {
+        nanosleep(&interval, NULL);
+        acc = mlp_accuracy(run->mlp, eval->image, eval->label);
+        elapsed = now_seconds() - start;
+
+        if (cfg->verbose)
+            printf("[%s %.2fs] examples: %ld  accuracy: %.5f\n", name, elapsed,
+                   __atomic_load_n(&run->examples, __ATOMIC_RELAXED), acc);
+
+        if (cfg->target_acc > 0 && acc >= cfg->target_acc && stats.time_to_target < 0)
+        {
+            stats.time_to_target = elapsed;
+            if (cfg->stop_at_target)
+                __atomic_store_n(&run->stop, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (int i = 0; i < cfg->n_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    /* Throughput only counts the time workers were running, not the tail
+     * of the last evaluation interval */
+    stats.seconds = run->end - start;
+    stats.examples = run->examples;
+    stats.examples_per_sec = stats.examples / stats.seconds;
+    stats.final_acc = mlp_accuracy(run->mlp, eval->image, eval->label);
+    if (cfg->target_acc > 0 && stats.final_acc >= cfg->target_acc && stats.time_to_target < 0)
+        stats.time_to_target = stats.seconds;
+    if (stats.time_to_target > stats.seconds)
+        stats.time_to_target = stats.seconds;
+
+    stats.access = run->access;
+
+    if (run->replicas)
+    {
+        for (int i = 0; i < run->topo->n_nodes; i++)
+            if (run->replicas[i] != run->ds)
+                mnist_clean(run->replicas[i]);
+        free(run->replicas);
+    }
+    if (run->topo)
+        topo_clean(run->topo);
+
+    free(threads);
+    free(workers);
+    return stats;
+}
+
+void* hogwild_worker(void* arg)
+{
+    worker_t* w = (worker_t*)arg;
+    run_t* run = w->run;
+    const parallel_config_t* cfg = run->cfg;
+    unsigned int seed = cfg->seed + 7919 * (w->id + 1);
+    mnist_t* ds = worker_setup(w);
+    mnist_example_t* batch;
+    train_res_t res;
+
+    for (int step = 0; step < cfg->max_steps; step++)
+    {
+        if (__atomic_load_n(&run->stop, __ATOMIC_RELAXED))
+            break;
+
+        batch = mnist_batch_r(ds, cfg->batch_size, 1, &seed);
+        res = mlp_forward_backward(run->mlp, batch->image, batch->label);
+        mlp_update(run->mlp, &res, cfg->lr);
+        sample_placement(w, step, ds, batch, &res);
+
+        train_res_clean(&res);
+        mnist_example_clean(batch);
+        __atomic_fetch_add(&run->examples, cfg->batch_size, __ATOMIC_RELAXED);
+    }
+
+    worker_done(run);
+    return NULL;
+}
+
+void* sync_worker(void* arg)
+{
+    worker_t* w = (worker_t*)arg;
+    run_t* run = w->run;
+    const parallel_config_t* cfg = run->cfg;
+    unsigned int seed = cfg->seed + 7919 * (w->id + 1);
+    mnist_t* ds = worker_setup(w);
+    mnist_example_t* batch;
+    train_res_t* avg = &run->grads[0];
+
+    for (int step = 0; step < cfg->max_steps; step++)
+    {
+        batch = mnist_batch_r(ds, cfg->batch_size, 1, &seed);
+        run->grads[w->id] = mlp_forward_backward(run->mlp, batch->image, batch->label);
+        sample_placement(w, step, ds, batch, &run->grads[w->id]);
+        mnist_example_clean(batch);
+
+        pthread_barrier_wait(&run->barrier);
+
+        /* A single worker averages the gradients and updates the model,
+         * the rest wait for it in the second barrier */
+        if (w->id == 0)
+        {
+            for (int i = 1; i < cfg->n_threads; i++)
+            {
+                accumulate(avg->dW1, run->grads[i].dW1);
+                accumulate(avg->db1, run->grads[i].db1);
+                accumulate(avg->dW2, run->grads[i].dW2);
+                accumulate(avg->db2, run->grads[i].db2);
+            }
+            mlp_update(run->mlp, avg, cfg->lr / cfg->n_threads);
+            __atomic_fetch_add(&run->examples,
+                    (long)cfg->batch_size * cfg->n_threads, __ATOMIC_RELAXED);
+            run->halt = __atomic_load_n(&run->stop, __ATOMIC_RELAXED);
+        }
+
+        pthread_barrier_wait(&run->barrier);
+        train_res_clean(&run->grads[w->id]);
+        if (run->halt)
+            break;
+    }
+
+    worker_done(run);
+    return NULL;
+}
+
+void accumulate(tensor_t* dst, const tensor_t* src)
+{
+    uint32_t nels = tensor_numel(dst);
+    for (int i = 0; i < nels; i++)
+        dst->values[i] += src->values[i];
+}
+
+/* Pinning happens before the worker allocates anything, so its batches and
+ * gradients are first touched, and thus placed, on its own node */
+mnist_t* worker_setup(worker_t* w)
+{
+    run_t* run = w->run;
+
+    w->node = -1;
+    if (run->cfg->pin_threads)
+        w->node = topo_pin_worker(run->topo, w->id);
+
+    if (run->replicas && w->node >= 0)
+        return run->replicas[w->node];
+    return run->ds;
+}
+
+void sample_placement(worker_t* w, int step, const mnist_t* ds,
+        const mnist_example_t* batch, const train_res_t* res)
+{
+    run_t* run = w->run;
+    const mlp_t* mlp = run->mlp;
+    topo_access_t access = {{0}, {0}};
+    int every = run->cfg->numa_sample_every;
+    int node;
+
+    if (every <= 0 || step % every != 0)
+        return;
+
+    /* Unpinned threads are local to wherever the scheduler put them */
+    node = w->node >= 0 ? w->node : topo_current_node(run->topo);
+
+    topo_sample(run->topo, ds->images->pixels,
+            (size_t)ds->images->n_images * ds->images->rows * ds->images->cols,
+            node, &access.remote[TOPO_DATASET], &access.pages[TOPO_DATASET]);
+    topo_sample(run->topo, batch->image->values, sizeof(float) * tensor_numel(batch->image),
+            node, &access.remote[TOPO_BATCH], &access.pages[TOPO_BATCH]);
+    topo_sample(run->topo, res->dW1->values, sizeof(float) * tensor_numel(res->dW1),
+            node, &access.remote[TOPO_GRADS], &access.pages[TOPO_GRADS]);
+    topo_sample(run->topo, mlp->W1->values, sizeof(float) * tensor_numel(mlp->W1),
+            node, &access.remote[TOPO_WEIGHTS], &access.pages[TOPO_WEIGHTS]);
+
+    for (int i = 0; i < TOPO_N_KINDS; i++)
+    {
+        __atomic_fetch_add(&run->access.remote[i], access.remote[i], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&run->access.pages[i], access.pages[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* Every copy is made by a thread bound to the node that will read it */
+void replicate(run_t* run)
+{
+    int n_nodes = run->topo->n_nodes;
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * n_nodes);
+    worker_t* helpers = (worker_t*)malloc(sizeof(worker_t) * n_nodes);
+
+    run->replicas = (mnist_t**)malloc(sizeof(mnist_t*) * n_nodes);
+    for (int i = 0; i < n_nodes; i++)
+    {
+        helpers[i].run = run;
+        helpers[i].node = i;
+        pthread_create(&threads[i], NULL, replicate_worker, &helpers[i]);
+    }
+
+    for (int i = 0; i < n_nodes; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(helpers);
+}
+
+void* replicate_worker(void* arg)
+{
+    worker_t* w = (worker_t*)arg;
+    run_t* run = w->run;
+
+    if (topo_pin_node(run->topo, w->node) < 0)
+        run->replicas[w->node] = run->ds;
+    else
+        run->replicas[w->node] = mnist_copy(run->ds);
+    return NULL;
+}
+
+void worker_done(run_t* run)
+{
+    double end = now_seconds();
+
+    if (__atomic_add_fetch(&run->finished, 1, __ATOMIC_ACQ_REL) == run->cfg->n_threads)
+        run->end = end;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
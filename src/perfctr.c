@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include "perfctr.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* Frames of the ops in progress on a thread, deeper ones overwrite the
+ * oldest */
+#define PERFCTR_DEPTH 32
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+typedef struct
+{
+    uint64_t start;
+    uint64_t counts[PERFCTR_COUNT];
+} perfctr_frame_t;
+
+/* Counters of one thread, -1 for the ones that could not be opened */
+typedef struct
+{
+    int fds[PERFCTR_COUNT];
+    uint32_t depth;
+    perfctr_frame_t frames[PERFCTR_DEPTH];
+} perfctr_thread_t;
+
+typedef struct
+{
+    const char* name;
+    uint64_t calls;
+    uint64_t elements;
+    uint64_t counts[PERFCTR_COUNT];
+} perfctr_op_t;
+
+static const struct
+{
+    uint32_t type;
+    uint64_t config;
+    const char* name;
+} events[PERFCTR_COUNT] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D), "L1d-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC-misses"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB), "dTLB-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+};
+
+uint32_t perfctr_available = 0;
+
+static __thread perfctr_thread_t* local = NULL;
+static pthread_key_t thread_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+/* Ops are found by open addressing on their name, a slot is published by
+ * the release store of its name */
+static perfctr_op_t ops[PERFCTR_MAX_OPS];
+static pthread_mutex_t ops_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Utility functions */
+static perfctr_thread_t* thread_open();
+static void thread_close(void* arg);
+static void key_create();
+static perfctr_op_t* op_find(const char* name);
+static int cmp_ops(const void* a, const void* b);
+static void print_per_element(FILE* f, const perfctr_op_t* op, perfctr_kind_t kind);
+static void report_at_exit();
+
+uint32_t perfctr_enable()
+{
+    perfctr_thread_t* t = local != NULL ? local : thread_open();
+    int missing = 0;
+
+    perfctr_available = 0;
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+        if (t->fds[i] >= 0)
+            perfctr_available |= 1u << i;
+
+    if (perfctr_available == 0)
+    {
+        printf("[WARNING] No performance counter available (%s), ops are not counted\n",
+                strerror(errno));
+        return 0;
+    }
+    if (perfctr_available != (1u << PERFCTR_COUNT) - 1)
+    {
+        printf("[WARNING] Performance counters not available:");
+        for (int i = 0; i < PERFCTR_COUNT; i++)
+            if (!(perfctr_available & (1u << i)))
+                printf("%s %s", missing++ ? "," : "", events[i].name);
+        printf("\n");
+    }
+
+    if (!(trace_enabled & TRACE_COUNTERS))
+        atexit(report_at_exit);
+    __atomic_or_fetch(&trace_enabled, TRACE_COUNTERS, __ATOMIC_RELEASE);
+    return perfctr_available;
+}
+
+int perfctr_read(uint64_t counts[PERFCTR_COUNT])
+{
+    perfctr_thread_t* t = local != NULL ? local : thread_open();
+    uint64_t buf[3];    /* Value, time enabled, time running */
+    int n_read = 0;
+
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        counts[i] = 0;
+        if (t->fds[i] < 0 || read(t->fds[i], buf, sizeof(buf)) != sizeof(buf))
+            continue;
+        if (buf[2] > 0)
+            counts[i] = buf[2] < buf[1] ? (uint64_t)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+        n_read++;
+    }
+    return n_read > 0;
+}
+
+void perfctr_report(FILE* f)
+{
+    perfctr_op_t* sorted = (perfctr_op_t*)malloc(sizeof(ops));
+    const perfctr_op_t* op;
+    int n = 0;
+
+    for (int i = 0; i < PERFCTR_MAX_OPS; i++)
+        if (__atomic_load_n(&ops[i].name, __ATOMIC_ACQUIRE) != NULL)
+            sorted[n++] = ops[i];
+    qsort(sorted, n, sizeof(perfctr_op_t), cmp_ops);
+
+    fprintf(f, "%-22s %8s %10s %9s %6s %9s %9s %9s %9s %9s\n", "op", "calls", "elements",
+            "cpu ms", "IPC", "cyc/el", "L1d/el", "LLC/el", "dTLB/el", "br/el");
+    for (int i = 0; i < n; i++)
+    {
+        op = &sorted[i];
+        fprintf(f, "%-22s %8lu %10lu %9.2f ", op->name, (unsigned long)op->calls,
+                (unsigned long)op->elements, op->counts[PERFCTR_TASK_CLOCK] * 1e-6);
+        if ((perfctr_available & (1u << PERFCTR_CYCLES)) &&
+                (perfctr_available & (1u << PERFCTR_INSTRUCTIONS)) && op->counts[PERFCTR_CYCLES] > 0)
+            fprintf(f, "%6.2f", (double)op->counts[PERFCTR_INSTRUCTIONS] / op->counts[PERFCTR_CYCLES]);
+        else
+            fprintf(f, "%6s", "n/a");
+        print_per_element(f, op, PERFCTR_CYCLES);
+        print_per_element(f, op, PERFCTR_L1D_MISSES);
+        print_per_element(f, op, PERFCTR_LLC_MISSES);
+        print_per_element(f, op, PERFCTR_DTLB_MISSES);
+        print_per_element(f, op, PERFCTR_BRANCH_MISSES);
+        fprintf(f, "\n");
+    }
+    free(sorted);
+}
+
+const char* perfctr_name(perfctr_kind_t kind)
+{
+    return events[kind].name;
+}
+
+void perfctr_push(uint64_t start)
+{
+    perfctr_thread_t* t = local != NULL ? local : thread_open();
+    perfctr_frame_t* frame = &t->frames[t->depth % PERFCTR_DEPTH];
+
+    frame->start = start;
+    perfctr_read(frame->counts);
+    t->depth++;
+}
+
+void perfctr_pop(const char* name, uint64_t start, uint64_t elements)
+{
+    perfctr_thread_t* t = local != NULL ? local : thread_open();
+    uint64_t end[PERFCTR_COUNT];
+    const perfctr_frame_t* frame;
+    perfctr_op_t* op;
+    uint32_t i;
+
+    perfctr_read(end);
+
+    /* Ops that returned without recording left their frame above this one */
+    for (i = t->depth; i > 0 && t->depth - i < PERFCTR_DEPTH; i--)
+        if (t->frames[(i - 1) % PERFCTR_DEPTH].start == start)
+            break;
+    if (i == 0 || t->depth - i >= PERFCTR_DEPTH)
+        return;
+    frame = &t->frames[(i - 1) % PERFCTR_DEPTH];
+    t->depth = i - 1;
+
+    op = op_find(name);
+    __atomic_fetch_add(&op->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&op->elements, elements, __ATOMIC_RELAXED);
+    for (int k = 0; k < PERFCTR_COUNT; k++)
+        if (end[k] > frame->counts[k])
+            __atomic_fetch_add(&op->counts[k], end[k] - frame->counts[k], __ATOMIC_RELAXED);
+}
+
+/* One counter per fd rather than one group, a group larger than the
+ * counters of the PMU would never be scheduled */
+perfctr_thread_t* thread_open()
+{
+    perfctr_thread_t* t = (perfctr_thread_t*)calloc(1, sizeof(perfctr_thread_t));
+    struct perf_event_attr attr;
+
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        t->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    pthread_once(&key_once, key_create);
+    pthread_setspecific(thread_key, t);
+    local = t;
+    return t;
+}
+
+void thread_close(void* arg)
+{
+    perfctr_thread_t* t = (perfctr_thread_t*)arg;
+
+    for (int i = 0; i < PERFCTR_COUNT; i++)
+        if (t->fds[i] >= 0)
+            close(t->fds[i]);
+    free(t);
+}
+
+void key_create()
+{
+    pthread_key_create(&thread_key, thread_close);
+}
+
+perfctr_op_t* op_find(const char* name)
+{
+    uint32_t hash = 0, i;
+
+    for (const char* c = name; *c; c++)
+        hash = hash * 31 + *c;
+
+    for (uint32_t probe = 0; probe < PERFCTR_MAX_OPS; probe++)
+    {
+        i = (hash + probe) % PERFCTR_MAX_OPS;
+        if (__atomic_load_n(&ops[i].name, __ATOMIC_ACQUIRE) == NULL)
+        {
+            pthread_mutex_lock(&ops_lock);
+            if (ops[i].name == NULL)
+                __atomic_store_n(&ops[i].name, name, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&ops_lock);
+        }
+        if (ops[i].name == name || !strcmp(ops[i].name, name))
+            return &ops[i];
+    }
+
+    printf("[ERROR] More than %d counted ops\n", PERFCTR_MAX_OPS);
+    exit(1);
+}
+
+/* Most CPU time first */
+int cmp_ops(const void* a, const void* b)
+{
+    uint64_t t1 = ((const perfctr_op_t*)a)->counts[PERFCTR_TASK_CLOCK];
+    uint64_t t2 = ((const perfctr_op_t*)b)->counts[PERFCTR_TASK_CLOCK];
+
+    return (t1 < t2) - (t1 > t2);
+}
+
+void print_per_element(FILE* f, const perfctr_op_t* op, perfctr_kind_t kind)
+{
+    if (!(perfctr_available & (1u << kind)) || op->elements == 0)
+        fprintf(f, " %9s", "n/a");
+    else
+        fprintf(f, " %9.3f", (double)op->counts[kind] / op->elements);
+}
+
+void report_at_exit()
+{
+    printf("Performance counters per op (nested ops included):\n");
+    perfctr_report(stdout);
+}
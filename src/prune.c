@@ -0,0 +1,226 @@
+#include "prune.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Utility functions */
+static void check_blocks(const tensor_t* W);
+static int compare_floats(const void* a, const void* b);
+static void add_row(float* h, const prune_bsr_t* W, uint32_t k, float v);
+
+tensor_t* prune_magnitude(tensor_t* W, float sparsity)
+{
+    uint32_t n_blocks, n_pruned, n_ties;
+    float* norms, *sorted;
+    tensor_t* mask;
+    float threshold, norm, keep;
+
+    check_blocks(W);
+    if (!(sparsity >= 0 && sparsity <= 1))
+    {
+        printf("[ERROR] Sparsity must be between 0 and 1, got %g\n", sparsity);
+        exit(1);
+    }
+
+    n_blocks = tensor_numel(W) / PRUNE_BLOCK;
+    n_pruned = (uint32_t)(n_blocks * sparsity);
+    norms = (float*)malloc(sizeof(float) * n_blocks);
+    sorted = (float*)malloc(sizeof(float) * n_blocks);
+    mask = tensor_copy(W);
+
+    /* Blocks are consecutive in memory since they run along the rows */
+    for (uint32_t b = 0; b < n_blocks; b++)
+    {
+        norm = 0;
+        for (int i = 0; i < PRUNE_BLOCK; i++)
+            norm += W->values[b * PRUNE_BLOCK + i] * W->values[b * PRUNE_BLOCK + i];
+        norms[b] = norm;
+    }
+
+    memcpy(sorted, norms, sizeof(float) * n_blocks);
+    qsort(sorted, n_blocks, sizeof(float), compare_floats);
+    threshold = n_pruned > 0 ? sorted[n_pruned - 1] : -1;
+
+    /* Every block under the threshold goes, then blocks tied at it in index
+     * order until n_pruned are gone */
+    for (n_ties = n_pruned; n_ties > 0 && sorted[n_pruned - n_ties] < threshold; n_ties--)
+        ;
+    for (uint32_t b = 0; b < n_blocks; b++)
+    {
+        keep = 1;
+        if (norms[b] < threshold)
+            keep = 0;
+        else if (norms[b] == threshold && n_ties > 0)
+        {
+            keep = 0;
+            n_ties--;
+        }
+
+        for (int i = 0; i < PRUNE_BLOCK; i++)
+        {
+            mask->values[b * PRUNE_BLOCK + i] = keep;
+            W->values[b * PRUNE_BLOCK + i] *= keep;
+        }
+    }
+
+    free(norms);
+    free(sorted);
+    return mask;
+}
+
+void prune_apply(tensor_t* W, const tensor_t* mask)
+{
+    for (uint32_t i = 0; i < tensor_numel(W); i++)
+        W->values[i] *= mask->values[i];
+}
+
+prune_bsr_t* prune_bsr_from_tensor(const tensor_t* W)
+{
+    prune_bsr_t* bsr = (prune_bsr_t*)malloc(sizeof(prune_bsr_t));
+    uint32_t n_blocks = tensor_numel(W) / PRUNE_BLOCK, b = 0;
+    const float* block;
+    int kept;
+
+    check_blocks(W);
+    bsr->n_rows = W->shape[0];
+    bsr->n_cols = W->shape[1];
+    bsr->row_ptr = (uint32_t*)malloc(sizeof(uint32_t) * (bsr->n_rows + 1));
+    bsr->block_cols = (uint32_t*)malloc(sizeof(uint32_t) * n_blocks);
+    bsr->blocks = (float*)malloc(sizeof(float) * n_blocks * PRUNE_BLOCK);
+
+    for (uint32_t k = 0; k < bsr->n_rows; k++)
+    {
+        bsr->row_ptr[k] = b;
+        for (uint32_t c = 0; c < bsr->n_cols; c += PRUNE_BLOCK)
+        {
+            block = &W->values[k * bsr->n_cols + c];
+            kept = 0;
+            for (int i = 0; i < PRUNE_BLOCK; i++)
+                kept |= block[i] != 0;
+
+            if (kept)
+            {
+                bsr->block_cols[b] = c;
+                memcpy(&bsr->blocks[b * PRUNE_BLOCK], block, sizeof(float) * PRUNE_BLOCK);
+                b++;
+            }
+        }
+    }
+    bsr->row_ptr[bsr->n_rows] = b;
+    bsr->n_blocks = b;
+    return bsr;
+}
+
+void prune_bsr_clean(prune_bsr_t* bsr)
+{
+    free(bsr->row_ptr);
+    free(bsr->block_cols);
+    free(bsr->blocks);
+    free(bsr);
+}
+
+prune_mlp_t* prune_mlp_new(const mlp_t* mlp)
+{
+    prune_mlp_t* p = (prune_mlp_t*)malloc(sizeof(prune_mlp_t));
+
+    p->W1 = prune_bsr_from_tensor(mlp->W1);
+    p->b1 = tensor_copy(mlp->b1);
+    p->W2 = tensor_copy(mlp->W2);
+    p->b2 = tensor_copy(mlp->b2);
+    return p;
+}
+
+void prune_mlp_clean(prune_mlp_t* p)
+{
+    prune_bsr_clean(p->W1);
+    tensor_clean(p->b1);
+    tensor_clean(p->W2);
+    tensor_clean(p->b2);
+    free(p);
+}
+
+uint32_t prune_mlp_bytes(const prune_mlp_t* p)
+{
+    uint32_t bytes = sizeof(uint32_t) * (p->W1->n_rows + 1);
+
+    bytes += (sizeof(uint32_t) + sizeof(float) * PRUNE_BLOCK) * p->W1->n_blocks;
+    bytes += sizeof(float) * (tensor_numel(p->b1) + tensor_numel(p->W2) + tensor_numel(p->b2));
+    return bytes;
+}
+
+tensor_t* prune_forward(const prune_mlp_t* p, const tensor_t* x)
+{
+    uint32_t n_inputs = p->W1->n_rows, n_hidden = p->W1->n_cols;
+    uint32_t n_outputs = p->W2->shape[1];
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t));
+    float* h = (float*)malloc(sizeof(float) * n_hidden);
+    float* logits = (float*)malloc(sizeof(float) * n_outputs);
+    const tensor_csr_t* csr = x->csr;
+    tensor_t* preds;
+    uint32_t best;
+
+    shape[0] = x->shape[0];
+    preds = tensor_zeros(shape, 1);
+
+    for (uint32_t i = 0; i < x->shape[0]; i++)
+    {
+        memcpy(h, p->b1->values, sizeof(float) * n_hidden);
+        if (csr)
+            for (uint32_t k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++)
+                add_row(h, p->W1, csr->cols[k], csr->values[k]);
+        else
+            for (uint32_t k = 0; k < n_inputs; k++)
+                if (x->values[i * n_inputs + k] != 0)
+                    add_row(h, p->W1, k, x->values[i * n_inputs + k]);
+
+        /* ReLU zeros skip their whole row of W2 as well */
+        memcpy(logits, p->b2->values, sizeof(float) * n_outputs);
+        for (uint32_t j = 0; j < n_hidden; j++)
+            if (h[j] > 0)
+                for (uint32_t o = 0; o < n_outputs; o++)
+                    logits[o] += h[j] * p->W2->values[j * n_outputs + o];
+
+        /* Softmax does not change the argmax, the logits are enough */
+        best = 0;
+        for (uint32_t o = 1; o < n_outputs; o++)
+            if (logits[o] > logits[best])
+                best = o;
+        preds->values[i] = best;
+    }
+
+    free(h);
+    free(logits);
+    return preds;
+}
+
+/* h += v * W[k, :] over the kept blocks of row k */
+void add_row(float* h, const prune_bsr_t* W, uint32_t k, float v)
+{
+    const float* restrict block;
+    float* restrict out;
+
+    for (uint32_t b = W->row_ptr[k]; b < W->row_ptr[k + 1]; b++)
+    {
+        block = &W->blocks[b * PRUNE_BLOCK];
+        out = &h[W->block_cols[b]];
+        for (int i = 0; i < PRUNE_BLOCK; i++)
+            out[i] += v * block[i];
+    }
+}
+
+void check_blocks(const tensor_t* W)
+{
+    if (W->n_dims != 2 || W->shape[1] % PRUNE_BLOCK != 0)
+    {
+        printf("[ERROR] Pruning needs a 2D tensor with a multiple of %d columns\n", PRUNE_BLOCK);
+        exit(1);
+    }
+}
+
+int compare_floats(const void* a, const void* b)
+{
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "quant.h"
+#include "cpu.h"
+#include "nn.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+
+/* Share of the calibration activations kept inside the uint8 range, the
+ * rest saturate. Clipping a few outliers buys resolution for the others. */
+#define CALIB_PERCENTILE 0.9999
+
+/* Utility functions */
+static int has_vnni();
+static uint32_t align_up(uint32_t n);
+static void* aligned_bytes(size_t n);
+static int8_t* quantize_channels(const tensor_t* W, uint32_t k_pad, float* scales);
+static float calibrate(const mlp_t* mlp, const tensor_t* calib);
+static int compare_floats(const void* a, const void* b);
+
+static void dot_rows(const uint8_t* x, const int8_t* w, uint32_t rows, uint32_t k, int32_t* out);
+static void dot_rows_vnni(const uint8_t* x, const int8_t* w, uint32_t rows, uint32_t k, int32_t* out);
+static void dot_rows_avx2(const uint8_t* x, const int8_t* w, uint32_t rows, uint32_t k, int32_t* out);
+
+qmlp_t* qmlp_quantize(const mlp_t* mlp, const tensor_t* calib)
+{
+    qmlp_t* q = (qmlp_t*)malloc(sizeof(qmlp_t));
+    float* w1_scale, *w2_scale;
+
+    q->n_inputs = mlp->W1->shape[0];
+    q->n_hidden = mlp->W1->shape[1];
+    q->n_outputs = mlp->W2->shape[1];
+    q->k1 = align_up(q->n_inputs);
+    q->k2 = align_up(q->n_hidden);
+
+    w1_scale = (float*)malloc(sizeof(float) * q->n_hidden);
+    w2_scale = (float*)malloc(sizeof(float) * q->n_outputs);
+    q->w1 = quantize_channels(mlp->W1, q->k1, w1_scale);
+    q->w2 = quantize_channels(mlp->W2, q->k2, w2_scale);
+    q->act_scale = calibrate(mlp, calib);
+
+    /* Inputs are raw pixels, so one input step is worth exactly 1 */
+    q->b1 = (int32_t*)malloc(sizeof(int32_t) * q->n_hidden);
+    q->requant = (float*)malloc(sizeof(float) * q->n_hidden);
+    for (int j = 0; j < q->n_hidden; j++)
+    {
+        q->b1[j] = (int32_t)lrintf(mlp->b1->values[j] / w1_scale[j]);
+        q->requant[j] = w1_scale[j] / q->act_scale;
+    }
+
+    q->dequant = (float*)malloc(sizeof(float) * q->n_outputs);
+    q->b2 = (float*)malloc(sizeof(float) * q->n_outputs);
+    for (int o = 0; o < q->n_outputs; o++)
+    {
+        q->dequant[o] = w2_scale[o] * q->act_scale;
+        q->b2[o] = mlp->b2->values[o];
+    }
+
+    free(w1_scale);
+    free(w2_scale);
+    return q;
+}
+
+void qmlp_clean(qmlp_t* q)
+{
+    free(q->w1);
+    free(q->b1);
+    free(q->requant);
+    free(q->w2);
+    free(q->dequant);
+    free(q->b2);
+    free(q);
+}
+
+void qmlp_predict(const qmlp_t* q, const uint8_t* pixels, uint32_t n, uint8_t* labels)
+{
+    uint8_t* x = (uint8_t*)aligned_bytes(q->k1);
+    uint8_t* h = (uint8_t*)aligned_bytes(q->k2);
+    int32_t* acc1 = (int32_t*)malloc(sizeof(int32_t) * q->n_hidden);
+    int32_t* acc2 = (int32_t*)malloc(sizeof(int32_t) * q->n_outputs);
+    float v, logit, best;
+    int32_t a;
+
+    memset(x, 0, q->k1);
+    memset(h, 0, q->k2);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        memcpy(x, &pixels[(size_t)i * q->n_inputs], q->n_inputs);
+        dot_rows(x, q->w1, q->n_hidden, q->k1, acc1);
+
+        /* Bias, ReLU and requantization to uint8 in a single pass */
+        for (uint32_t j = 0; j < q->n_hidden; j++)
+        {
+            a = acc1[j] + q->b1[j];
+            v = a > 0 ? a * q->requant[j] + 0.5f : 0;
+            h[j] = v > 255 ? 255 : (uint8_t)v;
+        }
+
+        dot_rows(h, q->w2, q->n_outputs, q->k2, acc2);
+
+        /* Softmax does not change the argmax, the logits are enough */
+        labels[i] = 0;
+        best = -INFINITY;
+        for (uint32_t o = 0; o < q->n_outputs; o++)
+        {
+            logit = acc2[o] * q->dequant[o] + q->b2[o];
+            if (logit > best)
+            {
+                best = logit;
+                labels[i] = o;
+            }
+        }
+    }
+
+    free(x);
+    free(h);
+    free(acc1);
+    free(acc2);
+}
+
+/* W is [in, out], the result is [out][k_pad] with symmetric per channel
+ * scales: max |w| of the channel maps to 127 */
+int8_t* quantize_channels(const tensor_t* W, uint32_t k_pad, float* scales)
+{
+    uint32_t n_in = W->shape[0], n_out = W->shape[1];
+    int8_t* q = (int8_t*)aligned_bytes((size_t)n_out * k_pad);
+    float max;
+
+    memset(q, 0, (size_t)n_out * k_pad);
+    for (uint32_t o = 0; o < n_out; o++)
+    {
+        max = 0;
+        for (uint32_t k = 0; k < n_in; k++)
+            max = fmaxf(max, fabsf(W->values[k * n_out + o]));
+
+        scales[o] = max > 0 ? max / 127 : 1;
+        for (uint32_t k = 0; k < n_in; k++)
+            q[(size_t)o * k_pad + k] = (int8_t)lrintf(W->values[k * n_out + o] / scales[o]);
+    }
+    return q;
+}
+
+float calibrate(const mlp_t* mlp, const tensor_t* calib)
+{
+    tensor_t* t1 = tensor_mm(calib, mlp->W1);
+    tensor_t* z1 = tensor_add(t1, mlp->b1);
+    tensor_t* a1 = nn_relu(z1);
+    uint32_t nels = tensor_numel(a1);
+    float* sorted = (float*)malloc(sizeof(float) * nels);
+    float range;
+
+    memcpy(sorted, a1->values, sizeof(float) * nels);
+    qsort(sorted, nels, sizeof(float), compare_floats);
+    range = sorted[(uint32_t)((nels - 1) * CALIB_PERCENTILE)];
+    if (range <= 0)
+        range = sorted[nels - 1] > 0 ? sorted[nels - 1] : 1;
+
+    free(sorted);
+    tensor_clean(t1);
+    tensor_clean(z1);
+    tensor_clean(a1);
+    return range / 255;
+}
+
+void dot_rows(const uint8_t* x, const int8_t* w, uint32_t rows, uint32_t k, int32_t* out)
+{
+    int32_t acc;
+
+    if (has_vnni())
+        dot_rows_vnni(x, w, rows, k, out);
+    else if (cpu_has_avx2())
+        dot_rows_avx2(x, w, rows, k, out);
+    else
+        for (uint32_t r = 0; r < rows; r++)
+        {
+            acc = 0;
+            for (uint32_t i = 0; i < k; i++)
+                acc += (int32_t)x[i] * w[(size_t)r * k + i];
+            out[r] = acc;
+        }
+}
+
+/* vpdpbusd multiplies 4 uint8 by 4 int8 and adds them to an int32 lane
+ * without any intermediate saturation */
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+void dot_rows_vnni(const uint8_t* x, const int8_t* w, uint32_t rows, uint32_t k, int32_t* out)
+{
+    __m512i acc;
+
+    for (uint32_t r = 0; r < rows; r++)
+    {
+        acc = _mm512_setzero_si512();
+        for (uint32_t i = 0; i < k; i += 64)
+            acc = _mm512_dpbusd_epi32(acc,
+                    _mm512_load_si512((const void*)&x[i]),
+                    _mm512_load_si512((const void*)&w[(size_t)r * k + i]));
+        out[r] = _mm512_reduce_add_epi32(acc);
+    }
+}
+
+/* vpmaddubsw adds pairs of uint8 * int8 products into int16 and saturates
+ * once both inputs are large (2 * 255 * 127 > 32767). Splitting x into
+ * x >> 1 and x & 1 keeps every pair in range and the result exact:
+ * x . w = 2 * ((x >> 1) . w) + ((x & 1) . w) */
+__attribute__((target("avx2")))
+void dot_rows_avx2(const uint8_t* x, const int8_t* w, uint32_t rows, uint32_t k, int32_t* out)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i low7 = _mm256_set1_epi8(0x7f);
+    const __m256i bit0 = _mm256_set1_epi8(0x01);
+    __m256i hi, lo, vx, vw, sum;
+    __m128i s;
+
+    for (uint32_t r = 0; r < rows; r++)
+    {
+        hi = _mm256_setzero_si256();
+        lo = _mm256_setzero_si256();
+        for (uint32_t i = 0; i < k; i += 32)
+        {
+            vx = _mm256_load_si256((const __m256i*)&x[i]);
+            vw = _mm256_load_si256((const __m256i*)&w[(size_t)r * k + i]);
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(ones,
+                    _mm256_maddubs_epi16(_mm256_and_si256(_mm256_srli_epi16(vx, 1), low7), vw)));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(ones,
+                    _mm256_maddubs_epi16(_mm256_and_si256(vx, bit0), vw)));
+        }
+
+        sum = _mm256_add_epi32(_mm256_slli_epi32(hi, 1), lo);
+        s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_hadd_epi32(s, s);
+        s = _mm_hadd_epi32(s, s);
+        out[r] = _mm_cvtsi128_si32(s);
+    }
+}
+
+int compare_floats(const void* a, const void* b)
+{
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+uint32_t align_up(uint32_t n)
+{
+    return (n + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN;
+}
+
+void* aligned_bytes(size_t n)
+{
+    void* ptr = NULL;
+
+    if (posix_memalign(&ptr, QUANT_ALIGN, n) != 0)
+        return NULL;
+    return ptr;
+}
+
+int has_vnni()
+{
+    static int cached = -1;
+    if (cached < 0)
+        cached = __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw");
+    return cached;
+}
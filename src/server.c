@@ -0,0 +1,562 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Requests read from a connection per read call */
+#define READ_REQUESTS 64
+
+/* Sleep of the watcher while it waits for workers to leave a version */
+#define RECLAIM_POLL_NS 50000
+
+struct server_conn
+{
+    int fd;
+    uint8_t buf[READ_REQUESTS * sizeof(server_request_t)];
+    size_t len;
+
+    /* Requests queued or being run. Once the I/O thread is done with the
+     * connection, whoever brings it to 0 closes and frees it, so the fd is
+     * never reused under a pending response. */
+    pthread_mutex_t lock;
+    uint32_t inflight;
+    uint8_t done_reading;
+
+    /* Keeps the responses of workers from interleaving, apart from lock so
+     * a slow client never holds up the I/O thread */
+    pthread_mutex_t send_lock;
+};
+
+/* Utility functions */
+static void* io_loop(void* arg);
+static int read_conn(server_t* server, server_conn_t* conn);
+static void* worker_loop(void* arg);
+static uint32_t take_batch(server_t* server, server_worker_t* w);
+static void respond(server_conn_t* conn, const server_response_t* res, uint32_t n);
+static void conn_release(server_conn_t* conn, uint32_t n);
+static void conn_close(server_conn_t* conn);
+static server_version_t* version_load(server_t* server, uint64_t epoch);
+static void version_clean(server_t* server, server_version_t* v);
+static server_version_t* version_enter(server_worker_t* w);
+static void version_leave(server_worker_t* w);
+static void* watch_loop(void* arg);
+static void sleep_ns(long ns);
+static double now_us();
+
+server_t* server_start(const char* socket_path, const char* model_path, uint32_t max_batch,
+        uint32_t max_wait_us, int n_workers)
+{
+    server_t* server = (server_t*)calloc(1, sizeof(server_t));
+    struct sockaddr_un addr;
+    pthread_condattr_t attr;
+    server_worker_t* w;
+    uint32_t* shape;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path) || max_batch == 0 || n_workers <= 0)
+    {
+        printf("[ERROR] Invalid server socket %s, max batch %u or %d workers\n", socket_path,
+                max_batch, n_workers);
+        exit(1);
+    }
+
+    server->socket_path = (char*)malloc(strlen(socket_path) + 1);
+    strcpy(server->socket_path, socket_path);
+    server->model_path = (char*)malloc(strlen(model_path) + 1);
+    strcpy(server->model_path, model_path);
+    server->max_batch = max_batch;
+    server->max_wait_us = max_wait_us;
+    server->n_workers = n_workers;
+    server->queue = (server_item_t*)malloc(sizeof(server_item_t) * SERVER_QUEUE_LEN);
+
+    /* Waits are timed against the monotonic clock of arrival times */
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&server->nonempty, &attr);
+    pthread_cond_init(&server->space, &attr);
+    pthread_condattr_destroy(&attr);
+    server->running = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(server->listen_fd, 128) != 0 || pipe(server->wake_fd) != 0)
+    {
+        printf("[ERROR] Could not listen on %s: %s\n", socket_path, strerror(errno));
+        exit(1);
+    }
+
+    server->current = version_load(server, 1);
+    if (server->current == NULL)
+        exit(1);
+
+    server->workers = (server_worker_t*)calloc(n_workers, sizeof(server_worker_t));
+    for (int i = 0; i < n_workers; i++)
+    {
+        w = &server->workers[i];
+        w->server = server;
+        w->index = i;
+        shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+        shape[0] = max_batch;
+        shape[1] = SERVER_IMAGE_BYTES;
+        w->x = tensor_zeros(shape, 2);
+        w->conns = (server_conn_t**)malloc(sizeof(server_conn_t*) * max_batch);
+        w->ids = (uint32_t*)malloc(sizeof(uint32_t) * max_batch);
+        pthread_create(&w->thread, NULL, worker_loop, w);
+    }
+
+    pthread_create(&server->io_thread, NULL, io_loop, server);
+    return server;
+}
+
+void server_stop(server_t* server)
+{
+    server_worker_t* w;
+
+    if (server->watching)
+    {
+        __atomic_store_n(&server->watching, 0, __ATOMIC_RELAXED);
+        pthread_join(server->watcher, NULL);
+    }
+
+    /* The I/O thread lets go of its connections on the way out, the
+     * workers then serve what is queued and free them */
+    pthread_mutex_lock(&server->lock);
+    server->running = 0;
+    pthread_cond_broadcast(&server->nonempty);
+    pthread_cond_broadcast(&server->space);
+    pthread_mutex_unlock(&server->lock);
+    if (write(server->wake_fd[1], "", 1) != 1)
+        printf("[WARNING] Could not wake the server I/O thread\n");
+    pthread_join(server->io_thread, NULL);
+
+    for (int i = 0; i < server->n_workers; i++)
+    {
+        w = &server->workers[i];
+        pthread_join(w->thread, NULL);
+        tensor_clean(w->x);
+        free(w->conns);
+        free(w->ids);
+    }
+
+    close(server->listen_fd);
+    close(server->wake_fd[0]);
+    close(server->wake_fd[1]);
+    unlink(server->socket_path);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->nonempty);
+    pthread_cond_destroy(&server->space);
+    version_clean(server, server->current);
+    free(server->workers);
+    free(server->queue);
+    free(server->model_path);
+    free(server->socket_path);
+    free(server);
+}
+
+void server_watch(server_t* server, uint32_t interval_ms)
+{
+    server->watch_ms = interval_ms;
+    server->watching = 1;
+    pthread_create(&server->watcher, NULL, watch_loop, server);
+}
+
+void* io_loop(void* arg)
+{
+    server_t* server = (server_t*)arg;
+    uint32_t capacity = 16, n_conns = 0;
+    struct pollfd* fds = (struct pollfd*)malloc(sizeof(struct pollfd) * (capacity + 2));
+    server_conn_t** conns = (server_conn_t**)malloc(sizeof(server_conn_t*) * capacity);
+    server_conn_t* conn;
+    int fd;
+
+    while (server->running)
+    {
+        fds[0].fd = server->listen_fd;
+        fds[1].fd = server->wake_fd[0];
+        for (uint32_t i = 0; i < n_conns; i++)
+            fds[i + 2].fd = conns[i]->fd;
+        for (uint32_t i = 0; i < n_conns + 2; i++)
+            fds[i].events = POLLIN;
+
+        if (poll(fds, n_conns + 2, -1) < 0)
+            continue;
+
+        for (uint32_t i = 0; i < n_conns; i++)
+        {
+            if (!(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) || read_conn(server, conns[i]))
+                continue;
+
+            /* Closed by the client, swapped with the last one */
+            conn_close(conns[i]);
+            conns[i] = conns[n_conns - 1];
+            fds[i + 2] = fds[n_conns + 1];
+            n_conns--;
+            i--;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            fd = accept(server->listen_fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+
+            if (n_conns == capacity)
+            {
+                capacity *= 2;
+                conns = (server_conn_t**)realloc(conns, sizeof(server_conn_t*) * capacity);
+                fds = (struct pollfd*)realloc(fds, sizeof(struct pollfd) * (capacity + 2));
+            }
+            conn = (server_conn_t*)calloc(1, sizeof(server_conn_t));
+            conn->fd = fd;
+            pthread_mutex_init(&conn->lock, NULL);
+            pthread_mutex_init(&conn->send_lock, NULL);
+            conns[n_conns++] = conn;
+        }
+    }
+
+    for (uint32_t i = 0; i < n_conns; i++)
+        conn_close(conns[i]);
+    free(conns);
+    free(fds);
+    return NULL;
+}
+
+/* Queues every whole request that can be read, returns 0 once the client
+ * is gone */
+int read_conn(server_t* server, server_conn_t* conn)
+{
+    const server_request_t* req;
+    server_item_t* item;
+    uint32_t n, tail, queued = 0;
+    ssize_t got;
+    double now;
+
+    got = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+    if (got <= 0)
+        return got < 0 && errno == EINTR;
+
+    conn->len += got;
+    n = conn->len / sizeof(server_request_t);
+    if (n == 0)
+        return 1;
+
+    pthread_mutex_lock(&conn->lock);
+    conn->inflight += n;
+    pthread_mutex_unlock(&conn->lock);
+
+    now = now_us();
+    pthread_mutex_lock(&server->lock);
+    for (; queued < n; queued++)
+    {
+        /* Back pressure: the client waits in its socket buffer */
+        while (server->count == SERVER_QUEUE_LEN && server->running)
+            pthread_cond_wait(&server->space, &server->lock);
+        if (!server->running)
+            break;
+
+        req = (const server_request_t*)(conn->buf + queued * sizeof(server_request_t));
+        tail = (server->head + server->count) % SERVER_QUEUE_LEN;
+        item = &server->queue[tail];
+        item->conn = conn;
+        item->id = req->id;
+        item->arrival = now;
+        memcpy(item->pixels, req->pixels, SERVER_IMAGE_BYTES);
+        server->count++;
+    }
+    pthread_cond_signal(&server->nonempty);
+    pthread_mutex_unlock(&server->lock);
+
+    /* Dropped when the server stops */
+    if (queued < n)
+        conn_release(conn, n - queued);
+
+    conn->len -= n * sizeof(server_request_t);
+    memmove(conn->buf, conn->buf + n * sizeof(server_request_t), conn->len);
+    return 1;
+}
+
+void* worker_loop(void* arg)
+{
+    server_worker_t* w = (server_worker_t*)arg;
+    server_response_t* res = (server_response_t*)malloc(sizeof(server_response_t) * w->server->max_batch);
+    const tensor_t* preds;
+    server_version_t* v;
+    uint32_t n, start, end;
+
+    while ((n = take_batch(w->server, w)) > 0)
+    {
+        /* The whole batch runs on the version current when it starts */
+        v = version_enter(w);
+        preds = model_forward(v->models[w->index], w->x);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            res[i].id = w->ids[i];
+            res[i].digit = (uint32_t)preds->values[i];
+        }
+        version_leave(w);
+
+        /* One write per run of requests from the same connection */
+        for (start = 0; start < n; start = end)
+        {
+            end = start + 1;
+            while (end < n && w->conns[end] == w->conns[start])
+                end++;
+            respond(w->conns[start], &res[start], end - start);
+            conn_release(w->conns[start], end - start);
+        }
+    }
+
+    free(res);
+    return NULL;
+}
+
+/* Waits for a batch and converts it into w->x, returns its size (0 once the
+ * server stops with nothing queued) */
+uint32_t take_batch(server_t* server, server_worker_t* w)
+{
+    struct timespec deadline;
+    server_item_t* item;
+    double until;
+    uint32_t n;
+
+    pthread_mutex_lock(&server->lock);
+    while (server->count == 0 && server->running)
+        pthread_cond_wait(&server->nonempty, &server->lock);
+
+    /* Fills up until the oldest request has waited long enough */
+    while (server->count > 0 && server->count < server->max_batch && server->running)
+    {
+        until = server->queue[server->head].arrival + server->max_wait_us;
+        if (now_us() >= until)
+            break;
+        deadline.tv_sec = (time_t)(until / 1e6);
+        deadline.tv_nsec = (long)((until - deadline.tv_sec * 1e6) * 1e3);
+        pthread_cond_timedwait(&server->nonempty, &server->lock, &deadline);
+    }
+
+    n = server->count < server->max_batch ? server->count : server->max_batch;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        item = &server->queue[(server->head + i) % SERVER_QUEUE_LEN];
+        w->conns[i] = item->conn;
+        w->ids[i] = item->id;
+        for (uint32_t j = 0; j < SERVER_IMAGE_BYTES; j++)
+            w->x->values[i * SERVER_IMAGE_BYTES + j] = item->pixels[j];
+    }
+    server->head = (server->head + n) % SERVER_QUEUE_LEN;
+    server->count -= n;
+    server->n_requests += n;
+    server->n_batches += n > 0;
+
+    /* Another worker may start on what is left */
+    if (server->count > 0)
+        pthread_cond_signal(&server->nonempty);
+    pthread_cond_signal(&server->space);
+    pthread_mutex_unlock(&server->lock);
+
+    w->x->shape[0] = n;
+    return n;
+}
+
+void respond(server_conn_t* conn, const server_response_t* res, uint32_t n)
+{
+    const uint8_t* data = (const uint8_t*)res;
+    size_t left = sizeof(server_response_t) * n;
+    ssize_t sent;
+
+    /* A client that went away makes send fail, which drops the rest */
+    pthread_mutex_lock(&conn->send_lock);
+    while (left > 0)
+    {
+        sent = send(conn->fd, data, left, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            break;
+        data += sent;
+        left -= sent;
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+}
+
+/* Drops n requests of conn that were served */
+void conn_release(server_conn_t* conn, uint32_t n)
+{
+    int last;
+
+    pthread_mutex_lock(&conn->lock);
+    conn->inflight -= n;
+    last = conn->done_reading && conn->inflight == 0;
+    pthread_mutex_unlock(&conn->lock);
+
+    if (last)
+    {
+        close(conn->fd);
+        pthread_mutex_destroy(&conn->lock);
+        pthread_mutex_destroy(&conn->send_lock);
+        free(conn);
+    }
+}
+
+/* Called by the I/O thread once it stops reading conn */
+void conn_close(server_conn_t* conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    conn->done_reading = 1;
+    pthread_mutex_unlock(&conn->lock);
+    conn_release(conn, 0);
+}
+
+/* One model per worker over a single mapping of model_path, so a rename
+ * landing during the load cannot give workers different weights. Each one
+ * is run once over a full batch, so the first batches after a switch do
+ * not fault in weights or activations. NULL, with the reason printed,
+ * when the file is not a valid checkpoint of a model of 28x28 inputs. */
+server_version_t* version_load(server_t* server, uint64_t epoch)
+{
+    server_version_t* v = (server_version_t*)calloc(1, sizeof(server_version_t));
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+    tensor_t* x;
+    ckpt_t* ckpt;
+    int valid = 1;
+
+    shape[0] = server->max_batch;
+    shape[1] = SERVER_IMAGE_BYTES;
+    x = tensor_zeros(shape, 2);
+
+    v->epoch = epoch;
+    v->models = (model_t**)calloc(server->n_workers, sizeof(model_t*));
+    ckpt = ckpt_try_open(server->model_path);
+    valid = ckpt != NULL;
+    if (valid && !(valid = ckpt_verify(ckpt)))
+        printf("[ERROR] Checkpoint %s is corrupted\n", server->model_path);
+    for (int i = 0; i < server->n_workers && valid; i++)
+    {
+        /* A bad config or parameters leave the reference to the caller */
+        v->models[i] = model_try_from_ckpt(ckpt_retain(ckpt), server->max_batch);
+        valid = v->models[i] != NULL && v->models[i]->n_inputs == SERVER_IMAGE_BYTES;
+        if (v->models[i] == NULL)
+            ckpt_close(ckpt);
+        else if (valid)
+            model_forward(v->models[i], x);
+        else
+            printf("[ERROR] Model of %s takes %u inputs, not 28x28 images\n", server->model_path,
+                    v->models[i]->n_inputs);
+    }
+    tensor_clean(x);
+
+    /* The models hold the mapping from here on */
+    if (ckpt != NULL)
+        ckpt_close(ckpt);
+    if (!valid)
+    {
+        version_clean(server, v);
+        return NULL;
+    }
+    return v;
+}
+
+void version_clean(server_t* server, server_version_t* v)
+{
+    for (int i = 0; i < server->n_workers; i++)
+        if (v->models[i] != NULL)
+            model_clean(v->models[i]);
+    free(v->models);
+    free(v);
+}
+
+/* Publishes the epoch of the current version before using it. Reading
+ * current again after publishing closes the race with a swap in between:
+ * either the watcher sees the epoch or the worker sees the new version. */
+server_version_t* version_enter(server_worker_t* w)
+{
+    server_version_t* v = __atomic_load_n(&w->server->current, __ATOMIC_SEQ_CST), *again;
+
+    while (1)
+    {
+        __atomic_store_n(&w->epoch, v->epoch, __ATOMIC_SEQ_CST);
+        again = __atomic_load_n(&w->server->current, __ATOMIC_SEQ_CST);
+        if (again == v)
+            return v;
+        v = again;
+    }
+}
+
+void version_leave(server_worker_t* w)
+{
+    __atomic_store_n(&w->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void* watch_loop(void* arg)
+{
+    server_t* server = (server_t*)arg;
+    server_version_t* v, *old;
+    struct stat seen, st;
+    uint64_t epoch;
+    double start;
+
+    if (stat(server->model_path, &seen) != 0)
+        memset(&seen, 0, sizeof(seen));
+
+    while (__atomic_load_n(&server->watching, __ATOMIC_RELAXED))
+    {
+        sleep_ns(server->watch_ms * 1000000L);
+
+        /* ckpt_save renames a new file in, so the inode changes */
+        if (stat(server->model_path, &st) != 0 || (st.st_ino == seen.st_ino &&
+                st.st_mtim.tv_sec == seen.st_mtim.tv_sec &&
+                st.st_mtim.tv_nsec == seen.st_mtim.tv_nsec && st.st_size == seen.st_size))
+            continue;
+        seen = st;
+
+        start = now_us();
+        old = server->current;
+        v = version_load(server, old->epoch + 1);
+        if (v == NULL)
+        {
+            printf("[WARNING] Keeping the weights of version %lu\n", (unsigned long)old->epoch);
+            continue;
+        }
+        __atomic_store_n(&server->current, v, __ATOMIC_SEQ_CST);
+
+        /* Batches started before the swap finish on the old version */
+        for (int i = 0; i < server->n_workers; i++)
+            while ((epoch = __atomic_load_n(&server->workers[i].epoch, __ATOMIC_SEQ_CST)) != 0 &&
+                    epoch < v->epoch)
+                sleep_ns(RECLAIM_POLL_NS);
+        version_clean(server, old);
+
+        __atomic_fetch_add(&server->n_reloads, 1, __ATOMIC_RELAXED);
+        printf("Reloaded %s as version %lu in %.1f ms\n", server->model_path,
+                (unsigned long)v->epoch, (now_us() - start) / 1000);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+void sleep_ns(long ns)
+{
+    struct timespec ts = {ns / 1000000000L, ns % 1000000000L};
+    nanosleep(&ts, NULL);
+}
+
+double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
@@ -0,0 +1,126 @@
+#include "sparse.h"
+
+#include <stdlib.h>
+
+/* Output columns per pass, 128 floats of a W row */
+#define SPARSE_COL_BLOCK 128
+
+/* Utility functions */
+static tensor_csr_t* csr_alloc(uint32_t n_rows, uint32_t nnz);
+static void axpy(float* restrict y, const float* restrict x, float a, uint32_t n);
+
+tensor_csr_t* sparse_from_u8(const uint8_t* const* rows, uint32_t n_rows, uint32_t n_cols)
+{
+    tensor_csr_t* csr;
+    uint32_t nnz = 0, k = 0;
+
+    /* Counting first sizes the arrays exactly, the pixels are cheap to
+     * read twice */
+    for (uint32_t i = 0; i < n_rows; i++)
+        for (uint32_t j = 0; j < n_cols; j++)
+            nnz += rows[i][j] != 0;
+
+    csr = csr_alloc(n_rows, nnz);
+    for (uint32_t i = 0; i < n_rows; i++)
+    {
+        csr->row_ptr[i] = k;
+        for (uint32_t j = 0; j < n_cols; j++)
+            if (rows[i][j])
+            {
+                csr->cols[k] = j;
+                csr->values[k++] = rows[i][j];
+            }
+    }
+    csr->row_ptr[n_rows] = k;
+    return csr;
+}
+
+tensor_csr_t* sparse_from_tensor(const tensor_t* t)
+{
+    uint32_t n_rows = t->shape[0], n_cols = t->shape[1];
+    uint32_t nnz = 0, k = 0;
+    tensor_csr_t* csr;
+    float v;
+
+    for (uint32_t i = 0; i < n_rows * n_cols; i++)
+        nnz += t->values[i] != 0;
+
+    csr = csr_alloc(n_rows, nnz);
+    for (uint32_t i = 0; i < n_rows; i++)
+    {
+        csr->row_ptr[i] = k;
+        for (uint32_t j = 0; j < n_cols; j++)
+        {
+            v = t->values[i * n_cols + j];
+            if (v != 0)
+            {
+                csr->cols[k] = j;
+                csr->values[k++] = v;
+            }
+        }
+    }
+    csr->row_ptr[n_rows] = k;
+    return csr;
+}
+
+void sparse_csr_clean(tensor_csr_t* csr)
+{
+    free(csr->row_ptr);
+    free(csr->cols);
+    free(csr->values);
+    free(csr);
+}
+
+float sparse_density(const tensor_t* t)
+{
+    return (float)t->csr->nnz / ((float)t->shape[0] * t->shape[1]);
+}
+
+void sparse_mm(const tensor_t* t1, const tensor_t* t2, float* result)
+{
+    const tensor_csr_t* csr = t1->csr;
+    uint32_t n = t2->shape[1], w;
+
+    /* Column blocks keep the touched part of t2 in cache across rows for
+     * wide t2, each output still sums in the same order */
+    for (uint32_t j = 0; j < n; j += SPARSE_COL_BLOCK)
+    {
+        w = n - j < SPARSE_COL_BLOCK ? n - j : SPARSE_COL_BLOCK;
+        for (uint32_t i = 0; i < t1->shape[0]; i++)
+            for (uint32_t k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++)
+                axpy(&result[i * n + j], &t2->values[csr->cols[k] * n + j], csr->values[k], w);
+    }
+}
+
+void sparse_mm_T(const tensor_t* t1, const tensor_t* t2, float* result)
+{
+    const tensor_csr_t* csr = t1->csr;
+    uint32_t n = t2->shape[1], w;
+
+    /* Row i of t1 scatters row i of t2 into the result rows of its nonzero
+     * columns, zero columns of the whole batch are never touched */
+    for (uint32_t j = 0; j < n; j += SPARSE_COL_BLOCK)
+    {
+        w = n - j < SPARSE_COL_BLOCK ? n - j : SPARSE_COL_BLOCK;
+        for (uint32_t i = 0; i < t1->shape[0]; i++)
+            for (uint32_t k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++)
+                axpy(&result[csr->cols[k] * n + j], &t2->values[i * n + j], csr->values[k], w);
+    }
+}
+
+tensor_csr_t* csr_alloc(uint32_t n_rows, uint32_t nnz)
+{
+    tensor_csr_t* csr = (tensor_csr_t*)malloc(sizeof(tensor_csr_t));
+
+    csr->nnz = nnz;
+    csr->row_ptr = (uint32_t*)malloc(sizeof(uint32_t) * (n_rows + 1));
+    csr->cols = (uint32_t*)malloc(sizeof(uint32_t) * (nnz ? nnz : 1));
+    csr->values = (float*)malloc(sizeof(float) * (nnz ? nnz : 1));
+    return csr;
+}
+
+void axpy(float* restrict y, const float* restrict x, float a, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+        y[i] += a * x[i];
+}
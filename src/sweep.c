@@ -0,0 +1,283 @@
+#include "sweep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Utility functions */
+static tensor_t* buffer(uint32_t d0, uint32_t d1, uint32_t d2);
+static void view(tensor_t* v, uint32_t* shape, float* values, uint32_t rows, uint32_t cols);
+static void forward(sweep_t* sweep, const tensor_t* x, const tensor_t* y);
+static void backward(sweep_t* sweep, const tensor_t* x);
+static void update(sweep_t* sweep);
+
+sweep_t* sweep_init(uint32_t n_models, const float* lrs, const unsigned int* seeds,
+        uint32_t n_inputs, uint32_t n_hidden, uint32_t n_outputs, uint32_t max_batch)
+{
+    sweep_t* sweep = (sweep_t*)malloc(sizeof(sweep_t));
+    uint32_t K = n_models, H = n_hidden, O = n_outputs;
+    mlp_t* mlp;
+
+    sweep->n_models = K;
+    sweep->n_inputs = n_inputs;
+    sweep->n_hidden = H;
+    sweep->n_outputs = O;
+    sweep->max_batch = max_batch;
+
+    sweep->W1 = buffer(0, n_inputs, K * H);
+    sweep->b1 = buffer(0, 0, K * H);
+    sweep->W2 = buffer(K, H, O);
+    sweep->b2 = buffer(0, K, O);
+    sweep->lrs = (float*)malloc(sizeof(float) * K);
+    sweep->losses = (float*)calloc(K, sizeof(float));
+
+    /* Same parameters as K separate mlp_init calls */
+    for (uint32_t k = 0; k < K; k++)
+    {
+        srand(seeds[k]);
+        mlp = mlp_init(n_inputs, H, O);
+        for (uint32_t i = 0; i < n_inputs; i++)
+            memcpy(&sweep->W1->values[i * K * H + k * H], &mlp->W1->values[i * H], sizeof(float) * H);
+        memcpy(&sweep->b1->values[k * H], mlp->b1->values, sizeof(float) * H);
+        memcpy(&sweep->W2->values[k * H * O], mlp->W2->values, sizeof(float) * H * O);
+        memcpy(&sweep->b2->values[k * O], mlp->b2->values, sizeof(float) * O);
+        sweep->lrs[k] = lrs[k];
+        mlp_clean(mlp);
+    }
+
+    sweep->z1 = buffer(0, max_batch, K * H);
+    sweep->a1 = buffer(K, max_batch, H);
+    sweep->da1 = buffer(K, max_batch, H);
+    sweep->z2 = buffer(K, max_batch, O);
+    sweep->dW1 = buffer(0, n_inputs, K * H);
+    sweep->db1 = buffer(0, 0, K * H);
+    sweep->dW2 = buffer(K, H, O);
+    sweep->db2 = buffer(0, K, O);
+    sweep->preds = buffer(0, K, max_batch);
+    return sweep;
+}
+
+void sweep_clean(sweep_t* sweep)
+{
+    tensor_t* tensors[] = {sweep->W1, sweep->b1, sweep->W2, sweep->b2, sweep->z1, sweep->a1,
+        sweep->da1, sweep->z2, sweep->dW1, sweep->db1, sweep->dW2, sweep->db2, sweep->preds};
+
+    for (int i = 0; i < sizeof(tensors) / sizeof(tensors[0]); i++)
+        tensor_clean(tensors[i]);
+    free(sweep->lrs);
+    free(sweep->losses);
+    free(sweep);
+}
+
+void sweep_step(sweep_t* sweep, const tensor_t* x, const tensor_t* y)
+{
+    if (y->n_dims != 1 || y->shape[0] != x->shape[0])
+    {
+        printf("[ERROR] Labels must have shape [%u]\n", x->shape[0]);
+        exit(1);
+    }
+
+    forward(sweep, x, y);
+    backward(sweep, x);
+    update(sweep);
+}
+
+void sweep_accuracy(sweep_t* sweep, const tensor_t* x, const tensor_t* y, float* accs)
+{
+    uint32_t rows = x->shape[0], cols = x->shape[1], batch = sweep->max_batch, n;
+    uint32_t shape[2];
+    tensor_t slice;
+
+    for (uint32_t k = 0; k < sweep->n_models; k++)
+        accs[k] = 0;
+
+    /* Row slices of x share its values */
+    for (uint32_t start = 0; start < rows; start += batch)
+    {
+        n = rows - start < batch ? rows - start : batch;
+        view(&slice, shape, &x->values[start * cols], n, cols);
+        forward(sweep, &slice, NULL);
+
+        for (uint32_t k = 0; k < sweep->n_models; k++)
+            for (uint32_t i = 0; i < n; i++)
+                accs[k] += sweep->preds->values[k * n + i] == y->values[start + i];
+    }
+
+    for (uint32_t k = 0; k < sweep->n_models; k++)
+        accs[k] /= rows;
+}
+
+mlp_t* sweep_extract(const sweep_t* sweep, uint32_t k)
+{
+    mlp_t* mlp = (mlp_t*)malloc(sizeof(mlp_t));
+    uint32_t K = sweep->n_models, H = sweep->n_hidden, O = sweep->n_outputs;
+
+    mlp->W1 = buffer(0, sweep->n_inputs, H);
+    mlp->b1 = buffer(0, 0, H);
+    mlp->W2 = buffer(0, H, O);
+    mlp->b2 = buffer(0, 0, O);
+    mlp->dtype = TENSOR_F32;
+    mlp->W1h = NULL;
+    mlp->W2h = NULL;
+
+    for (uint32_t i = 0; i < sweep->n_inputs; i++)
+        memcpy(&mlp->W1->values[i * H], &sweep->W1->values[i * K * H + k * H], sizeof(float) * H);
+    memcpy(mlp->b1->values, &sweep->b1->values[k * H], sizeof(float) * H);
+    memcpy(mlp->W2->values, &sweep->W2->values[k * H * O], sizeof(float) * H * O);
+    memcpy(mlp->b2->values, &sweep->b2->values[k * O], sizeof(float) * O);
+    return mlp;
+}
+
+/* Zeroed [d0, d1, d2], leading zero dims are dropped */
+tensor_t* buffer(uint32_t d0, uint32_t d1, uint32_t d2)
+{
+    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 3);
+    uint32_t n_dims = 0;
+
+    if (d0 > 0)
+        shape[n_dims++] = d0;
+    if (d0 > 0 || d1 > 0)
+        shape[n_dims++] = d1;
+    shape[n_dims++] = d2;
+    return tensor_zeros(shape, n_dims);
+}
+
+/* 2D tensor over existing values, `shape` must outlive it */
+void view(tensor_t* v, uint32_t* shape, float* values, uint32_t rows, uint32_t cols)
+{
+    memset(v, 0, sizeof(tensor_t));
+    shape[0] = rows;
+    shape[1] = cols;
+    v->n_dims = 2;
+    v->shape = shape;
+    v->values = values;
+    v->dtype = TENSOR_F32;
+}
+
+/* Leaves softmax(z2) - onehot(y), over the batch size, in z2 when labels
+ * are given */
+void forward(sweep_t* sweep, const tensor_t* x, const tensor_t* y)
+{
+    uint32_t B = x->shape[0], K = sweep->n_models, H = sweep->n_hidden, O = sweep->n_outputs;
+    float* z1 = sweep->z1->values, *a1 = sweep->a1->values, *row, *p, max, sum, v;
+
+    if (x->n_dims != 2 || x->shape[1] != sweep->n_inputs || B > sweep->max_batch)
+    {
+        printf("[ERROR] Sweep input must be [<= %u, %u]\n", sweep->max_batch, sweep->n_inputs);
+        exit(1);
+    }
+
+    sweep->z1->shape[0] = B;
+    sweep->a1->shape[1] = B;
+    sweep->da1->shape[1] = B;
+    sweep->z2->shape[1] = B;
+    sweep->preds->shape[1] = B;
+
+    /* One GEMM for the first layer of every model, sparse when x has a CSR */
+    tensor_mm_into(x, sweep->W1, sweep->z1);
+
+    /* Bias and relu, regrouped per model for the batched second layer */
+    for (uint32_t b = 0; b < B; b++)
+        for (uint32_t k = 0; k < K; k++)
+            for (uint32_t h = 0; h < H; h++)
+            {
+                v = z1[b * K * H + k * H + h] + sweep->b1->values[k * H + h];
+                a1[(k * B + b) * H + h] = v > 0 ? v : 0;
+            }
+
+    tensor_bmm_into(sweep->a1, sweep->W2, sweep->z2);
+
+    for (uint32_t k = 0; k < K; k++)
+    {
+        if (y != NULL)
+            sweep->losses[k] = 0;
+        for (uint32_t b = 0; b < B; b++)
+        {
+            row = &sweep->z2->values[(k * B + b) * O];
+            p = &sweep->preds->values[k * B + b];
+            *p = 0;
+            for (uint32_t c = 0; c < O; c++)
+            {
+                row[c] += sweep->b2->values[k * O + c];
+                if (row[c] > row[(int)*p])
+                    *p = c;
+            }
+            if (y == NULL)
+                continue;
+
+            /* Log-softmax as z - max - log(sum(exp(z - max))) */
+            max = row[(int)*p];
+            sum = 0;
+            for (uint32_t c = 0; c < O; c++)
+                sum += expf(row[c] - max);
+            sweep->losses[k] -= (row[(int)y->values[b]] - max - logf(sum)) / B;
+
+            for (uint32_t c = 0; c < O; c++)
+                row[c] = expf(row[c] - max) / sum / B;
+            row[(int)y->values[b]] -= 1.0f / B;
+        }
+    }
+}
+
+void backward(sweep_t* sweep, const tensor_t* x)
+{
+    uint32_t B = x->shape[0], K = sweep->n_models, H = sweep->n_hidden, O = sweep->n_outputs;
+    uint32_t s_a1[2], s_dz2[2], s_dW2[2], s_W2[2], s_da1[2];
+    tensor_t a1, dz2, dW2, W2, da1;
+    float* dz1 = sweep->z1->values;
+
+    /* Second layers, one small GEMM pair per model */
+    for (uint32_t k = 0; k < K; k++)
+    {
+        view(&a1, s_a1, &sweep->a1->values[k * B * H], B, H);
+        view(&dz2, s_dz2, &sweep->z2->values[k * B * O], B, O);
+        view(&dW2, s_dW2, &sweep->dW2->values[k * H * O], H, O);
+        view(&W2, s_W2, &sweep->W2->values[k * H * O], H, O);
+        view(&da1, s_da1, &sweep->da1->values[k * B * H], B, H);
+
+        tensor_mm_T_into(&a1, &dz2, &dW2);
+        tensor_mm_NT_into(&dz2, &W2, &da1);
+        for (uint32_t c = 0; c < O; c++)
+        {
+            sweep->db2->values[k * O + c] = 0;
+            for (uint32_t b = 0; b < B; b++)
+                sweep->db2->values[k * O + c] += dz2.values[b * O + c];
+        }
+    }
+
+    /* Back to the side by side layout of the first layer, into z1 */
+    for (uint32_t b = 0; b < B; b++)
+        for (uint32_t k = 0; k < K; k++)
+            for (uint32_t h = 0; h < H; h++)
+                dz1[b * K * H + k * H + h] = sweep->a1->values[(k * B + b) * H + h] > 0 ?
+                    sweep->da1->values[(k * B + b) * H + h] : 0;
+
+    /* Takes the sparse path when x comes with a CSR */
+    tensor_mm_T_into(x, sweep->z1, sweep->dW1);
+    memset(sweep->db1->values, 0, sizeof(float) * K * H);
+    for (uint32_t b = 0; b < B; b++)
+        for (uint32_t j = 0; j < K * H; j++)
+            sweep->db1->values[j] += dz1[b * K * H + j];
+}
+
+void update(sweep_t* sweep)
+{
+    uint32_t K = sweep->n_models, H = sweep->n_hidden, O = sweep->n_outputs;
+
+    for (uint32_t i = 0; i < sweep->n_inputs; i++)
+        for (uint32_t k = 0; k < K; k++)
+            for (uint32_t h = 0; h < H; h++)
+                sweep->W1->values[(i * K + k) * H + h] -=
+                    sweep->lrs[k] * sweep->dW1->values[(i * K + k) * H + h];
+
+    for (uint32_t k = 0; k < K; k++)
+    {
+        for (uint32_t h = 0; h < H; h++)
+            sweep->b1->values[k * H + h] -= sweep->lrs[k] * sweep->db1->values[k * H + h];
+        for (uint32_t j = 0; j < H * O; j++)
+            sweep->W2->values[k * H * O + j] -= sweep->lrs[k] * sweep->dW2->values[k * H * O + j];
+        for (uint32_t c = 0; c < O; c++)
+            sweep->b2->values[k * O + c] -= sweep->lrs[k] * sweep->db2->values[k * O + c];
+    }
+}
@@ -2,6 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include "tensor.h"
+#include "half.h"
+#include "sparse.h"
+#include "bmm.h"
+#include "trace.h"
+#include "memtrack.h"
 
 
 #define PRINT_ARRAY(a, l, f, lead, trail, sep) \
@@ -20,13 +25,18 @@ static void u32reverse(uint32_t*, uint32_t);
 static float* slice(float*, uint32_t, uint32_t);
 static float* f32copy(float* src, uint32_t n);
 static uint32_t* u32copy(uint32_t* src, uint32_t n);
+static uint32_t* shape_new(uint32_t n_dims);
 
 static uint32_t* build_indexer(uint32_t i, uint32_t n_dims, uint32_t* shape);
 static float random_uniform(float min, float max);
 
 static void check_n_dims(const tensor_t* t, uint32_t n_dims);
+static void check_f32(const tensor_t* t);
+static const char* dtype_name(tensor_dtype_t dtype);
+static uint32_t bmm_dims(const tensor_t* t, uint32_t* rows, uint32_t* cols);
 
-tensor_t* tensor_new(float* values, uint32_t* shape, uint32_t n_dims) 
+tensor_t* tensor_new_at(float* values, uint32_t* shape, uint32_t n_dims,
+        const char* file, int line, const char* func)
 {
     tensor_t* t = (tensor_t*)malloc(sizeof(tensor_t));
     if (n_dims == 0)
@@ -35,6 +45,13 @@ tensor_t* tensor_new(float* values, uint32_t* shape, uint32_t n_dims)
         t->shape = shape;
     t->values = values;
     t->n_dims = n_dims;
+    t->dtype = TENSOR_F32;
+    t->halfs = NULL;
+    t->csr = NULL;
+    t->mem_bytes = 0;
+    t->mem_site = 0;
+    if (memtrack_enabled)
+        memtrack_alloc(t, file, line, func);
     return t;
 }
 
@@ -42,6 +59,8 @@ tensor_t* tensor_arange(
         float start, float end, float step, 
         uint32_t* shape, uint32_t n_dims)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    tensor_t* result;
     uint32_t nels = (uint32_t)((end - start) / step);
     float* values = (float*)malloc(sizeof(float) * nels);
     int i = 0;
@@ -50,45 +69,120 @@ tensor_t* tensor_arange(
         values[i] = v;
         i++;
     }
-    return tensor_new(values, shape, n_dims);
+    result = tensor_new(values, shape, n_dims);
+    TRACE_OP(trace_start, "tensor_arange", NULL, NULL, result);
+    return result;
 }
 
 tensor_t* tensor_zeros(uint32_t* shape, uint32_t n_dims)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    tensor_t* result;
     int nels = array_prod(shape, n_dims);
     float* values = (float*)malloc(sizeof(float) * nels);
     for (int i = 0; i < nels; i++)
         values[i] = 0;
 
-    return tensor_new(values, shape, n_dims);
+    result = tensor_new(values, shape, n_dims);
+    TRACE_OP(trace_start, "tensor_zeros", NULL, NULL, result);
+    return result;
 }
 
 tensor_t* tensor_ones(uint32_t* shape, uint32_t n_dims)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* t = tensor_zeros(shape, n_dims);
-    return tensor_add_scalar(t, 1);
+    tensor_t* result = tensor_add_scalar(t, 1);
+
+    tensor_clean(t);
+    TRACE_OP(trace_start, "tensor_ones", NULL, NULL, result);
+    return result;
 }
 
 tensor_t* tensor_uniform(float min, float max, uint32_t* shape, uint32_t n_dims)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    tensor_t* result;
     int nels = array_prod(shape, n_dims);
     float* values = (float*)malloc(sizeof(float) * nels);
     for (int i = 0; i < nels; i++)
         values[i] = random_uniform(min, max);
 
-    return tensor_new(values, shape, n_dims);
+    result = tensor_new(values, shape, n_dims);
+    TRACE_OP(trace_start, "tensor_uniform", NULL, NULL, result);
+    return result;
 }
 
 tensor_t* tensor_copy(const tensor_t* t) 
 {
-    return tensor_new(
+    uint64_t trace_start = TRACE_BEGIN();
+    tensor_t* result;
+    uint32_t nels;
+
+    if (t->dtype != TENSOR_F32)
+    {
+        nels = tensor_numel(t);
+        result = tensor_new(NULL, u32copy(t->shape, t->n_dims), t->n_dims);
+        result->dtype = t->dtype;
+        result->halfs = (uint16_t*)malloc(sizeof(uint16_t) * nels);
+        memcpy(result->halfs, t->halfs, sizeof(uint16_t) * nels);
+        memtrack_resize(result);
+        TRACE_OP(trace_start, "tensor_copy", t, NULL, result);
+        return result;
+    }
+
+    result = tensor_new(
             f32copy(t->values, tensor_numel(t)), 
             u32copy(t->shape, t->n_dims), t->n_dims);
+    TRACE_OP(trace_start, "tensor_copy", t, NULL, result);
+    return result;
+}
+
+tensor_t* tensor_to_dtype(const tensor_t* t, tensor_dtype_t dtype)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    tensor_t* result;
+    uint32_t nels = tensor_numel(t);
+
+    if (t->dtype == dtype)
+        return tensor_copy(t);
+
+    result = tensor_new(NULL, u32copy(t->shape, t->n_dims), t->n_dims);
+    result->dtype = dtype;
+
+    if (dtype == TENSOR_F32)
+    {
+        result->values = (float*)malloc(sizeof(float) * nels);
+        half_to_f32(result->values, t->halfs, nels, t->dtype);
+    }
+    else if (t->dtype == TENSOR_F32)
+    {
+        result->halfs = (uint16_t*)malloc(sizeof(uint16_t) * nels);
+        half_from_f32(result->halfs, t->values, nels, dtype);
+    }
+    else
+    {
+        /* Between both 16 bit formats go through fp32 */
+        result->values = (float*)malloc(sizeof(float) * nels);
+        result->halfs = (uint16_t*)malloc(sizeof(uint16_t) * nels);
+        half_to_f32(result->values, t->halfs, nels, t->dtype);
+        half_from_f32(result->halfs, result->values, nels, dtype);
+        free(result->values);
+        result->values = NULL;
+    }
+    memtrack_resize(result);
+    TRACE_OP(trace_start, "tensor_to_dtype", t, NULL, result);
+    return result;
 }
 
 void tensor_clean(tensor_t* t)
 {
+    if (t->mem_site)
+        memtrack_free(t);
     free(t->values);
+    free(t->halfs);
+    if (t->csr)
+        sparse_csr_clean(t->csr);
     // if (t->n_dims > 0)
         // free(t->shape);
     free(t);
@@ -96,6 +190,7 @@ void tensor_clean(tensor_t* t)
 
 tensor_t* tensor_index(const tensor_t* t, uint32_t* index, uint32_t n_indices)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* result;
     tensor_t* gc;
 
@@ -129,11 +224,13 @@ tensor_t* tensor_index(const tensor_t* t, uint32_t* index, uint32_t n_indices)
                 t->n_dims - i - 1);
         tensor_clean(gc);
     }
+    TRACE_OP(trace_start, "tensor_index", t, NULL, result);
     return result;
 }
 
 tensor_t* tensor_T(const tensor_t* t)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* result;
     uint32_t* new_shape;
 
@@ -142,15 +239,26 @@ tensor_t* tensor_T(const tensor_t* t)
     u32reverse(new_shape, 2);
     result = tensor_reshape(t, new_shape, 2);
 
+    if (t->dtype != TENSOR_F32)
+    {
+        for (int i = 0; i < t->shape[0]; i++)
+            for (int j = 0; j < t->shape[1]; j++)
+                result->halfs[j * result->shape[1] + i] = t->halfs[i * t->shape[1] + j];
+        TRACE_OP(trace_start, "tensor_T", t, NULL, result);
+        return result;
+    }
+
     for (int i = 0; i < t->shape[0]; i++)
         for (int j = 0; j < t->shape[1]; j++)
             result->values[j * result->shape[1] + i] = t->values[i * t->shape[1] + j];
 
+    TRACE_OP(trace_start, "tensor_T", t, NULL, result);
     return result;
 }
 
 tensor_t* tensor_reshape(const tensor_t* t, uint32_t* shape, uint32_t n_dims)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* result;
 
     if (tensor_numel(t) != array_prod(shape, n_dims)) 
@@ -163,16 +271,21 @@ tensor_t* tensor_reshape(const tensor_t* t, uint32_t* shape, uint32_t n_dims)
     result = tensor_copy(t);
     result->n_dims = n_dims;
     result->shape = shape;
+    TRACE_OP(trace_start, "tensor_reshape", t, NULL, result);
     return result;
 }
 
 void tensor_broadcast(tensor_t** t1, tensor_t** t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* gc;
     uint32_t* t1_shape, *t2_shape;
     int* broadcasters; 
     uint32_t max_dim = (*t1)->n_dims > (*t2)->n_dims ? (*t1)->n_dims : (*t2)->n_dims;
 
+    check_f32(*t1);
+    check_f32(*t2);
+
     /* Align shapes */
     t1_shape = (uint32_t*)malloc(sizeof(uint32_t) * max_dim);
     t2_shape = (uint32_t*)malloc(sizeof(uint32_t) * max_dim);
@@ -234,18 +347,21 @@ void tensor_broadcast(tensor_t** t1, tensor_t** t2)
             tensor_clean(gc);
         }
     }
+    TRACE_OP(trace_start, "tensor_broadcast", *t1, *t2, NULL);
 }
 
 tensor_t* tensor_argmax(const tensor_t* t, uint32_t axis)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     int pitch;
     int to_reduce;
     int offset = 0, factor;
-    float tmp_max, tmp_max_idx;
+    float tmp_max, tmp_max_idx = 0;
 
     uint32_t* new_shape;
     tensor_t* res;
 
+    check_f32(t);
     if (axis > t->n_dims - 1)
     {
         printf("[ERROR] Axis %d is larger than the available n_dims range [0, %d)\n", axis, t->n_dims);
@@ -254,7 +370,7 @@ tensor_t* tensor_argmax(const tensor_t* t, uint32_t axis)
 
     pitch = array_prod(&t->shape[axis + 1], t->n_dims - axis - 1);
     to_reduce = t->shape[axis];
-    new_shape = (uint32_t*)malloc(sizeof(uint32_t) * t->n_dims - 1);
+    new_shape = shape_new(t->n_dims - 1);
     for (int i = 0; i < t->n_dims - 1; i++)
     {
         if (i == axis)
@@ -277,12 +393,15 @@ tensor_t* tensor_argmax(const tensor_t* t, uint32_t axis)
         }
         res->values[i] = tmp_max_idx;
     }
+    TRACE_OP(trace_start, "tensor_argmax", t, NULL, res);
     return res;
 }
 
 
 tensor_t* tensor_unsqueeze(const tensor_t* t, uint32_t axis)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    tensor_t* result;
     uint32_t* new_shape;
     int i = 0;
     int offset = 0;
@@ -293,7 +412,7 @@ tensor_t* tensor_unsqueeze(const tensor_t* t, uint32_t axis)
         exit(1);
     }
 
-    new_shape = (uint32_t*)malloc(sizeof(uint32_t) * t->n_dims + 1);
+    new_shape = shape_new(t->n_dims + 1);
     while (i < t->n_dims + 1)
     {
         if (i == axis)
@@ -304,11 +423,14 @@ tensor_t* tensor_unsqueeze(const tensor_t* t, uint32_t axis)
         new_shape[i + offset] = t->shape[i];
         i++;
     }
-    return tensor_reshape(t, new_shape, t->n_dims + 1);
+    result = tensor_reshape(t, new_shape, t->n_dims + 1);
+    TRACE_OP(trace_start, "tensor_unsqueeze", t, NULL, result);
+    return result;
 }
 
 tensor_t* tensor_repeat(const tensor_t* t, uint32_t repeats, uint32_t axis)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* res;
     int to_repeat, group;
 
@@ -321,6 +443,7 @@ tensor_t* tensor_repeat(const tensor_t* t, uint32_t repeats, uint32_t axis)
     res = tensor_copy(t);
     res->shape[axis] *= repeats;
     res->values = (float*)realloc(res->values, sizeof(float) * (int)tensor_numel(res));
+    memtrack_resize(res);
     to_repeat = array_prod(&t->shape[axis + 1], t->n_dims - axis - 1);
 
     for (int i = 0; i < tensor_numel(t); i++)
@@ -329,6 +452,7 @@ tensor_t* tensor_repeat(const tensor_t* t, uint32_t repeats, uint32_t axis)
         for (int j = group * repeats; j < group* repeats + repeats; j++)
             res->values[j * to_repeat + (i % to_repeat)] = t->values[i];
     }
+    TRACE_OP(trace_start, "tensor_repeat", t, NULL, res);
     return res;
 }
 
@@ -356,6 +480,7 @@ void tensor_print(const tensor_t* t)
     uint8_t new_group = 0;
     uint8_t is_tensor = t->n_dims > 2;
 
+    check_f32(t);
     printf("Tensor(");
 
     if (t->n_dims == 0)
@@ -406,17 +531,22 @@ void tensor_specs(const tensor_t* t)
 {
     printf("Tensor(shape=");
     PRINT_ARRAY(t->shape, t->n_dims, "%d", "(", ")", ", ");
-    printf(", ndims=%d)\n", t->n_dims);
+    if (t->dtype != TENSOR_F32)
+        printf(", ndims=%d, dtype=%s)\n", t->n_dims, dtype_name(t->dtype));
+    else
+        printf(", ndims=%d)\n", t->n_dims);
 }
 
 
 tensor_t* tensor_reduce_sum(const tensor_t* t, uint32_t axis)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* result;
     uint32_t* reduced_shape;
     int to_reduce, factor, pitch, offset = 0;
     float tmp;
 
+    check_f32(t);
     if (axis > t->n_dims - 1)
     {
         printf("[ERROR] Axis %d is larger than the available n_dims range [0, %d)\n", axis, t->n_dims);
@@ -425,7 +555,7 @@ tensor_t* tensor_reduce_sum(const tensor_t* t, uint32_t axis)
 
     pitch = array_prod(&t->shape[axis + 1], t->n_dims - axis - 1);
     to_reduce = t->shape[axis];
-    reduced_shape = (uint32_t*)malloc(sizeof(uint32_t) * t->n_dims - 1);
+    reduced_shape = shape_new(t->n_dims - 1);
     for (int i = 0; i < t->n_dims - 1; i++)
     {
         if (i == axis)
@@ -445,12 +575,13 @@ tensor_t* tensor_reduce_sum(const tensor_t* t, uint32_t axis)
         result->values[i] = tmp;
     }
 
-
+    TRACE_OP(trace_start, "tensor_reduce_sum", t, NULL, result);
     return result;
 }
 
 tensor_t* tensor_gte(const tensor_t* t1, const tensor_t* t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t *o1, *o2;
     o1 = tensor_copy(t1);
     o2 = tensor_copy(t2);
@@ -465,12 +596,13 @@ tensor_t* tensor_gte(const tensor_t* t1, const tensor_t* t2)
 
     tensor_clean(o1);
     tensor_clean(o2);
-
+    TRACE_OP(trace_start, "tensor_gte", t1, t2, res);
     return res;
 }
 
 tensor_t* tensor_eq(const tensor_t* t1, const tensor_t* t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t *o1, *o2;
     o1 = tensor_copy(t1);
     o2 = tensor_copy(t2);
@@ -485,22 +617,26 @@ tensor_t* tensor_eq(const tensor_t* t1, const tensor_t* t2)
 
     tensor_clean(o1);
     tensor_clean(o2);
-
+    TRACE_OP(trace_start, "tensor_eq", t1, t2, res);
     return res;
 }
 
 tensor_t* tensor_neg(const tensor_t* t)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    check_f32(t);
     tensor_t* res = tensor_copy(t);
     uint32_t nels = tensor_numel(t);
     for (int i = 0; i < nels; i++)
         res->values[i] = -1 * t->values[i];
 
+    TRACE_OP(trace_start, "tensor_neg", t, NULL, res);
     return res;
 }
 
 tensor_t* tensor_add(const tensor_t* t1, const tensor_t* t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t *o1, *o2;
     o1 = tensor_copy(t1);
     o2 = tensor_copy(t2);
@@ -515,39 +651,50 @@ tensor_t* tensor_add(const tensor_t* t1, const tensor_t* t2)
 
     tensor_clean(o1);
     tensor_clean(o2);
-
+    TRACE_OP(trace_start, "tensor_add", t1, t2, res);
     return res;
 }
 
 tensor_t* tensor_add_scalar(const tensor_t* t, float scalar)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    check_f32(t);
     tensor_t* res = tensor_copy(t);
     uint32_t nels = tensor_numel(t);
 
     for (int i = 0; i < nels; i++)
         res->values[i] = t->values[i] + scalar;
 
+    TRACE_OP(trace_start, "tensor_add_scalar", t, NULL, res);
     return res;
 }
 
 
 tensor_t* tensor_sub(const tensor_t* t1, const tensor_t* t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t* neg_t2 = tensor_neg(t2);
     tensor_t* res = tensor_add(t1, neg_t2);
     tensor_clean(neg_t2);
+    TRACE_OP(trace_start, "tensor_sub", t1, t2, res);
     return res;
 }
 
 
 tensor_t* tensor_sub_scalar(const tensor_t* t, float scalar)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    tensor_t* res;
+
     scalar = -1 * scalar;
-    return tensor_add_scalar(t, scalar);
+    res = tensor_add_scalar(t, scalar);
+    TRACE_OP(trace_start, "tensor_sub_scalar", t, NULL, res);
+    return res;
 }
 
 tensor_t* tensor_mul(const tensor_t* t1, const tensor_t* t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t *o1, *o2;
     o1 = tensor_copy(t1);
     o2 = tensor_copy(t2);
@@ -562,23 +709,27 @@ tensor_t* tensor_mul(const tensor_t* t1, const tensor_t* t2)
 
     tensor_clean(o1);
     tensor_clean(o2);
-
+    TRACE_OP(trace_start, "tensor_mul", t1, t2, res);
     return res;
 }
 
 tensor_t* tensor_mul_scalar(const tensor_t* t, float scalar)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    check_f32(t);
     tensor_t* res = tensor_copy(t);
     uint32_t nels = tensor_numel(t);
 
     for (int i = 0; i < nels; i++)
         res->values[i] = t->values[i] * scalar;
 
+    TRACE_OP(trace_start, "tensor_mul_scalar", t, NULL, res);
     return res;
 }
 
 tensor_t* tensor_div(const tensor_t* t1, const tensor_t* t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
     tensor_t *o1, *o2;
     o1 = tensor_copy(t1);
     o2 = tensor_copy(t2);
@@ -593,23 +744,45 @@ tensor_t* tensor_div(const tensor_t* t1, const tensor_t* t2)
 
     tensor_clean(o1);
     tensor_clean(o2);
-
+    TRACE_OP(trace_start, "tensor_div", t1, t2, res);
     return res;
 }
 
 tensor_t* tensor_div_scalar(const tensor_t* t, float scalar)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    check_f32(t);
     tensor_t* res = tensor_copy(t);
     uint32_t nels = tensor_numel(t);
 
     for (int i = 0; i < nels; i++)
         res->values[i] = t->values[i] / scalar;
 
+    TRACE_OP(trace_start, "tensor_div_scalar", t, NULL, res);
     return res;
 }
 
 tensor_t* tensor_mm(const tensor_t* t1, const tensor_t* t2)
 {
+    uint64_t trace_start = TRACE_BEGIN();
+    uint32_t* shape = shape_new(2);
+    tensor_t* result;
+
+    check_n_dims(t1, 2);
+    check_n_dims(t2, 2);
+    shape[0] = t1->shape[0];
+    shape[1] = t2->shape[1];
+    result = tensor_zeros(shape, 2);
+    tensor_mm_into(t1, t2, result);
+    TRACE_OP(trace_start, "tensor_mm", t1, t2, result);
+    return result;
+}
+
+void tensor_mm_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    float tmp;
+
     if (t1->n_dims != 2 || t2->n_dims != 2)
     {
         printf("[ERROR] tensor_mm only supports tensors of 2 dims.\n");
@@ -625,13 +798,28 @@ tensor_t* tensor_mm(const tensor_t* t1, const tensor_t* t2)
         printf("\n");
     }
 
-    float tmp;
-    uint32_t* shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
-    tensor_t* result;
+    check_f32(result);
+    if (result->shape[0] != t1->shape[0] || result->shape[1] != t2->shape[1])
+    {
+        printf("[ERROR] Result of tensor_mm_into has the wrong shape\n");
+        exit(1);
+    }
 
-    shape[0] = t1->shape[0];
-    shape[1] = t2->shape[1];
-    result = tensor_zeros(shape, 2);
+    if (t1->dtype != TENSOR_F32 || t2->dtype != TENSOR_F32)
+    {
+        memset(result->values, 0, sizeof(float) * tensor_numel(result));
+        half_mm(t1, t2, result->values);
+        TRACE_OP(trace_start, "tensor_mm_into", t1, t2, result);
+        return;
+    }
+
+    if (t1->csr && sparse_density(t1) < SPARSE_MAX_DENSITY)
+    {
+        memset(result->values, 0, sizeof(float) * tensor_numel(result));
+        sparse_mm(t1, t2, result->values);
+        TRACE_OP(trace_start, "tensor_mm_into", t1, t2, result);
+        return;
+    }
 
     for (int row = 0; row < t1->shape[0]; row++)
     {
@@ -643,9 +831,160 @@ tensor_t* tensor_mm(const tensor_t* t1, const tensor_t* t2)
             result->values[row * result->shape[1] + col] = tmp;
         }
     }
+    TRACE_OP(trace_start, "tensor_mm_into", t1, t2, result);
+}
+
+void tensor_mm_NT_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    uint32_t M, N, K;
+    const float* r1, *r2;
+    float acc;
+
+    check_n_dims(t1, 2);
+    check_n_dims(t2, 2);
+    check_f32(t1);
+    check_f32(t2);
+    check_f32(result);
+    M = t1->shape[0];
+    N = t1->shape[1];
+    K = t2->shape[0];
+
+    if (t2->shape[1] != N || result->shape[0] != M || result->shape[1] != K)
+    {
+        printf("[ERROR] No compatible shapes for tensor_mm_NT_into\n");
+        exit(1);
+    }
+
+    for (uint32_t m = 0; m < M; m++)
+    {
+        r1 = &t1->values[m * N];
+        for (uint32_t k = 0; k < K; k++)
+        {
+            r2 = &t2->values[k * N];
+            acc = 0;
+            for (uint32_t n = 0; n < N; n++)
+                acc += r1[n] * r2[n];
+            result->values[m * K + k] = acc;
+        }
+    }
+    TRACE_OP(trace_start, "tensor_mm_NT_into", t1, t2, result);
+}
+
+tensor_t* tensor_bmm(const tensor_t* t1, const tensor_t* t2)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    uint32_t* shape = shape_new(3);
+    uint32_t b1, b2, M, N, k;
+    tensor_t* result;
+
+    b1 = bmm_dims(t1, &M, &k);
+    b2 = bmm_dims(t2, &k, &N);
+    shape[0] = b1 > b2 ? b1 : b2;
+    shape[1] = M;
+    shape[2] = N;
+    result = tensor_zeros(shape, 3);
+    tensor_bmm_into(t1, t2, result);
+    TRACE_OP(trace_start, "tensor_bmm", t1, t2, result);
+    return result;
+}
+
+void tensor_bmm_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    uint32_t b1, b2, batch, M, K, K2, N;
+
+    check_f32(t1);
+    check_f32(t2);
+    check_f32(result);
+    b1 = bmm_dims(t1, &M, &K);
+    b2 = bmm_dims(t2, &K2, &N);
+    batch = b1 > b2 ? b1 : b2;
+
+    if (K != K2 || (b1 != b2 && b1 != 1 && b2 != 1))
+    {
+        printf("[ERROR] No compatible shapes for batched matrix multiplication.");
+        PRINT_ARRAY(t1->shape, t1->n_dims, "%d", "(", ")", ", ");
+        printf(" and ");
+        PRINT_ARRAY(t2->shape, t2->n_dims, "%d", "(", ")", ", ");
+        printf("\n");
+        exit(1);
+    }
+
+    if (result->n_dims != 3 || result->shape[0] != batch || result->shape[1] != M ||
+            result->shape[2] != N)
+    {
+        printf("[ERROR] Result of tensor_bmm_into has the wrong shape\n");
+        exit(1);
+    }
+
+    /* A batch of 1 is read again by every product */
+    bmm(t1->values, b1 == 1 ? 0 : (size_t)M * K, t2->values, b2 == 1 ? 0 : (size_t)K * N,
+            result->values, batch, M, K, N);
+    TRACE_OP(trace_start, "tensor_bmm_into", t1, t2, result);
+}
+
+tensor_t* tensor_mm_T(const tensor_t* t1, const tensor_t* t2)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    uint32_t* shape = shape_new(2);
+    tensor_t* result;
+
+    check_n_dims(t1, 2);
+    check_n_dims(t2, 2);
+    shape[0] = t1->shape[1];
+    shape[1] = t2->shape[1];
+    result = tensor_zeros(shape, 2);
+    tensor_mm_T_into(t1, t2, result);
+    TRACE_OP(trace_start, "tensor_mm_T", t1, t2, result);
     return result;
 }
 
+void tensor_mm_T_into(const tensor_t* t1, const tensor_t* t2, tensor_t* result)
+{
+    uint64_t trace_start = TRACE_BEGIN();
+    uint32_t M = t1->shape[0], K = t1->shape[1], N = t2->shape[1];
+    tensor_t* T;
+    float v;
+
+    check_n_dims(t1, 2);
+    check_n_dims(t2, 2);
+    check_f32(result);
+    if (M != t2->shape[0] || result->shape[0] != K || result->shape[1] != N)
+    {
+        printf("[ERROR] No compatible shapes for transposed matrix multiplication.\n");
+        exit(1);
+    }
+
+    /* 16 bit inputs go through a transposed copy and the half kernels */
+    if (t1->dtype != TENSOR_F32 || t2->dtype != TENSOR_F32)
+    {
+        T = tensor_T(t1);
+        tensor_mm_into(T, t2, result);
+        tensor_clean(T);
+        TRACE_OP(trace_start, "tensor_mm_T_into", t1, t2, result);
+        return;
+    }
+
+    memset(result->values, 0, sizeof(float) * K * N);
+    if (t1->csr && sparse_density(t1) < SPARSE_MAX_DENSITY)
+    {
+        sparse_mm_T(t1, t2, result->values);
+        TRACE_OP(trace_start, "tensor_mm_T_into", t1, t2, result);
+        return;
+    }
+
+    /* Row m of t1 scatters row m of t2, no transposed copy needed */
+    for (uint32_t m = 0; m < M; m++)
+        for (uint32_t k = 0; k < K; k++)
+        {
+            v = t1->values[m * K + k];
+            for (uint32_t n = 0; n < N; n++)
+                result->values[k * N + n] += v * t2->values[m * N + n];
+        }
+    TRACE_OP(trace_start, "tensor_mm_T_into", t1, t2, result);
+}
+
 float* slice(float* old_values, uint32_t start, uint32_t size)
 {
     float* new_values = (float*)malloc(sizeof(float) * size);
@@ -666,13 +1005,22 @@ float* f32copy(float* src, uint32_t n)
 
 uint32_t* u32copy(uint32_t* src, uint32_t n)
 {
-    uint32_t* new_values = (uint32_t*)malloc(sizeof(uint32_t) * n);
+    uint32_t* new_values = shape_new(n);
     for (int i = 0; i < n; i++)
         new_values[i] = src[i];
 
     return new_values;
 }
 
+/* Shapes of op results, counted by memtrack.h as tensor_clean never frees
+ * them */
+uint32_t* shape_new(uint32_t n_dims)
+{
+    if (memtrack_enabled)
+        memtrack_shape(n_dims);
+    return (uint32_t*)malloc(sizeof(uint32_t) * n_dims);
+}
+
 uint32_t* build_indexer(uint32_t i, uint32_t n_dims, uint32_t* shape)
 {
     uint32_t* indexer = (uint32_t*)malloc(
@@ -721,8 +1069,44 @@ void check_n_dims(const tensor_t* t, uint32_t n_dims)
     }
 }
 
+void check_f32(const tensor_t* t)
+{
+    if (t->dtype != TENSOR_F32)
+    {
+        printf("[ERROR] Operation only supports F32 tensors, got a %s one\n", dtype_name(t->dtype));
+        exit(1);
+    }
+}
+
+const char* dtype_name(tensor_dtype_t dtype)
+{
+    switch (dtype)
+    {
+    case TENSOR_BF16:
+        return "bf16";
+    case TENSOR_F16:
+        return "f16";
+    default:
+        return "f32";
+    }
+}
+
 float random_uniform(float min, float max)
 {
      return min + (float) (rand() / (double) (RAND_MAX) * (max - min));
 }
 
+
+/* Batch size of a bmm operand (1 for a matrix) and its matrix shape */
+uint32_t bmm_dims(const tensor_t* t, uint32_t* rows, uint32_t* cols)
+{
+    if (t->n_dims != 2 && t->n_dims != 3)
+    {
+        printf("[ERROR] tensor_bmm expects tensors of 2 or 3 dims, got %d.\n", t->n_dims);
+        exit(1);
+    }
+
+    *rows = t->shape[t->n_dims - 2];
+    *cols = t->shape[t->n_dims - 1];
+    return t->n_dims == 3 ? t->shape[0] : 1;
+}
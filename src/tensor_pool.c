@@ -1,4 +1,5 @@
 #include "tensor_pool.h"
+#include "memtrack.h"
 #include <stdlib.h>
 
 tensor_pool_t* tensor_pool_init()
@@ -17,6 +18,8 @@ void tensor_pool_add(tensor_pool_t* pool, const tensor_t* t)
         pool->ts = (tensor_t**)realloc(pool->ts, sizeof(tensor_t*) * pool->capacity * 2);
         pool->capacity = pool->capacity * 2;
     }
+    if (t->mem_site)
+        memtrack_pool(1, t->mem_bytes);
     pool->ts[pool->len] = (tensor_t*)t;
     pool->len += 1;
 }
@@ -24,7 +27,11 @@ void tensor_pool_add(tensor_pool_t* pool, const tensor_t* t)
 void tensor_pool_empty(tensor_pool_t* pool)
 {
     for (int i = 0; i < pool->len; i++)
+    {
+        if (pool->ts[i]->mem_site)
+            memtrack_pool(-1, -(int64_t)pool->ts[i]->mem_bytes);
         tensor_clean(pool->ts[i]);
+    }
     pool->len = 0;
 }
 
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+
+#include "topology.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#define ONLINE_PATH "/sys/devices/system/node/online"
+#define NODE_PATH "/sys/devices/system/node/node%d/cpulist"
+#define MAX_NODES 64
+#define SAMPLE_PAGES 1024
+
+/* Utility functions */
+static int parse_cpulist(const char* fname, int* cpus, int max_cpus);
+static int pin_to(const int* cpus, int n_cpus);
+
+topo_t* topo_read()
+{
+    topo_t* topo = (topo_t*)malloc(sizeof(topo_t));
+    char fname[128];
+    int online[MAX_NODES];
+    int* cpus;
+    int n, n_online;
+
+    topo->n_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    topo->node_ids = (int*)malloc(sizeof(int) * MAX_NODES);
+    topo->node_of_cpu = (int*)malloc(sizeof(int) * topo->n_cpus);
+    topo->n_node_cpus = (int*)malloc(sizeof(int) * MAX_NODES);
+    topo->node_cpus = (int**)malloc(sizeof(int*) * MAX_NODES);
+    topo->n_nodes = 0;
+
+    for (int i = 0; i < topo->n_cpus; i++)
+        topo->node_of_cpu[i] = 0;
+
+    /* Node ids need not be contiguous (offlined or hot-plugged nodes), the
+     * online list has the same format as a cpulist */
+    n_online = parse_cpulist(ONLINE_PATH, online, MAX_NODES);
+    for (int i = 0; i < n_online; i++)
+    {
+        sprintf(fname, NODE_PATH, online[i]);
+        cpus = (int*)malloc(sizeof(int) * topo->n_cpus);
+        n = parse_cpulist(fname, cpus, topo->n_cpus);
+        if (n < 0)
+        {
+            free(cpus);
+            continue;
+        }
+
+        for (int k = 0; k < n; k++)
+            topo->node_of_cpu[cpus[k]] = topo->n_nodes;
+
+        topo->node_ids[topo->n_nodes] = online[i];
+        topo->node_cpus[topo->n_nodes] = cpus;
+        topo->n_node_cpus[topo->n_nodes] = n;
+        topo->n_nodes++;
+    }
+
+    if (topo->n_nodes == 0)
+    {
+        topo->node_ids[0] = 0;
+        topo->node_cpus[0] = (int*)malloc(sizeof(int) * topo->n_cpus);
+        for (int i = 0; i < topo->n_cpus; i++)
+            topo->node_cpus[0][i] = i;
+        topo->n_node_cpus[0] = topo->n_cpus;
+        topo->n_nodes = 1;
+    }
+
+    return topo;
+}
+
+void topo_clean(topo_t* topo)
+{
+    for (int i = 0; i < topo->n_nodes; i++)
+        free(topo->node_cpus[i]);
+    free(topo->node_cpus);
+    free(topo->node_ids);
+    free(topo->n_node_cpus);
+    free(topo->node_of_cpu);
+    free(topo);
+}
+
+int topo_pin_worker(const topo_t* topo, int worker)
+{
+    int node = worker % topo->n_nodes;
+    int n = topo->n_node_cpus[node];
+
+    /* Memoryless nodes have no CPUs to pin to */
+    if (n == 0)
+        return -1;
+
+    if (pin_to(&topo->node_cpus[node][(worker / topo->n_nodes) % n], 1) != 0)
+        return -1;
+    return node;
+}
+
+int topo_pin_node(const topo_t* topo, int node)
+{
+    if (topo->n_node_cpus[node] == 0 || pin_to(topo->node_cpus[node], topo->n_node_cpus[node]) != 0)
+        return -1;
+    return node;
+}
+
+int topo_current_node(const topo_t* topo)
+{
+    int cpu = sched_getcpu();
+
+    if (cpu < 0 || cpu >= topo->n_cpus)
+        return 0;
+    return topo->node_of_cpu[cpu];
+}
+
+void topo_sample(const topo_t* topo, const void* addr, size_t bytes, int node, long* remote,
+        long* pages)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr / page_size * page_size;
+    uintptr_t end = (uintptr_t)addr + bytes;
+    void* query[SAMPLE_PAGES];
+    int status[SAMPLE_PAGES];
+    int n;
+
+    /* move_pages without target nodes only reports where every page lives */
+    while (start < end)
+    {
+        for (n = 0; n < SAMPLE_PAGES && start < end; n++, start += page_size)
+            query[n] = (void*)start;
+
+        if (syscall(SYS_move_pages, 0, n, query, NULL, status, 0) != 0)
+            return;
+
+        for (int i = 0; i < n; i++)
+        {
+            if (status[i] < 0)
+                continue;
+            *pages += 1;
+            *remote += status[i] != topo->node_ids[node];
+        }
+    }
+}
+
+int parse_cpulist(const char* fname, int* cpus, int max_cpus)
+{
+    FILE* f = fopen(fname, "r");
+    int n = 0, first, last;
+    char sep;
+
+    if (f == NULL)
+        return -1;
+
+    while (fscanf(f, "%d", &first) == 1)
+    {
+        last = first;
+        sep = fgetc(f);
+        if (sep == '-')
+        {
+            if (fscanf(f, "%d", &last) != 1)
+                break;
+            sep = fgetc(f);
+        }
+
+        for (int cpu = first; cpu <= last && cpu < max_cpus; cpu++)
+            cpus[n++] = cpu;
+
+        if (sep != ',')
+            break;
+    }
+
+    fclose(f);
+    return n;
+}
+
+int pin_to(const int* cpus, int n_cpus)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    for (int i = 0; i < n_cpus; i++)
+        CPU_SET(cpus[i], &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+}
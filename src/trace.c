@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "perfctr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_MAX_DIMS 4
+
+typedef struct
+{
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    uint64_t bytes;
+    uint8_t n_dims[3];      /* in1, in2, out, 0 when absent */
+    uint32_t shapes[3][TRACE_MAX_DIMS];
+} trace_event_t;
+
+/* Ring of one thread, only written by it. head counts every event ever
+ * recorded and is published after the event is written. */
+typedef struct trace_ring
+{
+    uint32_t tid;
+    uint64_t head;
+    trace_event_t* events;
+    struct trace_ring* next;
+} trace_ring_t;
+
+uint8_t trace_enabled = 0;
+
+static __thread trace_ring_t* local_ring = NULL;
+static trace_ring_t* rings = NULL;
+static uint32_t next_tid = 1;
+static uint64_t epoch = 0;
+
+/* Utility functions */
+static trace_ring_t* ring_register();
+static uint64_t tensor_bytes(const tensor_t* t);
+static uint64_t tensor_elements(const tensor_t* t);
+static void event_shape(trace_event_t* e, int slot, const tensor_t* t);
+static void json_shape(FILE* f, const trace_event_t* e, int slot);
+
+void trace_enable()
+{
+    if (epoch == 0)
+        epoch = trace_now();
+    __atomic_or_fetch(&trace_enabled, TRACE_EVENTS, __ATOMIC_RELEASE);
+}
+
+void trace_disable()
+{
+    __atomic_and_fetch(&trace_enabled, ~TRACE_EVENTS, __ATOMIC_RELEASE);
+}
+
+uint64_t trace_export(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    trace_ring_t* ring;
+    const trace_event_t* e;
+    uint64_t head, first, n_events = 0;
+    long pid = getpid();
+
+    if (f == NULL)
+    {
+        printf("[ERROR] Cannot write trace %s\n", path);
+        return 0;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        first = head > TRACE_RING_LEN ? head - TRACE_RING_LEN : 0;
+        for (uint64_t i = first; i < head; i++)
+        {
+            e = &ring->events[i % TRACE_RING_LEN];
+            fprintf(f, "%s\n{\"name\": \"%s\", \"cat\": \"op\", \"ph\": \"X\", \"pid\": %ld, "
+                    "\"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+                    n_events > 0 ? "," : "", e->name, pid, ring->tid, (e->start - epoch) * 1e-3,
+                    (e->end - e->start) * 1e-3);
+            fprintf(f, "\"in\": [");
+            json_shape(f, e, 0);
+            if (e->n_dims[0] > 0 && e->n_dims[1] > 0)
+                fprintf(f, ", ");
+            json_shape(f, e, 1);
+            fprintf(f, "], \"out\": ");
+            if (e->n_dims[2] > 0)
+                json_shape(f, e, 2);
+            else
+                fprintf(f, "null");
+            fprintf(f, ", \"bytes\": %lu}}", (unsigned long)e->bytes);
+            n_events++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return n_events;
+}
+
+uint64_t trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t trace_begin()
+{
+    uint64_t start = trace_now();
+
+    if (trace_enabled & TRACE_COUNTERS)
+        perfctr_push(start);
+    return start;
+}
+
+void trace_record(const char* name, uint64_t start, const tensor_t* in1, const tensor_t* in2,
+        const tensor_t* out, uint64_t bytes)
+{
+    uint64_t end = trace_now();
+    trace_ring_t* ring;
+    trace_event_t* e;
+
+    if (trace_enabled & TRACE_COUNTERS)
+        perfctr_pop(name, start, out != NULL ? tensor_elements(out) :
+                in1 != NULL ? tensor_elements(in1) : bytes / sizeof(float));
+    if (!(trace_enabled & TRACE_EVENTS))
+        return;
+
+    ring = local_ring != NULL ? local_ring : ring_register();
+    e = &ring->events[ring->head % TRACE_RING_LEN];
+    e->name = name;
+    e->start = start;
+    e->end = end;
+    e->bytes = bytes + tensor_bytes(in1) + tensor_bytes(in2) + tensor_bytes(out);
+    event_shape(e, 0, in1);
+    event_shape(e, 1, in2);
+    event_shape(e, 2, out);
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Pushes the ring of the calling thread on the list, rings live as long as
+ * the process */
+trace_ring_t* ring_register()
+{
+    trace_ring_t* ring = (trace_ring_t*)calloc(1, sizeof(trace_ring_t));
+
+    ring->events = (trace_event_t*)malloc(sizeof(trace_event_t) * TRACE_RING_LEN);
+    ring->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE,
+                __ATOMIC_RELAXED))
+        ;
+    local_ring = ring;
+    return ring;
+}
+
+uint64_t tensor_bytes(const tensor_t* t)
+{
+    if (t == NULL)
+        return 0;
+    return tensor_elements(t) * (t->dtype == TENSOR_F32 ? sizeof(float) : sizeof(uint16_t));
+}
+
+uint64_t tensor_elements(const tensor_t* t)
+{
+    uint64_t nels = 1;
+
+    for (uint32_t i = 0; i < t->n_dims; i++)
+        nels *= t->shape[i];
+    return nels;
+}
+
+void event_shape(trace_event_t* e, int slot, const tensor_t* t)
+{
+    /* Scalars keep one dim of 1 so they are not taken for absent */
+    e->n_dims[slot] = t == NULL ? 0 : t->n_dims == 0 ? 1 : t->n_dims;
+    for (uint32_t i = 0; i < e->n_dims[slot] && i < TRACE_MAX_DIMS; i++)
+        e->shapes[slot][i] = t->n_dims == 0 ? 1 : t->shape[i];
+}
+
+void json_shape(FILE* f, const trace_event_t* e, int slot)
+{
+    if (e->n_dims[slot] == 0)
+        return;
+    fprintf(f, "[");
+    for (uint32_t i = 0; i < e->n_dims[slot] && i < TRACE_MAX_DIMS; i++)
+        fprintf(f, "%s%u", i > 0 ? ", " : "", e->shapes[slot][i]);
+    fprintf(f, "]");
+}
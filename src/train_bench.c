@@ -0,0 +1,411 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "train_bench.h"
+#include "model.h"
+#include "nn.h"
+#include "memtrack.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define PHASE_COUNTERS(c) do { if (perfctr_available) perfctr_read(c); } while (0)
+
+typedef struct
+{
+    const train_bench_config_t* cfg;
+    int index;
+    model_t* model;
+    mnist_t* ds;
+    const mnist_example_t* eval;
+    pthread_barrier_t* start;
+
+    double* samples;        /* [steps][PHASE_COUNT] seconds */
+    double seconds;
+    double time_to_target;
+    uint64_t allocs;        /* Of the timed steps, counted with one replica */
+    uint64_t alloc_bytes;
+    uint64_t counters[PHASE_COUNT][PERFCTR_COUNT];
+    float final_loss;
+    float final_acc;
+} replica_t;
+
+/* Utility functions */
+static void* replica_loop(void* arg);
+static void phase_stats(const double* samples, int n, int stride, int phase, train_bench_phase_t* res);
+static void phase_json(const char* name, const train_bench_phase_t* p, FILE* f, const char* sep);
+static void counters_print(const train_bench_result_t* res, const char** names);
+static void counters_json(const train_bench_result_t* res, const char** names, FILE* f);
+static int cmp_double(const void* a, const void* b);
+static double now_seconds();
+
+train_bench_result_t train_bench_run(const train_bench_config_t* cfg, mnist_t* ds, mnist_t* test_ds)
+{
+    int n = cfg->n_threads > 0 ? cfg->n_threads : 1;
+    replica_t* replicas;
+    pthread_t* tids;
+    double* samples;
+    mnist_images_t eval_images = *test_ds->images;
+    mnist_labels_t eval_labels = *test_ds->labels;
+    mnist_t eval_ds = {&eval_images, &eval_labels};
+    mnist_example_t* eval;
+    pthread_barrier_t start;
+    train_bench_result_t res;
+    struct rusage usage;
+    memtrack_stats_t mem_start, mem_end;
+
+    if (cfg->steps < 1)
+    {
+        printf("[ERROR] The benchmark needs at least one step, got %d\n", cfg->steps);
+        exit(1);
+    }
+    replicas = (replica_t*)calloc(n, sizeof(replica_t));
+    tids = (pthread_t*)malloc(sizeof(pthread_t) * n);
+    samples = (double*)malloc(sizeof(double) * n * cfg->steps * PHASE_COUNT);
+
+    memset(&res, 0, sizeof(res));
+    res.cfg = *cfg;
+    res.cfg.n_threads = n;
+
+    /* The first test images, converted once */
+    if (eval_images.n_images > TRAIN_BENCH_EVAL)
+        eval_images.n_images = eval_labels.n_items = TRAIN_BENCH_EVAL;
+    eval = mnist_as_tensor(&eval_ds, 1);
+
+    /* Every model is built from the seed before any thread runs, param_init
+     * uses rand() */
+    srand(cfg->seed);
+    pthread_barrier_init(&start, NULL, n);
+    for (int r = 0; r < n; r++)
+    {
+        replicas[r].cfg = cfg;
+        replicas[r].index = r;
+        replicas[r].model = model_parse(cfg->model_config, cfg->batch_size);
+        replicas[r].ds = ds;
+        replicas[r].eval = eval;
+        replicas[r].start = &start;
+        replicas[r].samples = &samples[(size_t)r * cfg->steps * PHASE_COUNT];
+    }
+
+    memtrack_stats(&mem_start);
+    for (int r = 1; r < n; r++)
+        pthread_create(&tids[r], NULL, replica_loop, &replicas[r]);
+    replica_loop(&replicas[0]);
+    for (int r = 1; r < n; r++)
+        pthread_join(tids[r], NULL);
+    memtrack_stats(&mem_end);
+
+    for (int r = 0; r < n; r++)
+    {
+        if (replicas[r].seconds > res.seconds)
+            res.seconds = replicas[r].seconds;
+        res.images_per_sec += (double)cfg->steps * cfg->batch_size / replicas[r].seconds;
+    }
+    for (int p = 0; p < PHASE_COUNT; p++)
+        phase_stats(samples, n * cfg->steps, PHASE_COUNT, p, &res.phases[p]);
+    phase_stats(samples, n * cfg->steps, PHASE_COUNT, -1, &res.step);
+    res.time_to_target = replicas[0].time_to_target;
+    res.final_loss = replicas[0].final_loss;
+    res.final_acc = replicas[0].final_acc;
+    for (int r = 0; r < n; r++)
+        for (int p = 0; p < PHASE_COUNT; p++)
+            for (int k = 0; k < PERFCTR_COUNT; k++)
+                res.counters[p][k] += replicas[r].counters[p][k];
+
+    /* Linux reports it in KB */
+    getrusage(RUSAGE_SELF, &usage);
+    res.peak_rss_kb = usage.ru_maxrss;
+
+    /* Several replicas are only counted together, evaluations included */
+    if (memtrack_enabled)
+    {
+        if (n == 1)
+        {
+            res.allocs_per_step = (double)replicas[0].allocs / cfg->steps;
+            res.alloc_bytes_per_step = (double)replicas[0].alloc_bytes / cfg->steps;
+        }
+        else
+        {
+            res.allocs_per_step = (double)(mem_end.allocs - mem_start.allocs) / (n * cfg->steps);
+            res.alloc_bytes_per_step = (double)(mem_end.total_bytes - mem_start.total_bytes) /
+                (n * cfg->steps);
+        }
+        res.peak_tensor_bytes = mem_end.peak_bytes;
+    }
+
+    for (int r = 0; r < n; r++)
+        model_clean(replicas[r].model);
+    pthread_barrier_destroy(&start);
+    mnist_example_clean(eval);
+    free(replicas);
+    free(tids);
+    free(samples);
+    return res;
+}
+
+static const char* phase_names[] = {"data", "forward", "backward", "update"};
+
+void train_bench_print(const train_bench_result_t* res)
+{
+    const char** names = phase_names;
+    const train_bench_phase_t* p;
+
+    printf("%d steps of %d images x %d threads in %.2f s: %.0f images/s, peak RSS %.1f MB\n",
+            res->cfg.steps, res->cfg.batch_size, res->cfg.n_threads, res->seconds,
+            res->images_per_sec, res->peak_rss_kb / 1024.0);
+    printf("%-10s %10s %10s %10s %10s %10s\n", "phase", "mean us", "p50 us", "p90 us", "p99 us",
+            "max us");
+    for (int i = 0; i <= PHASE_COUNT; i++)
+    {
+        p = i < PHASE_COUNT ? &res->phases[i] : &res->step;
+        printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n", i < PHASE_COUNT ? names[i] : "step",
+                p->mean_us, p->p50_us, p->p90_us, p->p99_us, p->max_us);
+    }
+    if (res->peak_tensor_bytes > 0)
+        printf("Tensors: %.1f allocations (%.1f KB) per step, peak %.1f MB live\n",
+                res->allocs_per_step, res->alloc_bytes_per_step / 1024.0,
+                res->peak_tensor_bytes / 1048576.0);
+    /* Only the software clock is not worth a table */
+    if (perfctr_available & ~(1u << PERFCTR_TASK_CLOCK))
+        counters_print(res, names);
+    printf("Loss: %.5f  eval accuracy: %.4f", res->final_loss, res->final_acc);
+    if (res->cfg.target_acc > 0)
+    {
+        if (res->time_to_target >= 0)
+            printf("  %.3f reached after %.2f s", res->cfg.target_acc, res->time_to_target);
+        else
+            printf("  %.3f not reached", res->cfg.target_acc);
+    }
+    printf("\n");
+}
+
+void train_bench_json(const train_bench_result_t* res, FILE* f)
+{
+    const train_bench_config_t* c = &res->cfg;
+
+    fprintf(f, "{\n  \"model\": ");
+    train_bench_json_string(c->model_config, f);
+    fprintf(f, ",\n  \"batch_size\": %d,\n  \"steps\": %d,\n  \"threads\": %d,\n"
+            "  \"seed\": %u,\n  \"lr\": %g,\n", c->batch_size, c->steps, c->n_threads, c->seed,
+            c->lr);
+    fprintf(f, "  \"seconds\": %.4f,\n  \"images_per_sec\": %.1f,\n  \"peak_rss_kb\": %ld,\n",
+            res->seconds, res->images_per_sec, res->peak_rss_kb);
+    fprintf(f, "  \"allocs_per_step\": %.2f,\n  \"alloc_bytes_per_step\": %.1f,\n"
+            "  \"peak_tensor_bytes\": %ld,\n", res->allocs_per_step, res->alloc_bytes_per_step,
+            (long)res->peak_tensor_bytes);
+    fprintf(f, "  \"target_acc\": %g,\n  \"time_to_target\": %.4f,\n  \"final_loss\": %.6f,\n"
+            "  \"final_acc\": %.4f,\n", c->target_acc, res->time_to_target, res->final_loss,
+            res->final_acc);
+    fprintf(f, "  \"phases\": {\n");
+    phase_json("data", &res->phases[PHASE_DATA], f, ",");
+    phase_json("forward", &res->phases[PHASE_FORWARD], f, ",");
+    phase_json("backward", &res->phases[PHASE_BACKWARD], f, ",");
+    phase_json("update", &res->phases[PHASE_UPDATE], f, ",");
+    phase_json("step", &res->step, f, "");
+    fprintf(f, "  }%s\n", perfctr_available ? "," : "");
+    if (perfctr_available)
+        counters_json(res, phase_names, f);
+    fprintf(f, "}\n");
+}
+
+/* Configs read by model_from_file span several lines and may hold quotes */
+void train_bench_json_string(const char* str, FILE* f)
+{
+    fputc('"', f);
+    for (const char* c = str; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(f, "\\%c", *c);
+        else if (*c == '\n')
+            fprintf(f, "\\n");
+        else if (*c == '\t')
+            fprintf(f, "\\t");
+        else if ((unsigned char)*c < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char)*c);
+        else
+            fputc(*c, f);
+    }
+    fputc('"', f);
+}
+
+void* replica_loop(void* arg)
+{
+    replica_t* r = (replica_t*)arg;
+    const train_bench_config_t* cfg = r->cfg;
+    unsigned int seed = cfg->seed + r->index;
+    mnist_example_t* batch;
+    double t[PHASE_COUNT + 1], *s;
+    uint64_t c[PHASE_COUNT + 1][PERFCTR_COUNT];
+    float loss_sum = 0;
+    int count_mem = memtrack_enabled && cfg->n_threads <= 1;
+    memtrack_step_t mem;
+
+    r->time_to_target = -1;
+    pthread_barrier_wait(r->start);
+    for (int step = 0; step < cfg->steps; step++)
+    {
+        if (count_mem)
+            memtrack_step_begin();
+        t[0] = now_seconds();
+        PHASE_COUNTERS(c[0]);
+        batch = mnist_batch_r(r->ds, cfg->batch_size, 1, &seed);
+        PHASE_COUNTERS(c[1]);
+        t[1] = now_seconds();
+        loss_sum += model_forward_loss(r->model, batch->image, batch->label);
+        PHASE_COUNTERS(c[2]);
+        t[2] = now_seconds();
+        model_backward(r->model, batch->image, batch->label);
+        PHASE_COUNTERS(c[3]);
+        t[3] = now_seconds();
+        model_update(r->model, cfg->lr);
+        PHASE_COUNTERS(c[4]);
+        t[4] = now_seconds();
+        mnist_example_clean(batch);
+        if (count_mem)
+        {
+            mem = memtrack_step_end();
+            r->allocs += mem.allocs;
+            r->alloc_bytes += mem.bytes;
+        }
+
+        s = &r->samples[step * PHASE_COUNT];
+        for (int p = 0; p < PHASE_COUNT; p++)
+            s[p] = t[p + 1] - t[p];
+        if (perfctr_available)
+            for (int p = 0; p < PHASE_COUNT; p++)
+                for (int k = 0; k < PERFCTR_COUNT; k++)
+                    if (c[p + 1][k] > c[p][k])
+                        r->counters[p][k] += c[p + 1][k] - c[p][k];
+        r->seconds += now_seconds() - t[0];
+
+        /* Off the clock, the next step starts after it */
+        if (r->index == 0 && cfg->eval_every > 0 &&
+                ((step + 1) % cfg->eval_every == 0 || step + 1 == cfg->steps))
+        {
+            r->final_acc = model_accuracy(r->model, r->eval->image, r->eval->label);
+            r->final_loss = loss_sum / (step % cfg->eval_every + 1);
+            loss_sum = 0;
+            if (cfg->target_acc > 0 && r->time_to_target < 0 && r->final_acc >= cfg->target_acc)
+                r->time_to_target = r->seconds;
+        }
+    }
+    return NULL;
+}
+
+/* Stats of one phase, or of whole steps when phase is -1 */
+void phase_stats(const double* samples, int n, int stride, int phase, train_bench_phase_t* res)
+{
+    double* us = (double*)malloc(sizeof(double) * n);
+    double sum = 0;
+    int bucket;
+
+    memset(res, 0, sizeof(*res));
+    for (int i = 0; i < n; i++)
+    {
+        us[i] = 0;
+        for (int p = 0; p < stride; p++)
+            if (phase < 0 || p == phase)
+                us[i] += samples[i * stride + p] * 1e6;
+        sum += us[i];
+
+        for (bucket = 0; bucket < TRAIN_BENCH_BUCKETS - 1 && us[i] >= (double)(1u << bucket); bucket++)
+            ;
+        res->buckets[bucket]++;
+    }
+
+    qsort(us, n, sizeof(double), cmp_double);
+    res->mean_us = sum / n;
+    res->p50_us = us[n / 2];
+    res->p90_us = us[(int)(n * 0.9)];
+    res->p99_us = us[(int)(n * 0.99)];
+    res->max_us = us[n - 1];
+    free(us);
+}
+
+/* Buckets as [upper bound us, count], leaving out the empty ones */
+void phase_json(const char* name, const train_bench_phase_t* p, FILE* f, const char* sep)
+{
+    int first = 1;
+
+    fprintf(f, "    \"%s\": {\"mean_us\": %.2f, \"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, "
+            "\"max_us\": %.2f, \"histogram\": [", name, p->mean_us, p->p50_us, p->p90_us, p->p99_us,
+            p->max_us);
+    for (int i = 0; i < TRAIN_BENCH_BUCKETS; i++)
+    {
+        if (p->buckets[i] == 0)
+            continue;
+        fprintf(f, "%s[%u, %lu]", first ? "" : ", ", 1u << i, (unsigned long)p->buckets[i]);
+        first = 0;
+    }
+    fprintf(f, "]}%s\n", sep);
+}
+
+/* IPC and counts per image of every phase */
+void counters_print(const train_bench_result_t* res, const char** names)
+{
+    double images = (double)res->cfg.n_threads * res->cfg.steps * res->cfg.batch_size;
+    const uint64_t* c;
+
+    printf("%-10s %6s", "phase", "IPC");
+    for (int k = PERFCTR_CYCLES; k < PERFCTR_COUNT; k++)
+        if (k != PERFCTR_INSTRUCTIONS)
+            printf(" %13s", perfctr_name(k));
+    printf("  per image\n");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        c = res->counters[p];
+        printf("%-10s", names[p]);
+        if (c[PERFCTR_CYCLES] > 0)
+            printf(" %6.2f", (double)c[PERFCTR_INSTRUCTIONS] / c[PERFCTR_CYCLES]);
+        else
+            printf(" %6s", "n/a");
+        for (int k = PERFCTR_CYCLES; k < PERFCTR_COUNT; k++)
+        {
+            if (k == PERFCTR_INSTRUCTIONS)
+                continue;
+            if (perfctr_available & (1u << k))
+                printf(" %13.1f", c[k] / images);
+            else
+                printf(" %13s", "n/a");
+        }
+        printf("\n");
+    }
+}
+
+/* Totals of the counters available, by phase */
+void counters_json(const train_bench_result_t* res, const char** names, FILE* f)
+{
+    int first;
+
+    fprintf(f, "  \"counters\": {\n");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        fprintf(f, "    \"%s\": {", names[p]);
+        first = 1;
+        for (int k = 0; k < PERFCTR_COUNT; k++)
+        {
+            if (!(perfctr_available & (1u << k)))
+                continue;
+            fprintf(f, "%s\"%s\": %lu", first ? "" : ", ", perfctr_name(k),
+                    (unsigned long)res->counters[p][k]);
+            first = 0;
+        }
+        fprintf(f, "}%s\n", p + 1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(f, "  }\n");
+}
+
+int cmp_double(const void* a, const void* b)
+{
+    double d1 = *(const double*)a, d2 = *(const double*)b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Writes to stdout a C file with a dense kernel (GEMM, bias and optional
+ * relu) specialized for the shape of every dense layer of a model config
+ * (see model.h), and the table kernels.c dispatches from.
+ *
+ * Usage: gen_kernels "input:784 dense:128 relu dense:10 softmax_ce"
+ *
+ * Loop bounds are constants. Outputs up to UNROLL_MAX wide are fully
+ * unrolled into scalar accumulators. Wider ones are computed in blocks of
+ * BLOCK_WIDTHS columns held in vector registers over the whole K loop; the
+ * block divides the output so there is no remainder to handle. Every kernel
+ * comes as a baseline and an AVX2 / FMA build of the same code.
+ */
+
+#define CONFIG_DELIMITERS " ,\t\r\n"
+#define UNROLL_MAX 16
+#define MAX_KERNELS 64
+#define VEC_WIDTH 8
+
+static const unsigned int BLOCK_WIDTHS[] = {32, 16, 8};
+
+typedef struct
+{
+    unsigned int K;
+    unsigned int N;
+} shape_t;
+
+/* Utility functions */
+static void emit_unrolled(unsigned int K, unsigned int N);
+static void emit_blocked(unsigned int K, unsigned int N, unsigned int block);
+static void emit_plain(unsigned int K, unsigned int N);
+static void emit_body_head(unsigned int K, unsigned int N);
+static void emit_variants(unsigned int K, unsigned int N);
+
+int main(int argc, char** argv)
+{
+    shape_t shapes[MAX_KERNELS];
+    unsigned int n_shapes = 0, width = 0, n, seen, block;
+    char* tok;
+
+    if (argc != 2)
+    {
+        printf("[ERROR] Usage: %s MODEL_CONFIG\n", argv[0]);
+        return 1;
+    }
+
+    for (tok = strtok(argv[1], CONFIG_DELIMITERS); tok != NULL; tok = strtok(NULL, CONFIG_DELIMITERS))
+    {
+        if (sscanf(tok, "input:%u", &n) == 1)
+            width = n;
+        else if (sscanf(tok, "dense:%u", &n) == 1 && width > 0)
+        {
+            seen = 0;
+            for (unsigned int s = 0; s < n_shapes; s++)
+                seen |= shapes[s].K == width && shapes[s].N == n;
+            if (!seen && n_shapes < MAX_KERNELS)
+            {
+                shapes[n_shapes].K = width;
+                shapes[n_shapes++].N = n;
+            }
+            width = n;
+        }
+    }
+
+    printf("/* Generated by gen_kernels, do not edit */\n\n");
+    printf("#include <string.h>\n\n");
+    printf("#include \"kernels.h\"\n\n");
+    printf("typedef float vf_t __attribute__((vector_size(%u)));\n", VEC_WIDTH * 4);
+    printf("typedef int32_t vi_t __attribute__((vector_size(%u)));\n\n", VEC_WIDTH * 4);
+
+    for (unsigned int s = 0; s < n_shapes; s++)
+    {
+        block = 0;
+        for (unsigned int i = 0; block == 0 && i < sizeof(BLOCK_WIDTHS) / sizeof(BLOCK_WIDTHS[0]); i++)
+            if (shapes[s].N % BLOCK_WIDTHS[i] == 0)
+                block = BLOCK_WIDTHS[i];
+
+        if (shapes[s].N <= UNROLL_MAX)
+            emit_unrolled(shapes[s].K, shapes[s].N);
+        else if (block > 0)
+            emit_blocked(shapes[s].K, shapes[s].N, block);
+        else
+            emit_plain(shapes[s].K, shapes[s].N);
+        emit_variants(shapes[s].K, shapes[s].N);
+    }
+
+    printf("const kernel_entry_t KERNELS_GEN[] = {\n");
+    for (unsigned int s = 0; s < n_shapes; s++)
+        printf("    {%u, %u, dense_%u_%u, dense_%u_%u_avx2},\n", shapes[s].K, shapes[s].N,
+                shapes[s].K, shapes[s].N, shapes[s].K, shapes[s].N);
+    /* Keeps the array non empty when the config has no dense layer */
+    printf("    {0, 0, 0, 0}\n};\n\n");
+    printf("const uint32_t KERNELS_GEN_LEN = %u;\n", n_shapes);
+    return 0;
+}
+
+void emit_unrolled(unsigned int K, unsigned int N)
+{
+    emit_body_head(K, N);
+    for (unsigned int j = 0; j < N; j++)
+        printf("        float a%u = b[%u];\n", j, j);
+    printf("\n        for (uint32_t k = 0; k < %u; k++)\n        {\n", K);
+    printf("            const float xk = xm[k];\n");
+    printf("            const float* w = &W[k * %u];\n\n", N);
+    printf("            if (xk == 0.0f)\n                continue;\n");
+    for (unsigned int j = 0; j < N; j++)
+        printf("            a%u += xk * w[%u];\n", j, j);
+    printf("        }\n\n");
+    for (unsigned int j = 0; j < N; j++)
+        printf("        om[%u] = relu && a%u < 0 ? 0 : a%u;\n", j, j, j);
+    printf("    }\n}\n\n");
+}
+
+void emit_blocked(unsigned int K, unsigned int N, unsigned int block)
+{
+    unsigned int n_vecs = block / VEC_WIDTH;
+
+    emit_body_head(K, N);
+    printf("        for (uint32_t n0 = 0; n0 < %u; n0 += %u)\n        {\n", N, block);
+    printf("            vf_t wv");
+    for (unsigned int v = 0; v < n_vecs; v++)
+        printf(", acc%u", v);
+    printf(";\n\n");
+    for (unsigned int v = 0; v < n_vecs; v++)
+        printf("            memcpy(&acc%u, &b[n0 + %u], sizeof(vf_t));\n", v, v * VEC_WIDTH);
+    printf("\n            for (uint32_t k = 0; k < %u; k++)\n            {\n", K);
+    printf("                const float xk = xm[k];\n");
+    printf("                const float* w = &W[k * %u + n0];\n\n", N);
+    printf("                if (xk == 0.0f)\n                    continue;\n");
+    for (unsigned int v = 0; v < n_vecs; v++)
+    {
+        printf("                memcpy(&wv, &w[%u], sizeof(vf_t));\n", v * VEC_WIDTH);
+        printf("                acc%u += xk * wv;\n", v);
+    }
+    printf("            }\n\n");
+    printf("            if (relu)\n            {\n");
+    for (unsigned int v = 0; v < n_vecs; v++)
+        printf("                acc%u = (vf_t)((vi_t)acc%u & (acc%u > 0));\n", v, v, v);
+    printf("            }\n");
+    for (unsigned int v = 0; v < n_vecs; v++)
+        printf("            memcpy(&om[n0 + %u], &acc%u, sizeof(vf_t));\n", v * VEC_WIDTH, v);
+    printf("        }\n    }\n}\n\n");
+}
+
+/* Wide outputs with no block width dividing them */
+void emit_plain(unsigned int K, unsigned int N)
+{
+    emit_body_head(K, N);
+    printf("        for (uint32_t n = 0; n < %u; n++)\n", N);
+    printf("            om[n] = b[n];\n");
+    printf("        for (uint32_t k = 0; k < %u; k++)\n", K);
+    printf("            if (xm[k] != 0.0f)\n");
+    printf("                for (uint32_t n = 0; n < %u; n++)\n", N);
+    printf("                    om[n] += xm[k] * W[k * %u + n];\n", N);
+    printf("        for (uint32_t n = 0; n < %u; n++)\n", N);
+    printf("            om[n] = relu && om[n] < 0 ? 0 : om[n];\n");
+    printf("    }\n}\n\n");
+}
+
+/* Signature and row loop shared by every body */
+void emit_body_head(unsigned int K, unsigned int N)
+{
+    printf("static inline __attribute__((always_inline)) void dense_%u_%u_body(const float* restrict x,\n", K, N);
+    printf("        const float* restrict W, const float* restrict b, float* restrict out, uint32_t M, int relu)\n{\n");
+    printf("    for (uint32_t m = 0; m < M; m++)\n    {\n");
+    printf("        const float* xm = &x[m * %u];\n", K);
+    printf("        float* om = &out[m * %u];\n\n", N);
+}
+
+/* Baseline and AVX2 / FMA builds of the same body */
+void emit_variants(unsigned int K, unsigned int N)
+{
+    const char* args = "(const float* restrict x, const float* restrict W,\n"
+        "        const float* restrict b, float* restrict out, uint32_t M, int relu)\n{\n";
+
+    printf("static void dense_%u_%u%s", K, N, args);
+    printf("    dense_%u_%u_body(x, W, b, out, M, relu);\n}\n\n", K, N);
+    printf("__attribute__((target(\"avx2,fma\")))\n");
+    printf("static void dense_%u_%u_avx2%s", K, N, args);
+    printf("    dense_%u_%u_body(x, W, b, out, M, relu);\n}\n\n", K, N);
+}
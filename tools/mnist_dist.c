@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "nn.h"
+#include "mlp.h"
+#include "comm.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+#define TEST_IMAGES "data/t10k-images-idx3-ubyte"
+#define TEST_LABELS "data/t10k-labels-idx1-ubyte"
+
+/* Multi-process data parallel training over shared memory.
+ *
+ * Usage:
+ *   mnist_dist --procs N [options]            forks N ranks on this host
+ *   mnist_dist --rank R --world N [options]   runs a single rank, rank 0
+ *                                             creates the segment
+ * Options: --steps N --batch N --lr F --seed N --shm NAME --dtype f32|bf16|f16
+ */
+
+/* One bucket per layer, the last layer goes first since its gradients are
+ * ready first */
+#define N_BUCKETS 2
+
+typedef struct
+{
+    int steps;
+    int batch_size;
+    float lr;
+    unsigned int seed;
+    char shm[64];
+    tensor_dtype_t dtype;
+} dist_opts_t;
+
+static int run_rank(const dist_opts_t* opts, int rank);
+static void share_grads(int layer, const train_res_t* res, void* ctx);
+static void pack(float* dst, const tensor_t* t);
+static uint32_t unpack(tensor_t* t, const float* src, float scale);
+static double now_seconds();
+
+static const uint32_t N_INPUTS = 28 * 28;
+static const uint32_t N_HIDDEN = 128;
+static const uint32_t N_OUTPUTS = 10;
+
+int main(int argc, char** argv)
+{
+    dist_opts_t opts = {250, 256, 0.001, 42, "", TENSOR_F32};
+    int procs = 0, rank = -1, world = 0, status, failed = 0;
+    uint32_t sizes[N_BUCKETS];
+    pid_t pid;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--procs") && i + 1 < argc)
+            procs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rank") && i + 1 < argc)
+            rank = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--world") && i + 1 < argc)
+            world = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            opts.steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            opts.batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--lr") && i + 1 < argc)
+            opts.lr = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            opts.seed = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--shm") && i + 1 < argc)
+            strncpy(opts.shm, argv[++i], sizeof(opts.shm) - 1);
+        else if (!strcmp(argv[i], "--dtype") && i + 1 < argc)
+        {
+            i++;
+            opts.dtype = !strcmp(argv[i], "bf16") ? TENSOR_BF16 :
+                         !strcmp(argv[i], "f16") ? TENSOR_F16 : TENSOR_F32;
+        }
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    sizes[0] = N_HIDDEN * N_OUTPUTS + N_OUTPUTS;
+    sizes[1] = N_INPUTS * N_HIDDEN + N_HIDDEN;
+
+    if (procs > 0)
+    {
+        if (opts.shm[0] == 0)
+            sprintf(opts.shm, "/mnist_dist.%d", (int)getpid());
+
+        if (comm_create(opts.shm, procs, sizes, N_BUCKETS) != 0)
+            return 1;
+
+        for (int r = 0; r < procs; r++)
+        {
+            pid = fork();
+            if (pid == 0)
+                exit(run_rank(&opts, r));
+        }
+
+        for (int r = 0; r < procs; r++)
+        {
+            wait(&status);
+            failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+
+        comm_unlink(opts.shm);
+        return failed;
+    }
+
+    if (rank < 0 || world <= 0)
+    {
+        printf("[ERROR] Either --procs or both --rank and --world are required\n");
+        return 1;
+    }
+
+    if (opts.shm[0] == 0)
+        strcpy(opts.shm, "/mnist_dist");
+
+    if (rank == 0 && comm_create(opts.shm, world, sizes, N_BUCKETS) != 0)
+        return 1;
+
+    status = run_rank(&opts, rank);
+    if (rank == 0)
+        comm_unlink(opts.shm);
+    return status;
+}
+
+int run_rank(const dist_opts_t* opts, int rank)
+{
+    comm_t* comm = comm_open(opts->shm, rank);
+    unsigned int seed = opts->seed + 7919 * (rank + 1);
+    mnist_t* ds, *test_ds;
+    mnist_example_t* batch;
+    train_res_t res;
+    float scale, acc = 0;
+    float* bucket;
+    double start;
+    mlp_t* mlp;
+
+    if (comm == NULL)
+        return 1;
+
+    /* Every rank starts from the same weights */
+    srand(opts->seed);
+    mlp = mlp_init(N_INPUTS, N_HIDDEN, N_OUTPUTS);
+    mlp_set_dtype(mlp, opts->dtype);
+    scale = 1.0 / comm->world;
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (ds == NULL)
+        return 1;
+
+    comm_barrier(comm);
+    start = now_seconds();
+
+    for (int step = 0; step < opts->steps; step++)
+    {
+        batch = mnist_batch_r(ds, opts->batch_size, 1, &seed);
+
+        /* The hook hands every layer to the progress thread as soon as its
+         * gradients exist, so the reduction of the last layer overlaps with
+         * the backward pass of the first one */
+        res = mlp_forward_backward_hook(mlp, batch->image, batch->label, share_grads, comm);
+        acc += nn_accuracy_score(batch->label, res.predictions);
+
+        comm_allreduce_wait(comm, 0);
+        bucket = comm_bucket(comm, 0);
+        bucket += unpack(res.dW2, bucket, scale);
+        unpack(res.db2, bucket, scale);
+
+        comm_allreduce_wait(comm, 1);
+        bucket = comm_bucket(comm, 1);
+        bucket += unpack(res.dW1, bucket, scale);
+        unpack(res.db1, bucket, scale);
+
+        mlp_update(mlp, &res, opts->lr);
+
+        if (rank == 0 && (step + 1) % 20 == 0)
+            printf("[Step %d] loss: %.5f  accuracy: %.5f\n", step, res.loss, acc / (step + 1));
+
+        train_res_clean(&res);
+        mnist_example_clean(batch);
+    }
+
+    if (rank == 0)
+    {
+        printf("%d ranks: %.1f examples/s\n", comm->world,
+                (double)opts->steps * opts->batch_size * comm->world / (now_seconds() - start));
+
+        test_ds = mnist_read(TEST_IMAGES, TEST_LABELS);
+        batch = mnist_as_tensor(test_ds, 1);
+        printf("Test accuracy: %.2f\n", mlp_accuracy(mlp, batch->image, batch->label) * 100);
+        mnist_example_clean(batch);
+        mnist_clean(test_ds);
+    }
+
+    comm_barrier(comm);
+    comm_close(comm);
+    mnist_clean(ds);
+    mlp_clean(mlp);
+    return 0;
+}
+
+void share_grads(int layer, const train_res_t* res, void* ctx)
+{
+    comm_t* comm = (comm_t*)ctx;
+    int bucket = layer == 1 ? 0 : 1;
+    float* dst = comm_bucket_acquire(comm, bucket);
+
+    if (layer == 1)
+    {
+        pack(dst, res->dW2);
+        pack(dst + tensor_numel(res->dW2), res->db2);
+    }
+    else
+    {
+        pack(dst, res->dW1);
+        pack(dst + tensor_numel(res->dW1), res->db1);
+    }
+    comm_allreduce_start(comm, bucket);
+}
+
+void pack(float* dst, const tensor_t* t)
+{
+    memcpy(dst, t->values, sizeof(float) * tensor_numel(t));
+}
+
+uint32_t unpack(tensor_t* t, const float* src, float scale)
+{
+    uint32_t nels = tensor_numel(t);
+    for (int i = 0; i < nels; i++)
+        t->values[i] = src[i] * scale;
+    return nels;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "model.h"
+
+/* Classifies images with a model saved by model_save (or a training
+ * checkpoint), loaded with model_load so the weights are mapped, not read.
+ * Inputs are the images of an IDX file, or raw 28x28 uint8 images on stdin,
+ * and one predicted digit per line goes to stdout. With --bench it reports
+ * latency percentiles and throughput for batches of 1 to 1024 images.
+ *
+ * The input tensor and every activation are allocated once for the largest
+ * batch, each request only converts its pixels and runs the forward pass.
+ *
+ * Usage: mnist_infer MODEL [--images IDX [--labels IDX]] [--bench] [--reps N]
+ */
+
+#define MAX_BATCH 1024
+#define IMAGE_BYTES (28 * 28)
+
+typedef struct
+{
+    model_t* model;
+    tensor_t* x;        /* [MAX_BATCH, IMAGE_BYTES], first dim set per call */
+} infer_t;
+
+static const float* classify(infer_t* inf, const uint8_t* pixels, uint32_t n);
+static void run_stdin(infer_t* inf);
+static void run_bench(infer_t* inf, const uint8_t* pixels, uint32_t n_images, int reps);
+static int cmp_double(const void* a, const void* b);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    const char* model_path = NULL, *images_path = NULL, *labels_path = NULL;
+    int bench = 0, reps = 200;
+    uint32_t n, correct = 0;
+    mnist_images_t* images = NULL;
+    mnist_t* ds = NULL;
+    const float* preds;
+    uint32_t* shape;
+    infer_t inf;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--images") && i + 1 < argc)
+            images_path = argv[++i];
+        else if (!strcmp(argv[i], "--labels") && i + 1 < argc)
+            labels_path = argv[++i];
+        else if (!strcmp(argv[i], "--bench"))
+            bench = 1;
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && model_path == NULL)
+            model_path = argv[i];
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (model_path == NULL)
+    {
+        printf("[ERROR] Usage: mnist_infer MODEL [--images IDX [--labels IDX]] [--bench] [--reps N]\n");
+        return 1;
+    }
+    if (labels_path != NULL && images_path == NULL)
+    {
+        printf("[ERROR] --labels needs the --images they belong to\n");
+        return 1;
+    }
+    if (reps <= 0)
+    {
+        printf("[ERROR] --reps must be a positive number\n");
+        return 1;
+    }
+
+    inf.model = model_load(model_path, MAX_BATCH);
+    if (inf.model->n_inputs != IMAGE_BYTES)
+    {
+        printf("[ERROR] Model takes %u inputs, not 28x28 images\n", inf.model->n_inputs);
+        return 1;
+    }
+    shape = (uint32_t*)malloc(sizeof(uint32_t) * 2);
+    shape[0] = MAX_BATCH;
+    shape[1] = IMAGE_BYTES;
+    inf.x = tensor_zeros(shape, 2);
+
+    if (labels_path != NULL)
+    {
+        ds = mnist_read(images_path, labels_path);
+        images = ds != NULL ? ds->images : NULL;
+    }
+    else if (images_path != NULL)
+        images = mnist_read_images(images_path);
+    if (images_path != NULL && images == NULL)
+        return 1;
+
+    if (bench)
+    {
+        /* Random pixels when no images are given, latency does not depend
+         * on them */
+        if (images == NULL)
+        {
+            uint8_t* pixels = (uint8_t*)malloc(MAX_BATCH * IMAGE_BYTES);
+            for (uint32_t i = 0; i < MAX_BATCH * IMAGE_BYTES; i++)
+                pixels[i] = rand() % 256;
+            run_bench(&inf, pixels, MAX_BATCH, reps);
+            free(pixels);
+        }
+        else
+            run_bench(&inf, images->pixels, images->n_images, reps);
+    }
+    else if (images != NULL)
+    {
+        for (uint32_t start = 0; start < images->n_images; start += MAX_BATCH)
+        {
+            n = images->n_images - start < MAX_BATCH ? images->n_images - start : MAX_BATCH;
+            preds = classify(&inf, &images->pixels[(size_t)start * IMAGE_BYTES], n);
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (ds == NULL)
+                    printf("%d\n", (int)preds[i]);
+                else
+                    correct += preds[i] == ds->labels->labels[start + i];
+            }
+        }
+        if (ds != NULL)
+            printf("Accuracy: %.2f on %d images\n", 100.0 * correct / images->n_images,
+                    images->n_images);
+    }
+    else
+        run_stdin(&inf);
+
+    if (ds != NULL)
+        mnist_clean(ds);
+    else if (images != NULL)
+        mnist_images_clean(images);
+    tensor_clean(inf.x);
+    model_clean(inf.model);
+    return 0;
+}
+
+/* Predictions for n images of IMAGE_BYTES pixels, owned by the model */
+const float* classify(infer_t* inf, const uint8_t* pixels, uint32_t n)
+{
+    inf->x->shape[0] = n;
+    for (uint32_t i = 0; i < n * IMAGE_BYTES; i++)
+        inf->x->values[i] = pixels[i];
+    return model_forward(inf->model, inf->x)->values;
+}
+
+/* Classifies every complete image that has arrived, as soon as it has, so
+ * a client writing one image at a time gets its answer right away and a
+ * piped file goes through in large batches */
+void run_stdin(infer_t* inf)
+{
+    uint8_t* buf = (uint8_t*)malloc(MAX_BATCH * IMAGE_BYTES);
+    size_t len = 0, n;
+    const float* preds;
+    ssize_t got;
+
+    while ((got = read(STDIN_FILENO, buf + len, MAX_BATCH * IMAGE_BYTES - len)) > 0)
+    {
+        len += got;
+        n = len / IMAGE_BYTES;
+        if (n == 0)
+            continue;
+
+        preds = classify(inf, buf, n);
+        for (size_t i = 0; i < n; i++)
+            printf("%d\n", (int)preds[i]);
+        fflush(stdout);
+
+        len -= n * IMAGE_BYTES;
+        memmove(buf, buf + n * IMAGE_BYTES, len);
+    }
+
+    if (len > 0)
+        fprintf(stderr, "[WARNING] Ignored %zu trailing bytes, not a whole image\n", len);
+    free(buf);
+}
+
+void run_bench(infer_t* inf, const uint8_t* pixels, uint32_t n_images, int reps)
+{
+    double* lat = (double*)malloc(sizeof(double) * reps);
+    double start, total;
+    uint32_t offset = 0;
+
+    model_summary(inf->model);
+    printf("\n%6s %12s %12s %14s %14s\n", "batch", "p50 ms", "p99 ms", "p50 us/image",
+            "images/s");
+    for (uint32_t batch = 1; batch <= MAX_BATCH && batch <= n_images; batch *= 2)
+    {
+        classify(inf, pixels, batch);
+
+        total = 0;
+        for (int r = 0; r < reps; r++)
+        {
+            /* Walks over the images so every call reads new pixels */
+            if (offset + batch > n_images)
+                offset = 0;
+            start = now_seconds();
+            classify(inf, &pixels[(size_t)offset * IMAGE_BYTES], batch);
+            lat[r] = now_seconds() - start;
+            total += lat[r];
+            offset += batch;
+        }
+
+        qsort(lat, reps, sizeof(double), cmp_double);
+        printf("%6u %12.4f %12.4f %14.2f %14.0f\n", batch, lat[reps / 2] * 1e3,
+                lat[(int)(reps * 0.99)] * 1e3, lat[reps / 2] * 1e6 / batch,
+                batch * reps / total);
+    }
+    free(lat);
+}
+
+int cmp_double(const void* a, const void* b)
+{
+    double d1 = *(const double*)a, d2 = *(const double*)b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
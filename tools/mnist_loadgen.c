@@ -0,0 +1,359 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mnist.h"
+#include "server.h"
+
+/* Load generator for the inference server. Every client thread holds its
+ * own connection with a fixed number of requests in flight, sending a new
+ * one as soon as an answer comes back, and records the latency of each.
+ *
+ * Given a model it starts a server in this process for every batching
+ * window of --windows and prints throughput against latency percentiles
+ * and mean batch size for each. Given --socket it loads a running server
+ * (mnist_serve) once.
+ *
+ * With --reload-ms the in-process server watches its model file, which is
+ * saved again every that many ms while the clients run, so the latency
+ * percentiles include the switches to new weights.
+ *
+ * Usage: mnist_loadgen MODEL [--windows US,US,..] [--max-batch N] [--workers N]
+ *                      [--reload-ms N] [options]
+ *        mnist_loadgen --socket PATH [options]
+ * Options: --clients N --inflight N --requests N (per client) --images IDX
+ */
+
+#define MAX_WINDOWS 16
+#define LOADGEN_SOCKET "/tmp/mnist_loadgen.sock"
+#define LOADGEN_MODEL "/tmp/mnist_loadgen.ckpt"
+#define WATCH_MS 10
+
+typedef struct
+{
+    const char* socket_path;
+    const uint8_t* pixels;
+    uint32_t n_images;
+    uint32_t inflight;
+    uint32_t n_requests;
+    uint32_t offset;
+
+    double* sent;       /* send time of every request, by id */
+    double* latency;    /* us, by id */
+    uint32_t n_done;
+} client_t;
+
+typedef struct
+{
+    const model_t* model;
+    uint32_t interval_ms;
+    uint8_t running;
+} reloader_t;
+
+static void run_load(const char* socket_path, const uint8_t* pixels, uint32_t n_images,
+        int n_clients, uint32_t inflight, uint32_t n_requests, double* seconds,
+        double* latencies, uint32_t* n_latencies);
+static void* client_loop(void* arg);
+static void* reload_loop(void* arg);
+static int connect_to(const char* socket_path);
+static void send_request(client_t* c, int fd, uint32_t id);
+static int cmp_double(const void* a, const void* b);
+static double now_us();
+
+int main(int argc, char** argv)
+{
+    const char* model_path = NULL, *socket_path = NULL, *images_path = NULL;
+    int n_clients = 8, max_batch = 64, n_workers = 1, n_windows = 0, reload_ms = 0;
+    uint32_t inflight = 4, n_requests = 2000, n_latencies, n_images;
+    uint32_t windows[MAX_WINDOWS];
+    mnist_images_t* images = NULL;
+    uint8_t* pixels;
+    server_t* server;
+    model_t* model = NULL;
+    reloader_t reloader;
+    pthread_t reload_thread;
+    double seconds, *latencies;
+    char* list, *tok;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--socket") && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (!strcmp(argv[i], "--windows") && i + 1 < argc)
+        {
+            list = argv[++i];
+            for (tok = strtok(list, ","); tok != NULL && n_windows < MAX_WINDOWS; tok = strtok(NULL, ","))
+                windows[n_windows++] = atoi(tok);
+        }
+        else if (!strcmp(argv[i], "--max-batch") && i + 1 < argc)
+            max_batch = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc)
+            n_workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reload-ms") && i + 1 < argc)
+            reload_ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--clients") && i + 1 < argc)
+            n_clients = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--inflight") && i + 1 < argc)
+            inflight = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--requests") && i + 1 < argc)
+            n_requests = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--images") && i + 1 < argc)
+            images_path = argv[++i];
+        else if (argv[i][0] != '-' && model_path == NULL)
+            model_path = argv[i];
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if ((model_path == NULL) == (socket_path == NULL))
+    {
+        printf("[ERROR] Give either a model to serve in process or the --socket of a server\n");
+        return 1;
+    }
+
+    if (n_windows == 0)
+    {
+        windows[n_windows++] = 0;
+        windows[n_windows++] = 100;
+        windows[n_windows++] = 500;
+        windows[n_windows++] = 2000;
+    }
+
+    /* Random pixels without images, the server does not care */
+    if (images_path != NULL && (images = mnist_read_images(images_path)) == NULL)
+        return 1;
+    n_images = images != NULL ? images->n_images : 1024;
+    pixels = images != NULL ? images->pixels : (uint8_t*)malloc(n_images * SERVER_IMAGE_BYTES);
+    if (images == NULL)
+        for (uint32_t i = 0; i < n_images * SERVER_IMAGE_BYTES; i++)
+            pixels[i] = rand() % 256;
+
+    /* The server follows a copy, rewritten by the reloader */
+    if (model_path != NULL)
+    {
+        model = model_load(model_path, 1);
+        model_save(model, LOADGEN_MODEL);
+    }
+
+    latencies = (double*)malloc(sizeof(double) * n_clients * n_requests);
+    printf("%d clients with %u requests in flight each, %u requests per client\n", n_clients,
+            inflight, n_requests);
+    printf("%10s %12s %10s %10s %10s %10s %10s %8s\n", "window us", "requests/s", "p50 us",
+            "p99 us", "p99.9 us", "max us", "batch", "reloads");
+
+    for (int wi = 0; wi < (socket_path != NULL ? 1 : n_windows); wi++)
+    {
+        server = socket_path == NULL ?
+                server_start(LOADGEN_SOCKET, LOADGEN_MODEL, max_batch, windows[wi], n_workers) : NULL;
+        if (server != NULL && reload_ms > 0)
+        {
+            server_watch(server, WATCH_MS);
+            reloader.model = model;
+            reloader.interval_ms = reload_ms;
+            reloader.running = 1;
+            pthread_create(&reload_thread, NULL, reload_loop, &reloader);
+        }
+
+        run_load(socket_path != NULL ? socket_path : LOADGEN_SOCKET, pixels, n_images, n_clients,
+                inflight, n_requests, &seconds, latencies, &n_latencies);
+
+        qsort(latencies, n_latencies, sizeof(double), cmp_double);
+        if (server != NULL)
+            printf("%10u", windows[wi]);
+        else
+            printf("%10s", "-");
+        printf(" %12.0f %10.0f %10.0f %10.0f %10.0f", n_latencies / seconds,
+                latencies[n_latencies / 2], latencies[(size_t)(n_latencies * 0.99)],
+                latencies[(size_t)(n_latencies * 0.999)], latencies[n_latencies - 1]);
+        if (server != NULL && reload_ms > 0)
+        {
+            __atomic_store_n(&reloader.running, 0, __ATOMIC_RELAXED);
+            pthread_join(reload_thread, NULL);
+        }
+        if (server != NULL)
+        {
+            printf(" %10.1f %8lu\n", (double)server->n_requests / server->n_batches,
+                    (unsigned long)server->n_reloads);
+            server_stop(server);
+        }
+        else
+            printf(" %10s %8s\n", "-", "-");
+    }
+
+    if (model != NULL)
+    {
+        model_clean(model);
+        unlink(LOADGEN_MODEL);
+    }
+
+    if (images != NULL)
+        mnist_images_clean(images);
+    else
+        free(pixels);
+    free(latencies);
+    return 0;
+}
+
+/* Runs every client to completion, gathers their latencies */
+void run_load(const char* socket_path, const uint8_t* pixels, uint32_t n_images,
+        int n_clients, uint32_t inflight, uint32_t n_requests, double* seconds,
+        double* latencies, uint32_t* n_latencies)
+{
+    client_t* clients = (client_t*)calloc(n_clients, sizeof(client_t));
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * n_clients);
+    double start;
+
+    start = now_us();
+    for (int i = 0; i < n_clients; i++)
+    {
+        clients[i].socket_path = socket_path;
+        clients[i].pixels = pixels;
+        clients[i].n_images = n_images;
+        clients[i].inflight = inflight;
+        clients[i].n_requests = n_requests;
+        clients[i].offset = i * (n_images / n_clients);
+        clients[i].sent = (double*)malloc(sizeof(double) * n_requests);
+        clients[i].latency = (double*)malloc(sizeof(double) * n_requests);
+        pthread_create(&threads[i], NULL, client_loop, &clients[i]);
+    }
+
+    *n_latencies = 0;
+    for (int i = 0; i < n_clients; i++)
+    {
+        pthread_join(threads[i], NULL);
+        memcpy(&latencies[*n_latencies], clients[i].latency, sizeof(double) * clients[i].n_done);
+        *n_latencies += clients[i].n_done;
+        free(clients[i].sent);
+        free(clients[i].latency);
+    }
+    *seconds = (now_us() - start) * 1e-6;
+
+    free(clients);
+    free(threads);
+}
+
+void* client_loop(void* arg)
+{
+    client_t* c = (client_t*)arg;
+    server_response_t buf[64];
+    uint32_t next = 0;
+    size_t len = 0;
+    ssize_t got;
+    double now;
+    int fd;
+
+    fd = connect_to(c->socket_path);
+    while (next < c->inflight && next < c->n_requests)
+        send_request(c, fd, next++);
+
+    while (c->n_done < c->n_requests)
+    {
+        got = read(fd, (uint8_t*)buf + len, sizeof(buf) - len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+        {
+            printf("[ERROR] Server closed the connection after %u answers\n", c->n_done);
+            exit(1);
+        }
+
+        len += got;
+        now = now_us();
+        for (size_t i = 0; i < len / sizeof(server_response_t); i++)
+        {
+            c->latency[c->n_done++] = now - c->sent[buf[i].id];
+            if (next < c->n_requests)
+                send_request(c, fd, next++);
+        }
+
+        /* Keeps a partial answer for the next read */
+        memmove(buf, (uint8_t*)buf + len / sizeof(server_response_t) * sizeof(server_response_t),
+                len % sizeof(server_response_t));
+        len %= sizeof(server_response_t);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+/* Saves the model over the served file again and again, each save being a
+ * new file for the watcher */
+void* reload_loop(void* arg)
+{
+    reloader_t* r = (reloader_t*)arg;
+    struct timespec pause = {r->interval_ms / 1000, (r->interval_ms % 1000) * 1000000L};
+
+    while (__atomic_load_n(&r->running, __ATOMIC_RELAXED))
+    {
+        nanosleep(&pause, NULL);
+        model_save(r->model, LOADGEN_MODEL);
+    }
+    return NULL;
+}
+
+int connect_to(const char* socket_path)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        printf("[ERROR] Could not connect to %s: %s\n", socket_path, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+void send_request(client_t* c, int fd, uint32_t id)
+{
+    server_request_t req;
+    const uint8_t* data = (const uint8_t*)&req;
+    size_t left = sizeof(req);
+    ssize_t sent;
+
+    req.id = id;
+    memcpy(req.pixels, &c->pixels[(size_t)((c->offset + id) % c->n_images) * SERVER_IMAGE_BYTES],
+            SERVER_IMAGE_BYTES);
+
+    c->sent[id] = now_us();
+    while (left > 0)
+    {
+        sent = send(fd, data, left, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+        {
+            printf("[ERROR] Could not send request %u: %s\n", id, strerror(errno));
+            exit(1);
+        }
+        data += sent;
+        left -= sent;
+    }
+}
+
+int cmp_double(const void* a, const void* b)
+{
+    double d1 = *(const double*)a, d2 = *(const double*)b;
+    return (d1 > d2) - (d1 < d2);
+}
+
+double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "nn.h"
+#include "prune.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+#define TEST_IMAGES "data/t10k-images-idx3-ubyte"
+#define TEST_LABELS "data/t10k-labels-idx1-ubyte"
+
+/* Trains the fp32 model, prunes W1 by block magnitude, optionally fine-tunes
+ * with the pruned weights held at 0 and compares the dense and the block
+ * sparse model: accuracy, latency per image and size.
+ *
+ * Usage: mnist_prune [--steps N] [--batch N] [--lr F] [--sparsity F]
+ *                    [--finetune N] [--reps N]
+ */
+
+static void train(mlp_t* mlp, mnist_t* ds, int steps, int batch_size, float lr,
+        const tensor_t* mask, unsigned int* seed);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int steps = 1000, finetune = 200, batch_size = 256, reps = 3;
+    float lr = 0.001, sparsity = 0.9, dense_acc, pruned_acc;
+    unsigned int seed = 42;
+    uint32_t dense_bytes;
+    mnist_t* train_ds, *test_ds;
+    mnist_example_t* test;
+    tensor_t* preds, *mask;
+    prune_mlp_t* pruned;
+    mlp_t* mlp;
+    double start, dense_s, pruned_s;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--lr") && i + 1 < argc)
+            lr = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--sparsity") && i + 1 < argc)
+            sparsity = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--finetune") && i + 1 < argc)
+            finetune = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    train_ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    test_ds = mnist_read(TEST_IMAGES, TEST_LABELS);
+    if (train_ds == NULL || test_ds == NULL)
+        return 1;
+
+    mlp = mlp_init(28 * 28, 128, 10);
+    train(mlp, train_ds, steps, batch_size, lr, NULL, &seed);
+    test = mnist_as_tensor(test_ds, 1);
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        tensor_clean(mlp_forward(mlp, test->image));
+    dense_s = (now_seconds() - start) / reps;
+    dense_acc = mlp_accuracy(mlp, test->image, test->label);
+    dense_bytes = sizeof(float) * (tensor_numel(mlp->W1) + tensor_numel(mlp->b1) +
+            tensor_numel(mlp->W2) + tensor_numel(mlp->b2));
+
+    mask = prune_magnitude(mlp->W1, sparsity);
+    train(mlp, train_ds, finetune, batch_size, lr, mask, &seed);
+    pruned = prune_mlp_new(mlp);
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        tensor_clean(prune_forward(pruned, test->image));
+    pruned_s = (now_seconds() - start) / reps;
+
+    preds = prune_forward(pruned, test->image);
+    pruned_acc = nn_accuracy_score(test->label, preds);
+
+    printf("%-7s %10s %14s %12s\n", "model", "accuracy", "us / image", "bytes");
+    printf("%-7s %10.4f %14.2f %12u\n", "dense", dense_acc,
+            dense_s * 1e6 / test_ds->images->n_images, dense_bytes);
+    printf("%-7s %10.4f %14.2f %12u\n", "pruned", pruned_acc,
+            pruned_s * 1e6 / test_ds->images->n_images, prune_mlp_bytes(pruned));
+    printf("Sparsity: %.2f (%u of %u blocks kept), accuracy drop: %.4f, speedup: %.2fx, %.2fx smaller\n",
+            sparsity, pruned->W1->n_blocks, tensor_numel(mlp->W1) / PRUNE_BLOCK,
+            dense_acc - pruned_acc, dense_s / pruned_s,
+            (float)dense_bytes / prune_mlp_bytes(pruned));
+
+    tensor_clean(preds);
+    tensor_clean(mask);
+    prune_mlp_clean(pruned);
+    mnist_example_clean(test);
+    mlp_clean(mlp);
+    mnist_clean(train_ds);
+    mnist_clean(test_ds);
+    return 0;
+}
+
+/* Plain SGD, with a mask the pruned weights stay at 0 */
+void train(mlp_t* mlp, mnist_t* ds, int steps, int batch_size, float lr,
+        const tensor_t* mask, unsigned int* seed)
+{
+    mnist_example_t* batch;
+    train_res_t res;
+
+    for (int s = 0; s < steps; s++)
+    {
+        batch = mnist_batch_r(ds, batch_size, 1, seed);
+        res = mlp_forward_backward(mlp, batch->image, batch->label);
+        mlp_update(mlp, &res, lr);
+        if (mask)
+            prune_apply(mlp->W1, mask);
+        train_res_clean(&res);
+        mnist_example_clean(batch);
+    }
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "nn.h"
+#include "mlp.h"
+#include "quant.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+#define TEST_IMAGES "data/t10k-images-idx3-ubyte"
+#define TEST_LABELS "data/t10k-labels-idx1-ubyte"
+
+/* Trains the fp32 model, quantizes it to INT8 and compares both on the test
+ * set: accuracy, agreement between their predictions and single thread
+ * throughput.
+ *
+ * Usage: mnist_quant [--steps N] [--batch N] [--lr F] [--calib N] [--reps N]
+ */
+
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int steps = 1000, batch_size = 256, calib_size = 1024, reps = 3;
+    float lr = 0.001, f32_acc, int8_acc, agree;
+    unsigned int seed = 42;
+    uint32_t n_test, hits_f32 = 0, hits_int8 = 0, same = 0;
+    mnist_t* train_ds, *test_ds;
+    mnist_example_t* batch, *test;
+    train_res_t res;
+    tensor_t* preds;
+    uint8_t* labels;
+    mlp_t* mlp;
+    qmlp_t* q;
+    double start, f32_s, int8_s;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--lr") && i + 1 < argc)
+            lr = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--calib") && i + 1 < argc)
+            calib_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reps") && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    train_ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    test_ds = mnist_read(TEST_IMAGES, TEST_LABELS);
+    if (train_ds == NULL || test_ds == NULL)
+        return 1;
+
+    mlp = mlp_init(28 * 28, 128, 10);
+    for (int s = 0; s < steps; s++)
+    {
+        batch = mnist_batch_r(train_ds, batch_size, 1, &seed);
+        res = mlp_forward_backward(mlp, batch->image, batch->label);
+        mlp_update(mlp, &res, lr);
+        train_res_clean(&res);
+        mnist_example_clean(batch);
+    }
+
+    batch = mnist_batch_r(train_ds, calib_size, 1, &seed);
+    q = qmlp_quantize(mlp, batch->image);
+    mnist_example_clean(batch);
+
+    test = mnist_as_tensor(test_ds, 1);
+    n_test = test_ds->images->n_images;
+    labels = (uint8_t*)malloc(n_test);
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        tensor_clean(mlp_forward(mlp, test->image));
+    f32_s = (now_seconds() - start) / reps;
+    preds = mlp_forward(mlp, test->image);
+
+    start = now_seconds();
+    for (int r = 0; r < reps; r++)
+        qmlp_predict(q, test_ds->images->pixels, n_test, labels);
+    int8_s = (now_seconds() - start) / reps;
+
+    for (uint32_t i = 0; i < n_test; i++)
+    {
+        hits_f32 += (uint8_t)preds->values[i] == test_ds->labels->labels[i];
+        hits_int8 += labels[i] == test_ds->labels->labels[i];
+        same += (uint8_t)preds->values[i] == labels[i];
+    }
+    f32_acc = (float)hits_f32 / n_test;
+    int8_acc = (float)hits_int8 / n_test;
+    agree = (float)same / n_test;
+
+    printf("%-6s %10s %18s\n", "model", "accuracy", "images/s/core");
+    printf("%-6s %10.4f %18.0f\n", "f32", f32_acc, n_test / f32_s);
+    printf("%-6s %10.4f %18.0f\n", "int8", int8_acc, n_test / int8_s);
+    printf("Agreement: %.4f, accuracy drop: %.4f, speedup: %.2fx\n",
+            agree, f32_acc - int8_acc, f32_s / int8_s);
+
+    free(labels);
+    tensor_clean(preds);
+    mnist_example_clean(test);
+    qmlp_clean(q);
+    mlp_clean(mlp);
+    mnist_clean(train_ds);
+    mnist_clean(test_ds);
+    return 0;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
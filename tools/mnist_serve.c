@@ -0,0 +1,76 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "server.h"
+
+/* Serves a saved model over a Unix domain socket (see server.h for the
+ * protocol) until SIGINT or SIGTERM, then prints how many requests it
+ * served and in how many batches. The model file is checked for a new
+ * version every --watch-ms (0 turns it off), which is swapped in between
+ * batches.
+ *
+ * Usage: mnist_serve MODEL [--socket PATH] [--max-batch N] [--max-wait-us N] [--workers N]
+ *                    [--watch-ms N]
+ */
+
+int main(int argc, char** argv)
+{
+    const char* model_path = NULL, *socket_path = "/tmp/mnist.sock";
+    int max_batch = 64, max_wait_us = 200, n_workers = 1, watch_ms = 500, sig;
+    server_t* server;
+    sigset_t signals;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--socket") && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (!strcmp(argv[i], "--max-batch") && i + 1 < argc)
+            max_batch = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--max-wait-us") && i + 1 < argc)
+            max_wait_us = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc)
+            n_workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--watch-ms") && i + 1 < argc)
+            watch_ms = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && model_path == NULL)
+            model_path = argv[i];
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (model_path == NULL)
+    {
+        printf("[ERROR] Usage: mnist_serve MODEL [--socket PATH] [--max-batch N] "
+                "[--max-wait-us N] [--workers N] [--watch-ms N]\n");
+        return 1;
+    }
+
+    /* Blocked before the server threads start so only sigwait sees them */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    server = server_start(socket_path, model_path, max_batch, max_wait_us, n_workers);
+    if (watch_ms > 0)
+        server_watch(server, watch_ms);
+    printf("Serving %s on %s, batches of up to %d within %d us, %d workers\n", model_path,
+            socket_path, max_batch, max_wait_us, n_workers);
+    fflush(stdout);
+
+    sigwait(&signals, &sig);
+
+    pthread_mutex_lock(&server->lock);
+    printf("Served %lu requests in %lu batches, %lu reloads\n", (unsigned long)server->n_requests,
+            (unsigned long)server->n_batches, (unsigned long)server->n_reloads);
+    pthread_mutex_unlock(&server->lock);
+    server_stop(server);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tensor.h"
+#include "mnist.h"
+#include "mlp.h"
+#include "sweep.h"
+
+#define TRAIN_IMAGES "data/train-images-idx3-ubyte"
+#define TRAIN_LABELS "data/train-labels-idx1-ubyte"
+#define TEST_IMAGES "data/t10k-images-idx3-ubyte"
+#define TEST_LABELS "data/t10k-labels-idx1-ubyte"
+
+#define MAX_MODELS 64
+
+/* Trains one 784-128-10 model per learning rate in lockstep over the same
+ * batches and reports the test accuracy of each. With --baseline it also
+ * trains them one after the other the way separate mnist runs would (own
+ * dataset read, own batches) and compares the time and the parameters.
+ *
+ * Usage: mnist_sweep [--lrs A,B,..] [--seed N] [--steps N] [--batch N] [--baseline]
+ */
+
+static double train_baseline(float lr, unsigned int seed, unsigned int data_seed, int steps,
+        int batch_size, const sweep_t* sweep, uint32_t k, float* diff);
+static float max_param_diff(const mlp_t* m1, const mlp_t* m2);
+static double now_seconds();
+
+int main(int argc, char** argv)
+{
+    int steps = 1000, batch_size = 256, baseline = 0;
+    char lrs_arg[256] = "0.0005,0.001,0.002,0.003";
+    unsigned int seed = 42, data_seed, seeds[MAX_MODELS];
+    uint32_t n_models = 0;
+    float lrs[MAX_MODELS], accs[MAX_MODELS], diff;
+    double start, sweep_s, baseline_s = 0;
+    mnist_t* train_ds, *test_ds;
+    mnist_example_t* batch, *test;
+    sweep_t* sweep;
+    char* tok;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--lrs") && i + 1 < argc)
+        {
+            strncpy(lrs_arg, argv[++i], sizeof(lrs_arg) - 1);
+            lrs_arg[sizeof(lrs_arg) - 1] = '\0';
+        }
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            steps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--baseline"))
+            baseline = 1;
+        else
+        {
+            printf("[ERROR] Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    for (tok = strtok(lrs_arg, ","); tok != NULL && n_models < MAX_MODELS; tok = strtok(NULL, ","))
+    {
+        lrs[n_models] = atof(tok);
+        seeds[n_models] = seed + n_models;
+        n_models++;
+    }
+
+    /* Read, sample and convert once for every model */
+    start = now_seconds();
+    train_ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    if (train_ds == NULL)
+        return 1;
+    sweep = sweep_init(n_models, lrs, seeds, 28 * 28, 128, 10, batch_size);
+    data_seed = seed;
+    for (int s = 0; s < steps; s++)
+    {
+        batch = mnist_batch_r(train_ds, batch_size, 1, &data_seed);
+        sweep_step(sweep, batch->image, batch->label);
+        mnist_example_clean(batch);
+    }
+    sweep_s = now_seconds() - start;
+
+    test_ds = mnist_read(TEST_IMAGES, TEST_LABELS);
+    if (test_ds == NULL)
+        return 1;
+    test = mnist_as_tensor(test_ds, 1);
+    sweep_accuracy(sweep, test->image, test->label, accs);
+
+    printf("%10s %6s %12s %14s", "lr", "seed", "last loss", "test acc (%)");
+    printf(baseline ? " %16s\n" : "\n", "param diff");
+    for (uint32_t k = 0; k < n_models; k++)
+    {
+        printf("%10g %6u %12.5f %14.2f", lrs[k], seeds[k], sweep->losses[k], accs[k] * 100);
+        if (baseline)
+        {
+            baseline_s += train_baseline(lrs[k], seeds[k], seed, steps, batch_size, sweep, k, &diff);
+            printf(" %16g", diff);
+        }
+        printf("\n");
+    }
+
+    printf("\nSweep of %u models: %.2f s (%.2f s per model)\n", n_models, sweep_s, sweep_s / n_models);
+    if (baseline)
+        printf("One run per model: %.2f s, sweep speedup %.2fx\n", baseline_s, baseline_s / sweep_s);
+
+    mnist_example_clean(test);
+    mnist_clean(test_ds);
+    mnist_clean(train_ds);
+    sweep_clean(sweep);
+    return 0;
+}
+
+/* One model trained alone like a separate mnist process would, on the same
+ * batches as the sweep. Returns its time and leaves in diff how far it ends
+ * from model k of the sweep. */
+double train_baseline(float lr, unsigned int seed, unsigned int data_seed, int steps,
+        int batch_size, const sweep_t* sweep, uint32_t k, float* diff)
+{
+    double start = now_seconds(), elapsed;
+    mnist_example_t* batch;
+    train_res_t res;
+    mnist_t* ds;
+    mlp_t* mlp, *swept;
+
+    ds = mnist_read(TRAIN_IMAGES, TRAIN_LABELS);
+    srand(seed);
+    mlp = mlp_init(28 * 28, 128, 10);
+    for (int s = 0; s < steps; s++)
+    {
+        batch = mnist_batch_r(ds, batch_size, 1, &data_seed);
+        res = mlp_forward_backward(mlp, batch->image, batch->label);
+        mlp_update(mlp, &res, lr);
+        train_res_clean(&res);
+        mnist_example_clean(batch);
+    }
+    mnist_clean(ds);
+    elapsed = now_seconds() - start;
+
+    swept = sweep_extract(sweep, k);
+    *diff = max_param_diff(mlp, swept);
+    mlp_clean(swept);
+    mlp_clean(mlp);
+    return elapsed;
+}
+
+float max_param_diff(const mlp_t* m1, const mlp_t* m2)
+{
+    const tensor_t* p1[] = {m1->W1, m1->b1, m1->W2, m1->b2};
+    const tensor_t* p2[] = {m2->W1, m2->b1, m2->W2, m2->b2};
+    float diff = 0;
+
+    for (int p = 0; p < 4; p++)
+        for (uint32_t i = 0; i < tensor_numel(p1[p]); i++)
+            diff = fmaxf(diff, fabsf(p1[p]->values[i] - p2[p]->values[i]));
+    return diff;
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}